@@ -0,0 +1,14 @@
+#include "qtc.h"
+#include <time.h>
+static size_t nmal, bytes;
+void *__real_malloc(size_t);
+void *__wrap_malloc(size_t s){ nmal++; bytes+=s; return __real_malloc(s);}
+static double now(void){struct timespec t; clock_gettime(CLOCK_THREAD_CPUTIME_ID,&t); return t.tv_sec+t.tv_nsec*1e-9;}
+int bench_main(int argc,char**argv){
+    FILE*f=fopen(argv[1],"rb"); static unsigned char buf[1<<25]; size_t n=fread(buf,1,sizeof buf,f); fclose(f);
+    int reps=atoi(argv[2]); unsigned int th=(argc>3)?atoi(argv[3]):1;
+    unsigned int w,h; QtcContext ctx; unsigned char*r; double best=1e9,s; int i;
+    if(!qtc_image_size(buf,n,&w,&h)){puts("size");return 1;}
+    make_qtc_context(&ctx,11,NULL); r=malloc(w*h);
+    for(i=0;i<reps;i++){ size_t m0=nmal,b0=bytes; s=now(); if(!qtc_context_decode(&ctx,buf,n,r,w,h,w,th)){puts("fail");return 1;} s=now()-s; if(s<best)best=s; if(i==reps-1)printf("mallocs %zu bytes %zu\n",nmal-m0,bytes-b0);}
+    printf("%s best %.4f s\n",argv[1],best); return 0;}
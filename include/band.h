@@ -0,0 +1,56 @@
+/**
+ * @file include/band.h
+ * @authors MUNAITPASOV M. & BENVENISTE A.
+ * @brief Band streaming implementation
+ * @version 0.1
+ * @date 2025-01-09
+ *
+ * @copyright licence MIT Copyright (c) 2025
+ *
+ */
+
+#ifndef BAND_H
+#define BAND_H
+
+#include "qtree.h"
+
+/**
+ * Receiver of the bands of `decode_qtc_file_streaming`, top to bottom: `nb_lines` lines of `width`
+ * pixels, from the line `first_line` of an image of `height` lines. Returns false to stop the decoding.
+ */
+typedef bool (*QtcBandSink)(void *user, const unsigned char *lines, unsigned int width, unsigned int height,
+                            unsigned int first_line, unsigned int nb_lines);
+
+/**
+ * @brief Write a chunked .qtc file (Q2 or Q3) from a P5 .pgm read by bands of 2^k lines.
+ * Each band is a row of chunks: every chunk is built, filtered and written on its own, then
+ * dropped, only the levels above the chunks stay in memory. With a filtering, the file is read
+ * twice: once for the variances, once to filter and write the chunks.
+ *
+ * @param pgm_name the name of the .pgm file, P5 and seekable with a filtering
+ * @param file_name the name of the .qtc file
+ * @param band_level `k`, the level of the chunks, lowered to the level of the image, raised to keep 4^8 chunks at most
+ * @param alpha the filtering rate, below 0.1 the tree is written unfiltered, as `-a`
+ * @param nb_threads the number of threads building each chunk
+ * @param format 2 or 3, the version of the file
+ * @return bool true if the file is written, false on an error
+ */
+extern bool create_qtc_file_streaming(const char *pgm_name, const char *file_name, unsigned char band_level,
+                                      double alpha, unsigned int nb_threads, unsigned char format);
+
+/**
+ * @brief Decode a Q2 or Q3 file by bands of lines, each one handed to `sink` then overwritten:
+ * only the levels above the chunks, a band and a chunk per thread are in memory.
+ * A band is 2^k lines, at least a line of chunks; the chunks of a band are read from the index.
+ *
+ * @param file_name the name of the .qtc file, seekable
+ * @param band_level `k`, the band is 2^k lines, rounded to lines of chunks
+ * @param nb_threads the number of threads decoding the chunks of a band
+ * @param sink the receiver of the bands
+ * @param user the first argument of `sink`
+ * @return true if the whole image was decoded, false on error or if `sink` stopped it
+ */
+extern bool decode_qtc_file_streaming(const char *file_name, unsigned char band_level, unsigned int nb_threads,
+                                      QtcBandSink sink, void *user);
+
+#endif
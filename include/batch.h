@@ -0,0 +1,33 @@
+/**
+ * @file include/batch.h
+ * @authors MUNAITPASOV M. & BENVENISTE A.
+ * @brief Batch implementation
+ * @version 0.1
+ * @date 2025-01-09
+ *
+ * @copyright licence MIT Copyright (c) 2025
+ *
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "qtree.h"
+
+/**
+ * @brief Encode (`-c`) or decode (`-u`) many files in one process, into the directory `args->batch`:
+ * the inputs are files, directories of .pgm (or .qtc) files, and `-` or nothing for a list on stdin,
+ * one path per line. The files go through a pipeline: a reader on the calling thread, a pool of
+ * `args->threads` workers, each one reusing its tree and its pixels from one image to the next,
+ * and a writer thread, linked by queues bounded by two images per worker. The reader and the writer
+ * submit their files to an io_uring on Linux, else read and write blocking on their own threads:
+ * the I/O of the next and previous images overlaps the work on the current ones.
+ * A file that fails is reported and the batch goes on, as a file whose output is named as the one
+ * of a file before it: "in1/x.pgm" and "in2/x.pgm" both write "x.qtc", the first one only does.
+ *
+ * @param args the arguments, `args->inputs` and `args->batch` set
+ * @return int 0 if every file was encoded or decoded, 1 otherwise
+ */
+extern int batch_run(const Args *args);
+
+#endif
@@ -25,11 +25,23 @@
 /* #define NBLETTRES 256 */
 #define MAX_SIZE 1024
 
+#define FILEBIT_BLOCK_SIZE (1UL << 16) /* 64 Ko, taille du bloc memoire   */
+#define FILEBIT_MAX_BITS 24U           /* taille max d'un champ lu/ecrit  */
+
 typedef struct
 {
-  FILE *fich;          /* descripteur du fichier                  */
-  unsigned char nbBit; /* nombre de bits écrits dans le buffer    */
-  unsigned char stock; /* buffer de 8 bits                        */
+  FILE *fich;                             /* descripteur du fichier                    */
+  uint64_t acc;                           /* accumulateur de 64 bits                   */
+  size_t pos;                             /* position courante dans le bloc            */
+  size_t len;                             /* nombre d'octets valides (en lecture)      */
+  unsigned char nbBit;                    /* nombre de bits en attente dans `acc`      */
+  unsigned char ecriture;                 /* 1 si le flux est utilise en ecriture      */
+  unsigned char depasse;                  /* 1 si une lecture a depasse la fin du flux */
+  const unsigned char *src;               /* octets lus: `bloc`, ou un tampon en memoire */
+  unsigned char *mem;                     /* tampon memoire si `fich` est NULL          */
+  size_t memlen;                          /* nombre d'octets ecrits dans `mem`          */
+  size_t memcap;                          /* taille allouee de `mem`                    */
+  unsigned char bloc[FILEBIT_BLOCK_SIZE]; /* bloc memoire entre `acc` et le fichier    */
 } FileBit;
 
 /**
@@ -41,6 +53,7 @@ extern unsigned char fBitopen(FileBit *__restrict__ f, const char *__restrict__
 /**
  * @brief Initialise une structure FileBit
  * avec un descripteur de fichier deja ouvert
+   Note: si `fich` est NULL, les octets ecrits s'accumulent dans `f->mem` (`f->memlen` octets)
  *
  * @param f
  * @param fich
@@ -48,7 +61,25 @@ extern unsigned char fBitopen(FileBit *__restrict__ f, const char *__restrict__
 extern void fBitinit(FileBit *__restrict__ f, FILE *__restrict__ fich);
 
 /**
- * @brief Ferme le fichier en argument, et ecrit les bits en attente
+ * @brief Initialise une structure FileBit en lecture sur un tampon en memoire
+   Note: le tampon n'est pas copie, il doit rester valide jusqu'a `fBitclose`
+ *
+ * @param f
+ * @param buf
+ * @param len
+ */
+extern void fBitinitMem(FileBit *__restrict__ f, const unsigned char *__restrict__ buf, size_t len);
+
+/**
+ * @brief Complete le dernier octet par des 0 et ecrit les bits en attente, sans fermer
+ *
+ * @param f
+ * @return int
+ */
+extern int fBitflush(FileBit *__restrict__ f);
+
+/**
+ * @brief Ferme le fichier en argument (ou libere le tampon memoire), et ecrit les bits en attente
  *
  * @param f
  * @return int
@@ -73,6 +104,73 @@ extern int fEcrireBit(FileBit *__restrict__ f, int bit);
  */
 extern int fLireBit(FileBit *__restrict__ f);
 
+/**
+ * @brief Ecrit les `n` bits de poids faible de `valeur`, bit de poids fort en premier
+   Note: `n` dans [0, FILEBIT_MAX_BITS], un seul decalage dans l'accumulateur
+ *
+ * @param f
+ * @param valeur
+ * @param n
+ * @return int
+ */
+extern int fEcrireBits(FileBit *__restrict__ f, unsigned int valeur, unsigned char n);
+
+/**
+ * @brief Renvoie le champ de `n` bits suivant lu depuis le fichier, ou EOF
+   Note: `n` dans [0, FILEBIT_MAX_BITS]
+ *
+ * @param f
+ * @param n
+ * @return int
+ */
+extern int fLireBits(FileBit *__restrict__ f, unsigned char n);
+
+/**
+ * @brief Ecrit `len` octets, par `memcpy` si le flux est aligne sur un octet
+ *
+ * @param f
+ * @param buf
+ * @param len
+ * @return int
+ */
+extern int fEcrireOctets(FileBit *__restrict__ f, const unsigned char *__restrict__ buf, size_t len);
+
+/**
+ * @brief Lit `len` octets, par `memcpy` si le flux est aligne sur un octet
+ *
+ * @param f
+ * @param buf
+ * @param len
+ * @return size_t nombre d'octets lus
+ */
+extern size_t fLireOctets(FileBit *__restrict__ f, unsigned char *__restrict__ buf, size_t len);
+
+/**
+ * @brief Saute `len` octets d'un flux aligne sur un octet, par `fseek` dans un fichier
+ *
+ * @param f
+ * @param len
+ * @return size_t nombre d'octets sautes
+ */
+extern size_t fSauterOctets(FileBit *__restrict__ f, size_t len);
+
+/**
+ * @brief Renvoie la position dans le fichier du prochain octet lu, ou -1L pour un tampon memoire
+ *
+ * @param f
+ * @return long
+ */
+extern long fPositionOctet(FileBit *__restrict__ f);
+
+/**
+ * @brief Place la lecture a l'octet `position` du fichier, sans relire le bloc s'il le contient deja
+ *
+ * @param f
+ * @param position
+ * @return int: 1 si OK et EOF sinon
+ */
+extern int fAllerOctet(FileBit *__restrict__ f, long position);
+
 /**
  * @brief Ecrit les 8 bits d'un char en argument
  *
@@ -0,0 +1,308 @@
+/**
+ * @file include/codec.h
+ * @authors MUNAITPASOV M. & BENVENISTE A.
+ * @brief Codec internals, shared by the quadtree, the band streaming and the push decoder,
+ * not part of `qtc.h`
+ * @version 0.1
+ * @date 2025-01-09
+ *
+ * @copyright licence MIT Copyright (c) 2025
+ *
+ */
+
+#ifndef CODEC_H
+#define CODEC_H
+
+#include "qtree.h"
+
+/* number of depths of a quadtree: the longest side of an image is at most 2^16 pixels */
+#define QTC_LEVELS 17U
+
+/* the image fills the 2^niveau square of the tree: no node is outside of it */
+#define QTREE_IS_SQUARE(qtree) ((qtree)->width == (1UL << (qtree)->niveau) && (qtree)->height == (qtree)->width)
+
+/* the nodes outside of the image are not built, but read from the edges */
+#define QTREE_HAS_EDGES(qtree) ((qtree)->edges && !QTREE_IS_SQUARE(qtree))
+
+/* nodes of the edges of a tree of `level`: at each depth, the column on the right of the image, then the line below it */
+#define QTREE_EDGE_NODES(level) (2UL * ((2UL << (level)) - 1UL))
+
+/* bytes of the edges: the sums of the variances of their subtrees, the variances, their maximums, the colors and `eu` */
+#define QTREE_EDGE_SIZE(level) (QTREE_EDGE_NODES(level) * (sizeof(double) + 2UL * sizeof(float) + 2UL))
+
+/* index of the top stream of a chunked file, in place of a chunk */
+#define QTC_TOP_STREAM ((size_t)~0UL)
+
+/* longest header of a .qtc file: magic number, date, compression rate and size of the image */
+#define QTC_HEADER_MAX 128U
+
+/* `e` and `u` of an internal node as one symbol: `u` when `e` is 0, `e + 1` otherwise */
+#define QTC_EU_SYMBOLS 5U
+#define QTC_EU_LOOKUP 8U /* entries of the decoding table of an `eu` model */
+
+/**
+ * Shared state of a quadtree build, read-only for the workers
+ */
+typedef struct build_job
+{
+    QTree *qtree;                          /* tree to fill */
+    const unsigned char *pixels;           /* source pixels */
+    size_t stride;                         /* bytes from a line of pixels to the next one */
+    unsigned int width;                    /* width of the image */
+    unsigned int height;                   /* height of the image */
+    unsigned char lut[QTC_GREY_LEVEL + 1]; /* normalized value of each grey level */
+    bool normalize;                        /* false if the pixels are already on QTC_GREY_LEVEL */
+    unsigned char depth;                   /* depth of the subtrees handed to the workers */
+    double *sums;                          /* sum of the pixels of each internal node, NULL without `sse` */
+} BuildJob;
+
+/**
+ * Sum and maximum of the variances of the nodes built, for the filtering
+ */
+typedef struct variance_stats
+{
+    double sum; /* sum of the variances */
+    float max;  /* maximum variance */
+} VarianceStats;
+
+/**
+ * Adaptive models of a Q3 stream, reset at the start of each stream.
+ * Colors are coded as their difference to the parent mean, per depth,
+ * `e` and `u` per depth and `e` of the parent.
+ */
+typedef struct qtc_entropy
+{
+    RansEncoder enc;  /* encoding */
+    RansDecoder dec;  /* decoding */
+    uint32_t *queue;  /* encoding: the queue lent to `enc` at each stream, NULL to let it allocate one */
+    size_t queue_cap; /* entries of `queue` */
+    RansModel color[QTC_LEVELS];
+    RansModel eu[QTC_LEVELS][MAX_CHILD];
+    uint32_t color_count[QTC_LEVELS][RANS_MAX_SYMBOLS];
+    uint16_t color_freq[QTC_LEVELS][RANS_MAX_SYMBOLS];
+    uint16_t color_cum[QTC_LEVELS][RANS_MAX_SYMBOLS + 1U];
+    uint32_t color_lookup[QTC_LEVELS][RANS_MAX_SYMBOLS];
+    uint32_t eu_count[QTC_LEVELS][MAX_CHILD][QTC_EU_SYMBOLS];
+    uint16_t eu_freq[QTC_LEVELS][MAX_CHILD][QTC_EU_SYMBOLS];
+    uint16_t eu_cum[QTC_LEVELS][MAX_CHILD][QTC_EU_SYMBOLS + 1U];
+    uint32_t eu_lookup[QTC_LEVELS][MAX_CHILD][QTC_EU_LOOKUP];
+} QtcEntropy;
+
+/**
+ * @brief Spread the 16 low bits of `v` on the even bits of the result
+ *
+ * @param v the value to spread
+ * @return size_t bit `b` of `v` moved to bit `2b`
+ */
+static __inline__ size_t spread_bits(size_t v)
+{
+    v &= 0xFFFFUL;
+    v = (v | (v << 8UL)) & 0x00FF00FFUL;
+    v = (v | (v << 4UL)) & 0x0F0F0F0FUL;
+    v = (v | (v << 2UL)) & 0x33333333UL;
+    v = (v | (v << 1UL)) & 0x55555555UL;
+    return v;
+}
+
+/**
+ * @brief Position of the block (line, col) among the nodes of its level.
+ * Children are stored as (top-left, top-right, bottom-right, bottom-left),
+ * so each base-4 digit is `2 * line_bit + (line_bit ^ col_bit)`.
+ *
+ * @param line the line of the block at this level
+ * @param col the column of the block at this level
+ * @return size_t offset from the first node of the level
+ */
+static __inline__ size_t zorder_index(size_t line, size_t col)
+{
+    return (spread_bits(line) << 1UL) | spread_bits(line ^ col);
+}
+
+/**
+ * @brief Gather the even bits of `v` on its 16 low bits, inverse of `spread_bits`
+ *
+ * @param v the value to compact
+ * @return size_t bit `2b` of `v` moved to bit `b`
+ */
+static __inline__ size_t compact_bits(size_t v)
+{
+    v &= 0x55555555UL;
+    v = (v | (v >> 1UL)) & 0x33333333UL;
+    v = (v | (v >> 2UL)) & 0x0F0F0F0FUL;
+    v = (v | (v >> 4UL)) & 0x00FF00FFUL;
+    v = (v | (v >> 8UL)) & 0x0000FFFFUL;
+    return v;
+}
+
+/**
+ * @brief Tell if a node is outside of the image, when the image is not the 2^n square of the tree.
+ * Such a node is neither written nor read: its pixels are copies of the edges of the image.
+ *
+ * @param qtree the quadtree
+ * @param i the index of the node
+ * @param depth the depth of the node
+ * @return true if none of its pixels is in the image
+ */
+static __inline__ bool is_outside(const QTree *qtree, size_t i, unsigned char depth)
+{
+    size_t offset = 0UL, line = 0UL, side = 1UL << (qtree->niveau - depth);
+
+    if (QTREE_IS_SQUARE(qtree))
+    {
+        return false;
+    }
+    offset = i - DETERMINE_LEVEL_OFFSET((size_t)depth);
+    line = compact_bits(offset >> 1UL);
+    return line * side >= qtree->height || (line ^ compact_bits(offset)) * side >= qtree->width;
+}
+
+/**
+ * @brief Tell if the color of a node of the image is written: the root, the first 3 children,
+ * and a 4th child whose 2nd sibling is outside of the image, its color can't be deduced then
+ *
+ * @param qtree the quadtree
+ * @param i the index of the node
+ * @param depth the depth of the node
+ * @return true if its color is in the stream
+ */
+static __inline__ bool color_written(const QTree *qtree, size_t i, unsigned char depth)
+{
+    return !i || (i % MAX_CHILD) || is_outside(qtree, i - 2UL, depth);
+}
+
+/**
+ * @brief Run `worker` on each task, one thread per task, the first one on the calling thread.
+ * Tasks whose thread could not be started are run on the calling thread too.
+ *
+ * @param worker the worker
+ * @param tasks the array of tasks
+ * @param task_size the size of a task, in bytes
+ * @param nb_tasks the number of tasks
+ */
+extern void run_workers(void *(*worker)(void *), void *tasks, size_t task_size, unsigned int nb_tasks);
+
+/**
+ * @brief Fill the internal nodes of a subtree, level by level, from `bottom` up to its root.
+ * Children of the `j`-th node of a level are the 4 nodes starting at `4j`
+ * in the next level, so each level of a subtree is a single linear sweep.
+ *
+ * @param job the build shared by every worker
+ * @param stats the variances of the nodes filled are added to it
+ * @param subtree the index of the subtree among the nodes at `sub_depth`
+ * @param sub_depth the depth of the root of the subtree
+ * @param bottom the deepest level to fill, usually the grandparents of the leaves
+ * @return void
+ */
+extern void fill_quadtree_levels(const BuildJob *job, VarianceStats *stats, size_t subtree, int sub_depth, int bottom);
+
+/**
+ * @brief Filtering the quadtree recursively on the root
+ * \mu = \sum from 0 to k < 4, (v_k^2) + (m - m_k)^2 => v = \sqrt{\mu / 4}
+ *
+ * @param qtree the quadtree
+ * @param index the index of the node
+ * @param niveau the level of the quadtree
+ * @param sigma the threshold
+ * @param alpha the alpha value
+ * @return unsigned int 1 if the node is uniform, 0 otherwise
+ */
+extern unsigned int filtrage(QTree *qtree,
+                             size_t index, int niveau,
+                             double sigma, double alpha);
+
+/**
+ * @brief Make a quadtree, in the arenas of a context, or allocated by `make_qtree` without one
+ *
+ * @param tree the quadtree
+ * @param ctx the context, NULL to allocate the tree
+ * @param grey_level the grey level of the image
+ * @param niveau the level of the quadtree, at most the one of the context
+ * @param with_variance true for the variance plane
+ * @return true on success
+ * @return false if the tree is larger than the context, or on a memory allocation error
+ */
+extern bool make_qtree_from(QTree *tree, QtcContext *ctx, unsigned char grey_level, unsigned char niveau,
+                            bool with_variance);
+
+/**
+ * @brief Write the header of a .qtc file: magic number, date and compression rate
+ *
+ * @param fptr the file
+ * @param version '1', '2' or '3'
+ * @param encoded_size the size of the encoded tree, in bits
+ * @param qtree the quadtree
+ */
+extern void write_qtc_header(FILE *fptr, char version, size_t encoded_size, const QTree *qtree);
+
+/**
+ * @brief Read the header of a .qtc file: the version, the comments, the size of a rectangular image
+ * and the level of the tree
+ *
+ * @param in the file or the buffer, at its first byte
+ * @param file_name the name of the file, for the comments and the errors, NULL to read quietly
+ * @param version '1', '2' or '3'
+ * @param width the width of the image
+ * @param height the height of the image
+ * @return unsigned char the level of the tree, `QTC_ALL_LEVELS` if the file is not a .qtc file or is corrupted
+ */
+extern unsigned char read_qtc_header(FileBit *in, const char *file_name, unsigned char *version,
+                                     unsigned long *width, unsigned long *height);
+
+/**
+ * @brief Read node `i` from the bitstream, the reverse of `qtc_write_node`
+ *
+ * @param tree the quadtree, nodes above `i` already read
+ * @param stream the `FileBit`
+ * @param i the index of the node
+ * @param depth the depth of the node
+ */
+extern void qtc_read_node(QTree *tree, void *stream, size_t i, unsigned char depth);
+
+/**
+ * @brief Write a stream of a chunked file, byte aligned: the top stream, or a chunk
+ *
+ * @param qtree the quadtree
+ * @param bits the stream, in memory
+ * @param entropy true for a range coded stream (Q3)
+ * @param models Q3: the models and the queue of the worker, NULL to allocate them for this stream
+ * @param depth the depth of the roots of the chunks
+ * @param chunk the index of the chunk, or `QTC_TOP_STREAM`
+ * @return int 1 if OK, EOF otherwise
+ */
+extern int qtc_write_stream(QTree *qtree, FileBit *bits, bool entropy, QtcEntropy *models, unsigned char depth,
+                            size_t chunk);
+
+/**
+ * @brief Read a stream of a chunked file, the reverse of `qtc_write_stream`
+ *
+ * @param tree the quadtree
+ * @param bits the stream, in memory
+ * @param entropy true for a range coded stream (Q3)
+ * @param models Q3: the models of the worker, NULL to allocate them for this stream
+ * @param depth the depth of the roots of the chunks
+ * @param chunk the index of the chunk, or `QTC_TOP_STREAM`
+ * @param last the depth of the last level read, the stream is left unfinished above `tree->niveau`
+ * @return true on success
+ * @return false if the models could not be allocated
+ */
+extern bool qtc_read_stream(QTree *tree, FileBit *bits, bool entropy, QtcEntropy *models, unsigned char depth,
+                            size_t chunk, unsigned char last);
+
+/**
+ * @brief Fill the pixels of a region covered by a node, the nodes outside the region are not visited.
+ * The tree is walked with a stack, down to the uniform nodes, filled as blocks, and to the quads of leaves,
+ * written as two rows of two pixels
+ *
+ * @param qtree the quadtree
+ * @param pix the pixmap of the region
+ * @param roi the region, inside the image
+ * @param index the index of the node
+ * @param niveau the level of the node, its side is 2^niveau pixels
+ * @param line the first line of the node, in the image
+ * @param col the first column of the node, in the image
+ */
+extern void fill_pixmap_tree(QTree *qtree, Pixmap *pix, const QtcRoi *roi,
+                             size_t index, unsigned char niveau,
+                             unsigned int line, unsigned int col);
+
+#endif
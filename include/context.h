@@ -0,0 +1,112 @@
+/**
+ * @file include/context.h
+ * @authors MUNAITPASOV M. & BENVENISTE A.
+ * @brief Codec context implementation
+ * @version 0.1
+ * @date 2025-01-09
+ *
+ * @copyright licence MIT Copyright (c) 2025
+ *
+ */
+
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include "bits_operations.h"
+
+/**
+ * Allocator of a `QtcContext`: `alloc` returns a block of `size` bytes aligned as by `malloc`, NULL on failure,
+ * `release` gives it back. `user` is their first argument.
+ */
+typedef struct qtc_allocator
+{
+    void *(*alloc)(void *user, size_t size);
+    void (*release)(void *user, void *block);
+    void *user;
+} QtcAllocator;
+
+/**
+ * Codec context, for encoding and decoding many images in memory without allocating their trees:
+ * the planes of the nodes are arenas sized to the largest tree once, the file, the lines and the scratch of the
+ * workers grow to the largest ones seen, and the calls borrow them. A context serves one call at a time, one per thread.
+ */
+typedef struct qtc_context
+{
+    QtcAllocator allocator;  /* source of the arenas */
+    unsigned char max_level; /* level of the largest tree: images of 2^max_level pixels on their longest side */
+    unsigned char *color;    /* arena of the colors of the nodes */
+    unsigned char *eu;       /* arena of `eu` */
+    float *variance;         /* arena of the variances, NULL until the first filtered encode */
+    unsigned char *edges;    /* arena of the nodes outside of the images which are not square */
+    unsigned char *file;     /* the last file encoded, `file_size` bytes */
+    size_t file_size;        /* bytes of the last file encoded */
+    size_t file_capacity;    /* bytes of `file` */
+    unsigned char *pixels;   /* lines decoded when the stride is not the width */
+    size_t pixels_capacity;  /* bytes of `pixels` */
+    unsigned char *scratch;  /* streams, rANS queues and models of the workers of a call */
+    size_t scratch_capacity; /* bytes of `scratch` */
+} QtcContext;
+
+/**
+ * @brief Make a codec context: the planes of a tree of `max_level` are allocated once,
+ * with `allocator` or with `malloc` and `free`
+ *
+ * @param ctx the context
+ * @param max_level the level of the largest tree, below 17
+ * @param allocator the allocator, copied, NULL for `malloc` and `free`
+ * @return true on success
+ * @return false on a memory allocation error, `ctx` is then empty
+ */
+extern bool make_qtc_context(QtcContext *ctx, unsigned char max_level, const QtcAllocator *allocator);
+
+/**
+ * @brief Free the arenas of a codec context
+ *
+ * @param ctx the context
+ * @return void
+ */
+extern void free_qtc_context(QtcContext *ctx);
+
+/**
+ * @brief A block of a context of `size` bytes at least: `block` when it is large enough,
+ * else a new one a quarter larger, so that slightly larger images do not allocate it again
+ *
+ * @param ctx the context
+ * @param block the block, released if too small, NULL if none
+ * @param capacity the size of the block, updated
+ * @param size the size needed
+ * @return void* the block, NULL on a memory allocation error
+ */
+extern void *qtc_context_reserve(QtcContext *ctx, void *block, size_t *capacity, size_t size);
+
+/**
+ * @brief The scratch memory of a call, `size` bytes: the arena of a context, kept for the next calls,
+ * or a block of its own without one
+ *
+ * @param ctx the context, NULL to allocate the block
+ * @param size the size needed
+ * @return void* the block, NULL on a memory allocation error
+ */
+extern void *qtc_scratch(QtcContext *ctx, size_t size);
+
+/**
+ * @brief Release the scratch memory of a call, unless it is the arena of a context
+ *
+ * @param ctx the context, NULL if the block is its own
+ * @param block the block of `qtc_scratch`
+ */
+extern void qtc_scratch_release(QtcContext *ctx, void *block);
+
+/**
+ * @brief Write the file of an encode in the arena of a context: `dest` is a buffer
+ * of `size` bytes at least, which does not grow
+ *
+ * @param ctx the context
+ * @param dest the buffer
+ * @param size the size of the file
+ * @return true on success
+ * @return false on a memory allocation error
+ */
+extern bool qtc_context_file(QtcContext *ctx, FileBit *dest, size_t size);
+
+#endif
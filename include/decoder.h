@@ -0,0 +1,84 @@
+/**
+ * @file include/decoder.h
+ * @authors MUNAITPASOV M. & BENVENISTE A.
+ * @brief Push decoder implementation
+ * @version 0.1
+ * @date 2025-01-09
+ *
+ * @copyright licence MIT Copyright (c) 2025
+ *
+ */
+
+#ifndef DECODER_H
+#define DECODER_H
+
+#include "qtree.h"
+
+/**
+ * Decoder of a .qtc file arriving in slices of any size, from a socket for instance: `qtc_decoder_push` reads
+ * the nodes as far as the bytes received allow, and keeps only those of an unfinished header, index or stream.
+ * The first `levels` levels of `tree` are complete, to be shown before the end of the file (`qtc_decoder_view`).
+ */
+typedef struct qtc_decoder
+{
+    QTree tree;                /* the nodes read so far, allocated once the header is read */
+    unsigned char levels;      /* number of complete levels, from the root */
+    bool done;                 /* true once the last node is read */
+    QtcContext *ctx;           /* arenas of the tree, NULL to allocate it */
+    unsigned char step;        /* part of the file being read */
+    unsigned char version;     /* '1', '2' or '3', once the header is read */
+    unsigned char depth;       /* Q1: depth of the next node, Q2/Q3: depth of the roots of the chunks */
+    size_t next;               /* Q1: index of the next node, Q2/Q3: the next stream, 0 for the top one */
+    size_t nb_streams;         /* Q2/Q3: the top stream and the chunks */
+    size_t *sizes;             /* Q2/Q3: bytes of each stream, from the index */
+    uint64_t acc;              /* Q1: the bits received and not read yet */
+    unsigned char nb_bits;     /* Q1: number of bits in `acc` */
+    unsigned char *pending;    /* bytes of an unfinished part of the file */
+    size_t pending_size;       /* bytes in `pending` */
+    size_t pending_capacity;   /* bytes allocated for `pending` */
+} QtcDecoder;
+
+/**
+ * @brief Make a decoder of a .qtc file arriving in slices, Q1, Q2 or Q3
+ *
+ * @param dec the decoder
+ * @param ctx the context whose arenas hold the tree, lent to the decoder until it is freed, NULL to allocate it
+ * @return true on success
+ * @return false if an argument is wrong
+ */
+extern bool make_qtc_decoder(QtcDecoder *dec, QtcContext *ctx);
+
+/**
+ * @brief Free a decoder, its tree unless in the arenas of a context
+ *
+ * @param dec the decoder
+ * @return void
+ */
+extern void free_qtc_decoder(QtcDecoder *dec);
+
+/**
+ * @brief Give the next bytes of the file to a decoder, and read the nodes as far as they allow.
+ * The nodes of a Q1 file are read one by one, the bits of an unfinished node kept for the next slice;
+ * the streams of a Q2 or Q3 file are read once whole, the top one first. The bytes after the file are ignored.
+ *
+ * @param dec the decoder
+ * @param data the bytes, copied if needed: they can be written over after the call
+ * @param size the number of bytes, 0 to only ask for the levels
+ * @return int the number of complete levels, `dec->done` once the file is read; EOF if the bytes are not
+ * a .qtc file or on a memory allocation error, the decoder then fails until it is freed
+ */
+extern int qtc_decoder_push(QtcDecoder *dec, const unsigned char *data, size_t size);
+
+/**
+ * @brief The complete levels of a decoder as a quadtree of their own, for `pixmap_from_quadtree`:
+ * its nodes are those of the decoder, the last complete level its leaves, a thumbnail
+ * of the image until the file is read
+ *
+ * @param dec the decoder
+ * @param view the quadtree, not to be freed, valid until the decoder is freed
+ * @return true on success
+ * @return false if no level is complete yet
+ */
+extern bool qtc_decoder_view(const QtcDecoder *dec, QTree *view);
+
+#endif
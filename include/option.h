@@ -14,16 +14,35 @@
 
 #include "bits_operations.h"
 
+#define QTC_MAX_ALPHAS 16U /* alphas of a sweep, `-a a1,a2,...` */
+
 typedef struct args
 {
     char *file_name_input;  /* `-i` + input.{pgm | qtc} */
     char *file_name_output; /* `-o` + output.{pgm | qtc}, by default: {QTC | PGM}/out.{qtc | pgm} */
     double alpha;           /* `-a`: quadtree filtering */
+    double alphas[QTC_MAX_ALPHAS]; /* `-a a1,a2,...`: one .qtc file per alpha, from a single build */
+    unsigned int nb_alphas;        /* number of alphas given to `-a`, 0 if not set */
+    unsigned int threads;   /* `-j`: number of threads for the quadtree construction and the Q2 chunks, 1 by default */
+    unsigned char format;   /* `-f`: version of the .qtc files written, 1 by default, 3 is range coded */
+    unsigned short roi[4];  /* `-r`: x, y, width and height of the region decoded, width 0 for the whole image */
+    unsigned char max_level; /* `--max-level`: last level decoded, for a thumbnail, 0xFF for all of them */
+    size_t target_bytes;     /* `--target-bytes`: size of the .qtc file, alpha is searched, 0 if not set */
+    double psnr;             /* `--psnr`: rate-distortion filtering down to this PSNR, in dB, 0 if not set */
+    double lambda;           /* `--lambda`: rate-distortion filtering at this price of a bit, negative if not set */
+    unsigned char stream;    /* `--stream`: the image is encoded or decoded by bands of 2^k lines, 0 if not set */
+    char *batch;             /* `--batch`: output directory of a batch of files, NULL if not set */
+    char **inputs;           /* batch: the input files and directories, `-` for a list on stdin */
+    int nb_inputs;           /* batch: number of `inputs`, 0 reads the list on stdin */
     bool mode;              /* `-c`: false - (encodeur),`-u`: true - (decodeur) */
     bool seg_grid;          /* `-g`: la grille de segmentation is  */
+    bool ascii;             /* `--ascii`: the decoded .pgm is written as P2, P5 by default */
     bool verbose;           /* `-v`: verbose */
     bool help;              /* `-h`: help  */
     bool err;               /* `error`: unknown option */
+    bool defined_mode;      /* `-c` or `-u` is already given, for the parsing */
+    bool defined_extension; /* the input file is already given, for the parsing */
+    bool defined_output;    /* `-o` is already given, for the parsing */
 } Args;
 
 /**
@@ -21,14 +21,38 @@
 typedef struct pixmap /* struct occupies 16 bits */
 {
     unsigned char *data;      /* data of the image */
-    unsigned short width;     /* width of the image, 0 - 65535 */
-    unsigned short height;    /* height of the image, 0 - 65535 */
+    unsigned char *map;       /* file mapping holding `data`, NULL if `data` is allocated */
+    size_t map_size;          /* size of the mapping */
+    unsigned int width;       /* width of the image, 0 - 2^32 - 1 */
+    unsigned int height;      /* height of the image, 0 - 2^32 - 1 */
     unsigned char grey_level; /* grey level of the image, 0 - 255 */
     char magic_number[3];     /* for example `P5` or `P2` */
 } Pixmap;
 
+/**
+ * A .pgm file written band by band, by `write_pgm_band`
+ */
+typedef struct pgm_stream
+{
+    FILE *file;       /* the .pgm file, opened for writing */
+    char *text;       /* P2: the text of a band, NULL before the first one */
+    size_t text_size; /* size of `text` */
+    bool ascii;       /* P2 (ASCII) instead of P5 */
+} PgmStream;
+
+/**
+ * @brief Read the header of a PGM file (P5 or P2), the file is left at the first pixel
+ *
+ * @param pix Pixmap whose magic number, size and grey level are set, `data` is not touched
+ * @param filename Filename of the image
+ * @return FILE* the file opened, positioned at the raster, NULL on error
+ */
+FILE *read_pgm_file(Pixmap *pix, const char *filename);
+
 /**
  * @brief Initialize a pixmap from a file (P5 PGM format)
+ * A regular file is mapped in memory and `data` points into the mapping, without copy;
+ * a pipe is read into an allocated buffer.
  *
  * @param pix Pixmap to initialize
  * @param filename Filename of the image
@@ -61,4 +85,56 @@ void free_pixmap(Pixmap *pix);
  */
 void from_pixmap_to_pgm(Pixmap *pix, const char *filename);
 
+/**
+ * @brief Write a band of lines to a .pgm file, after the header when it is the first one,
+ * as `from_pixmap_to_pgm` writes the whole image: a `QtcBandSink`
+ *
+ * @param stream the `PgmStream`
+ * @param lines the pixels of the band
+ * @param width the width of the image
+ * @param height the height of the image
+ * @param first_line the line of the image of the first line of the band
+ * @param nb_lines the number of lines of the band
+ * @return bool true if OK, false on a write or an allocation error
+ */
+bool write_pgm_band(void *stream, const unsigned char *lines, unsigned int width, unsigned int height,
+                    unsigned int first_line, unsigned int nb_lines);
+
+/**
+ * @brief Initialize a pixmap from a PGM file (P5 or P2) read in memory, without copy:
+ * the raster of a P5 file is used in place, a P2 one is parsed into `raster`.
+ * The pixmap is not to be freed, `raster` is kept by the caller from one image to the next.
+ *
+ * @param pix Pixmap to initialize
+ * @param buf the file
+ * @param len the size of `buf`
+ * @param raster P2: the buffer of the values, NULL at first, grown as needed
+ * @param raster_size the size of `raster`, updated
+ * @return bool true if OK, false on a format or an allocation error
+ */
+bool read_pgm_buffer(Pixmap *pix, unsigned char *buf, size_t len, unsigned char **raster, size_t *raster_size);
+
+/**
+ * @brief Size of a buffer large enough for `write_pgm_buffer`
+ *
+ * @param width the width of the image
+ * @param height the height of the image
+ * @param ascii P2 (ASCII) instead of P5
+ * @return size_t the size in bytes
+ */
+size_t pgm_buffer_size(unsigned int width, unsigned int height, bool ascii);
+
+/**
+ * @brief Write a whole .pgm file in memory, as `write_pgm_band` writes it to a file
+ *
+ * @param out the file, `pgm_buffer_size` bytes at least
+ * @param lines the pixels of the image
+ * @param width the width of the image
+ * @param height the height of the image
+ * @param ascii P2 (ASCII) instead of P5
+ * @return size_t the number of bytes written
+ */
+size_t write_pgm_buffer(unsigned char *out, const unsigned char *lines, unsigned int width, unsigned int height,
+                        bool ascii);
+
 #endif
@@ -24,37 +24,52 @@
 
 #define MAX_SIZE 1024
 
+#define FILEBIT_BLOCK_SIZE (1UL << 16) /* 64 KiB memory block */
+#define FILEBIT_MAX_BITS 24U           /* widest field read/written at once */
+
 typedef struct
 {
-    FILE *fich;          /* file descriptor */
-    unsigned char nbBit; /* number of bites written in buffer */
-    unsigned char stock; /* buffer of 8 bits */
+    FILE *fich;                             /* file descriptor */
+    uint64_t acc;                           /* 64-bit accumulator */
+    size_t pos;                             /* current position in the block */
+    size_t len;                             /* number of valid bytes in the block (reading) */
+    unsigned char nbBit;                    /* number of bits pending in `acc` */
+    unsigned char ecriture;                 /* 1 if the stream is used for writing */
+    unsigned char depasse;                  /* 1 if a read went past the end of the stream */
+    const unsigned char *src;               /* bytes read: `bloc`, or a buffer in memory */
+    unsigned char *mem;                     /* memory buffer when `fich` is NULL */
+    size_t memlen;                          /* number of bytes written in `mem` */
+    size_t memcap;                          /* allocated size of `mem` */
+    unsigned char bloc[FILEBIT_BLOCK_SIZE]; /* memory block between `acc` and the file */
 } FileBit;
 
+/* `e` is stored on bits 0-1 of `eu`, `u` on bit 2 */
+#define QTREE_E(tree, i) ((unsigned char)((tree)->eu[i] & 0x3U))
+#define QTREE_U(tree, i) ((unsigned char)(((tree)->eu[i] >> 0x2U) & 0x1U))
+#define QTREE_EU(e, u) ((unsigned char)((e) | ((u) << 0x2U)))
+
 /**
- * `float variance;`
+ * Quadtree structure, one plane per field of the nodes
  *
- * `unsigned char color;`
+ * `unsigned char *color;`
  *
- * `unsigned char e;`
+ * `unsigned char *eu;`
  *
- * `unsigned char u;`
- * }
- */
-typedef struct node
-{
-    /*unsigned int e : 2;*/ /* 2 bits, value in [0, 3] */
-    /*unsigned int u : 1;*/ /* true if uniform, false otherwise */
-    float variance;         /* variance of the node */
-    unsigned char e;        /* without -ansi flag, 2 bytes of memory */
-    unsigned char u;        /* without -ansi flag, 2 bytes of memory */
-    unsigned char color;    /* 8 bits from 0 to 255 */
-} Node;
-
-/**
- * Quadtree structure with nodes, grey_level and niveau
+ * `float *variance;`
+ *
+ * `double *sse;`
+ *
+ * `unsigned char *raster;`
+ *
+ * `unsigned char *edges;`
+ *
+ * `double variance_sum;`
+ *
+ * `float variance_max;`
  *
- * `Node *nodes;`
+ * `unsigned int width;`
+ *
+ * `unsigned int height;`
  *
  * `int grey_level;`
  *
@@ -63,32 +78,160 @@ typedef struct node
  */
 typedef struct qtree
 {
-    Node *nodes;          /* nodes of the quadtree */
-    int grey_level;       /* 4 bytes */
-    unsigned char niveau; /* 8 bits from 0 to 255 */
+    unsigned char *color;  /* average color of each node, 8 bits from 0 to 255 */
+    unsigned char *eu;     /* `e` in [0, 3] and `u` (true if uniform) of each node, 3 bits */
+    float *variance;       /* variance of each node, NULL unless the tree is filtered */
+    double *sse;           /* squared error of each internal node if collapsed, NULL unless RD filtered */
+    unsigned char *raster; /* pixels of the leaves, read straight into them, NULL unless decoding to a pixmap */
+    unsigned char *edges;  /* nodes outside of an image which is not square, by depth, NULL until built */
+    double variance_sum;   /* sum of the variances, accumulated by the build for the filtering */
+    float variance_max;    /* maximum variance, accumulated by the build */
+    unsigned int width;    /* width of the image, the tree covers the 2^niveau square above it */
+    unsigned int height;   /* height of the image, the nodes outside are neither built nor written */
+    int grey_level;        /* 4 bytes */
+    unsigned char niveau;  /* 8 bits from 0 to 255 */
 } QTree;
 
+/**
+ * Region of an image, in pixels: `w` x `h` pixels from column `x` and line `y`
+ */
+typedef struct qtc_roi
+{
+    unsigned int x; /* first column */
+    unsigned int y; /* first line */
+    unsigned int w; /* width */
+    unsigned int h; /* height */
+} QtcRoi;
+
+/**
+ * Receiver of the bands of `decode_qtc_file_streaming`, top to bottom: `nb_lines` lines of `width`
+ * pixels, from the line `first_line` of an image of `height` lines. Returns false to stop the decoding.
+ */
+typedef bool (*QtcBandSink)(void *user, const unsigned char *lines, unsigned int width, unsigned int height,
+                            unsigned int first_line, unsigned int nb_lines);
+
+/**
+ * A .qtc file in memory, written by `qtc_encode_buffer`: `size` bytes of `data`, allocated with `malloc`
+ * and grown as needed, `capacity` of them. Given back to the next call, it is written over without
+ * being allocated again; `qtc_free_buffer` frees it.
+ */
+typedef struct qtc_buffer
+{
+    unsigned char *data; /* the bytes, NULL before the first call */
+    size_t size;         /* bytes of the file */
+    size_t capacity;     /* bytes allocated */
+} QtcBuffer;
+
+/**
+ * Allocator of a `QtcContext`: `alloc` returns a block of `size` bytes aligned as by `malloc`, NULL on failure,
+ * `release` gives it back. `user` is their first argument.
+ */
+typedef struct qtc_allocator
+{
+    void *(*alloc)(void *user, size_t size);
+    void (*release)(void *user, void *block);
+    void *user;
+} QtcAllocator;
+
+/**
+ * Codec context, for encoding and decoding many images in memory without allocating their trees:
+ * the planes of the nodes are arenas sized to the largest tree once, the file, the lines and the scratch of the
+ * workers grow to the largest ones seen, and the calls borrow them. A context serves one call at a time, one per thread.
+ */
+typedef struct qtc_context
+{
+    QtcAllocator allocator;  /* source of the arenas */
+    unsigned char max_level; /* level of the largest tree: images of 2^max_level pixels on their longest side */
+    unsigned char *color;    /* arena of the colors of the nodes */
+    unsigned char *eu;       /* arena of `eu` */
+    float *variance;         /* arena of the variances, NULL until the first filtered encode */
+    unsigned char *edges;    /* arena of the nodes outside of the images which are not square */
+    unsigned char *file;     /* the last file encoded, `file_size` bytes */
+    size_t file_size;        /* bytes of the last file encoded */
+    size_t file_capacity;    /* bytes of `file` */
+    unsigned char *pixels;   /* lines decoded when the stride is not the width */
+    size_t pixels_capacity;  /* bytes of `pixels` */
+    unsigned char *scratch;  /* streams, rANS queues and models of the workers of a call */
+    size_t scratch_capacity; /* bytes of `scratch` */
+} QtcContext;
+
+/**
+ * Decoder of a .qtc file arriving in slices of any size, from a socket for instance: `qtc_decoder_push` reads
+ * the nodes as far as the bytes received allow, and keeps only those of an unfinished header, index or stream.
+ * The first `levels` levels of `tree` are complete, to be shown before the end of the file (`qtc_decoder_view`).
+ */
+typedef struct qtc_decoder
+{
+    QTree tree;                /* the nodes read so far, allocated once the header is read */
+    unsigned char levels;      /* number of complete levels, from the root */
+    bool done;                 /* true once the last node is read */
+    QtcContext *ctx;           /* arenas of the tree, NULL to allocate it */
+    unsigned char step;        /* part of the file being read */
+    unsigned char version;     /* '1', '2' or '3', once the header is read */
+    unsigned char depth;       /* Q1: depth of the next node, Q2/Q3: depth of the roots of the chunks */
+    size_t next;               /* Q1: index of the next node, Q2/Q3: the next stream, 0 for the top one */
+    size_t nb_streams;         /* Q2/Q3: the top stream and the chunks */
+    size_t *sizes;             /* Q2/Q3: bytes of each stream, from the index */
+    uint64_t acc;              /* Q1: the bits received and not read yet */
+    unsigned char nb_bits;     /* Q1: number of bits in `acc` */
+    unsigned char *pending;    /* bytes of an unfinished part of the file */
+    size_t pending_size;       /* bytes in `pending` */
+    size_t pending_capacity;   /* bytes allocated for `pending` */
+} QtcDecoder;
+
+#define QTC_MAX_ALPHAS 16U /* alphas of a sweep, `-a a1,a2,...` */
+
 typedef struct args
 {
     char *file_name_input;  /* `-i` + input.{pgm | qtc} */
     char *file_name_output; /* `-o` + output.{pgm | qtc}, by default: {QTC | PGM}/out.{qtc | pgm} */
     double alpha;           /* `-a`: quadtree filtering */
+    double alphas[QTC_MAX_ALPHAS]; /* `-a a1,a2,...`: one .qtc file per alpha, from a single build */
+    unsigned int nb_alphas;        /* number of alphas given to `-a`, 0 if not set */
+    unsigned int threads;   /* `-j`: number of threads for the quadtree construction and the Q2 chunks, 1 by default */
+    unsigned char format;   /* `-f`: version of the .qtc files written, 1 by default, 3 is range coded */
+    unsigned short roi[4];  /* `-r`: x, y, width and height of the region decoded, width 0 for the whole image */
+    unsigned char max_level; /* `--max-level`: last level decoded, for a thumbnail, 0xFF for all of them */
+    size_t target_bytes;     /* `--target-bytes`: size of the .qtc file, alpha is searched, 0 if not set */
+    double psnr;             /* `--psnr`: rate-distortion filtering down to this PSNR, in dB, 0 if not set */
+    double lambda;           /* `--lambda`: rate-distortion filtering at this price of a bit, negative if not set */
+    unsigned char stream;    /* `--stream`: the image is encoded or decoded by bands of 2^k lines, 0 if not set */
+    char *batch;             /* `--batch`: output directory of a batch of files, NULL if not set */
+    char **inputs;           /* batch: the input files and directories, `-` for a list on stdin */
+    int nb_inputs;           /* batch: number of `inputs`, 0 reads the list on stdin */
     bool mode;              /* `-c`: false - (encodeur),`-u`: true - (decodeur) */
     bool seg_grid;          /* `-g`: la grille de segmentation is  */
+    bool ascii;             /* `--ascii`: the decoded .pgm is written as P2, P5 by default */
     bool verbose;           /* `-v`: verbose */
     bool help;              /* `-h`: help  */
     bool err;               /* `error`: unknown option */
+    bool defined_mode;      /* `-c` or `-u` is already given, for the parsing */
+    bool defined_extension; /* the input file is already given, for the parsing */
+    bool defined_output;    /* `-o` is already given, for the parsing */
 } Args;
 
 typedef struct pixmap /* struct occupies 16 bits */
 {
     unsigned char *data;      /* data of the image */
-    unsigned short width;     /* width of the image, 0 - 65535 */
-    unsigned short height;    /* height of the image, 0 - 65535 */
+    unsigned char *map;       /* file mapping holding `data`, NULL if `data` is allocated */
+    size_t map_size;          /* size of the mapping */
+    unsigned int width;       /* width of the image, 0 - 2^32 - 1 */
+    unsigned int height;      /* height of the image, 0 - 2^32 - 1 */
     unsigned char grey_level; /* grey level of the image, 0 - 255 */
     char magic_number[3];     /* for example `P5` or `P2` */
 } Pixmap;
 
+/**
+ * A .pgm file written band by band, by `write_pgm_band`
+ */
+typedef struct pgm_stream
+{
+    FILE *file;       /* the .pgm file, opened for writing */
+    char *text;       /* P2: the text of a band, NULL before the first one */
+    size_t text_size; /* size of `text` */
+    bool ascii;       /* P2 (ASCII) instead of P5 */
+} PgmStream;
+
 /****************************************************************/
 /****************************************************************/
 /***************    FUNCTIONS FOR BIT OPERATIONS    *************/
@@ -104,6 +247,7 @@ extern unsigned char fBitopen(FileBit *__restrict__ f, const char *__restrict__
 /**
  * @brief Initialise une structure FileBit
  * avec un descripteur de fichier deja ouvert
+   Note: si `fich` est NULL, les octets ecrits s'accumulent dans `f->mem` (`f->memlen` octets)
  *
  * @param f
  * @param fich
@@ -111,7 +255,25 @@ extern unsigned char fBitopen(FileBit *__restrict__ f, const char *__restrict__
 extern void fBitinit(FileBit *__restrict__ f, FILE *__restrict__ fich);
 
 /**
- * @brief Ferme le fichier en argument, et ecrit les bits en attente
+ * @brief Initialise une structure FileBit en lecture sur un tampon en memoire
+   Note: le tampon n'est pas copie, il doit rester valide jusqu'a `fBitclose`
+ *
+ * @param f
+ * @param buf
+ * @param len
+ */
+extern void fBitinitMem(FileBit *__restrict__ f, const unsigned char *__restrict__ buf, size_t len);
+
+/**
+ * @brief Complete le dernier octet par des 0 et ecrit les bits en attente, sans fermer
+ *
+ * @param f
+ * @return int
+ */
+extern int fBitflush(FileBit *__restrict__ f);
+
+/**
+ * @brief Ferme le fichier en argument (ou libere le tampon memoire), et ecrit les bits en attente
  *
  * @param f
  * @return int
@@ -136,6 +298,73 @@ extern int fEcrireBit(FileBit *__restrict__ f, int bit);
  */
 extern int fLireBit(FileBit *__restrict__ f);
 
+/**
+ * @brief Ecrit les `n` bits de poids faible de `valeur`, bit de poids fort en premier
+   Note: `n` dans [0, FILEBIT_MAX_BITS], un seul decalage dans l'accumulateur
+ *
+ * @param f
+ * @param valeur
+ * @param n
+ * @return int
+ */
+extern int fEcrireBits(FileBit *__restrict__ f, unsigned int valeur, unsigned char n);
+
+/**
+ * @brief Renvoie le champ de `n` bits suivant lu depuis le fichier, ou EOF
+   Note: `n` dans [0, FILEBIT_MAX_BITS]
+ *
+ * @param f
+ * @param n
+ * @return int
+ */
+extern int fLireBits(FileBit *__restrict__ f, unsigned char n);
+
+/**
+ * @brief Ecrit `len` octets, par `memcpy` si le flux est aligne sur un octet
+ *
+ * @param f
+ * @param buf
+ * @param len
+ * @return int
+ */
+extern int fEcrireOctets(FileBit *__restrict__ f, const unsigned char *__restrict__ buf, size_t len);
+
+/**
+ * @brief Lit `len` octets, par `memcpy` si le flux est aligne sur un octet
+ *
+ * @param f
+ * @param buf
+ * @param len
+ * @return size_t nombre d'octets lus
+ */
+extern size_t fLireOctets(FileBit *__restrict__ f, unsigned char *__restrict__ buf, size_t len);
+
+/**
+ * @brief Saute `len` octets d'un flux aligne sur un octet, par `fseek` dans un fichier
+ *
+ * @param f
+ * @param len
+ * @return size_t nombre d'octets sautes
+ */
+extern size_t fSauterOctets(FileBit *__restrict__ f, size_t len);
+
+/**
+ * @brief Renvoie la position dans le fichier du prochain octet lu, ou -1L pour un tampon memoire
+ *
+ * @param f
+ * @return long
+ */
+extern long fPositionOctet(FileBit *__restrict__ f);
+
+/**
+ * @brief Place la lecture a l'octet `position` du fichier, sans relire le bloc s'il le contient deja
+ *
+ * @param f
+ * @param position
+ * @return int: 1 si OK et EOF sinon
+ */
+extern int fAllerOctet(FileBit *__restrict__ f, long position);
+
 /**
  * @brief Ecrit les 8 bits d'un char en argument
  *
@@ -152,6 +381,127 @@ extern void fEcritCharbin(FileBit *__restrict__ f, unsigned char n);
  */
 extern unsigned char fLireCharbin(FileBit *__restrict__ f);
 
+/****************************************************************/
+/****************************************************************/
+/*************    FUNCTIONS FOR RANGE CODING (rANS)    **********/
+/****************************************************************/
+/****************************************************************/
+
+#define RANS_SCALE_BITS 12U                  /* frequencies of a model sum to 2^12 */
+#define RANS_SCALE (1U << RANS_SCALE_BITS)
+#define RANS_LOW (1UL << 16U)                /* the state stays in [2^16, 2^32), renormalized by 16 bits */
+#define RANS_MAX_SYMBOLS 256U
+#define RANS_REFRESH_FIRST 16U               /* symbols before the first refresh of a model */
+#define RANS_REFRESH_LAST 4096U              /* the interval doubles up to this one */
+#define RANS_MAX_COUNT (1UL << 16U)          /* counts are halved above this total */
+
+/**
+ * Adaptive model of an alphabet of `nb_symbols` symbols.
+ * Frequencies are rebuilt from the counts every `interval` symbols,
+ * in the same way by the encoder and the decoder.
+ *
+ * The arrays belong to the caller: `count` and `freq` of `nb_symbols` entries,
+ * `cum` of `nb_symbols + 1` entries, `lookup` of the smallest power of two at least `nb_symbols` entries, or NULL.
+ */
+typedef struct rans_model
+{
+    uint32_t *count;         /* occurrences of each symbol, plus one */
+    uint16_t *freq;          /* frequency of each symbol, at least 1 */
+    uint16_t *cum;           /* cumulative frequencies */
+    uint32_t *lookup;        /* decoding: the symbol of the first slot of each group of slots, on bits 0-7,
+                                its frequency - 1 on 8-19 and its cumulative frequency on 20-31,
+                                NULL for a linear search among `cum` */
+    uint32_t total;          /* sum of `count`, at the last refresh */
+    unsigned int nb_symbols; /* size of the alphabet, at most `RANS_MAX_SYMBOLS` */
+    unsigned int left;       /* symbols before the next refresh */
+    unsigned int interval;   /* symbols between two refreshes */
+    unsigned int shift;      /* a group of slots of `lookup` is 2^shift slots */
+} RansModel;
+
+/**
+ * Encoder of a stream: symbols are queued, then coded backwards by `rans_encoder_flush`,
+ * into the end of the queue itself
+ */
+typedef struct rans_encoder
+{
+    FileBit *bits;     /* byte aligned stream */
+    uint32_t *queue;   /* `(cum << 16) | freq` of each symbol, in coding order */
+    size_t len;        /* number of symbols queued */
+    size_t cap;        /* capacity of `queue` */
+    bool owned;        /* true if `queue` was allocated by the encoder, false if it is lent by the caller */
+    bool error;        /* true if `queue` could not grow */
+} RansEncoder;
+
+/**
+ * Decoder of a stream in memory
+ */
+typedef struct rans_decoder
+{
+    const unsigned char *ptr; /* next bytes to read */
+    const unsigned char *end; /* end of the stream */
+    uint32_t x;               /* state */
+} RansDecoder;
+
+/**
+ * @brief Set up a model, all the symbols equally likely
+ *
+ * @param m the model
+ * @param nb_symbols the size of the alphabet
+ * @param count the counts, `nb_symbols` entries
+ * @param freq the frequencies, `nb_symbols` entries
+ * @param cum the cumulative frequencies, `nb_symbols + 1` entries
+ * @param lookup the decoding table, the smallest power of two at least `nb_symbols` entries, NULL to search `cum`
+ */
+extern void rans_model_init(RansModel *m, unsigned int nb_symbols,
+                            uint32_t *count, uint16_t *freq, uint16_t *cum, uint32_t *lookup);
+
+/**
+ * @brief Start encoding into `bits`, which must be byte aligned.
+ * The queue is lent by the caller: a stream of `cap - 1` symbols at most never allocates,
+ * a longer one moves to a queue of its own.
+ *
+ * @param enc the encoder
+ * @param bits the stream
+ * @param queue the queue, `cap` entries, NULL to allocate it
+ * @param cap the capacity of `queue`
+ */
+extern void rans_encoder_init(RansEncoder *enc, FileBit *bits, uint32_t *queue, size_t cap);
+
+/**
+ * @brief Queue symbol `s` with the model, then adapt the model
+ *
+ * @param enc the encoder
+ * @param m the model
+ * @param s the symbol
+ */
+extern void rans_encode(RansEncoder *enc, RansModel *m, unsigned int s);
+
+/**
+ * @brief Code the queued symbols and write them, the stream stays byte aligned.
+ * The encoder is released, a lent queue is left to the caller.
+ *
+ * @param enc the encoder
+ * @return int 1 if OK, EOF otherwise
+ */
+extern int rans_encoder_flush(RansEncoder *enc);
+
+/**
+ * @brief Start decoding from `bits`, a byte aligned stream in memory (`fBitinitMem`)
+ *
+ * @param dec the decoder
+ * @param bits the stream
+ */
+extern void rans_decoder_init(RansDecoder *dec, FileBit *bits);
+
+/**
+ * @brief Decode a symbol with the model, then adapt the model
+ *
+ * @param dec the decoder
+ * @param m the model, as it was when the symbol was encoded
+ * @return unsigned int the symbol
+ */
+extern unsigned int rans_decode(RansDecoder *dec, RansModel *m);
+
 /****************************************************************/
 /****************************************************************/
 /**************    FUNCTIONS FOR GRID OPERATIONS    *************/
@@ -177,6 +527,183 @@ extern void generate_grid_from_quadtree(QTree *qtree, Pixmap *pix);
  */
 extern char *change_filename_to_seg_grid(const char *src);
 
+/****************************************************************/
+/****************************************************************/
+/**************   FUNCTIONS FOR BATCH OPERATIONS   **************/
+/****************************************************************/
+/****************************************************************/
+
+/**
+ * @brief Encode (`-c`) or decode (`-u`) many files in one process, into the directory `args->batch`:
+ * the inputs are files, directories of .pgm (or .qtc) files, and `-` or nothing for a list on stdin,
+ * one path per line. The files go through a pipeline: a reader on the calling thread, a pool of
+ * `args->threads` workers, each one reusing its tree and its pixels from one image to the next,
+ * and a writer thread, linked by queues bounded by two images per worker. The reader and the writer
+ * submit their files to an io_uring on Linux, else read and write blocking on their own threads:
+ * the I/O of the next and previous images overlaps the work on the current ones.
+ * A file that fails is reported and the batch goes on, as a file whose output is named as the one
+ * of a file before it: "in1/x.pgm" and "in2/x.pgm" both write "x.qtc", the first one only does.
+ *
+ * @param args the arguments, `args->inputs` and `args->batch` set
+ * @return int 0 if every file was encoded or decoded, 1 otherwise
+ */
+extern int batch_run(const Args *args);
+
+/****************************************************************/
+/****************************************************************/
+/*************   FUNCTIONS FOR CONTEXT OPERATIONS   *************/
+/****************************************************************/
+/****************************************************************/
+
+/**
+ * @brief Make a codec context: the planes of a tree of `max_level` are allocated once,
+ * with `allocator` or with `malloc` and `free`
+ *
+ * @param ctx the context
+ * @param max_level the level of the largest tree, below 17
+ * @param allocator the allocator, copied, NULL for `malloc` and `free`
+ * @return true on success
+ * @return false on a memory allocation error, `ctx` is then empty
+ */
+extern bool make_qtc_context(QtcContext *ctx, unsigned char max_level, const QtcAllocator *allocator);
+
+/**
+ * @brief Free the arenas of a codec context
+ *
+ * @param ctx the context
+ * @return void
+ */
+extern void free_qtc_context(QtcContext *ctx);
+
+/**
+ * @brief A block of a context of `size` bytes at least: `block` when it is large enough,
+ * else a new one a quarter larger, so that slightly larger images do not allocate it again
+ *
+ * @param ctx the context
+ * @param block the block, released if too small, NULL if none
+ * @param capacity the size of the block, updated
+ * @param size the size needed
+ * @return void* the block, NULL on a memory allocation error
+ */
+extern void *qtc_context_reserve(QtcContext *ctx, void *block, size_t *capacity, size_t size);
+
+/**
+ * @brief The scratch memory of a call, `size` bytes: the arena of a context, kept for the next calls,
+ * or a block of its own without one
+ *
+ * @param ctx the context, NULL to allocate the block
+ * @param size the size needed
+ * @return void* the block, NULL on a memory allocation error
+ */
+extern void *qtc_scratch(QtcContext *ctx, size_t size);
+
+/**
+ * @brief Release the scratch memory of a call, unless it is the arena of a context
+ *
+ * @param ctx the context, NULL if the block is its own
+ * @param block the block of `qtc_scratch`
+ */
+extern void qtc_scratch_release(QtcContext *ctx, void *block);
+
+/**
+ * @brief Write the file of an encode in the arena of a context: `dest` is a buffer
+ * of `size` bytes at least, which does not grow
+ *
+ * @param ctx the context
+ * @param dest the buffer
+ * @param size the size of the file
+ * @return true on success
+ * @return false on a memory allocation error
+ */
+extern bool qtc_context_file(QtcContext *ctx, FileBit *dest, size_t size);
+
+/****************************************************************/
+/****************************************************************/
+/***************   FUNCTIONS FOR PUSH DECODING   ****************/
+/****************************************************************/
+/****************************************************************/
+
+/**
+ * @brief Make a decoder of a .qtc file arriving in slices, Q1, Q2 or Q3
+ *
+ * @param dec the decoder
+ * @param ctx the context whose arenas hold the tree, lent to the decoder until it is freed, NULL to allocate it
+ * @return true on success
+ * @return false if an argument is wrong
+ */
+extern bool make_qtc_decoder(QtcDecoder *dec, QtcContext *ctx);
+
+/**
+ * @brief Free a decoder, its tree unless in the arenas of a context
+ *
+ * @param dec the decoder
+ * @return void
+ */
+extern void free_qtc_decoder(QtcDecoder *dec);
+
+/**
+ * @brief Give the next bytes of the file to a decoder, and read the nodes as far as they allow.
+ * The nodes of a Q1 file are read one by one, the bits of an unfinished node kept for the next slice;
+ * the streams of a Q2 or Q3 file are read once whole, the top one first. The bytes after the file are ignored.
+ *
+ * @param dec the decoder
+ * @param data the bytes, copied if needed: they can be written over after the call
+ * @param size the number of bytes, 0 to only ask for the levels
+ * @return int the number of complete levels, `dec->done` once the file is read; EOF if the bytes are not
+ * a .qtc file or on a memory allocation error, the decoder then fails until it is freed
+ */
+extern int qtc_decoder_push(QtcDecoder *dec, const unsigned char *data, size_t size);
+
+/**
+ * @brief The complete levels of a decoder as a quadtree of their own, for `pixmap_from_quadtree`:
+ * its nodes are those of the decoder, the last complete level its leaves, a thumbnail
+ * of the image until the file is read
+ *
+ * @param dec the decoder
+ * @param view the quadtree, not to be freed, valid until the decoder is freed
+ * @return true on success
+ * @return false if no level is complete yet
+ */
+extern bool qtc_decoder_view(const QtcDecoder *dec, QTree *view);
+
+/****************************************************************/
+/****************************************************************/
+/***************   FUNCTIONS FOR BAND STREAMING   ***************/
+/****************************************************************/
+/****************************************************************/
+
+/**
+ * @brief Write a chunked .qtc file (Q2 or Q3) from a P5 .pgm read by bands of 2^k lines.
+ * Each band is a row of chunks: every chunk is built, filtered and written on its own, then
+ * dropped, only the levels above the chunks stay in memory. With a filtering, the file is read
+ * twice: once for the variances, once to filter and write the chunks.
+ *
+ * @param pgm_name the name of the .pgm file, P5 and seekable with a filtering
+ * @param file_name the name of the .qtc file
+ * @param band_level `k`, the level of the chunks, lowered to the level of the image, raised to keep 4^8 chunks at most
+ * @param alpha the filtering rate, below 0.1 the tree is written unfiltered, as `-a`
+ * @param nb_threads the number of threads building each chunk
+ * @param format 2 or 3, the version of the file
+ * @return bool true if the file is written, false on an error
+ */
+extern bool create_qtc_file_streaming(const char *pgm_name, const char *file_name, unsigned char band_level,
+                                      double alpha, unsigned int nb_threads, unsigned char format);
+
+/**
+ * @brief Decode a Q2 or Q3 file by bands of lines, each one handed to `sink` then overwritten:
+ * only the levels above the chunks, a band and a chunk per thread are in memory.
+ * A band is 2^k lines, at least a line of chunks; the chunks of a band are read from the index.
+ *
+ * @param file_name the name of the .qtc file, seekable
+ * @param band_level `k`, the band is 2^k lines, rounded to lines of chunks
+ * @param nb_threads the number of threads decoding the chunks of a band
+ * @param sink the receiver of the bands
+ * @param user the first argument of `sink`
+ * @return true if the whole image was decoded, false on error or if `sink` stopped it
+ */
+extern bool decode_qtc_file_streaming(const char *file_name, unsigned char band_level, unsigned int nb_threads,
+                                      QtcBandSink sink, void *user);
+
 /****************************************************************/
 /****************************************************************/
 /************   FUNCTIONS FOR ARGUMENTS OPERATIONS   ************/
@@ -220,8 +747,19 @@ extern void option_print_help_verbose(void);
 
 #define AUTHORS "MUNAITPASOV M. & BENVENISTE A."
 
+/**
+ * @brief Read the header of a PGM file (P5 or P2), the file is left at the first pixel
+ *
+ * @param pix Pixmap whose magic number, size and grey level are set, `data` is not touched
+ * @param filename Filename of the image
+ * @return FILE* the file opened, positioned at the raster, NULL on error
+ */
+FILE *read_pgm_file(Pixmap *pix, const char *filename);
+
 /**
  * @brief Initialize a pixmap from a file (P5 PGM format)
+ * A regular file is mapped in memory and `data` points into the mapping, without copy;
+ * a pipe is read into an allocated buffer.
  *
  * @param pix Pixmap to initialize
  * @param filename Filename of the image
@@ -246,6 +784,58 @@ void free_pixmap(Pixmap *pix);
  */
 void from_pixmap_to_pgm(Pixmap *pix, const char *filename);
 
+/**
+ * @brief Write a band of lines to a .pgm file, after the header when it is the first one,
+ * as `from_pixmap_to_pgm` writes the whole image: a `QtcBandSink`
+ *
+ * @param stream the `PgmStream`
+ * @param lines the pixels of the band
+ * @param width the width of the image
+ * @param height the height of the image
+ * @param first_line the line of the image of the first line of the band
+ * @param nb_lines the number of lines of the band
+ * @return bool true if OK, false on a write or an allocation error
+ */
+bool write_pgm_band(void *stream, const unsigned char *lines, unsigned int width, unsigned int height,
+                    unsigned int first_line, unsigned int nb_lines);
+
+/**
+ * @brief Initialize a pixmap from a PGM file (P5 or P2) read in memory, without copy:
+ * the raster of a P5 file is used in place, a P2 one is parsed into `raster`.
+ * The pixmap is not to be freed, `raster` is kept by the caller from one image to the next.
+ *
+ * @param pix Pixmap to initialize
+ * @param buf the file
+ * @param len the size of `buf`
+ * @param raster P2: the buffer of the values, NULL at first, grown as needed
+ * @param raster_size the size of `raster`, updated
+ * @return bool true if OK, false on a format or an allocation error
+ */
+bool read_pgm_buffer(Pixmap *pix, unsigned char *buf, size_t len, unsigned char **raster, size_t *raster_size);
+
+/**
+ * @brief Size of a buffer large enough for `write_pgm_buffer`
+ *
+ * @param width the width of the image
+ * @param height the height of the image
+ * @param ascii P2 (ASCII) instead of P5
+ * @return size_t the size in bytes
+ */
+size_t pgm_buffer_size(unsigned int width, unsigned int height, bool ascii);
+
+/**
+ * @brief Write a whole .pgm file in memory, as `write_pgm_band` writes it to a file
+ *
+ * @param out the file, `pgm_buffer_size` bytes at least
+ * @param lines the pixels of the image
+ * @param width the width of the image
+ * @param height the height of the image
+ * @param ascii P2 (ASCII) instead of P5
+ * @return size_t the number of bytes written
+ */
+size_t write_pgm_buffer(unsigned char *out, const unsigned char *lines, unsigned int width, unsigned int height,
+                        bool ascii);
+
 /****************************************************************/
 /****************************************************************/
 /*************   FUNCTIONS FOR QUADTREE OPERATIONS   ************/
@@ -260,22 +850,51 @@ void from_pixmap_to_pgm(Pixmap *pix, const char *filename);
 */
 #define DETERMINE_QTREE_SIZE(level) ((1UL << (2UL * (level + 1UL))) / 3UL)
 
+/* index of the first node at `depth` from the root, the size of the tree above it */
+#define DETERMINE_LEVEL_OFFSET(depth) (((1UL << (2UL * (depth))) - 1UL) / 3UL)
+
 #define MAX_CHILD 4
 
+/* `max_level` reading all the levels of a file */
+#define QTC_ALL_LEVELS 0xFFU
+
+/* Q2/Q3 files: the subtrees below this depth, at most 4^3 = 64, are stored as independent chunks,
+ * of 2^8 x 2^8 pixels at least so that the adaptive models of Q3 have time to learn */
+#define QTC_CHUNK_MAX_DEPTH 3U
+#define QTC_CHUNK_MIN_LEVEL 8U
+#define QTC_CHUNK_DEPTH(level) ((unsigned char)(((level) <= QTC_CHUNK_MIN_LEVEL) ? (0U) : (((level) - QTC_CHUNK_MIN_LEVEL < QTC_CHUNK_MAX_DEPTH) ? ((level) - QTC_CHUNK_MIN_LEVEL) : (QTC_CHUNK_MAX_DEPTH))))
+
 /**
- * @brief Determine the level of the quadtree
+ * @brief Determine the level of the quadtree: the smallest square of 2^level pixels
+ * holding the image, whatever its width and height
  *
  * @param pix the pixmap
- * @return unsigned char the level of the quadtree
+ * @return unsigned char the level of the quadtree, `QTC_ALL_LEVELS` if the image is too large
  */
 extern unsigned char determine_qtree_level(Pixmap *pix);
 
 /**
- * @brief Make a quadtree with the given size, grey level and niveau
+ * @brief Make a quadtree with the given size, grey level and niveau,
+ * for a square image of 2^niveau pixels until `init_quadtree` sets its size.
+ * The planes are reserved for the whole square, but only the nodes of the image take memory.
  *
  * @param tree the quadtree
+ * @param grey_level the grey level of the image
+ * @param niveau the level of the quadtree
+ * @param with_variance true to allocate the variance plane, needed by `must_filter_qtree`
+ * @return size_t the number of nodes, 0 on error
  */
-extern size_t make_qtree(QTree *tree, unsigned char grey_level, unsigned char niveau);
+extern size_t make_qtree(QTree *tree, unsigned char grey_level, unsigned char niveau, bool with_variance);
+
+/**
+ * @brief Allocate the plane of the squared errors of a quadtree made by `make_qtree`,
+ * needed by `rd_filter_quadtree`: the build then measures, for each internal node,
+ * the sum of the squared differences between its pixels and its color.
+ *
+ * @param tree the quadtree
+ * @return size_t the number of internal nodes, 0 on error
+ */
+extern size_t make_qtree_sse(QTree *tree);
 
 /**
  * @brief Initialize the quadtree with the pixmap's data
@@ -286,6 +905,17 @@ extern size_t make_qtree(QTree *tree, unsigned char grey_level, unsigned char ni
  */
 extern void init_quadtree(QTree *tree, Pixmap *pix);
 
+/**
+ * @brief Initialize the quadtree with the pixmap's data, on several threads.
+ * Disjoint subtrees are built by the workers, the levels above them serially.
+ *
+ * @param tree the quadtree
+ * @param pix the pixmap
+ * @param nb_threads the number of threads, 1 builds on the calling thread only
+ * @return void
+ */
+extern void init_quadtree_parallel(QTree *tree, Pixmap *pix, unsigned int nb_threads);
+
 /**
  * @brief Free the quadtree
  *
@@ -295,14 +925,44 @@ extern void init_quadtree(QTree *tree, Pixmap *pix);
 extern void free_qtree(QTree *tree);
 
 /**
- * @brief Create a .qtc file from the quadtree
+ * @brief Create a .qtc file from the quadtree.
+ * The width and the height follow the comments of the header when the image is not a 2^n square.
  *
  * @param qtree the quadtree
- * @param width the width of the image
  * @param file_name the name of the file
- * @return void
+ * @return bool true if the file is written, false on an error
+ */
+extern bool create_qtc_file(QTree *qtree, const char *file_name);
+
+/**
+ * @brief Create a chunked .qtc file (Q2, or Q3 when range coded) from the quadtree, on several threads.
+ * The subtrees below `QTC_CHUNK_DEPTH` are byte aligned chunks, listed in an index of their sizes.
+ *
+ * @param qtree the quadtree
+ * @param file_name the name of the file
+ * @param nb_threads the number of threads, 1 encodes on the calling thread only
+ * @param format 2 for raw streams, 3 for range coded streams
+ * @return bool true if the file is written, false on an error
  */
-extern void create_qtc_file(QTree *qtree, unsigned short width, const char *file_name);
+extern bool create_qtc_file_chunked(QTree *qtree, const char *file_name,
+                                    unsigned int nb_threads, unsigned char format);
+
+/**
+ * @brief Write one .qtc file per alpha from a single build: the tree is filtered at every alpha
+ * in one pass, without changing it, and the files are written in parallel, each one from
+ * its own copy of `eu`. An alpha below 0.1 writes the tree unfiltered, as `-a`.
+ *
+ * @param qtree the quadtree, built with the variance and left unfiltered
+ * @param alphas the alpha of each file, in any order
+ * @param file_names the name of each file
+ * @param nb_files the number of files, below 255
+ * @param nb_threads the number of threads, shared by the files
+ * @param format 1, 2 or 3, the version of the files
+ * @return bool true if every file is written, false on an error
+ */
+extern bool create_qtc_files_sweep(QTree *qtree, const double *alphas,
+                                   char *const *file_names, unsigned int nb_files,
+                                   unsigned int nb_threads, unsigned char format);
 
 /**
  * @brief Initialize the quadtree from a file
@@ -313,6 +973,165 @@ extern void create_qtc_file(QTree *qtree, unsigned short width, const char *file
  */
 extern void init_quadtree_from_file(QTree *tree, const char *file_name);
 
+/**
+ * @brief Initialize the quadtree from a file, Q1, Q2 or Q3.
+ * The chunks of a Q2 or Q3 file are decoded on several threads.
+ *
+ * @param tree the quadtree
+ * @param file_name the name of the file
+ * @param nb_threads the number of threads, 1 decodes on the calling thread only
+ * @return void
+ */
+extern void init_quadtree_from_file_parallel(QTree *tree, const char *file_name, unsigned int nb_threads);
+
+/**
+ * @brief Initialize the nodes of the quadtree covering a region, from a file.
+ * Only the chunks of a Q2 or Q3 file crossing the region are read and decoded, the others are skipped
+ * in the file and left empty; a Q1 file has no index and is read whole.
+ *
+ * @param tree the quadtree
+ * @param file_name the name of the file
+ * @param nb_threads the number of threads, 1 decodes on the calling thread only
+ * @param roi the region, NULL for the whole image
+ * @return void
+ */
+extern void init_quadtree_from_file_roi(QTree *tree, const char *file_name, unsigned int nb_threads,
+                                        const QtcRoi *roi);
+
+/**
+ * @brief Initialize the first levels of the quadtree from a file, down to `max_level`.
+ * The tree is allocated for these levels only, and the file is not read further:
+ * `pixmap_from_quadtree` then makes a thumbnail of 2^max_level x 2^max_level pixels from the node means,
+ * cut to the image when it is not a square.
+ *
+ * @param tree the quadtree
+ * @param file_name the name of the file
+ * @param nb_threads the number of threads, 1 decodes on the calling thread only
+ * @param max_level the depth of the last level read, `QTC_ALL_LEVELS` for the whole tree
+ * @return void
+ */
+extern void init_quadtree_from_file_max_level(QTree *tree, const char *file_name, unsigned int nb_threads,
+                                              unsigned char max_level);
+
+/**
+ * @brief Decode a .qtc file straight into a pixmap: the tree is allocated down to the parents of the leaves,
+ * and the colors of the leaves, the 4th ones computed, are written in the pixels as they are read.
+ * The tree is freed before returning, use `init_quadtree_from_file` when it is needed (`-g`)
+ *
+ * @param pix the pixmap, of the size of the image
+ * @param file_name the name of the file
+ * @param nb_threads the number of threads decoding the chunks of a Q2 or Q3 file
+ * @return void
+ */
+extern void init_pixmap_from_file(Pixmap *pix, const char *file_name, unsigned int nb_threads);
+
+/**
+ * @brief Encode an image in memory into a .qtc file in memory. Reentrant: every state is on the stack
+ * of the call or allocated by it, so images can be encoded on several threads at once, without a file.
+ *
+ * @param raster the first pixel of the image, its lines `stride` bytes apart
+ * @param width the width of the image
+ * @param height the height of the image
+ * @param stride the bytes from a line to the next one, the width at least
+ * @param maxval the grey level of the pixels, from 1 to 255
+ * @param alpha the filtering rate, below 0.1 the tree is written unfiltered, as `-a`
+ * @param format 1, 2 or 3, the version of the file
+ * @param nb_threads the number of threads building and encoding the tree, 1 on the calling thread only
+ * @param out the file, `{NULL, 0, 0}` or the buffer of a previous call
+ * @return true on success
+ * @return false if an argument is wrong, the image too large, or on a memory allocation error
+ */
+extern bool qtc_encode_buffer(const unsigned char *raster, unsigned int width, unsigned int height, size_t stride,
+                              unsigned char maxval, double alpha, unsigned char format, unsigned int nb_threads,
+                              QtcBuffer *out);
+
+/**
+ * @brief Free the bytes of a buffer of `qtc_encode_buffer`, left empty
+ *
+ * @param buffer the buffer
+ * @return void
+ */
+extern void qtc_free_buffer(QtcBuffer *buffer);
+
+/**
+ * @brief Read the size of the image of a .qtc file in memory, from its header
+ *
+ * @param data the bytes of the file
+ * @param size the number of bytes
+ * @param width the width of the image
+ * @param height the height of the image
+ * @return true on success
+ * @return false if the bytes are not a .qtc file
+ */
+extern bool qtc_image_size(const unsigned char *data, size_t size, unsigned int *width, unsigned int *height);
+
+/**
+ * @brief Read the size of the image of a .qtc file, from its header alone
+ *
+ * @param file_name the .qtc file
+ * @param width the width of the image
+ * @param height the height of the image
+ * @return true on success
+ * @return false if the file can not be opened, or is not a .qtc file
+ */
+extern bool qtc_file_image_size(const char *file_name, unsigned int *width, unsigned int *height);
+
+/**
+ * @brief Decode a .qtc file in memory, Q1, Q2 or Q3, into the pixels of the caller, on a grey level of 255.
+ * Reentrant, and quiet: neither the comments nor the errors are printed.
+ *
+ * @param data the bytes of the file
+ * @param size the number of bytes
+ * @param raster the first pixel of the image, its lines `stride` bytes apart
+ * @param width the width of the image, as `qtc_image_size`
+ * @param height the height of the image, as `qtc_image_size`
+ * @param stride the bytes from a line to the next one, the width at least
+ * @param nb_threads the number of threads decoding the chunks of a Q2 or Q3 file
+ * @return true on success
+ * @return false if the bytes are not a .qtc file of this size, are truncated or corrupted, or on a memory allocation error
+ */
+extern bool qtc_decode_buffer(const unsigned char *data, size_t size, unsigned char *raster, unsigned int width,
+                              unsigned int height, size_t stride, unsigned int nb_threads);
+
+/**
+ * @brief Encode an image in memory as `qtc_encode_buffer`, into the arenas of a context:
+ * the tree is built in its planes, and the file written in `ctx->file`, valid until the next call
+ *
+ * @param ctx the context, of a level holding the image
+ * @param raster the first pixel of the image, its lines `stride` bytes apart
+ * @param width the width of the image
+ * @param height the height of the image
+ * @param stride the bytes from a line to the next one, the width at least
+ * @param maxval the grey level of the pixels, from 1 to 255
+ * @param alpha the filtering rate, below 0.1 the tree is written unfiltered, as `-a`
+ * @param format 1, 2 or 3, the version of the file
+ * @param nb_threads the number of threads building and encoding the tree, 1 on the calling thread only
+ * @return true on success, the file is `ctx->file_size` bytes of `ctx->file`
+ * @return false if an argument is wrong, the image too large for the context, or on a memory allocation error
+ */
+extern bool qtc_context_encode(QtcContext *ctx, const unsigned char *raster, unsigned int width, unsigned int height,
+                               size_t stride, unsigned char maxval, double alpha, unsigned char format,
+                               unsigned int nb_threads);
+
+/**
+ * @brief Decode a .qtc file in memory as `qtc_decode_buffer`, with the arenas of a context:
+ * the tree is read in its planes, and the streams of a Q2 or Q3 file where they are
+ *
+ * @param ctx the context, of a level holding the image
+ * @param data the bytes of the file
+ * @param size the number of bytes
+ * @param raster the first pixel of the image, its lines `stride` bytes apart
+ * @param width the width of the image, as `qtc_image_size`
+ * @param height the height of the image, as `qtc_image_size`
+ * @param stride the bytes from a line to the next one, the width at least
+ * @param nb_threads the number of threads decoding the chunks of a Q2 or Q3 file
+ * @return true on success
+ * @return false if the bytes are not a .qtc file of this size, are truncated or corrupted, if the image is too
+ * large for the context, or on a memory allocation error
+ */
+extern bool qtc_context_decode(QtcContext *ctx, const unsigned char *data, size_t size, unsigned char *raster,
+                               unsigned int width, unsigned int height, size_t stride, unsigned int nb_threads);
+
 /**
  * @brief Create a pixmap from the quadtree
  *
@@ -322,6 +1141,17 @@ extern void init_quadtree_from_file(QTree *tree, const char *file_name);
  */
 extern void pixmap_from_quadtree(QTree *qtree, Pixmap *pix);
 
+/**
+ * @brief Create a pixmap of a region of the image from the quadtree,
+ * only the nodes crossing the region are visited
+ *
+ * @param qtree the quadtree, with at least the nodes covering the region
+ * @param pix the pixmap, of the size of the region clipped to the image
+ * @param roi the region
+ * @return void
+ */
+extern void pixmap_from_quadtree_roi(QTree *qtree, Pixmap *pix, const QtcRoi *roi);
+
 /**
  * @brief Filtering the quadtree on the root
  *
@@ -341,4 +1171,37 @@ extern void filter_quadtree(QTree *qtree, double medvar, double maxvar, double a
  */
 extern void must_filter_qtree(QTree *qtree, double alpha, bool flag);
 
+/**
+ * @brief Search the smallest alpha whose .qtc file fits in `target_bytes`, without encoding it:
+ * the size of every stream is counted at each alpha of the grid 0.10, 0.11, ..., 2.00 in one pass over the tree.
+ * The tree is left unfiltered, `must_filter_qtree` applies the alpha found.
+ *
+ * @param qtree the quadtree, built with the variance
+ * @param target_bytes the budget, header included
+ * @param format `1` or `2`, the size of a range coded file is not known before coding it
+ * @return double the alpha, 0.0 if the file fits unfiltered, -1.0 if it never fits or on error
+ */
+extern double search_alpha_for_size(QTree *qtree, size_t target_bytes, unsigned char format);
+
+/**
+ * @brief Rate-distortion filtering: collapse the nodes minimizing D + lambda R, where D is the
+ * squared error of the image and R the bits of a Q1 file. The pruning is optimal for `lambda`,
+ * from the errors measured by the build and the bits each collapse saves.
+ *
+ * @param qtree the quadtree, built with `make_qtree_sse`
+ * @param lambda the price of a bit, in squared grey levels: 0 keeps the tree lossless
+ * @return double the PSNR of the filtered tree, in dB, `HUGE_VAL` if lossless
+ */
+extern double rd_filter_quadtree(QTree *qtree, double lambda);
+
+/**
+ * @brief Rate-distortion filtering down to a PSNR: the largest lambda whose pruning keeps
+ * the PSNR at or above `psnr` is searched, then applied by `rd_filter_quadtree`.
+ *
+ * @param qtree the quadtree, built with `make_qtree_sse`
+ * @param psnr the lowest PSNR accepted, in dB
+ * @return double the PSNR of the filtered tree, in dB, `HUGE_VAL` if lossless
+ */
+extern double rd_filter_quadtree_psnr(QTree *qtree, double psnr);
+
 #endif /* __QTC_H__ */
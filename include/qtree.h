@@ -13,6 +13,8 @@
 #define QTREE_H
 
 #include "pixmap.h"
+#include "rans.h"
+#include "context.h"
 
 /*
     formula for sum of 4^k, for k in [0, n-1], in this case `k` is `qtree->niveau`,
@@ -22,32 +24,47 @@
 */
 #define DETERMINE_QTREE_SIZE(level) ((1UL << (2UL * (level + 1UL))) / 3UL)
 
+/* index of the first node at `depth` from the root, the size of the tree above it */
+#define DETERMINE_LEVEL_OFFSET(depth) (((1UL << (2UL * (depth))) - 1UL) / 3UL)
+
 #define MAX_CHILD 4
 
+/* `max_level` reading all the levels of a file */
+#define QTC_ALL_LEVELS 0xFFU
+
+/* Q2/Q3 files: the subtrees below this depth, at most 4^3 = 64, are stored as independent chunks,
+ * of 2^8 x 2^8 pixels at least so that the adaptive models of Q3 have time to learn */
+#define QTC_CHUNK_MAX_DEPTH 3U
+#define QTC_CHUNK_MIN_LEVEL 8U
+#define QTC_CHUNK_DEPTH(level) ((unsigned char)(((level) <= QTC_CHUNK_MIN_LEVEL) ? (0U) : (((level) - QTC_CHUNK_MIN_LEVEL < QTC_CHUNK_MAX_DEPTH) ? ((level) - QTC_CHUNK_MIN_LEVEL) : (QTC_CHUNK_MAX_DEPTH))))
+
+/* `e` is stored on bits 0-1 of `eu`, `u` on bit 2 */
+#define QTREE_E(tree, i) ((unsigned char)((tree)->eu[i] & 0x3U))
+#define QTREE_U(tree, i) ((unsigned char)(((tree)->eu[i] >> 0x2U) & 0x1U))
+#define QTREE_EU(e, u) ((unsigned char)((e) | ((u) << 0x2U)))
+
 /**
- * `float variance;`
+ * Quadtree structure, one plane per field of the nodes
  *
- * `unsigned char color;`
+ * `unsigned char *color;`
  *
- * `unsigned char e;`
+ * `unsigned char *eu;`
  *
- * `unsigned char u;`
- * }
- */
-typedef struct node
-{
-    /*unsigned int e : 2;*/ /* 2 bits, value in [0, 3] */
-    /*unsigned int u : 1;*/ /* true if uniform, false otherwise */
-    float variance;         /* variance of the node */
-    unsigned char e;        /* without -ansi flag, 2 bytes of memory */
-    unsigned char u;        /* without -ansi flag, 2 bytes of memory */
-    unsigned char color;    /* 8 bits from 0 to 255 */
-} Node;
-
-/**
- * Quadtree structure with nodes, grey_level and niveau
+ * `float *variance;`
  *
- * `Node *nodes;`
+ * `double *sse;`
+ *
+ * `unsigned char *raster;`
+ *
+ * `unsigned char *edges;`
+ *
+ * `double variance_sum;`
+ *
+ * `float variance_max;`
+ *
+ * `unsigned int width;`
+ *
+ * `unsigned int height;`
  *
  * `int grey_level;`
  *
@@ -56,25 +73,74 @@ typedef struct node
  */
 typedef struct qtree
 {
-    Node *nodes;          /* nodes of the quadtree */
-    int grey_level;       /* 4 bytes */
-    unsigned char niveau; /* 8 bits from 0 to 255 */
+    unsigned char *color;  /* average color of each node, 8 bits from 0 to 255 */
+    unsigned char *eu;     /* `e` in [0, 3] and `u` (true if uniform) of each node, 3 bits */
+    float *variance;       /* variance of each node, NULL unless the tree is filtered */
+    double *sse;           /* squared error of each internal node if collapsed, NULL unless RD filtered */
+    unsigned char *raster; /* pixels of the leaves, read straight into them, NULL unless decoding to a pixmap */
+    unsigned char *edges;  /* nodes outside of an image which is not square, by depth, NULL until built */
+    double variance_sum;   /* sum of the variances, accumulated by the build for the filtering */
+    float variance_max;    /* maximum variance, accumulated by the build */
+    unsigned int width;    /* width of the image, the tree covers the 2^niveau square above it */
+    unsigned int height;   /* height of the image, the nodes outside are neither built nor written */
+    int grey_level;        /* 4 bytes */
+    unsigned char niveau;  /* 8 bits from 0 to 255 */
 } QTree;
 
 /**
- * @brief Determine the level of the quadtree
+ * Region of an image, in pixels: `w` x `h` pixels from column `x` and line `y`
+ */
+typedef struct qtc_roi
+{
+    unsigned int x; /* first column */
+    unsigned int y; /* first line */
+    unsigned int w; /* width */
+    unsigned int h; /* height */
+} QtcRoi;
+
+/**
+ * A .qtc file in memory, written by `qtc_encode_buffer`: `size` bytes of `data`, allocated with `malloc`
+ * and grown as needed, `capacity` of them. Given back to the next call, it is written over without
+ * being allocated again; `qtc_free_buffer` frees it.
+ */
+typedef struct qtc_buffer
+{
+    unsigned char *data; /* the bytes, NULL before the first call */
+    size_t size;         /* bytes of the file */
+    size_t capacity;     /* bytes allocated */
+} QtcBuffer;
+
+/**
+ * @brief Determine the level of the quadtree: the smallest square of 2^level pixels
+ * holding the image, whatever its width and height
  *
  * @param pix the pixmap
- * @return unsigned char the level of the quadtree
+ * @return unsigned char the level of the quadtree, `QTC_ALL_LEVELS` if the image is too large
  */
 extern unsigned char determine_qtree_level(Pixmap *pix);
 
 /**
- * @brief Make a quadtree with the given size, grey level and niveau
+ * @brief Make a quadtree with the given size, grey level and niveau,
+ * for a square image of 2^niveau pixels until `init_quadtree` sets its size.
+ * The planes are reserved for the whole square, but only the nodes of the image take memory.
  *
  * @param tree the quadtree
+ * @param grey_level the grey level of the image
+ * @param niveau the level of the quadtree
+ * @param with_variance true to allocate the variance plane, needed by `must_filter_qtree`
+ * @return size_t the number of nodes, 0 on error
  */
-extern size_t make_qtree(QTree *tree, unsigned char grey_level, unsigned char niveau);
+extern size_t make_qtree(QTree *tree, unsigned char grey_level, unsigned char niveau, bool with_variance);
+
+/**
+ * @brief Allocate the plane of the squared errors of a quadtree made by `make_qtree`,
+ * needed by `rd_filter_quadtree`: the build then measures, for each internal node,
+ * the sum of the squared differences between its pixels and its color.
+ *
+ * @param tree the quadtree
+ * @return size_t the number of internal nodes, 0 on error
+ */
+extern size_t make_qtree_sse(QTree *tree);
 
 /**
  * @brief Initialize the quadtree with the pixmap's data
@@ -85,6 +151,17 @@ extern size_t make_qtree(QTree *tree, unsigned char grey_level, unsigned char ni
  */
 extern void init_quadtree(QTree *tree, Pixmap *pix);
 
+/**
+ * @brief Initialize the quadtree with the pixmap's data, on several threads.
+ * Disjoint subtrees are built by the workers, the levels above them serially.
+ *
+ * @param tree the quadtree
+ * @param pix the pixmap
+ * @param nb_threads the number of threads, 1 builds on the calling thread only
+ * @return void
+ */
+extern void init_quadtree_parallel(QTree *tree, Pixmap *pix, unsigned int nb_threads);
+
 /**
  * @brief Free the quadtree
  *
@@ -94,14 +171,44 @@ extern void init_quadtree(QTree *tree, Pixmap *pix);
 extern void free_qtree(QTree *tree);
 
 /**
- * @brief Create a .qtc file from the quadtree
+ * @brief Create a .qtc file from the quadtree.
+ * The width and the height follow the comments of the header when the image is not a 2^n square.
  *
  * @param qtree the quadtree
- * @param width the width of the image
  * @param file_name the name of the file
- * @return void
+ * @return bool true if the file is written, false on an error
+ */
+extern bool create_qtc_file(QTree *qtree, const char *file_name);
+
+/**
+ * @brief Create a chunked .qtc file (Q2, or Q3 when range coded) from the quadtree, on several threads.
+ * The subtrees below `QTC_CHUNK_DEPTH` are byte aligned chunks, listed in an index of their sizes.
+ *
+ * @param qtree the quadtree
+ * @param file_name the name of the file
+ * @param nb_threads the number of threads, 1 encodes on the calling thread only
+ * @param format 2 for raw streams, 3 for range coded streams
+ * @return bool true if the file is written, false on an error
+ */
+extern bool create_qtc_file_chunked(QTree *qtree, const char *file_name,
+                                    unsigned int nb_threads, unsigned char format);
+
+/**
+ * @brief Write one .qtc file per alpha from a single build: the tree is filtered at every alpha
+ * in one pass, without changing it, and the files are written in parallel, each one from
+ * its own copy of `eu`. An alpha below 0.1 writes the tree unfiltered, as `-a`.
+ *
+ * @param qtree the quadtree, built with the variance and left unfiltered
+ * @param alphas the alpha of each file, in any order
+ * @param file_names the name of each file
+ * @param nb_files the number of files, below 255
+ * @param nb_threads the number of threads, shared by the files
+ * @param format 1, 2 or 3, the version of the files
+ * @return bool true if every file is written, false on an error
  */
-extern void create_qtc_file(QTree *qtree, unsigned short width, const char *file_name);
+extern bool create_qtc_files_sweep(QTree *qtree, const double *alphas,
+                                   char *const *file_names, unsigned int nb_files,
+                                   unsigned int nb_threads, unsigned char format);
 
 /**
  * @brief Initialize the quadtree from a file
@@ -112,6 +219,165 @@ extern void create_qtc_file(QTree *qtree, unsigned short width, const char *file
  */
 extern void init_quadtree_from_file(QTree *tree, const char *file_name);
 
+/**
+ * @brief Initialize the quadtree from a file, Q1, Q2 or Q3.
+ * The chunks of a Q2 or Q3 file are decoded on several threads.
+ *
+ * @param tree the quadtree
+ * @param file_name the name of the file
+ * @param nb_threads the number of threads, 1 decodes on the calling thread only
+ * @return void
+ */
+extern void init_quadtree_from_file_parallel(QTree *tree, const char *file_name, unsigned int nb_threads);
+
+/**
+ * @brief Initialize the nodes of the quadtree covering a region, from a file.
+ * Only the chunks of a Q2 or Q3 file crossing the region are read and decoded, the others are skipped
+ * in the file and left empty; a Q1 file has no index and is read whole.
+ *
+ * @param tree the quadtree
+ * @param file_name the name of the file
+ * @param nb_threads the number of threads, 1 decodes on the calling thread only
+ * @param roi the region, NULL for the whole image
+ * @return void
+ */
+extern void init_quadtree_from_file_roi(QTree *tree, const char *file_name, unsigned int nb_threads,
+                                        const QtcRoi *roi);
+
+/**
+ * @brief Initialize the first levels of the quadtree from a file, down to `max_level`.
+ * The tree is allocated for these levels only, and the file is not read further:
+ * `pixmap_from_quadtree` then makes a thumbnail of 2^max_level x 2^max_level pixels from the node means,
+ * cut to the image when it is not a square.
+ *
+ * @param tree the quadtree
+ * @param file_name the name of the file
+ * @param nb_threads the number of threads, 1 decodes on the calling thread only
+ * @param max_level the depth of the last level read, `QTC_ALL_LEVELS` for the whole tree
+ * @return void
+ */
+extern void init_quadtree_from_file_max_level(QTree *tree, const char *file_name, unsigned int nb_threads,
+                                              unsigned char max_level);
+
+/**
+ * @brief Decode a .qtc file straight into a pixmap: the tree is allocated down to the parents of the leaves,
+ * and the colors of the leaves, the 4th ones computed, are written in the pixels as they are read.
+ * The tree is freed before returning, use `init_quadtree_from_file` when it is needed (`-g`)
+ *
+ * @param pix the pixmap, of the size of the image
+ * @param file_name the name of the file
+ * @param nb_threads the number of threads decoding the chunks of a Q2 or Q3 file
+ * @return void
+ */
+extern void init_pixmap_from_file(Pixmap *pix, const char *file_name, unsigned int nb_threads);
+
+/**
+ * @brief Encode an image in memory into a .qtc file in memory. Reentrant: every state is on the stack
+ * of the call or allocated by it, so images can be encoded on several threads at once, without a file.
+ *
+ * @param raster the first pixel of the image, its lines `stride` bytes apart
+ * @param width the width of the image
+ * @param height the height of the image
+ * @param stride the bytes from a line to the next one, the width at least
+ * @param maxval the grey level of the pixels, from 1 to 255
+ * @param alpha the filtering rate, below 0.1 the tree is written unfiltered, as `-a`
+ * @param format 1, 2 or 3, the version of the file
+ * @param nb_threads the number of threads building and encoding the tree, 1 on the calling thread only
+ * @param out the file, `{NULL, 0, 0}` or the buffer of a previous call
+ * @return true on success
+ * @return false if an argument is wrong, the image too large, or on a memory allocation error
+ */
+extern bool qtc_encode_buffer(const unsigned char *raster, unsigned int width, unsigned int height, size_t stride,
+                              unsigned char maxval, double alpha, unsigned char format, unsigned int nb_threads,
+                              QtcBuffer *out);
+
+/**
+ * @brief Free the bytes of a buffer of `qtc_encode_buffer`, left empty
+ *
+ * @param buffer the buffer
+ * @return void
+ */
+extern void qtc_free_buffer(QtcBuffer *buffer);
+
+/**
+ * @brief Read the size of the image of a .qtc file in memory, from its header
+ *
+ * @param data the bytes of the file
+ * @param size the number of bytes
+ * @param width the width of the image
+ * @param height the height of the image
+ * @return true on success
+ * @return false if the bytes are not a .qtc file
+ */
+extern bool qtc_image_size(const unsigned char *data, size_t size, unsigned int *width, unsigned int *height);
+
+/**
+ * @brief Read the size of the image of a .qtc file, from its header alone
+ *
+ * @param file_name the .qtc file
+ * @param width the width of the image
+ * @param height the height of the image
+ * @return true on success
+ * @return false if the file can not be opened, or is not a .qtc file
+ */
+extern bool qtc_file_image_size(const char *file_name, unsigned int *width, unsigned int *height);
+
+/**
+ * @brief Decode a .qtc file in memory, Q1, Q2 or Q3, into the pixels of the caller, on a grey level of 255.
+ * Reentrant, and quiet: neither the comments nor the errors are printed.
+ *
+ * @param data the bytes of the file
+ * @param size the number of bytes
+ * @param raster the first pixel of the image, its lines `stride` bytes apart
+ * @param width the width of the image, as `qtc_image_size`
+ * @param height the height of the image, as `qtc_image_size`
+ * @param stride the bytes from a line to the next one, the width at least
+ * @param nb_threads the number of threads decoding the chunks of a Q2 or Q3 file
+ * @return true on success
+ * @return false if the bytes are not a .qtc file of this size, are truncated or corrupted, or on a memory allocation error
+ */
+extern bool qtc_decode_buffer(const unsigned char *data, size_t size, unsigned char *raster, unsigned int width,
+                              unsigned int height, size_t stride, unsigned int nb_threads);
+
+/**
+ * @brief Encode an image in memory as `qtc_encode_buffer`, into the arenas of a context:
+ * the tree is built in its planes, and the file written in `ctx->file`, valid until the next call
+ *
+ * @param ctx the context, of a level holding the image
+ * @param raster the first pixel of the image, its lines `stride` bytes apart
+ * @param width the width of the image
+ * @param height the height of the image
+ * @param stride the bytes from a line to the next one, the width at least
+ * @param maxval the grey level of the pixels, from 1 to 255
+ * @param alpha the filtering rate, below 0.1 the tree is written unfiltered, as `-a`
+ * @param format 1, 2 or 3, the version of the file
+ * @param nb_threads the number of threads building and encoding the tree, 1 on the calling thread only
+ * @return true on success, the file is `ctx->file_size` bytes of `ctx->file`
+ * @return false if an argument is wrong, the image too large for the context, or on a memory allocation error
+ */
+extern bool qtc_context_encode(QtcContext *ctx, const unsigned char *raster, unsigned int width, unsigned int height,
+                               size_t stride, unsigned char maxval, double alpha, unsigned char format,
+                               unsigned int nb_threads);
+
+/**
+ * @brief Decode a .qtc file in memory as `qtc_decode_buffer`, with the arenas of a context:
+ * the tree is read in its planes, and the streams of a Q2 or Q3 file where they are
+ *
+ * @param ctx the context, of a level holding the image
+ * @param data the bytes of the file
+ * @param size the number of bytes
+ * @param raster the first pixel of the image, its lines `stride` bytes apart
+ * @param width the width of the image, as `qtc_image_size`
+ * @param height the height of the image, as `qtc_image_size`
+ * @param stride the bytes from a line to the next one, the width at least
+ * @param nb_threads the number of threads decoding the chunks of a Q2 or Q3 file
+ * @return true on success
+ * @return false if the bytes are not a .qtc file of this size, are truncated or corrupted, if the image is too
+ * large for the context, or on a memory allocation error
+ */
+extern bool qtc_context_decode(QtcContext *ctx, const unsigned char *data, size_t size, unsigned char *raster,
+                               unsigned int width, unsigned int height, size_t stride, unsigned int nb_threads);
+
 /**
  * @brief Create a pixmap from the quadtree
  *
@@ -121,6 +387,17 @@ extern void init_quadtree_from_file(QTree *tree, const char *file_name);
  */
 extern void pixmap_from_quadtree(QTree *qtree, Pixmap *pix);
 
+/**
+ * @brief Create a pixmap of a region of the image from the quadtree,
+ * only the nodes crossing the region are visited
+ *
+ * @param qtree the quadtree, with at least the nodes covering the region
+ * @param pix the pixmap, of the size of the region clipped to the image
+ * @param roi the region
+ * @return void
+ */
+extern void pixmap_from_quadtree_roi(QTree *qtree, Pixmap *pix, const QtcRoi *roi);
+
 /**
  * @brief Filtering the quadtree on the root
  *
@@ -140,4 +417,37 @@ extern void filter_quadtree(QTree *qtree, double medvar, double maxvar, double a
  */
 extern void must_filter_qtree(QTree *qtree, double alpha, bool flag);
 
+/**
+ * @brief Search the smallest alpha whose .qtc file fits in `target_bytes`, without encoding it:
+ * the size of every stream is counted at each alpha of the grid 0.10, 0.11, ..., 2.00 in one pass over the tree.
+ * The tree is left unfiltered, `must_filter_qtree` applies the alpha found.
+ *
+ * @param qtree the quadtree, built with the variance
+ * @param target_bytes the budget, header included
+ * @param format `1` or `2`, the size of a range coded file is not known before coding it
+ * @return double the alpha, 0.0 if the file fits unfiltered, -1.0 if it never fits or on error
+ */
+extern double search_alpha_for_size(QTree *qtree, size_t target_bytes, unsigned char format);
+
+/**
+ * @brief Rate-distortion filtering: collapse the nodes minimizing D + lambda R, where D is the
+ * squared error of the image and R the bits of a Q1 file. The pruning is optimal for `lambda`,
+ * from the errors measured by the build and the bits each collapse saves.
+ *
+ * @param qtree the quadtree, built with `make_qtree_sse`
+ * @param lambda the price of a bit, in squared grey levels: 0 keeps the tree lossless
+ * @return double the PSNR of the filtered tree, in dB, `HUGE_VAL` if lossless
+ */
+extern double rd_filter_quadtree(QTree *qtree, double lambda);
+
+/**
+ * @brief Rate-distortion filtering down to a PSNR: the largest lambda whose pruning keeps
+ * the PSNR at or above `psnr` is searched, then applied by `rd_filter_quadtree`.
+ *
+ * @param qtree the quadtree, built with `make_qtree_sse`
+ * @param psnr the lowest PSNR accepted, in dB
+ * @return double the PSNR of the filtered tree, in dB, `HUGE_VAL` if lossless
+ */
+extern double rd_filter_quadtree_psnr(QTree *qtree, double psnr);
+
 #endif
@@ -0,0 +1,132 @@
+/**
+ * @file include/rans.h
+ * @authors MUNAITPASOV M. & BENVENISTE A.
+ * @brief Range coding with adaptive models (rANS) on top of a FileBit
+ * @version 0.1
+ * @date 2025-01-09
+ *
+ * @copyright licence MIT Copyright (c) 2025
+ *
+ */
+
+#ifndef RANS_H
+#define RANS_H
+
+#include "bits_operations.h"
+
+#define RANS_SCALE_BITS 12U                  /* frequencies of a model sum to 2^12 */
+#define RANS_SCALE (1U << RANS_SCALE_BITS)
+#define RANS_LOW (1UL << 16U)                /* the state stays in [2^16, 2^32), renormalized by 16 bits */
+#define RANS_MAX_SYMBOLS 256U
+#define RANS_REFRESH_FIRST 16U               /* symbols before the first refresh of a model */
+#define RANS_REFRESH_LAST 4096U              /* the interval doubles up to this one */
+#define RANS_MAX_COUNT (1UL << 16U)          /* counts are halved above this total */
+
+/**
+ * Adaptive model of an alphabet of `nb_symbols` symbols.
+ * Frequencies are rebuilt from the counts every `interval` symbols,
+ * in the same way by the encoder and the decoder.
+ *
+ * The arrays belong to the caller: `count` and `freq` of `nb_symbols` entries,
+ * `cum` of `nb_symbols + 1` entries, `lookup` of the smallest power of two at least `nb_symbols` entries, or NULL.
+ */
+typedef struct rans_model
+{
+    uint32_t *count;         /* occurrences of each symbol, plus one */
+    uint16_t *freq;          /* frequency of each symbol, at least 1 */
+    uint16_t *cum;           /* cumulative frequencies */
+    uint32_t *lookup;        /* decoding: the symbol of the first slot of each group of slots, on bits 0-7,
+                                its frequency - 1 on 8-19 and its cumulative frequency on 20-31,
+                                NULL for a linear search among `cum` */
+    uint32_t total;          /* sum of `count`, at the last refresh */
+    unsigned int nb_symbols; /* size of the alphabet, at most `RANS_MAX_SYMBOLS` */
+    unsigned int left;       /* symbols before the next refresh */
+    unsigned int interval;   /* symbols between two refreshes */
+    unsigned int shift;      /* a group of slots of `lookup` is 2^shift slots */
+} RansModel;
+
+/**
+ * Encoder of a stream: symbols are queued, then coded backwards by `rans_encoder_flush`,
+ * into the end of the queue itself
+ */
+typedef struct rans_encoder
+{
+    FileBit *bits;     /* byte aligned stream */
+    uint32_t *queue;   /* `(cum << 16) | freq` of each symbol, in coding order */
+    size_t len;        /* number of symbols queued */
+    size_t cap;        /* capacity of `queue` */
+    bool owned;        /* true if `queue` was allocated by the encoder, false if it is lent by the caller */
+    bool error;        /* true if `queue` could not grow */
+} RansEncoder;
+
+/**
+ * Decoder of a stream in memory
+ */
+typedef struct rans_decoder
+{
+    const unsigned char *ptr; /* next bytes to read */
+    const unsigned char *end; /* end of the stream */
+    uint32_t x;               /* state */
+} RansDecoder;
+
+/**
+ * @brief Set up a model, all the symbols equally likely
+ *
+ * @param m the model
+ * @param nb_symbols the size of the alphabet
+ * @param count the counts, `nb_symbols` entries
+ * @param freq the frequencies, `nb_symbols` entries
+ * @param cum the cumulative frequencies, `nb_symbols + 1` entries
+ * @param lookup the decoding table, the smallest power of two at least `nb_symbols` entries, NULL to search `cum`
+ */
+extern void rans_model_init(RansModel *m, unsigned int nb_symbols,
+                            uint32_t *count, uint16_t *freq, uint16_t *cum, uint32_t *lookup);
+
+/**
+ * @brief Start encoding into `bits`, which must be byte aligned.
+ * The queue is lent by the caller: a stream of `cap - 1` symbols at most never allocates,
+ * a longer one moves to a queue of its own.
+ *
+ * @param enc the encoder
+ * @param bits the stream
+ * @param queue the queue, `cap` entries, NULL to allocate it
+ * @param cap the capacity of `queue`
+ */
+extern void rans_encoder_init(RansEncoder *enc, FileBit *bits, uint32_t *queue, size_t cap);
+
+/**
+ * @brief Queue symbol `s` with the model, then adapt the model
+ *
+ * @param enc the encoder
+ * @param m the model
+ * @param s the symbol
+ */
+extern void rans_encode(RansEncoder *enc, RansModel *m, unsigned int s);
+
+/**
+ * @brief Code the queued symbols and write them, the stream stays byte aligned.
+ * The encoder is released, a lent queue is left to the caller.
+ *
+ * @param enc the encoder
+ * @return int 1 if OK, EOF otherwise
+ */
+extern int rans_encoder_flush(RansEncoder *enc);
+
+/**
+ * @brief Start decoding from `bits`, a byte aligned stream in memory (`fBitinitMem`)
+ *
+ * @param dec the decoder
+ * @param bits the stream
+ */
+extern void rans_decoder_init(RansDecoder *dec, FileBit *bits);
+
+/**
+ * @brief Decode a symbol with the model, then adapt the model
+ *
+ * @param dec the decoder
+ * @param m the model, as it was when the symbol was encoded
+ * @return unsigned int the symbol
+ */
+extern unsigned int rans_decode(RansDecoder *dec, RansModel *m);
+
+#endif
@@ -0,0 +1,4 @@
+#include <stdio.h>
+extern unsigned long nsym[2], nmiss[2];
+int bench_main(int,char**);
+int main(int c,char**v){int r=bench_main(c,v); printf("eu %lu miss %lu color %lu miss %lu\n",nsym[0],nmiss[0],nsym[1],nmiss[1]); return r;}
@@ -0,0 +1,567 @@
+/**
+ * @file src/band.c
+ * @authors MUNAITPASOV M. & BENVENISTE A.
+ * @brief Band streaming implementation
+ * @version 0.1
+ * @date 2025-01-09
+ *
+ * @copyright licence MIT Copyright (c) 2025
+ */
+
+#include "band.h"
+#include "codec.h"
+
+/* deepest chunks of a streaming encode: at most 4^8 chunks, their index and the top levels stay small */
+#define QTC_STREAM_MAX_DEPTH 8U
+
+/**
+ * State of a streaming encode: the image is read by bands, each one a line of chunks
+ */
+typedef struct stream_job
+{
+    QTree top;               /* levels 0 to `depth` of the tree of the image */
+    QTree chunk;             /* the chunk being built, the subtree of a node of `depth` */
+    Pixmap pix;              /* the pixels of the chunk */
+    FILE *raster;            /* the .pgm file, at the first line of the next band */
+    unsigned char *band;     /* the lines of the band */
+    FILE *spill;             /* the streams of the chunks, in the order of the bands */
+    size_t *offsets;         /* position of each chunk in `spill`, in z-order */
+    size_t *sizes;           /* size of each chunk, in bytes */
+    size_t spilled;          /* size of `spill` */
+    size_t built;            /* internal nodes whose variance is in the statistics */
+    FileBit outside;         /* the stream of a chunk outside of the image */
+    unsigned int nb_threads; /* threads building each chunk */
+    unsigned char depth;     /* depth of the roots of the chunks */
+    bool entropy;            /* Q3: the streams are range coded */
+} StreamJob;
+
+/**
+ * A band of a streaming decode: the streams of its chunks, and its pixels
+ */
+typedef struct band_job
+{
+    const QTree *top;             /* levels 0 to `depth` of the tree of the image */
+    const unsigned char *payload; /* the streams of the chunks of the band, back to back */
+    const size_t *offsets;        /* start of each chunk of the band in `payload`, and the end of the last one */
+    unsigned char *lines;         /* the pixels of the band, the width of the image */
+    size_t first_row;             /* the first line of chunks of the band */
+    size_t nb_cols;               /* chunks of a line of chunks, in the image */
+    unsigned char depth;          /* depth of the roots of the chunks */
+    bool entropy;                 /* Q3: the streams are range coded */
+} BandJob;
+
+/**
+ * Range of chunks of a band decoded by one worker, line by line
+ */
+typedef struct band_task
+{
+    const BandJob *job; /* shared state */
+    QTree chunk;        /* the chunk being decoded, as a tree of its own */
+    size_t first;       /* first chunk, index in the band */
+    size_t last;        /* one past the last chunk */
+    bool done;          /* false if a stream is truncated */
+    FileBit bits;       /* the stream of the chunk */
+} BandTask;
+
+static bool stream_chunks(StreamJob *job, VarianceStats *stats, double sigma, double alpha, bool write);
+
+static void filter_top_levels(QTree *top, unsigned char depth, const double *thresholds);
+
+static void *decode_band_chunks(void *arg);
+
+/**
+ * @brief One pass over the bands of the image: each chunk is built from its lines, its root is
+ * stored in the top tree at `job->depth`, and with `write` the chunk is filtered and written to
+ * the spill file. A chunk outside of the image takes the color of its neighbour on the left,
+ * or above it, and its stream is `job->outside`.
+ *
+ * @param job the streaming encode
+ * @param stats the variances of the nodes of the chunks are added to it
+ * @param sigma the threshold of the filtering at the roots of the chunks, negative to not filter
+ * @param alpha the filtering rate
+ * @param write false for the first pass of a filtering, which only gathers the variances
+ * @return true if OK, false on a read, a write or an allocation error
+ */
+static bool stream_chunks(StreamJob *job, VarianceStats *stats, double sigma, double alpha, bool write)
+{
+    QTree *top = &job->top, *chunk = &job->chunk;
+    FileBit bits = {0};
+    const unsigned char *stream = NULL;
+    size_t side = 1UL << chunk->niveau, per_line = 1UL << job->depth, first = DETERMINE_LEVEL_OFFSET((size_t)job->depth);
+    size_t width = top->width, height = top->height;
+    size_t band = 0UL, col = 0UL, line = 0UL, lines = 0UL, cols = 0UL, z = 0UL, node = 0UL, size = 0UL;
+    bool done = true;
+
+    for (band = 0UL; done && band < per_line; ++band)
+    {
+        lines = (band * side >= height) ? (0UL) : ((height - band * side < side) ? (height - band * side) : (side));
+        if (lines && fread(job->band, sizeof(*job->band), lines * width, job->raster) != lines * width)
+        {
+            fprintf(stderr, "Error: truncated .pgm file in create_qtc_file_streaming()!\n");
+            return false;
+        }
+        for (col = 0UL; done && col < per_line; ++col)
+        {
+            z = zorder_index(band, col);
+            node = first + z;
+            cols = (!lines || col * side >= width) ? (0UL) : ((width - col * side < side) ? (width - col * side) : (side));
+            if (cols)
+            {
+                job->pix.width = (unsigned int)cols;
+                job->pix.height = (unsigned int)lines;
+                for (line = 0UL; line < lines; ++line)
+                {
+                    (void)memcpy(job->pix.data + line * cols, job->band + line * width + col * side, cols);
+                }
+                init_quadtree_parallel(chunk, &job->pix, job->nb_threads);
+                job->built += DETERMINE_LEVEL_OFFSET((size_t)chunk->niveau);
+                stats->sum += chunk->variance_sum;
+                stats->max = (chunk->variance_max > stats->max) ? (chunk->variance_max) : (stats->max);
+                if (sigma >= 0.0)
+                {
+                    (void)filtrage(chunk, 0UL, chunk->niveau, sigma, alpha);
+                }
+                top->color[node] = chunk->color[0];
+                top->eu[node] = chunk->eu[0];
+                if (top->variance)
+                {
+                    top->variance[node] = chunk->variance[0];
+                }
+            }
+            else
+            {
+                top->color[node] = top->color[first + ((lines) ? (zorder_index(band, col - 1UL))
+                                                                : (zorder_index(band - 1UL, col)))];
+                top->eu[node] = QTREE_EU(0U, 1U);
+                if (top->variance)
+                {
+                    top->variance[node] = 0.0F;
+                }
+            }
+            if (!write)
+            {
+                continue;
+            }
+
+            fBitinit(&bits, NULL);
+            if (cols)
+            {
+                done = (EOF != qtc_write_stream(chunk, &bits, job->entropy, NULL, 0U, 0UL));
+            }
+            stream = (cols) ? (bits.mem) : (job->outside.mem);
+            size = (cols) ? (bits.memlen) : (job->outside.memlen);
+            done = done && (!size || fwrite(stream, sizeof(*stream), size, job->spill) == size);
+            job->offsets[z] = job->spilled;
+            job->sizes[z] = size;
+            job->spilled += size;
+            (void)fBitclose(&bits);
+        }
+    }
+    if (!done)
+    {
+        fprintf(stderr, "Error: can't write the chunks in create_qtc_file_streaming()!\n");
+    }
+    return done;
+}
+
+/**
+ * @brief Filter the levels above the chunks, bottom-up, as `filtrage` does: a node is uniformized
+ * if its 4 children are uniform and its variance does not exceed the threshold of its depth
+ *
+ * @param top the levels 0 to `depth` of the tree, the chunks at `depth` already filtered
+ * @param depth the depth of the roots of the chunks
+ * @param thresholds the threshold of each depth
+ * @return void
+ */
+static void filter_top_levels(QTree *top, unsigned char depth, const double *thresholds)
+{
+    size_t i = 0UL, child_index = 0UL;
+    unsigned char level = depth;
+
+    while (level--)
+    {
+        for (i = DETERMINE_LEVEL_OFFSET((size_t)level); i < DETERMINE_LEVEL_OFFSET((size_t)level + 1UL); ++i)
+        {
+            child_index = i * MAX_CHILD + 1UL;
+            if (!QTREE_U(top, i) && QTREE_U(top, child_index) && QTREE_U(top, child_index + 1UL) &&
+                QTREE_U(top, child_index + 2UL) && QTREE_U(top, child_index + 3UL) && !(top->variance[i] > thresholds[level]))
+            {
+                top->eu[i] = QTREE_EU(0U, 1U);
+            }
+        }
+    }
+}
+
+extern bool create_qtc_file_streaming(const char *pgm_name, const char *file_name, unsigned char band_level,
+                                      double alpha, unsigned int nb_threads, unsigned char format)
+{
+    StreamJob job;
+    BuildJob levels;
+    VarianceStats stats = {0.0, 0.0F};
+    FileBit top = {0}, out = {0};
+    FILE *fptr = NULL;
+    Pixmap pix;
+    unsigned char *copy = NULL;
+    double thresholds[QTC_LEVELS];
+    size_t nb_chunks = 0UL, chunk = 0UL, encoded_size = 0UL, size = 0UL, n = 0UL;
+    long start = 0L;
+    unsigned char niveau = 0U, level = 0U;
+    bool filter = (alpha >= 0.1), done = true;
+
+    (void)memset(&job, 0, sizeof(job));
+    if (!pgm_name || !file_name || !(job.raster = read_pgm_file(&pix, pgm_name)))
+    {
+        fprintf(stderr, "Error: can't read the .pgm file in create_qtc_file_streaming()!\n");
+        return false;
+    }
+    if ('5' != pix.magic_number[1] || !pix.width || !pix.height ||
+        QTC_ALL_LEVELS == (niveau = determine_qtree_level(&pix)) ||
+        (filter && (start = ftell(job.raster)) < 0L))
+    {
+        fprintf(stderr, "Error: a streamed .pgm file must be P5, not empty, and seekable to be filtered!\n");
+        fclose(job.raster);
+        return false;
+    }
+
+    /* the chunks are 2^k x 2^k, a band of the image is a line of chunks */
+    level = (band_level < niveau) ? (band_level) : (niveau);
+    level = (niveau > level + QTC_STREAM_MAX_DEPTH) ? ((unsigned char)(niveau - QTC_STREAM_MAX_DEPTH)) : (level);
+    job.depth = (unsigned char)(niveau - level);
+    job.entropy = (3U == format);
+    job.nb_threads = nb_threads;
+    nb_chunks = 1UL << (2UL * job.depth);
+    job.pix = pix;
+    job.pix.map = NULL;
+    job.pix.data = malloc((1UL << (2UL * level)) * sizeof(*job.pix.data));
+    job.band = malloc((1UL << level) * pix.width * sizeof(*job.band));
+    job.offsets = malloc(nb_chunks * sizeof(*job.offsets));
+    job.sizes = malloc(nb_chunks * sizeof(*job.sizes));
+    copy = malloc(FILEBIT_BLOCK_SIZE * sizeof(*copy));
+    job.spill = tmpfile();
+    if (!make_qtree(&job.top, QTC_GREY_LEVEL, job.depth, filter) ||
+        !make_qtree(&job.chunk, pix.grey_level, level, filter) ||
+        !job.pix.data || !job.band || !job.offsets || !job.sizes || !copy || !job.spill)
+    {
+        fprintf(stderr, "Error: memory allocation error in create_qtc_file_streaming()!\n");
+        done = false;
+    }
+
+    /* the top tree holds the levels 0 to `depth` of the tree of the whole image */
+    job.top.niveau = niveau;
+    job.top.width = pix.width;
+    job.top.height = pix.height;
+    levels.qtree = &job.top;
+    levels.pixels = NULL;
+    levels.normalize = false;
+    levels.depth = 0U;
+    levels.sums = NULL;
+
+    /* the stream of a chunk outside of the image: none of its nodes is written */
+    if (done)
+    {
+        job.chunk.width = job.chunk.height = 0U;
+        fBitinit(&job.outside, NULL);
+        done = (EOF != qtc_write_stream(&job.chunk, &job.outside, job.entropy, NULL, 0U, 0UL));
+    }
+
+    /* filtering: a first pass for the average and the maximum of the variances, the average
+     * over the nodes built, the chunks outside of a rectangular image are not */
+    if (done && filter)
+    {
+        done = stream_chunks(&job, &stats, -1.0, alpha, false);
+        fill_quadtree_levels(&levels, &stats, 0UL, 0, (int)job.depth - 1);
+        job.built += DETERMINE_LEVEL_OFFSET((size_t)job.depth);
+        job.top.variance_sum = stats.sum;
+        job.top.variance_max = stats.max;
+        thresholds[0] = ((job.built) ? (stats.sum / (double)job.built) : (0.0)) / (double)stats.max;
+        for (level = 1U; level <= job.depth; ++level)
+        {
+            thresholds[level] = thresholds[level - 1U] * alpha;
+        }
+        done = done && !fseek(job.raster, start, SEEK_SET);
+    }
+    if (done)
+    {
+        done = stream_chunks(&job, &stats, (filter) ? (thresholds[job.depth]) : (-1.0), alpha, true);
+    }
+    if (done && filter)
+    {
+        filter_top_levels(&job.top, job.depth, thresholds);
+    }
+    else if (done)
+    {
+        fill_quadtree_levels(&levels, &stats, 0UL, 0, (int)job.depth - 1);
+    }
+
+    /* the levels above the chunks */
+    fBitinit(&top, NULL);
+    done = done && (EOF != qtc_write_stream(&job.top, &top, job.entropy, NULL, job.depth, QTC_TOP_STREAM));
+    encoded_size = 0x2UL + 0x4UL * (nb_chunks + 1UL) + top.memlen + job.spilled;
+
+    if (!done)
+    {
+        fprintf(stderr, "Error: can't encode %s in create_qtc_file_streaming()!\n", pgm_name);
+    }
+    else if (!(fptr = fopen(file_name, "w")))
+    {
+        fprintf(stderr, "Error: %s file not found in create_qtc_file_streaming()!\n", file_name);
+        done = false;
+    }
+    else
+    {
+        write_qtc_header(fptr, (job.entropy) ? ('3') : ('2'), (encoded_size - 1UL) * 0x8UL, &job.top);
+
+        /* the same layout as `create_qtc_file_chunked`, the chunks copied back in z-order */
+        fBitinit(&out, fptr);
+        fEcritCharbin(&out, niveau);
+        fEcritCharbin(&out, job.depth);
+        (void)fEcrireBits(&out, (unsigned int)(top.memlen >> 16UL), 16U);
+        (void)fEcrireBits(&out, (unsigned int)(top.memlen & 0xFFFFUL), 16U);
+        for (chunk = 0UL; chunk < nb_chunks; ++chunk)
+        {
+            (void)fEcrireBits(&out, (unsigned int)(job.sizes[chunk] >> 16UL), 16U);
+            (void)fEcrireBits(&out, (unsigned int)(job.sizes[chunk] & 0xFFFFUL), 16U);
+        }
+        done = (EOF != fEcrireOctets(&out, top.mem, top.memlen));
+        for (chunk = 0UL; done && chunk < nb_chunks; ++chunk)
+        {
+            done = !fseek(job.spill, (long)job.offsets[chunk], SEEK_SET);
+            for (size = job.sizes[chunk]; done && size; size -= n)
+            {
+                n = (size < FILEBIT_BLOCK_SIZE) ? (size) : (FILEBIT_BLOCK_SIZE);
+                done = (fread(copy, sizeof(*copy), n, job.spill) == n) && (EOF != fEcrireOctets(&out, copy, n));
+            }
+        }
+        done = (EOF != fBitflush(&out)) && done;
+        done = (0 == fBitclose(&out)) && done;
+        if (!done)
+        {
+            fprintf(stderr, "Error: can't write %s in create_qtc_file_streaming()!\n", file_name);
+        }
+    }
+
+    (void)fBitclose(&top);
+    (void)fBitclose(&job.outside);
+    free_qtree(&job.top);
+    free_qtree(&job.chunk);
+    free(job.pix.data);
+    free(job.band);
+    free(job.offsets);
+    free(job.sizes);
+    free(copy);
+    if (job.spill)
+    {
+        fclose(job.spill);
+    }
+    fclose(job.raster);
+    return done;
+}
+
+/**
+ * @brief Worker: decode the chunks of `[first, last)` of a band, and fill their pixels in the band
+ *
+ * @param arg the `BandTask`
+ * @return void* NULL
+ */
+static void *decode_band_chunks(void *arg)
+{
+    BandTask *task = arg;
+    const BandJob *job = task->job;
+    QTree *chunk = &task->chunk;
+    Pixmap view = {0};
+    QtcRoi roi = {0U, 0U, 0U, 0U};
+    size_t j = 0UL, row = 0UL, col = 0UL, node = 0UL, side = 1UL << chunk->niveau;
+
+    task->done = true;
+    view.width = job->top->width;
+    for (j = task->first; j < task->last; ++j)
+    {
+        row = job->first_row + j / job->nb_cols;
+        col = j % job->nb_cols;
+        node = DETERMINE_LEVEL_OFFSET((size_t)job->depth) + zorder_index(row, col);
+
+        /* the chunk as a tree of its own, its root from the top stream */
+        chunk->width = (unsigned int)((job->top->width - col * side < side) ? (job->top->width - col * side) : (side));
+        chunk->height = (unsigned int)((job->top->height - row * side < side) ? (job->top->height - row * side) : (side));
+        chunk->color[0] = job->top->color[node];
+        chunk->eu[0] = job->top->eu[node];
+        if (!QTREE_U(chunk, 0U))
+        {
+            fBitinitMem(&task->bits, job->payload + job->offsets[j], job->offsets[j + 1UL] - job->offsets[j]);
+            task->done = qtc_read_stream(chunk, &task->bits, job->entropy, NULL, 0U, 0UL, chunk->niveau) && task->done;
+        }
+        view.data = job->lines + (row - job->first_row) * side * view.width + col * side;
+        roi.w = chunk->width;
+        roi.h = chunk->height;
+        fill_pixmap_tree(chunk, &view, &roi, 0U, chunk->niveau, 0U, 0U);
+    }
+    return NULL;
+}
+
+extern bool decode_qtc_file_streaming(const char *file_name, unsigned char band_level, unsigned int nb_threads,
+                                      QtcBandSink sink, void *user)
+{
+    FileBit in = {0}, bits = {0};
+    QTree top = {0};
+    BandJob job;
+    BandTask *tasks = NULL;
+    size_t *sizes = NULL;   /* size of the top stream and of each chunk, in the file */
+    long *starts = NULL;    /* position of each chunk in the file */
+    size_t *offsets = NULL; /* start of each chunk of a band in `payload`, and the end of the last one */
+    unsigned char *payload = NULL, *grown = NULL;
+    size_t nb_chunks = 0UL, side = 0UL, per_band = 1UL, nb_rows = 0UL, row = 0UL, rows = 0UL, count = 0UL;
+    size_t i = 0UL, z = 0UL, len = 0UL, capacity = 0UL, lines = 0UL;
+    unsigned long width = 0UL, height = 0UL;
+    long position = 0L;
+    int high = 0, low = 0;
+    unsigned int t = 0U;
+    unsigned char niveau = 0U, version = 0U, depth = 0U;
+    bool done = true;
+
+    if (!file_name || !sink)
+    {
+        fprintf(stderr, "Error: file_name / sink is NULL in decode_qtc_file_streaming()!\n");
+        return false;
+    }
+    if (!(fBitopen(&in, file_name, "r")))
+    {
+        fprintf(stderr, "Error: %s file not found in decode_qtc_file_streaming()!\n", file_name);
+        return false;
+    }
+    if (QTC_ALL_LEVELS == (niveau = read_qtc_header(&in, file_name, &version, &width, &height)))
+    {
+        (void)fBitclose(&in);
+        return false;
+    }
+    if ('1' == version)
+    {
+        fprintf(stderr, "Error: %s is a Q1 file, a single stream: decode it without `--stream`!\n", file_name);
+        (void)fBitclose(&in);
+        return false;
+    }
+    if ((depth = fLireCharbin(&in)) > niveau)
+    {
+        fprintf(stderr, "Error: %s is truncated or corrupted!\n", file_name);
+        (void)fBitclose(&in);
+        return false;
+    }
+
+    /* the bands are lines of chunks, 2^k lines at least */
+    nb_chunks = 1UL << (2UL * depth);
+    side = 1UL << (niveau - depth);
+    per_band = (band_level > niveau - depth) ? (1UL << (band_level - (niveau - depth))) : (1UL);
+    nb_rows = (height + side - 1UL) / side;
+    per_band = (per_band < nb_rows) ? (per_band) : (nb_rows);
+    (void)memset(&job, 0, sizeof(job));
+    job.nb_cols = (width + side - 1UL) / side;
+    job.depth = depth;
+    job.entropy = ('3' == version);
+    nb_threads = (nb_threads < 1U) ? (1U) : (nb_threads);
+    nb_threads = (per_band * job.nb_cols < nb_threads) ? ((unsigned int)(per_band * job.nb_cols)) : (nb_threads);
+
+    sizes = malloc((nb_chunks + 1UL) * sizeof(*sizes));
+    starts = malloc(nb_chunks * sizeof(*starts));
+    offsets = malloc((per_band * job.nb_cols + 1UL) * sizeof(*offsets));
+    job.lines = malloc(per_band * side * width * sizeof(*job.lines));
+    tasks = calloc(nb_threads, sizeof(*tasks));
+    done = (sizes && starts && offsets && job.lines && tasks && make_qtree(&top, QTC_GREY_LEVEL, depth, false));
+    for (t = 0U; done && t < nb_threads; ++t)
+    {
+        done = (0UL != make_qtree(&tasks[t].chunk, QTC_GREY_LEVEL, (unsigned char)(niveau - depth), false));
+    }
+    if (!done)
+    {
+        fprintf(stderr, "Error: memory allocation error in decode_qtc_file_streaming()!\n");
+    }
+
+    /* the index, then the top stream, the chunks follow it */
+    for (i = 0UL; done && i <= nb_chunks; ++i)
+    {
+        high = fLireBits(&in, 16U);
+        low = fLireBits(&in, 16U);
+        done = (EOF != high && EOF != low);
+        sizes[i] = ((size_t)high << 16UL) | (size_t)low;
+    }
+    if (done && (payload = malloc(sizes[0] + 1UL)))
+    {
+        capacity = sizes[0] + 1UL;
+        done = (fLireOctets(&in, payload, sizes[0]) == sizes[0]) && (position = fPositionOctet(&in)) >= 0L;
+    }
+    for (z = 0UL; done && z < nb_chunks; ++z)
+    {
+        starts[z] = position;
+        position += (long)sizes[z + 1UL];
+    }
+    if (done && payload)
+    {
+        top.niveau = niveau;
+        top.width = (unsigned int)width;
+        top.height = (unsigned int)height;
+        fBitinitMem(&bits, payload, sizes[0]);
+        done = qtc_read_stream(&top, &bits, job.entropy, NULL, depth, QTC_TOP_STREAM, niveau);
+    }
+    done = done && payload;
+    job.top = &top;
+
+    for (row = 0UL; done && row < nb_rows; row += per_band)
+    {
+        /* the streams of the chunks of the band, in the image and not uniform, read in the order of the index */
+        rows = (per_band < nb_rows - row) ? (per_band) : (nb_rows - row);
+        count = rows * job.nb_cols;
+        for (offsets[0] = 0UL, i = 0UL; done && i < count; ++i)
+        {
+            z = zorder_index(row + i / job.nb_cols, i % job.nb_cols);
+            len = (QTREE_U(&top, DETERMINE_LEVEL_OFFSET((size_t)depth) + z)) ? (0UL) : (sizes[z + 1UL]);
+            offsets[i + 1UL] = offsets[i] + len;
+            if (offsets[i + 1UL] + 1UL > capacity)
+            {
+                capacity = 2UL * (offsets[i + 1UL] + 1UL);
+                done = (NULL != (grown = realloc(payload, capacity)));
+                payload = (done) ? (grown) : (payload);
+            }
+            done = done && (!len || (EOF != fAllerOctet(&in, starts[z]) &&
+                                     fLireOctets(&in, payload + offsets[i], len) == len));
+        }
+
+        /* decoded on several threads, each one with its own chunk */
+        job.payload = payload;
+        job.offsets = offsets;
+        job.first_row = row;
+        for (t = 0U; done && t < nb_threads; ++t)
+        {
+            tasks[t].job = &job;
+            tasks[t].first = count * t / nb_threads;
+            tasks[t].last = count * (t + 1U) / nb_threads;
+        }
+        if (done)
+        {
+            run_workers(decode_band_chunks, tasks, sizeof(*tasks), nb_threads);
+        }
+        for (t = 0U; done && t < nb_threads; ++t)
+        {
+            done = tasks[t].done;
+        }
+        if (!done)
+        {
+            fprintf(stderr, "Error: %s is truncated or corrupted!\n", file_name);
+            break;
+        }
+        lines = (rows * side < height - row * side) ? (rows * side) : (height - row * side);
+        done = sink(user, job.lines, (unsigned int)width, (unsigned int)height, (unsigned int)(row * side),
+                    (unsigned int)lines);
+    }
+
+    for (t = 0U; tasks && t < nb_threads; ++t)
+    {
+        free_qtree(&tasks[t].chunk);
+    }
+    free(tasks);
+    free_qtree(&top);
+    free(job.lines);
+    free(payload);
+    free(offsets);
+    free(starts);
+    free(sizes);
+    (void)fBitclose(&in);
+    return done;
+}
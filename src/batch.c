@@ -0,0 +1,1306 @@
+/**
+ * @file src/batch.c
+ * @authors MUNAITPASOV M. & BENVENISTE A.
+ * @brief Batch implementation
+ * @version 0.1
+ * @date 2025-01-09
+ *
+ * @copyright licence MIT Copyright (c) 2025
+ */
+
+#define _DEFAULT_SOURCE /* opendir(), getline(), mkdir(), pread() and syscall() with `-ansi` */
+
+#include "batch.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#define BATCH_IO_URING /* the reader and the writer submit their files to an io_uring */
+#endif
+
+/* first size of the buffers of a job or a worker, doubled as needed */
+#define BATCH_BLOCK_SIZE (1UL << 16)
+
+/* files read, or written, at once by the ring of a stage */
+#define BATCH_RING_DEPTH 8U
+
+/**
+ * The paths of the files of a batch
+ */
+typedef struct batch_list
+{
+    char **paths;    /* the paths, allocated */
+    size_t nb_paths; /* number of paths */
+    size_t capacity; /* number of paths allocated */
+    size_t unread;   /* directories that could not be read */
+    size_t clashes;  /* files dropped: their output is named as the one of a file before them */
+} BatchList;
+
+/**
+ * A file of the list and the name of its output, to find the outputs named alike
+ */
+typedef struct batch_name
+{
+    const char *name; /* the name of the file, without its directory */
+    size_t index;     /* its position in the list */
+} BatchName;
+
+/**
+ * The io_uring of the reader or of the writer, used by its thread alone.
+ * Without it (another system, or a kernel refusing it) the thread reads or writes blocking:
+ * it is a thread of its own, the I/O still overlaps the work of the workers.
+ */
+typedef struct batch_ring
+{
+    int fd;                    /* the ring, -1 if none */
+    bool writing;              /* writes instead of reads */
+    bool broken;               /* the ring failed: its jobs fail, the next ones are blocking */
+    unsigned int in_flight;    /* jobs submitted and not yet completed */
+#ifdef BATCH_IO_URING
+    unsigned char *sq;         /* the submission ring, mapped */
+    size_t sq_size;            /* size of `sq` */
+    unsigned char *cq;         /* the completion ring, mapped */
+    size_t cq_size;            /* size of `cq` */
+    struct io_uring_sqe *sqes; /* the submissions, mapped */
+    size_t sqes_size;          /* size of `sqes` */
+    unsigned int *sq_tail;     /* in `sq` */
+    unsigned int *sq_array;    /* in `sq` */
+    unsigned int sq_mask;      /* number of submissions - 1 */
+    unsigned int *cq_head;     /* in `cq` */
+    unsigned int *cq_tail;     /* in `cq` */
+    unsigned int cq_mask;      /* number of completions - 1 */
+    struct io_uring_cqe *cqes; /* in `cq` */
+#endif
+} BatchRing;
+
+/**
+ * An image on its way through the stages: read, encoded or decoded, written.
+ * Its buffers are kept for the image that takes the job after it.
+ */
+typedef struct batch_job
+{
+    const char *input;        /* the file read, in the list */
+    char *output;             /* the file written, NULL if its name can not be made */
+    unsigned char *in;        /* the bytes of `input` */
+    size_t in_size;           /* bytes read */
+    size_t in_capacity;       /* bytes of `in` */
+    unsigned char *out;       /* the bytes of `output` */
+    size_t out_size;          /* bytes to write */
+    size_t out_capacity;      /* bytes of `out` */
+    unsigned char *io_buf;    /* `in` or `out`, read or written from `fd` */
+    size_t io_size;           /* bytes of the file to read or write */
+    size_t done;              /* bytes already read or written */
+    struct iovec iov;         /* the part left, submitted to a ring */
+    struct batch_ring *ring;  /* the ring of the read or the write in flight, NULL if none */
+    int fd;                   /* the file read or written, -1 if none */
+    bool failed;              /* the image failed at one of the stages */
+} BatchJob;
+
+/**
+ * A queue of jobs between two stages. It holds every job and every end mark at once,
+ * a push never waits: the jobs themselves bound the images in the pipeline.
+ */
+typedef struct batch_queue
+{
+    BatchJob **jobs;       /* the jobs, NULL for the end of the stage before */
+    size_t capacity;       /* number of places of `jobs` */
+    size_t head;           /* the first job */
+    size_t count;          /* number of jobs in the queue */
+    pthread_mutex_t lock;  /* guards the queue */
+    pthread_cond_t pushed; /* a job was pushed */
+} BatchQueue;
+
+/**
+ * The stages of a batch: the reader on the calling thread, the workers, the writer,
+ * and the queues of jobs between them
+ */
+typedef struct batch_pipeline
+{
+    const Args *args;      /* the arguments: mode, output directory, alpha, format */
+    const BatchList *list; /* the files */
+    BatchJob *jobs;        /* the jobs */
+    size_t nb_jobs;        /* number of jobs */
+    BatchQueue empty;      /* the jobs free, for the reader */
+    BatchQueue read;       /* the jobs read, for the workers */
+    BatchQueue built;      /* the jobs encoded or decoded, for the writer */
+    bool writer;           /* the writer runs on its thread, else the workers write */
+    size_t failed;         /* files that failed */
+    pthread_mutex_t lock;  /* guards `failed` and the messages */
+} BatchPipeline;
+
+/**
+ * A worker of a batch, and the buffers it reuses from one image to the next
+ */
+typedef struct batch_worker
+{
+    BatchPipeline *pipe;     /* the stages */
+    QtcContext ctx;          /* the tree and the .qtc file written, of the largest image so far */
+    unsigned char *raster;   /* the pixels of a P2 file, or decoded */
+    size_t raster_capacity;  /* bytes of `raster` */
+} BatchWorker;
+
+static bool batch_reserve(unsigned char **block, size_t *capacity, size_t size);
+
+static bool batch_add(BatchList *list, const char *dir, const char *name);
+
+static bool batch_add_directory(BatchList *list, const char *dir, const char *ext);
+
+static bool batch_read_manifest(BatchList *list, FILE *manifest);
+
+static int batch_compare(const void *a, const void *b);
+
+static int batch_compare_names(const void *a, const void *b);
+
+static bool batch_drop_clashes(BatchList *list);
+
+static char *batch_output_name(const char *dir, const char *input, const char *ext_in, const char *ext_out);
+
+static bool batch_queue_init(BatchQueue *queue, size_t capacity);
+
+static void batch_queue_free(BatchQueue *queue);
+
+static void batch_push(BatchQueue *queue, BatchJob *job);
+
+static bool batch_pop(BatchQueue *queue, BatchJob **job, bool wait);
+
+static bool batch_ring_init(BatchRing *ring, bool writing);
+
+static void batch_ring_free(BatchRing *ring);
+
+static bool batch_ring_submit(BatchRing *ring, BatchJob *job);
+
+static BatchJob *batch_ring_wait(BatchRing *ring, BatchPipeline *pipe);
+
+static void batch_close(BatchJob *job, bool writing);
+
+static void batch_read_rest(BatchJob *job, bool regular);
+
+static void batch_write_rest(BatchJob *job);
+
+static bool batch_start_read(BatchPipeline *pipe, BatchJob *job, BatchRing *ring);
+
+static bool batch_start_write(BatchJob *job, BatchRing *ring);
+
+static bool batch_context(BatchWorker *worker, unsigned char level);
+
+static bool batch_encode(BatchWorker *worker, BatchJob *job);
+
+static bool batch_decode(BatchWorker *worker, BatchJob *job);
+
+static void batch_build(BatchWorker *worker, BatchJob *job);
+
+static void batch_finish(BatchPipeline *pipe, BatchJob *job);
+
+static void batch_built(BatchPipeline *pipe, BatchJob *job);
+
+static void batch_dispatch(BatchPipeline *pipe, BatchJob *job, BatchWorker *worker);
+
+static void batch_reader(BatchPipeline *pipe, BatchWorker *worker);
+
+static void *batch_worker(void *arg);
+
+static void *batch_writer(void *arg);
+
+/**
+ * @brief Grow a buffer to `size` bytes at least, its bytes kept: doubled from `BATCH_BLOCK_SIZE`
+ *
+ * @param block the buffer, NULL if none
+ * @param capacity its size, updated
+ * @param size the size needed
+ * @return true on success
+ * @return false on a memory allocation error, the buffer is left as it was
+ */
+static bool batch_reserve(unsigned char **block, size_t *capacity, size_t size)
+{
+    unsigned char *grown = NULL;
+    size_t cap = (*capacity) ? (*capacity) : (BATCH_BLOCK_SIZE);
+
+    while (cap < size)
+    {
+        cap <<= 1UL;
+    }
+    if (cap == *capacity)
+    {
+        return true;
+    }
+    if (!(grown = realloc(*block, cap)))
+    {
+        return false;
+    }
+    *block = grown;
+    *capacity = cap;
+    return true;
+}
+
+/**
+ * @brief Add a path to the list, copied: `dir/name`, or `name` alone when `dir` is NULL
+ *
+ * @param list the list
+ * @param dir the directory, NULL if none
+ * @param name the name of the file
+ * @return true on success
+ * @return false on a memory allocation error
+ */
+static bool batch_add(BatchList *list, const char *dir, const char *name)
+{
+    char **paths = NULL, *path = NULL;
+    size_t len = (dir) ? (strlen(dir) + 1UL) : (0UL);
+
+    if (list->nb_paths == list->capacity)
+    {
+        if (!(paths = realloc(list->paths, ((list->capacity) ? (2UL * list->capacity) : (64UL)) * sizeof(*paths))))
+        {
+            return false;
+        }
+        list->paths = paths;
+        list->capacity = (list->capacity) ? (2UL * list->capacity) : (64UL);
+    }
+    if (!(path = malloc(len + strlen(name) + 1UL)))
+    {
+        return false;
+    }
+    if (dir)
+    {
+        (void)memcpy(path, dir, len - 1UL);
+        path[len - 1UL] = '/';
+    }
+    (void)strcpy(path + len, name);
+    list->paths[list->nb_paths++] = path;
+    return true;
+}
+
+/**
+ * @brief Add the files of a directory ending with `ext`, in the order of their names
+ *
+ * @param list the list
+ * @param dir the directory
+ * @param ext ".pgm" or ".qtc"
+ * @return true on success, an unreadable directory is counted as a file that failed
+ * @return false on a memory allocation error
+ */
+static bool batch_add_directory(BatchList *list, const char *dir, const char *ext)
+{
+    DIR *d = NULL;
+    struct dirent *entry = NULL;
+    size_t first = list->nb_paths, len = 0UL;
+    bool done = true;
+
+    if (!(d = opendir(dir)))
+    {
+        fprintf(stderr, "Error: cannot read the directory %s, the batch goes on\n", dir);
+        ++list->unread;
+        return true;
+    }
+    while (done && (entry = readdir(d)))
+    {
+        len = strlen(entry->d_name);
+        if (len > 4UL && !strcmp(entry->d_name + len - 4UL, ext))
+        {
+            done = batch_add(list, dir, entry->d_name);
+        }
+    }
+    (void)closedir(d);
+    qsort(list->paths + first, list->nb_paths - first, sizeof(*list->paths), batch_compare);
+    return done;
+}
+
+/**
+ * @brief Add the paths of a manifest, one per line, the empty lines skipped
+ *
+ * @param list the list
+ * @param manifest the manifest, stdin
+ * @return true on success
+ * @return false on a memory allocation error
+ */
+static bool batch_read_manifest(BatchList *list, FILE *manifest)
+{
+    char *line = NULL;
+    size_t size = 0UL;
+    ssize_t len = 0;
+    bool done = true;
+
+    while (done && (len = getline(&line, &size, manifest)) > 0)
+    {
+        while (len > 0 && ('\n' == line[len - 1] || '\r' == line[len - 1]))
+        {
+            line[--len] = '\0';
+        }
+        done = !len || batch_add(list, NULL, line);
+    }
+    free(line);
+    return done;
+}
+
+/**
+ * @brief Order of two paths, for `qsort`
+ *
+ * @param a the first path
+ * @param b the second path
+ * @return int as `strcmp`
+ */
+static int batch_compare(const void *a, const void *b)
+{
+    const char *const *pa = a;
+    const char *const *pb = b;
+    return strcmp(*pa, *pb);
+}
+
+/**
+ * @brief Order of two files by name, then by position in the list, for `qsort`
+ *
+ * @param a the first `BatchName`
+ * @param b the second `BatchName`
+ * @return int as `strcmp`
+ */
+static int batch_compare_names(const void *a, const void *b)
+{
+    const BatchName *na = a;
+    const BatchName *nb = b;
+    int order = strcmp(na->name, nb->name);
+    return (order) ? (order) : ((na->index < nb->index) ? (-1) : (na->index > nb->index));
+}
+
+/**
+ * @brief Drop the files whose output would be written over the one of a file before them:
+ * the outputs are named after the files without their directories, "a/x.pgm" and "b/x.pgm"
+ * both write "x.qtc". Each one dropped is reported and counted as a file that failed.
+ *
+ * @param list the list, kept in its order
+ * @return true on success
+ * @return false on a memory allocation error, the list is left as it was
+ */
+static bool batch_drop_clashes(BatchList *list)
+{
+    BatchName *names = NULL;
+    bool *drop = NULL;
+    const char *slash = NULL;
+    size_t i = 0UL, first = 0UL, kept = 0UL;
+
+    if (list->nb_paths < 2UL)
+    {
+        return true;
+    }
+    names = malloc(list->nb_paths * sizeof(*names));
+    drop = calloc(list->nb_paths, sizeof(*drop));
+    if (!names || !drop)
+    {
+        free(names);
+        free(drop);
+        return false;
+    }
+    for (i = 0UL; i < list->nb_paths; ++i)
+    {
+        slash = strrchr(list->paths[i], '/');
+        names[i].name = (slash) ? (slash + 1) : (list->paths[i]);
+        names[i].index = i;
+    }
+    /* the files of a name side by side, the first one of the list first: it keeps its output */
+    qsort(names, list->nb_paths, sizeof(*names), batch_compare_names);
+    for (i = 1UL; i < list->nb_paths; ++i)
+    {
+        if (strcmp(names[first].name, names[i].name))
+        {
+            first = i;
+            continue;
+        }
+        fprintf(stderr, "Error: %s writes the same output as %s, the batch goes on\n",
+                list->paths[names[i].index], list->paths[names[first].index]);
+        drop[names[i].index] = true;
+    }
+    for (i = 0UL; i < list->nb_paths; ++i)
+    {
+        if (drop[i])
+        {
+            free(list->paths[i]);
+            ++list->clashes;
+        }
+        else
+        {
+            list->paths[kept++] = list->paths[i];
+        }
+    }
+    list->nb_paths = kept;
+    free(names);
+    free(drop);
+    return true;
+}
+
+/**
+ * @brief Name of the output of a file: its name in the output directory, `ext_in` replaced by `ext_out`.
+ * For exemple: "PGM/boat.512.pgm" -> "QTC/boat.512.qtc"
+ *
+ * @param dir the output directory
+ * @param input the input file
+ * @param ext_in ".pgm" or ".qtc", the extension of the input
+ * @param ext_out ".qtc" or ".pgm"
+ * @return char* the new string, NULL if the input has not the extension, or on a memory allocation error
+ */
+static char *batch_output_name(const char *dir, const char *input, const char *ext_in, const char *ext_out)
+{
+    const char *name = strrchr(input, '/');
+    char *output = NULL;
+    size_t len = 0UL, len_dir = strlen(dir);
+
+    name = (name) ? (name + 1) : (input);
+    if ((len = strlen(name)) <= 4UL || strcmp(name + len - 4UL, ext_in))
+    {
+        fprintf(stderr, "Error: %s is not a `%s` file!\n", input, ext_in);
+        return NULL;
+    }
+    if (!(output = malloc(len_dir + len + 2UL)))
+    {
+        fprintf(stderr, "Error: memory allocation failed!\n");
+        return NULL;
+    }
+    (void)memcpy(output, dir, len_dir);
+    output[len_dir] = '/';
+    (void)memcpy(output + len_dir + 1UL, name, len - 4UL);
+    (void)strcpy(output + len_dir + 1UL + len - 4UL, ext_out);
+    return output;
+}
+
+/**
+ * @brief Make an empty queue of `capacity` places
+ *
+ * @param queue the queue
+ * @param capacity the number of places: every job and every end mark
+ * @return true on success
+ * @return false on an allocation error, nothing is left to free
+ */
+static bool batch_queue_init(BatchQueue *queue, size_t capacity)
+{
+    queue->capacity = capacity;
+    queue->head = queue->count = 0UL;
+    if (!(queue->jobs = malloc(capacity * sizeof(*queue->jobs))))
+    {
+        return false;
+    }
+    if (pthread_mutex_init(&queue->lock, NULL))
+    {
+        free(queue->jobs);
+        queue->jobs = NULL;
+        return false;
+    }
+    if (pthread_cond_init(&queue->pushed, NULL))
+    {
+        (void)pthread_mutex_destroy(&queue->lock);
+        free(queue->jobs);
+        queue->jobs = NULL;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Free a queue made by `batch_queue_init`, or whose making failed
+ *
+ * @param queue the queue
+ */
+static void batch_queue_free(BatchQueue *queue)
+{
+    if (queue->jobs)
+    {
+        (void)pthread_cond_destroy(&queue->pushed);
+        (void)pthread_mutex_destroy(&queue->lock);
+        free(queue->jobs);
+        queue->jobs = NULL;
+    }
+}
+
+/**
+ * @brief Push a job at the end of a queue, without waiting
+ *
+ * @param queue the queue
+ * @param job the job, NULL for the end of the stage
+ */
+static void batch_push(BatchQueue *queue, BatchJob *job)
+{
+    (void)pthread_mutex_lock(&queue->lock);
+    queue->jobs[(queue->head + queue->count++) % queue->capacity] = job;
+    (void)pthread_cond_signal(&queue->pushed);
+    (void)pthread_mutex_unlock(&queue->lock);
+}
+
+/**
+ * @brief Take the first job of a queue
+ *
+ * @param queue the queue
+ * @param job the job taken, NULL for the end of the stage before
+ * @param wait wait for a job when the queue is empty
+ * @return true if a job is taken
+ * @return false if the queue is empty and `wait` is false
+ */
+static bool batch_pop(BatchQueue *queue, BatchJob **job, bool wait)
+{
+    bool taken = false;
+
+    (void)pthread_mutex_lock(&queue->lock);
+    while (wait && !queue->count)
+    {
+        (void)pthread_cond_wait(&queue->pushed, &queue->lock);
+    }
+    if ((taken = (queue->count > 0UL)))
+    {
+        *job = queue->jobs[queue->head];
+        queue->head = (queue->head + 1UL) % queue->capacity;
+        --queue->count;
+    }
+    (void)pthread_mutex_unlock(&queue->lock);
+    return taken;
+}
+
+/**
+ * @brief Make the io_uring of a stage, with `BATCH_RING_DEPTH` places
+ *
+ * @param ring the ring, its `fd` is -1 when it can not be made
+ * @param writing the ring writes files, else it reads them
+ * @return true if the ring is made
+ * @return false if the stage reads or writes blocking
+ */
+static bool batch_ring_init(BatchRing *ring, bool writing)
+{
+#ifdef BATCH_IO_URING
+    struct io_uring_params params;
+    long fd = -1L;
+#endif
+
+    ring->fd = -1;
+    ring->writing = writing;
+    ring->broken = false;
+    ring->in_flight = 0U;
+#ifdef BATCH_IO_URING
+    ring->sq = ring->cq = NULL;
+    ring->sqes = NULL;
+    (void)memset(&params, 0, sizeof(params));
+    if ((fd = syscall(__NR_io_uring_setup, BATCH_RING_DEPTH, &params)) < 0L)
+    {
+        return false;
+    }
+    ring->fd = (int)fd;
+    ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sq = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                    (off_t)IORING_OFF_SQ_RING);
+    ring->cq = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                    (off_t)IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                      (off_t)IORING_OFF_SQES);
+    ring->sq = (MAP_FAILED == ring->sq) ? (NULL) : (ring->sq);
+    ring->cq = (MAP_FAILED == ring->cq) ? (NULL) : (ring->cq);
+    ring->sqes = (MAP_FAILED == (void *)ring->sqes) ? (NULL) : (ring->sqes);
+    if (!ring->sq || !ring->cq || !ring->sqes)
+    {
+        batch_ring_free(ring);
+        return false;
+    }
+    /* the offsets given by the kernel are aligned */
+    ring->sq_tail = (unsigned int *)(void *)(ring->sq + params.sq_off.tail);
+    ring->sq_array = (unsigned int *)(void *)(ring->sq + params.sq_off.array);
+    ring->sq_mask = *(unsigned int *)(void *)(ring->sq + params.sq_off.ring_mask);
+    ring->cq_head = (unsigned int *)(void *)(ring->cq + params.cq_off.head);
+    ring->cq_tail = (unsigned int *)(void *)(ring->cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned int *)(void *)(ring->cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(void *)(ring->cq + params.cq_off.cqes);
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief Free the io_uring of a stage, nothing in flight
+ *
+ * @param ring the ring
+ */
+static void batch_ring_free(BatchRing *ring)
+{
+#ifdef BATCH_IO_URING
+    if (ring->sqes)
+    {
+        (void)munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq)
+    {
+        (void)munmap(ring->cq, ring->cq_size);
+    }
+    if (ring->sq)
+    {
+        (void)munmap(ring->sq, ring->sq_size);
+    }
+    ring->sq = ring->cq = NULL;
+    ring->sqes = NULL;
+#endif
+    if (ring->fd >= 0)
+    {
+        (void)close(ring->fd);
+    }
+    ring->fd = -1;
+}
+
+/**
+ * @brief Submit the read, or the write, of the part left of a job: `io_buf` from `done` to `io_size`
+ *
+ * @param ring the ring of the stage, NULL if none
+ * @param job the job, its file opened
+ * @return true if the job is in flight
+ * @return false if there is no ring, or if it refuses it: the job is to read or write blocking
+ */
+static bool batch_ring_submit(BatchRing *ring, BatchJob *job)
+{
+#ifdef BATCH_IO_URING
+    struct io_uring_sqe *sqe = NULL;
+    unsigned int tail = 0U, index = 0U;
+    long submitted = 0L;
+
+    if (!ring || ring->fd < 0 || ring->broken)
+    {
+        return false;
+    }
+    /* the tail is only moved by this thread, the kernel reads it */
+    tail = *ring->sq_tail;
+    index = tail & ring->sq_mask;
+    sqe = &ring->sqes[index];
+    (void)memset(sqe, 0, sizeof(*sqe));
+    job->iov.iov_base = job->io_buf + job->done;
+    job->iov.iov_len = job->io_size - job->done;
+    sqe->opcode = (unsigned char)((ring->writing) ? (IORING_OP_WRITEV) : (IORING_OP_READV));
+    sqe->fd = job->fd;
+    sqe->addr = (unsigned long)&job->iov;
+    sqe->len = 1U;
+    sqe->off = (unsigned long)job->done;
+    sqe->user_data = (unsigned long)job;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1U, __ATOMIC_RELEASE);
+    do
+    {
+        submitted = syscall(__NR_io_uring_enter, ring->fd, 1U, 0U, 0U, NULL, 0UL);
+    } while (submitted < 0L && EINTR == errno);
+    if (1L != submitted)
+    {
+        /* not taken by the kernel: withdrawn */
+        __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+        return false;
+    }
+    job->ring = ring;
+    ++ring->in_flight;
+    return true;
+#else
+    (void)ring;
+    (void)job;
+    return false;
+#endif
+}
+
+/**
+ * @brief Wait for a job of the ring to be read, or written: a short read or write is submitted again,
+ * and the job returned at the end of its file, on an error, or when the ring refuses the part left
+ *
+ * @param ring the ring, a job in flight at least
+ * @param pipe the stages, whose jobs fail one by one if the ring breaks
+ * @return BatchJob* the job, `done` bytes read or written
+ */
+static BatchJob *batch_ring_wait(BatchRing *ring, BatchPipeline *pipe)
+{
+    BatchJob *job = NULL;
+    size_t i = 0UL;
+#ifdef BATCH_IO_URING
+    struct io_uring_cqe *cqe = NULL;
+    unsigned int head = 0U;
+    int res = 0;
+
+    while (!ring->broken)
+    {
+        head = *ring->cq_head;
+        if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+        {
+            if (syscall(__NR_io_uring_enter, ring->fd, 0U, 1U, IORING_ENTER_GETEVENTS, NULL, 0UL) < 0L &&
+                EINTR != errno)
+            {
+                ring->broken = true;
+            }
+            continue;
+        }
+        cqe = &ring->cqes[head & ring->cq_mask];
+        job = (BatchJob *)(unsigned long)cqe->user_data;
+        res = cqe->res;
+        __atomic_store_n(ring->cq_head, head + 1U, __ATOMIC_RELEASE);
+        --ring->in_flight;
+        job->ring = NULL;
+        job->done += (res > 0) ? ((size_t)res) : (0UL);
+        job->failed = job->failed || (res < 0 && -EINTR != res && -EAGAIN != res);
+        /* a short read or write: the rest, unless it is the end of the file */
+        if (job->failed || !res || job->done == job->io_size || !batch_ring_submit(ring, job))
+        {
+            return job;
+        }
+    }
+#endif
+    /* the ring is broken: its jobs fail */
+    for (i = 0UL; i < pipe->nb_jobs; ++i)
+    {
+        if (ring == pipe->jobs[i].ring)
+        {
+            job = &pipe->jobs[i];
+            job->ring = NULL;
+            job->failed = true;
+            --ring->in_flight;
+            return job;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Close the file of a job
+ *
+ * @param job the job
+ * @param writing the file was written: the job fails if it can not be closed
+ */
+static void batch_close(BatchJob *job, bool writing)
+{
+    if (job->fd >= 0 && close(job->fd) && writing)
+    {
+        job->failed = true;
+    }
+    job->fd = -1;
+}
+
+/**
+ * @brief Read the rest of the file of a job, blocking: up to `io_size` bytes of a regular file,
+ * up to its end for anything else, `in` grown as needed
+ *
+ * @param job the job, its file opened
+ * @param regular the file is a regular one, of `io_size` bytes
+ */
+static void batch_read_rest(BatchJob *job, bool regular)
+{
+    ssize_t n = 1;
+
+    while (!job->failed && n)
+    {
+        if (job->done == job->io_size)
+        {
+            if (regular)
+            {
+                break;
+            }
+            if (!batch_reserve(&job->in, &job->in_capacity, job->done + 1UL))
+            {
+                job->failed = true;
+                break;
+            }
+            job->io_size = job->in_capacity;
+        }
+        n = (regular) ? (pread(job->fd, job->in + job->done, job->io_size - job->done, (off_t)job->done))
+                      : (read(job->fd, job->in + job->done, job->io_size - job->done));
+        if (n < 0)
+        {
+            job->failed = EINTR != errno;
+            n = 1;
+        }
+        else
+        {
+            job->done += (size_t)n;
+        }
+    }
+    job->in_size = job->done;
+}
+
+/**
+ * @brief Write the rest of the file of a job, blocking, up to `io_size` bytes
+ *
+ * @param job the job, its file opened
+ */
+static void batch_write_rest(BatchJob *job)
+{
+    ssize_t n = 0;
+
+    while (!job->failed && job->done < job->io_size)
+    {
+        n = pwrite(job->fd, job->io_buf + job->done, job->io_size - job->done, (off_t)job->done);
+        if (n > 0)
+        {
+            job->done += (size_t)n;
+        }
+        else
+        {
+            job->failed = !n || EINTR != errno;
+        }
+    }
+}
+
+/**
+ * @brief Start the read of the next file of the list into a job, its output named: submitted to the ring
+ * for a regular file, else read blocking
+ *
+ * @param pipe the stages
+ * @param job the job, `input` set
+ * @param ring the ring of the reader
+ * @return true if the read is in flight
+ * @return false if the file is read, or failed, and closed
+ */
+static bool batch_start_read(BatchPipeline *pipe, BatchJob *job, BatchRing *ring)
+{
+    const Args *args = pipe->args;
+    struct stat st;
+    bool regular = false;
+
+    free(job->output);
+    job->output = (args->mode) ? (batch_output_name(args->batch, job->input, ".qtc", ".pgm"))
+                               : (batch_output_name(args->batch, job->input, ".pgm", ".qtc"));
+    job->in_size = job->out_size = job->io_size = job->done = 0UL;
+    if (!(job->failed = !job->output) && (job->fd = open(job->input, O_RDONLY)) < 0)
+    {
+        fprintf(stderr, "Error: %s file not found\n", job->input);
+        job->failed = true;
+    }
+    if (job->failed)
+    {
+        return false;
+    }
+    if ((regular = !fstat(job->fd, &st) && S_ISREG(st.st_mode)))
+    {
+        job->io_size = (size_t)st.st_size;
+        job->failed = !batch_reserve(&job->in, &job->in_capacity, job->io_size);
+        job->io_buf = job->in;
+        if (!job->failed && job->io_size && batch_ring_submit(ring, job))
+        {
+            return true;
+        }
+    }
+    batch_read_rest(job, regular);
+    batch_close(job, false);
+    return false;
+}
+
+/**
+ * @brief Start the write of the output of a job, its file created: submitted to the ring, else written blocking
+ *
+ * @param job the job, encoded or decoded
+ * @param ring the ring of the writer, NULL if none
+ * @return true if the write is in flight
+ * @return false if the file is written, or failed, and closed
+ */
+static bool batch_start_write(BatchJob *job, BatchRing *ring)
+{
+    job->done = 0UL;
+    if (job->failed)
+    {
+        return false;
+    }
+    if ((job->fd = open(job->output, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+    {
+        job->failed = true;
+        return false;
+    }
+    job->io_buf = job->out;
+    job->io_size = job->out_size;
+    if (job->io_size && batch_ring_submit(ring, job))
+    {
+        return true;
+    }
+    batch_write_rest(job);
+    batch_close(job, true);
+    return false;
+}
+
+/**
+ * @brief Make the context of a worker hold a tree of `level`: kept when large enough,
+ * else made again at this level
+ *
+ * @param worker the worker
+ * @param level the level of the tree
+ * @return true on success
+ * @return false on a memory allocation error
+ */
+static bool batch_context(BatchWorker *worker, unsigned char level)
+{
+    if (worker->ctx.color && level <= worker->ctx.max_level)
+    {
+        return true;
+    }
+    free_qtc_context(&worker->ctx);
+    return make_qtc_context(&worker->ctx, level, NULL);
+}
+
+/**
+ * @brief Encode the .pgm file read by a job into its .qtc file, with the alpha and the format of the batch,
+ * the tree built and the file written in the context of the worker
+ *
+ * @param worker the worker
+ * @param job the job, read
+ * @return true on success
+ */
+static bool batch_encode(BatchWorker *worker, BatchJob *job)
+{
+    const Args *args = worker->pipe->args;
+    Pixmap pix = {0};
+    unsigned char level = 0U;
+
+    /* one thread per image: the images are spread on the workers */
+    if (!read_pgm_buffer(&pix, job->in, job->in_size, &worker->raster, &worker->raster_capacity) ||
+        QTC_ALL_LEVELS == (level = determine_qtree_level(&pix)) || !batch_context(worker, level) ||
+        !qtc_context_encode(&worker->ctx, pix.data, pix.width, pix.height, pix.width, pix.grey_level, args->alpha,
+                            args->format, 1U) ||
+        !batch_reserve(&job->out, &job->out_capacity, worker->ctx.file_size))
+    {
+        return false;
+    }
+    (void)memcpy(job->out, worker->ctx.file, worker->ctx.file_size);
+    job->out_size = worker->ctx.file_size;
+    return true;
+}
+
+/**
+ * @brief Decode the .qtc file read by a job into its .pgm file, the tree and the pixels
+ * in the buffers of the worker
+ *
+ * @param worker the worker
+ * @param job the job, read
+ * @return true on success
+ */
+static bool batch_decode(BatchWorker *worker, BatchJob *job)
+{
+    bool ascii = worker->pipe->args->ascii;
+    unsigned int width = 0U, height = 0U;
+    unsigned char level = 0U;
+
+    if (!qtc_image_size(job->in, job->in_size, &width, &height))
+    {
+        return false;
+    }
+    while ((1UL << level) < width || (1UL << level) < height)
+    {
+        ++level;
+    }
+    if (!batch_reserve(&worker->raster, &worker->raster_capacity, (size_t)width * height) ||
+        !batch_context(worker, level) ||
+        !qtc_context_decode(&worker->ctx, job->in, job->in_size, worker->raster, width, height, width, 1U) ||
+        !batch_reserve(&job->out, &job->out_capacity, pgm_buffer_size(width, height, ascii)))
+    {
+        return false;
+    }
+    job->out_size = write_pgm_buffer(job->out, worker->raster, width, height, ascii);
+    return true;
+}
+
+/**
+ * @brief Encode or decode a job, unless it failed to be read
+ *
+ * @param worker the worker
+ * @param job the job
+ */
+static void batch_build(BatchWorker *worker, BatchJob *job)
+{
+    if (!job->failed)
+    {
+        job->failed = (worker->pipe->args->mode) ? (!batch_decode(worker, job)) : (!batch_encode(worker, job));
+    }
+}
+
+/**
+ * @brief Report a job, written or failed, and give it back to the reader
+ *
+ * @param pipe the stages
+ * @param job the job
+ */
+static void batch_finish(BatchPipeline *pipe, BatchJob *job)
+{
+    (void)pthread_mutex_lock(&pipe->lock);
+    if (job->failed)
+    {
+        fprintf(stderr, "Error: %s failed, the batch goes on\n", job->input);
+        ++pipe->failed;
+    }
+    else if (pipe->args->verbose)
+    {
+        fprintf(stdout, "%s -> %s\n", job->input, job->output);
+    }
+    (void)pthread_mutex_unlock(&pipe->lock);
+    batch_push(&pipe->empty, job);
+}
+
+/**
+ * @brief Pass a job encoded or decoded to the writer, or write it at once when it has no thread
+ *
+ * @param pipe the stages
+ * @param job the job
+ */
+static void batch_built(BatchPipeline *pipe, BatchJob *job)
+{
+    if (pipe->writer)
+    {
+        batch_push(&pipe->built, job);
+        return;
+    }
+    (void)batch_start_write(job, NULL);
+    batch_finish(pipe, job);
+}
+
+/**
+ * @brief Pass a job read to the workers, or build it at once when they have no thread
+ *
+ * @param pipe the stages
+ * @param job the job, read or failed
+ * @param worker the worker of the reader, NULL if the workers have their threads
+ */
+static void batch_dispatch(BatchPipeline *pipe, BatchJob *job, BatchWorker *worker)
+{
+    if (!worker)
+    {
+        batch_push(&pipe->read, job);
+        return;
+    }
+    batch_build(worker, job);
+    batch_built(pipe, job);
+}
+
+/**
+ * @brief Reader, on the calling thread: the files of the list into the jobs free, up to `BATCH_RING_DEPTH`
+ * in flight on its ring, so that the next images are read while the workers build the previous ones
+ *
+ * @param pipe the stages
+ * @param worker the worker building the jobs read, NULL if the workers have their threads
+ */
+static void batch_reader(BatchPipeline *pipe, BatchWorker *worker)
+{
+    BatchRing ring;
+    BatchJob *job = NULL;
+    size_t next = 0UL;
+
+    (void)batch_ring_init(&ring, false);
+    while (next < pipe->list->nb_paths || ring.in_flight)
+    {
+        /* a job free for each next file, waiting for one only when no read is in flight */
+        while (next < pipe->list->nb_paths && ring.in_flight < BATCH_RING_DEPTH &&
+               batch_pop(&pipe->empty, &job, !ring.in_flight))
+        {
+            job->input = pipe->list->paths[next++];
+            if (!batch_start_read(pipe, job, &ring))
+            {
+                batch_dispatch(pipe, job, worker);
+            }
+        }
+        if (ring.in_flight && (job = batch_ring_wait(&ring, pipe)))
+        {
+            batch_read_rest(job, true);
+            batch_close(job, false);
+            batch_dispatch(pipe, job, worker);
+        }
+    }
+    batch_ring_free(&ring);
+}
+
+/**
+ * @brief Worker: build the jobs read until the end of the reader
+ *
+ * @param arg the `BatchWorker`
+ * @return void* NULL
+ */
+static void *batch_worker(void *arg)
+{
+    BatchWorker *worker = arg;
+    BatchJob *job = NULL;
+
+    for (;;)
+    {
+        (void)batch_pop(&worker->pipe->read, &job, true);
+        if (!job)
+        {
+            return NULL;
+        }
+        batch_build(worker, job);
+        batch_built(worker->pipe, job);
+    }
+}
+
+/**
+ * @brief Writer: the jobs built into their files, up to `BATCH_RING_DEPTH` in flight on its ring,
+ * until the end of the workers
+ *
+ * @param arg the `BatchPipeline`
+ * @return void* NULL
+ */
+static void *batch_writer(void *arg)
+{
+    BatchPipeline *pipe = arg;
+    BatchRing ring;
+    BatchJob *job = NULL;
+    bool end = false;
+
+    (void)batch_ring_init(&ring, true);
+    while (!end || ring.in_flight)
+    {
+        /* as the reader: waiting for a job only when no write is in flight */
+        while (!end && ring.in_flight < BATCH_RING_DEPTH && batch_pop(&pipe->built, &job, !ring.in_flight))
+        {
+            if (!(end = !job) && !batch_start_write(job, &ring))
+            {
+                batch_finish(pipe, job);
+            }
+        }
+        if (ring.in_flight && (job = batch_ring_wait(&ring, pipe)))
+        {
+            batch_write_rest(job);
+            batch_close(job, true);
+            batch_finish(pipe, job);
+        }
+    }
+    batch_ring_free(&ring);
+    return NULL;
+}
+
+extern int batch_run(const Args *args)
+{
+    BatchList list = {NULL, 0UL, 0UL, 0UL, 0UL};
+    BatchPipeline pipe;
+    BatchWorker *workers = NULL;
+    pthread_t *threads = NULL, writer;
+    struct stat st;
+    const char *ext = NULL;
+    size_t failed = 0UL, i = 0UL, capacity = 0UL;
+    unsigned int nb_workers = 0U, t = 0U, started = 0U;
+    int k = 0;
+    bool done = true;
+
+    if (!args || !args->batch)
+    {
+        fprintf(stderr, "Error: no output directory in batch_run()!\n");
+        return 1;
+    }
+    if (mkdir(args->batch, 0777) && EEXIST != errno)
+    {
+        fprintf(stderr, "Error: cannot create the directory %s!\n", args->batch);
+        return 1;
+    }
+
+    /* the files, the directories and the manifest on stdin, `-` or no input at all */
+    ext = (args->mode) ? (".qtc") : (".pgm");
+    for (k = 0; done && k < args->nb_inputs; ++k)
+    {
+        if (!strcmp(args->inputs[k], "-"))
+        {
+            done = batch_read_manifest(&list, stdin);
+        }
+        else if (!stat(args->inputs[k], &st) && S_ISDIR(st.st_mode))
+        {
+            done = batch_add_directory(&list, args->inputs[k], ext);
+        }
+        else
+        {
+            done = batch_add(&list, NULL, args->inputs[k]);
+        }
+    }
+    if (done && !args->nb_inputs)
+    {
+        done = batch_read_manifest(&list, stdin);
+    }
+    done = done && batch_drop_clashes(&list);
+
+    /* two jobs per worker, one being read and one being written: the bound of the pipeline */
+    nb_workers = (list.nb_paths < args->threads) ? ((unsigned int)list.nb_paths) : (args->threads);
+    nb_workers = (nb_workers < 1U) ? (1U) : (nb_workers);
+    pipe.nb_jobs = 2UL * nb_workers + 2UL;
+    pipe.nb_jobs = (list.nb_paths && list.nb_paths < pipe.nb_jobs) ? (list.nb_paths) : (pipe.nb_jobs);
+    capacity = pipe.nb_jobs + nb_workers + 1UL;
+    pipe.args = args;
+    pipe.list = &list;
+    pipe.writer = false;
+    pipe.failed = 0UL;
+    pipe.jobs = calloc(pipe.nb_jobs, sizeof(*pipe.jobs));
+    workers = calloc(nb_workers, sizeof(*workers));
+    threads = malloc(nb_workers * sizeof(*threads));
+    done = batch_queue_init(&pipe.empty, capacity) && done;
+    done = batch_queue_init(&pipe.read, capacity) && done;
+    done = batch_queue_init(&pipe.built, capacity) && done;
+    if (!done || !pipe.jobs || !workers || !threads || pthread_mutex_init(&pipe.lock, NULL))
+    {
+        fprintf(stderr, "Error: the batch can not start!\n");
+        batch_queue_free(&pipe.empty);
+        batch_queue_free(&pipe.read);
+        batch_queue_free(&pipe.built);
+        for (i = 0UL; i < list.nb_paths; ++i)
+        {
+            free(list.paths[i]);
+        }
+        free(list.paths);
+        free(pipe.jobs);
+        free(workers);
+        free(threads);
+        return 1;
+    }
+    for (i = 0UL; i < pipe.nb_jobs; ++i)
+    {
+        pipe.jobs[i].fd = -1;
+        batch_push(&pipe.empty, &pipe.jobs[i]);
+    }
+
+    /* the reader on the calling thread: the stages that can not start run on it, in turn */
+    pipe.writer = !pthread_create(&writer, NULL, batch_writer, &pipe);
+    for (t = 0U; t < nb_workers; ++t)
+    {
+        workers[t].pipe = &pipe;
+    }
+    for (started = 0U; started < nb_workers; ++started)
+    {
+        if (pthread_create(&threads[started], NULL, batch_worker, &workers[started]))
+        {
+            break;
+        }
+    }
+    batch_reader(&pipe, (started) ? (NULL) : (&workers[0]));
+    for (t = 0U; t < started; ++t)
+    {
+        batch_push(&pipe.read, NULL);
+    }
+    for (t = 0U; t < started; ++t)
+    {
+        (void)pthread_join(threads[t], NULL);
+    }
+    if (pipe.writer)
+    {
+        batch_push(&pipe.built, NULL);
+        (void)pthread_join(writer, NULL);
+    }
+
+    failed = list.unread + list.clashes + pipe.failed;
+    for (t = 0U; t < nb_workers; ++t)
+    {
+        free_qtc_context(&workers[t].ctx);
+        free(workers[t].raster);
+    }
+    for (i = 0UL; i < pipe.nb_jobs; ++i)
+    {
+        free(pipe.jobs[i].output);
+        free(pipe.jobs[i].in);
+        free(pipe.jobs[i].out);
+    }
+    if (failed || args->verbose)
+    {
+        fprintf((failed) ? (stderr) : (stdout), "%lu files, %lu failed\n",
+                (unsigned long)(list.nb_paths + list.clashes), (unsigned long)failed);
+    }
+    (void)pthread_mutex_destroy(&pipe.lock);
+    batch_queue_free(&pipe.empty);
+    batch_queue_free(&pipe.read);
+    batch_queue_free(&pipe.built);
+    for (i = 0UL; i < list.nb_paths; ++i)
+    {
+        free(list.paths[i]);
+    }
+    free(list.paths);
+    free(pipe.jobs);
+    free(threads);
+    free(workers);
+    return (failed) ? (1) : (0);
+}
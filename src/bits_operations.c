@@ -10,23 +10,133 @@
  */
 #include "bits_operations.h"
 
+/* masque des `n` bits de poids faible, `n` dans [0, 32] */
+#define FILEBIT_MASK(n) ((uint64_t)((((uint64_t)1) << (n)) - 1U))
+
 /****************************************************************/
 /****************************************************************/
 /************    LES FONCTIONS POUR BIT OPERATIONS    ***********/
 /****************************************************************/
 /****************************************************************/
 
+/**
+ * @brief Ajoute `n` octets du bloc a la fin du tampon memoire, qui grandit au besoin
+ *
+ * @param f
+ * @param n
+ * @return int: 1 si OK et EOF sinon
+ */
+static int fAjouteMemoire(FileBit *__restrict__ f, size_t n)
+{
+    unsigned char *mem = NULL;
+    size_t cap = (f->memcap) ? (f->memcap) : (FILEBIT_BLOCK_SIZE);
+    while (cap < f->memlen + n)
+    {
+        cap <<= 1UL;
+    }
+    if (cap != f->memcap)
+    {
+        if (!(mem = realloc(f->mem, cap)))
+        {
+            return EOF;
+        }
+        f->mem = mem;
+        f->memcap = cap;
+    }
+    (void)memcpy(f->mem + f->memlen, f->bloc, n);
+    f->memlen += n;
+    return 1;
+}
+
+/**
+ * @brief Ecrit le bloc memoire dans le fichier (ou le tampon memoire) et le remet a zero
+ *
+ * @param f
+ * @return int: 1 si OK et EOF sinon
+ */
+static int fVideBloc(FileBit *__restrict__ f)
+{
+    size_t n = f->pos;
+    f->pos = 0UL;
+    if (!n)
+    {
+        return 1;
+    }
+    if (!f->fich)
+    {
+        return fAjouteMemoire(f, n);
+    }
+    return (fwrite(f->bloc, sizeof(*f->bloc), n, f->fich) == n) ? 1 : EOF;
+}
+
+/**
+ * @brief Transfere les octets complets de l'accumulateur vers le bloc
+ *
+ * @param f
+ * @return int: 1 si OK et EOF sinon
+ */
+static __inline__ int fVideAccumulateur(FileBit *__restrict__ f)
+{
+    int coderetour = 1;
+    while (f->nbBit >= 8U)
+    {
+        if (f->pos == FILEBIT_BLOCK_SIZE && EOF == fVideBloc(f))
+        {
+            coderetour = EOF;
+        }
+        f->nbBit = (unsigned char)(f->nbBit - 8U);
+        f->bloc[f->pos++] = (unsigned char)(f->acc >> f->nbBit);
+    }
+    return coderetour;
+}
+
+/**
+ * @brief Recharge le bloc memoire depuis le fichier
+ *
+ * @param f
+ * @return size_t nombre d'octets lus
+ */
+static size_t fRemplitBloc(FileBit *__restrict__ f)
+{
+    if (!f->fich) /* tampon memoire: tout est deja lu */
+    {
+        return 0UL;
+    }
+    f->pos = 0UL;
+    f->len = fread(f->bloc, sizeof(*f->bloc), FILEBIT_BLOCK_SIZE, f->fich);
+    return f->len;
+}
+
+/**
+ * @brief Complete l'accumulateur octet par octet (au plus 64 bits)
+ *
+ * @param f
+ */
+static __inline__ void fRemplitAccumulateur(FileBit *__restrict__ f)
+{
+    while (f->nbBit <= 56U)
+    {
+        if (f->pos == f->len && !fRemplitBloc(f))
+        {
+            return;
+        }
+        f->acc = (f->acc << 8U) | f->src[f->pos++];
+        f->nbBit = (unsigned char)(f->nbBit + 8U);
+    }
+}
+
 extern unsigned char fBitopen(
     FileBit *__restrict__ f,
     const char *__restrict__ path,
     const char *__restrict__ mode)
 {
-    if (!(f->fich = fopen(path, mode)))
+    FILE *fich = NULL;
+    if (!(fich = fopen(path, mode)))
     {
+        f->fich = NULL;
         return 0;
     }
-    f->stock = 0U;
-    f->nbBit = 0U;
+    fBitinit(f, fich);
     return 1;
 }
 
@@ -35,71 +145,238 @@ extern void fBitinit(
     FILE *__restrict__ fich)
 {
     f->fich = fich;
-    f->stock = 0U;
+    f->acc = 0U;
+    f->pos = 0UL;
+    f->len = 0UL;
     f->nbBit = 0U;
+    f->ecriture = 0U;
+    f->depasse = 0U;
+    f->mem = NULL;
+    f->memlen = 0UL;
+    f->memcap = 0UL;
+    f->src = f->bloc;
+}
+
+extern void fBitinitMem(
+    FileBit *__restrict__ f,
+    const unsigned char *__restrict__ buf,
+    size_t len)
+{
+    fBitinit(f, NULL);
+    f->src = buf;
+    f->len = len;
+}
+
+extern int fBitflush(FileBit *__restrict__ f)
+{
+    int coderetour = 1;
+    if (!f->ecriture)
+    {
+        return 1;
+    }
+    /* decaler a gauche les derniers bits si necessaire */
+    if (f->nbBit % 8U)
+    {
+        f->acc <<= 8U - f->nbBit % 8U;
+        f->nbBit = (unsigned char)(f->nbBit + 8U - f->nbBit % 8U);
+    }
+    coderetour = fVideAccumulateur(f);
+    return (EOF == fVideBloc(f)) ? EOF : coderetour;
 }
 
 extern int fBitclose(FileBit *__restrict__ f)
 {
-    if (f->nbBit != 0)
+    (void)fBitflush(f);
+    if (!f->fich)
     {
-        /* decaler a gauche les derniers bits si necessaire*/
-        if (f->nbBit != 8)
-            f->stock <<= 8 - f->nbBit;
-        fputc(f->stock, f->fich);
+        free(f->mem);
+        f->mem = NULL;
+        f->memlen = f->memcap = 0UL;
+        return 0;
     }
     return fclose(f->fich);
 }
 
-extern int fEcrireBit(FileBit *__restrict__ f, int bit)
+extern int fEcrireBits(FileBit *__restrict__ f, unsigned int valeur, unsigned char n)
 {
-    int coderetour = 1;
-    if (f->nbBit == 8)
+    f->ecriture = 1U;
+    f->acc = (f->acc << n) | (valeur & FILEBIT_MASK(n));
+    f->nbBit = (unsigned char)(f->nbBit + n);
+    /* on garde au plus 31 bits en attente, pour accueillir le champ suivant */
+    if (f->nbBit >= 32U)
     {
-        f->nbBit = 0;
-        coderetour = fputc((int)f->stock, f->fich);
+        return fVideAccumulateur(f);
     }
-    ++f->nbBit;
-    f->stock = (unsigned char)((f->stock << 1) | bit);
-    return coderetour;
+    return 1;
 }
 
-extern int fLireBit(FileBit *__restrict__ f)
+extern int fLireBits(FileBit *__restrict__ f, unsigned char n)
 {
-    int n = 0;
-    if (!f->nbBit)
+    if (f->nbBit < n)
     {
-        if (EOF == (n = fgetc(f->fich)))
+        fRemplitAccumulateur(f);
+        if (f->nbBit < n)
         {
+            f->nbBit = 0U; /* fin de fichier: les derniers bits sont consommes */
+            f->depasse = 1U;
             return EOF;
         }
-        f->stock = (unsigned char)n;
-        f->nbBit = 8;
     }
-    --f->nbBit;
-    return (f->stock >> f->nbBit) & 1;
+    f->nbBit = (unsigned char)(f->nbBit - n);
+    return (int)((f->acc >> f->nbBit) & FILEBIT_MASK(n));
 }
 
-extern void fEcritCharbin(FileBit *__restrict__ f, unsigned char n)
+extern int fEcrireBit(FileBit *__restrict__ f, int bit)
 {
-    int i = 0;
-    unsigned int mask = 0U; /* to test, if mask should be 1 or 0 at the beginning */
-    for (i = 7; i >= 0; --i)
+    return fEcrireBits(f, (unsigned int)bit & 0x1U, 1U);
+}
+
+extern int fLireBit(FileBit *__restrict__ f)
+{
+    return fLireBits(f, 1U);
+}
+
+extern long fPositionOctet(FileBit *__restrict__ f)
+{
+    long fin = 0L;
+    if (!f->fich || (fin = ftell(f->fich)) < 0L)
     {
-        mask = 1U << i;
+        return -1L;
+    }
+    /* les octets du bloc et de l'accumulateur ne sont pas encore lus */
+    return fin - (long)(f->len - f->pos) - (long)(f->nbBit / 8U);
+}
 
-        /* code before:  fEcrireBit(f, (n & mask) != 0); */
-        (void)fEcrireBit(f, (n & mask) != 0); /* ignore return value; we don't need it */
+extern int fAllerOctet(FileBit *__restrict__ f, long position)
+{
+    long debut = 0L;
+    if (!f->fich || (debut = ftell(f->fich)) < 0L)
+    {
+        return EOF;
+    }
+    f->acc = 0U;
+    f->nbBit = 0U;
+    /* debut du bloc en memoire */
+    debut -= (long)f->len;
+    if (position >= debut && position < debut + (long)f->len)
+    {
+        f->pos = (size_t)(position - debut);
+        return 1;
     }
+    f->pos = f->len = 0UL;
+    return (fseek(f->fich, position, SEEK_SET)) ? (EOF) : (1);
+}
+
+extern void fEcritCharbin(FileBit *__restrict__ f, unsigned char n)
+{
+    (void)fEcrireBits(f, n, 8U); /* ignore return value; we don't need it */
 }
 
 extern unsigned char fLireCharbin(FileBit *__restrict__ f)
 {
-    char i = 0;
-    unsigned char c = 0;
-    for (i = 0; i < 8; ++i)
+    return (unsigned char)fLireBits(f, 8U);
+}
+
+extern int fEcrireOctets(FileBit *__restrict__ f, const unsigned char *__restrict__ buf, size_t len)
+{
+    size_t i = 0UL, n = 0UL;
+    int coderetour = 1;
+
+    if (f->nbBit % 8U)
     {
-        c = (unsigned char)((c << 1U) | fLireBit(f));
+        /* flux non aligne: chaque octet passe par l'accumulateur */
+        for (i = 0UL; i < len; ++i)
+        {
+            if (EOF == fEcrireBits(f, buf[i], 8U))
+            {
+                coderetour = EOF;
+            }
+        }
+        return coderetour;
+    }
+
+    f->ecriture = 1U;
+    coderetour = fVideAccumulateur(f);
+    while (len)
+    {
+        if (f->pos == FILEBIT_BLOCK_SIZE && EOF == fVideBloc(f))
+        {
+            coderetour = EOF;
+        }
+        n = FILEBIT_BLOCK_SIZE - f->pos;
+        n = (len < n) ? len : n;
+        (void)memcpy(f->bloc + f->pos, buf, n);
+        f->pos += n;
+        buf += n;
+        len -= n;
+    }
+    return coderetour;
+}
+
+extern size_t fLireOctets(FileBit *__restrict__ f, unsigned char *__restrict__ buf, size_t len)
+{
+    size_t i = 0UL, n = 0UL;
+    int c = 0;
+
+    if (f->nbBit % 8U)
+    {
+        /* flux non aligne: chaque octet passe par l'accumulateur */
+        for (i = 0UL; i < len && EOF != (c = fLireBits(f, 8U)); ++i)
+        {
+            buf[i] = (unsigned char)c;
+        }
+        return i;
+    }
+
+    /* d'abord les octets deja presents dans l'accumulateur */
+    for (i = 0UL; i < len && f->nbBit; ++i)
+    {
+        buf[i] = (unsigned char)fLireBits(f, 8U);
+    }
+    while (i < len)
+    {
+        if (f->pos == f->len && !fRemplitBloc(f))
+        {
+            break;
+        }
+        n = f->len - f->pos;
+        n = (len - i < n) ? len - i : n;
+        (void)memcpy(buf + i, f->src + f->pos, n);
+        f->pos += n;
+        i += n;
+    }
+    return i;
+}
+
+extern size_t fSauterOctets(FileBit *__restrict__ f, size_t len)
+{
+    size_t i = 0UL, n = 0UL;
+
+    /* d'abord les octets deja presents dans l'accumulateur, puis dans le bloc */
+    for (i = 0UL; i < len && f->nbBit >= 8U; ++i)
+    {
+        (void)fLireBits(f, 8U);
+    }
+    n = f->len - f->pos;
+    n = (len - i < n) ? len - i : n;
+    f->pos += n;
+    i += n;
+
+    /* le reste est saute dans le fichier, sans le lire si possible */
+    if (i < len && f->fich && !fseek(f->fich, (long)(len - i), SEEK_CUR))
+    {
+        return len;
+    }
+    while (i < len)
+    {
+        if (f->pos == f->len && !fRemplitBloc(f))
+        {
+            break;
+        }
+        n = f->len - f->pos;
+        n = (len - i < n) ? len - i : n;
+        f->pos += n;
+        i += n;
     }
-    return c;
+    return i;
 }
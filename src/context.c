@@ -0,0 +1,131 @@
+/**
+ * @file src/context.c
+ * @authors MUNAITPASOV M. & BENVENISTE A.
+ * @brief Codec context implementation
+ * @version 0.1
+ * @date 2025-01-09
+ *
+ * @copyright licence MIT Copyright (c) 2025
+ */
+
+#include "context.h"
+#include "codec.h"
+
+/**
+ * @brief Default allocator of a context
+ *
+ * @param user unused
+ * @param size the size of the block
+ * @return void* the block, NULL on failure
+ */
+static void *qtc_default_alloc(void *user, size_t size)
+{
+    (void)user;
+    return malloc(size);
+}
+
+/**
+ * @brief Default release of a context
+ *
+ * @param user unused
+ * @param block the block
+ */
+static void qtc_default_release(void *user, void *block)
+{
+    (void)user;
+    free(block);
+}
+
+extern bool make_qtc_context(QtcContext *ctx, unsigned char max_level, const QtcAllocator *allocator)
+{
+    size_t size = DETERMINE_QTREE_SIZE((size_t)max_level);
+    if (!ctx || max_level >= QTC_LEVELS || (allocator && (!allocator->alloc || !allocator->release)))
+    {
+        fprintf(stderr, "Error: wrong arguments in make_qtc_context()!\n");
+        return false;
+    }
+    (void)memset(ctx, 0, sizeof(*ctx));
+    ctx->allocator.alloc = (allocator) ? (allocator->alloc) : (qtc_default_alloc);
+    ctx->allocator.release = (allocator) ? (allocator->release) : (qtc_default_release);
+    ctx->allocator.user = (allocator) ? (allocator->user) : (NULL);
+    ctx->max_level = max_level;
+    ctx->color = ctx->allocator.alloc(ctx->allocator.user, size * sizeof(*ctx->color));
+    ctx->eu = ctx->allocator.alloc(ctx->allocator.user, size * sizeof(*ctx->eu));
+    ctx->edges = ctx->allocator.alloc(ctx->allocator.user, QTREE_EDGE_SIZE((size_t)max_level));
+    if (!ctx->color || !ctx->eu || !ctx->edges)
+    {
+        fprintf(stderr, "Memory allocation error for the quad tree !\n");
+        free_qtc_context(ctx);
+        return false;
+    }
+    return true;
+}
+
+extern void free_qtc_context(QtcContext *ctx)
+{
+    void *blocks[7];
+    unsigned int i = 0U;
+    if (!ctx || !ctx->allocator.release)
+    {
+        return;
+    }
+    blocks[0] = ctx->color;
+    blocks[1] = ctx->eu;
+    blocks[2] = ctx->variance;
+    blocks[3] = ctx->file;
+    blocks[4] = ctx->pixels;
+    blocks[5] = ctx->edges;
+    blocks[6] = ctx->scratch;
+    for (i = 0U; i < 7U; ++i)
+    {
+        if (blocks[i])
+        {
+            ctx->allocator.release(ctx->allocator.user, blocks[i]);
+        }
+    }
+    ctx->color = ctx->eu = ctx->file = ctx->pixels = ctx->edges = ctx->scratch = NULL;
+    ctx->variance = NULL;
+    ctx->file_size = ctx->file_capacity = ctx->pixels_capacity = ctx->scratch_capacity = 0UL;
+}
+
+extern void *qtc_context_reserve(QtcContext *ctx, void *block, size_t *capacity, size_t size)
+{
+    if (block && size <= *capacity)
+    {
+        return block;
+    }
+    if (block)
+    {
+        ctx->allocator.release(ctx->allocator.user, block);
+    }
+    size += size >> 2UL;
+    *capacity = (NULL != (block = ctx->allocator.alloc(ctx->allocator.user, size))) ? (size) : (0UL);
+    return block;
+}
+
+extern void *qtc_scratch(QtcContext *ctx, size_t size)
+{
+    size = (size) ? (size) : (1UL);
+    if (!ctx)
+    {
+        return malloc(size);
+    }
+    return ctx->scratch = qtc_context_reserve(ctx, ctx->scratch, &ctx->scratch_capacity, size);
+}
+
+extern void qtc_scratch_release(QtcContext *ctx, void *block)
+{
+    if (!ctx)
+    {
+        free(block);
+    }
+}
+
+extern bool qtc_context_file(QtcContext *ctx, FileBit *dest, size_t size)
+{
+    ctx->file = qtc_context_reserve(ctx, ctx->file, &ctx->file_capacity, size);
+    fBitinit(dest, NULL);
+    dest->mem = ctx->file;
+    dest->memcap = ctx->file_capacity;
+    return NULL != ctx->file;
+}
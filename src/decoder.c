@@ -0,0 +1,357 @@
+/**
+ * @file src/decoder.c
+ * @authors MUNAITPASOV M. & BENVENISTE A.
+ * @brief Push decoder implementation
+ * @version 0.1
+ * @date 2025-01-09
+ *
+ * @copyright licence MIT Copyright (c) 2025
+ */
+
+#include "decoder.h"
+#include "codec.h"
+
+/* parts of a file read by a `QtcDecoder`, in the order of the file */
+#define QTC_DECODER_HEADER 0U  /* the header, down to the level */
+#define QTC_DECODER_DEPTH 1U   /* Q2/Q3: the depth of the chunks */
+#define QTC_DECODER_INDEX 2U   /* Q2/Q3: the sizes of the streams */
+#define QTC_DECODER_STREAMS 3U /* Q2/Q3: the streams, each one once whole */
+#define QTC_DECODER_NODES 4U   /* Q1: the nodes, each one once its bits are there */
+#define QTC_DECODER_FAILED 5U  /* not a .qtc file, or a memory allocation error */
+
+/* longest header kept by a `QtcDecoder` before it gives up: no comment is that long */
+#define QTC_DECODER_HEADER_MAX 0x1000UL
+
+static bool qtc_decoder_keep(QtcDecoder *dec, const unsigned char *data, size_t size);
+
+static bool qtc_decoder_take(QtcDecoder *dec, const unsigned char **data, size_t *size, size_t need,
+                             const unsigned char **part);
+
+static size_t qtc_header_length(const unsigned char *data, size_t size);
+
+static void qtc_decoder_header(QtcDecoder *dec, const unsigned char **data, size_t *size);
+
+static void qtc_decoder_streams(QtcDecoder *dec, const unsigned char **data, size_t *size);
+
+static void qtc_decoder_nodes(QtcDecoder *dec, const unsigned char *data, size_t size);
+
+extern bool make_qtc_decoder(QtcDecoder *dec, QtcContext *ctx)
+{
+    if (!dec || (ctx && !ctx->color))
+    {
+        fprintf(stderr, "Error: wrong arguments in make_qtc_decoder()!\n");
+        return false;
+    }
+    (void)memset(dec, 0, sizeof(*dec));
+    dec->ctx = ctx;
+    dec->step = QTC_DECODER_HEADER;
+    return true;
+}
+
+extern void free_qtc_decoder(QtcDecoder *dec)
+{
+    if (!dec)
+    {
+        return;
+    }
+    if (!dec->ctx) /* the arenas of a context are kept */
+    {
+        free_qtree(&dec->tree);
+    }
+    free(dec->sizes);
+    free(dec->pending);
+    (void)memset(dec, 0, sizeof(*dec));
+}
+
+extern int qtc_decoder_push(QtcDecoder *dec, const unsigned char *data, size_t size)
+{
+    const unsigned char *part = NULL;
+    size_t i = 0UL;
+
+    if (!dec || (!data && size) || QTC_DECODER_FAILED == dec->step)
+    {
+        return EOF;
+    }
+    if (dec->done) /* the bytes after the last node are not part of the file */
+    {
+        return (int)dec->levels;
+    }
+    if (QTC_DECODER_HEADER == dec->step)
+    {
+        qtc_decoder_header(dec, &data, &size);
+    }
+    if (QTC_DECODER_DEPTH == dec->step && qtc_decoder_take(dec, &data, &size, 1UL, &part))
+    {
+        dec->depth = part[0];
+        dec->step = QTC_DECODER_FAILED;
+        if (dec->depth <= dec->tree.niveau) /* and the number of chunks fits in a shift */
+        {
+            dec->nb_streams = (1UL << (2UL * dec->depth)) + 1UL;
+            dec->step = (NULL != (dec->sizes = malloc(dec->nb_streams * sizeof(*dec->sizes)))) ? (QTC_DECODER_INDEX)
+                                                                                                : (QTC_DECODER_FAILED);
+        }
+    }
+    if (QTC_DECODER_INDEX == dec->step && qtc_decoder_take(dec, &data, &size, 4UL * dec->nb_streams, &part))
+    {
+        for (i = 0UL; i < dec->nb_streams; ++i, part += 4)
+        {
+            dec->sizes[i] = ((size_t)part[0] << 24UL) | ((size_t)part[1] << 16UL) | ((size_t)part[2] << 8UL) |
+                            (size_t)part[3];
+        }
+        dec->step = QTC_DECODER_STREAMS;
+    }
+    if (QTC_DECODER_STREAMS == dec->step)
+    {
+        qtc_decoder_streams(dec, &data, &size);
+    }
+    if (QTC_DECODER_NODES == dec->step)
+    {
+        qtc_decoder_nodes(dec, data, size);
+    }
+    return (QTC_DECODER_FAILED == dec->step) ? (EOF) : ((int)dec->levels);
+}
+
+extern bool qtc_decoder_view(const QtcDecoder *dec, QTree *view)
+{
+    unsigned char shift = 0U;
+
+    if (!dec || !view || !dec->levels)
+    {
+        return false;
+    }
+    /* the nodes of the last complete level are the leaves of a thumbnail, as with `max_level` */
+    *view = dec->tree;
+    view->niveau = (unsigned char)(dec->levels - 1U);
+    shift = (unsigned char)(dec->tree.niveau - view->niveau);
+    view->width = (unsigned int)(((size_t)dec->tree.width + (1UL << shift) - 1UL) >> shift);
+    view->height = (unsigned int)(((size_t)dec->tree.height + (1UL << shift) - 1UL) >> shift);
+    return true;
+}
+
+/**
+ * @brief Append bytes to those kept by a decoder, its buffer doubled as needed
+ *
+ * @param dec the decoder
+ * @param data the bytes
+ * @param size the number of bytes
+ * @return true on success
+ * @return false on a memory allocation error
+ */
+static bool qtc_decoder_keep(QtcDecoder *dec, const unsigned char *data, size_t size)
+{
+    unsigned char *pending = NULL;
+    size_t capacity = (dec->pending_capacity) ? (dec->pending_capacity) : (QTC_HEADER_MAX);
+
+    while (capacity < dec->pending_size + size)
+    {
+        capacity <<= 1UL;
+    }
+    if (capacity != dec->pending_capacity)
+    {
+        if (!(pending = realloc(dec->pending, capacity)))
+        {
+            return false;
+        }
+        dec->pending = pending;
+        dec->pending_capacity = capacity;
+    }
+    if (size)
+    {
+        (void)memcpy(dec->pending + dec->pending_size, data, size);
+    }
+    dec->pending_size += size;
+    return true;
+}
+
+/**
+ * @brief Gather the `need` bytes of a part of the file: read in the slice when it holds the whole part,
+ * else kept from slice to slice until the last one arrives
+ *
+ * @param dec the decoder
+ * @param data the slice, moved after the bytes taken
+ * @param size the bytes left in the slice, updated
+ * @param need the size of the part
+ * @param part the part, valid until the next part is taken
+ * @return true if the part is whole
+ * @return false if bytes are missing, or on a memory allocation error: the decoder has then failed
+ */
+static bool qtc_decoder_take(QtcDecoder *dec, const unsigned char **data, size_t *size, size_t need,
+                             const unsigned char **part)
+{
+    size_t n = need - dec->pending_size;
+
+    if (!dec->pending_size && *size >= need)
+    {
+        *part = *data;
+        *data += need;
+        *size -= need;
+        return true;
+    }
+    n = (*size < n) ? (*size) : (n);
+    if (!qtc_decoder_keep(dec, *data, n))
+    {
+        dec->step = QTC_DECODER_FAILED;
+        return false;
+    }
+    *data += n;
+    *size -= n;
+    if (dec->pending_size < need)
+    {
+        return false;
+    }
+    *part = dec->pending;
+    dec->pending_size = 0UL; /* the part is read before the next one is kept */
+    return true;
+}
+
+/**
+ * @brief Length of the header of a .qtc file, down to the level: the magic number, the comments,
+ * the size of a rectangular image, then the level
+ *
+ * @param data the first bytes of the file
+ * @param size the number of bytes
+ * @return size_t the length of the header, 0 if it does not end in these bytes
+ */
+static size_t qtc_header_length(const unsigned char *data, size_t size)
+{
+    const unsigned char *end = NULL;
+    size_t pos = 3UL; /* "Qn\n" */
+    bool digits = false;
+
+    while (pos < size)
+    {
+        digits = data[pos] >= '0' && data[pos] <= '9';
+        if ('#' != data[pos] && !digits) /* no level is a '#' nor a digit */
+        {
+            return pos + 1UL;
+        }
+        if (!(end = memchr(data + pos, '\n', size - pos)))
+        {
+            return 0UL;
+        }
+        pos = (size_t)(end - data) + 1UL;
+        if (digits) /* the width and the height, then the level */
+        {
+            return (pos < size) ? (pos + 1UL) : (0UL);
+        }
+    }
+    return 0UL;
+}
+
+/**
+ * @brief Read the header of the file once it is whole, and allocate the tree
+ *
+ * @param dec the decoder
+ * @param data the slice, moved after the header
+ * @param size the bytes left in the slice, updated
+ */
+static void qtc_decoder_header(QtcDecoder *dec, const unsigned char **data, size_t *size)
+{
+    FileBit in = {0};
+    unsigned long width = 0UL, height = 0UL;
+    size_t kept = dec->pending_size, n = QTC_DECODER_HEADER_MAX - kept, length = 0UL;
+    unsigned char niveau = 0U;
+
+    /* the header is short: it is kept whole, and the bytes after it taken back */
+    n = (*size < n) ? (*size) : (n);
+    if (!qtc_decoder_keep(dec, *data, n))
+    {
+        dec->step = QTC_DECODER_FAILED;
+        return;
+    }
+    if (!(length = qtc_header_length(dec->pending, dec->pending_size)))
+    {
+        *data += n;
+        *size -= n;
+        dec->step = (QTC_DECODER_HEADER_MAX == dec->pending_size) ? (QTC_DECODER_FAILED) : (QTC_DECODER_HEADER);
+        return;
+    }
+    *data += length - kept;
+    *size -= length - kept;
+    dec->pending_size = 0UL;
+
+    fBitinitMem(&in, dec->pending, length);
+    if (QTC_ALL_LEVELS == (niveau = read_qtc_header(&in, NULL, &dec->version, &width, &height)) ||
+        !make_qtree_from(&dec->tree, dec->ctx, QTC_GREY_LEVEL, niveau, false))
+    {
+        dec->step = QTC_DECODER_FAILED;
+        return;
+    }
+    dec->tree.width = (unsigned int)width;
+    dec->tree.height = (unsigned int)height;
+    dec->step = ('1' == dec->version) ? (QTC_DECODER_NODES) : (QTC_DECODER_DEPTH);
+}
+
+/**
+ * @brief Read the streams of a Q2 or Q3 file whole in the slice, the top one then the chunks in the
+ * order of the index. A range coded stream cannot be left midway: each one is read once whole.
+ *
+ * @param dec the decoder
+ * @param data the slice, moved after the streams read
+ * @param size the bytes left in the slice, updated
+ */
+static void qtc_decoder_streams(QtcDecoder *dec, const unsigned char **data, size_t *size)
+{
+    FileBit bits = {0};
+    const unsigned char *part = NULL;
+
+    while (dec->next < dec->nb_streams && qtc_decoder_take(dec, data, size, dec->sizes[dec->next], &part))
+    {
+        fBitinitMem(&bits, part, dec->sizes[dec->next]);
+        if (!qtc_read_stream(&dec->tree, &bits, '3' == dec->version, NULL, dec->depth,
+                             (dec->next) ? (dec->next - 1UL) : (QTC_TOP_STREAM), dec->tree.niveau))
+        {
+            dec->step = QTC_DECODER_FAILED;
+            return;
+        }
+        /* the top stream holds the levels down to the roots of the chunks, the chunks all the others */
+        dec->levels = (unsigned char)((++dec->next < dec->nb_streams) ? (dec->depth + 1U) : (dec->tree.niveau + 1U));
+    }
+    dec->done = dec->next == dec->nb_streams;
+}
+
+/**
+ * @brief Read the nodes of a Q1 file, in BFS order, while the bits of the slice hold the next one.
+ * The bits left, fewer than a node needs, are kept for the next slice.
+ *
+ * @param dec the decoder
+ * @param data the slice
+ * @param size the number of bytes of the slice
+ */
+static void qtc_decoder_nodes(QtcDecoder *dec, const unsigned char *data, size_t size)
+{
+    FileBit in = {0};
+    QTree *tree = &dec->tree;
+    size_t end = DETERMINE_LEVEL_OFFSET((size_t)tree->niveau + 1UL), need = 0UL, i = 0UL;
+
+    fBitinitMem(&in, data, size);
+    in.acc = dec->acc;
+    in.nbBit = dec->nb_bits;
+    for (i = dec->next; i < end; ++i)
+    {
+        /* the bits of the node, at most: its color unless computed, `e` and `u` unless a leaf */
+        need = 0UL;
+        if (!i || (!QTREE_U(tree, (i - 1UL) / MAX_CHILD) && !is_outside(tree, i, dec->depth)))
+        {
+            need = ((color_written(tree, i, dec->depth)) ? (8UL) : (0UL)) + ((dec->depth < tree->niveau) ? (3UL) : (0UL));
+        }
+        if (in.nbBit + 8UL * (in.len - in.pos) < need)
+        {
+            break;
+        }
+        qtc_read_node(tree, &in, i, dec->depth);
+        if (i + 1UL == DETERMINE_LEVEL_OFFSET((size_t)dec->depth + 1UL))
+        {
+            dec->levels = ++dec->depth;
+        }
+    }
+    dec->next = i;
+    dec->done = dec->next == end;
+    while (!dec->done && in.pos < in.len) /* at most a byte */
+    {
+        in.acc = (in.acc << 8U) | in.src[in.pos++];
+        in.nbBit = (unsigned char)(in.nbBit + 8U);
+    }
+    dec->acc = in.acc;
+    dec->nb_bits = in.nbBit;
+}
@@ -47,19 +47,25 @@ static void generate_grid_from_qtree_recursive(QTree *qtree, Pixmap *pix,
 {
     unsigned int i = 0U, j = 0U, child_index = 0x0U, size = 1U << niveau;
 
-    if (niveau > 0 && qtree->nodes[index].u)
+    /* outside of the image, when it is not a square */
+    if (line >= pix->height || col >= pix->width)
     {
-        for (i = 0; i < size; ++i)
+        return;
+    }
+
+    if (niveau > 0 && QTREE_U(qtree, index))
+    {
+        for (i = 0; i < size && line + i < pix->height; ++i)
         {
-            for (j = 0; j < size; ++j)
+            for (j = 0; j < size && col + j < pix->width; ++j)
             {
                 if (!i || !j)
                 {
-                    pix->data[(line + i) * pix->width + (col + j)] = 0U;
+                    pix->data[(size_t)(line + i) * pix->width + (col + j)] = 0U;
                 }
                 else
                 {
-                    pix->data[(line + i) * pix->width + (col + j)] = 255U;
+                    pix->data[(size_t)(line + i) * pix->width + (col + j)] = 255U;
                 }
             }
         }
@@ -68,7 +74,7 @@ static void generate_grid_from_qtree_recursive(QTree *qtree, Pixmap *pix,
 
     if (!niveau)
     {
-        pix->data[line * pix->width + col] = !(index % 2) ? (255U) : (0U);
+        pix->data[(size_t)line * pix->width + col] = !(index % 2) ? (255U) : (0U);
         return;
     }
 
@@ -89,14 +95,15 @@ extern void generate_grid_from_quadtree(QTree *qtree, Pixmap *pix)
         return;
     }
     (void)strcpy(pix->magic_number, "P5");
-    pix->height = pix->width = (unsigned short)(1UL << (qtree->niveau));
-    pix->data = malloc(pix->width * pix->height * sizeof(*pix->data));
+    pix->width = qtree->width;
+    pix->height = qtree->height;
+    pix->data = malloc((size_t)pix->width * pix->height * sizeof(*pix->data));
     if (!pix->data)
     {
         fprintf(stderr, "Error: memory allocation error in pixmap_from_quadtree()!\n");
         return;
     }
     pix->grey_level = QTC_GREY_LEVEL;
-    (void)memset(pix->data, 0, pix->width * pix->height * sizeof(*pix->data));
+    (void)memset(pix->data, 0, (size_t)pix->width * pix->height * sizeof(*pix->data));
     generate_grid_from_qtree_recursive(qtree, pix, 0U, qtree->niveau, 0U, 0U);
 }
@@ -12,19 +12,139 @@
 #include "qtc.h"
 /* #include "grid.h" */
 
+/**
+ * @brief Name of the file of one alpha of a sweep
+ * For exemple: "QTC/out.qtc" and 1.2 -> "QTC/out_a1.20.qtc"
+ *
+ * @param src the output file given by `-o`
+ * @param alpha the alpha of the file
+ * @return char * the new string, NULL on error
+ */
+static char *change_filename_to_alpha(const char *src, double alpha)
+{
+    size_t len = 0UL;
+    char *new_str = NULL;
+    if (!src || (len = strlen(src)) < 4UL)
+    {
+        fprintf(stderr, "Error: source is too short in change_filename_to_alpha()!\n");
+        return NULL;
+    }
+    /* "_a" + at most "2.00" before ".qtc", and '\0' */
+    if (!(new_str = malloc((len + 7UL) * sizeof(*new_str))))
+    {
+        fprintf(stderr, "Error: memory allocation failed!\n");
+        return NULL;
+    }
+    (void)memcpy(new_str, src, len - 4UL);
+    (void)sprintf(new_str + len - 4UL, "_a%.2f%s", alpha, src + len - 4UL);
+    return new_str;
+}
+
+/**
+ * @brief Write one .qtc file per alpha of `args->alphas`, from the tree built once
+ *
+ * @param args the arguments, with several alphas
+ * @param tree the quadtree, built with the variance
+ * @return int 0 if OK, 1 on error
+ */
+static int sweep_pgm_to_qtc(Args *args, QTree *tree)
+{
+    char *file_names[QTC_MAX_ALPHAS] = {NULL};
+    unsigned int k = 0U;
+    int err = 0;
+
+    for (k = 0U; k < args->nb_alphas; ++k)
+    {
+        if (!(file_names[k] = change_filename_to_alpha(args->file_name_output, args->alphas[k])))
+        {
+            err = 1;
+        }
+        else if (args->verbose)
+        {
+            fprintf(stdout, "alpha %.2f: %s\n", args->alphas[k], file_names[k]);
+        }
+    }
+    if (!err)
+    {
+        err = (create_qtc_files_sweep(tree, args->alphas, file_names, args->nb_alphas, args->threads,
+                                      args->format)) ? (0) : (1);
+    }
+    for (k = 0U; k < args->nb_alphas; ++k)
+    {
+        free(file_names[k]);
+    }
+    return err;
+}
+
 int from_pgm_to_qtc(Args *args, Pixmap *pix, QTree *tree)
 {
     Pixmap grid = {0};
     char *seg_grid_file = NULL;
+    double psnr = 0.0;
     unsigned char level = 0;
+    int err = 0;
+
+    /* by bands: neither the pixmap nor the whole tree are in memory */
+    if (args->stream)
+    {
+        return (create_qtc_file_streaming(args->file_name_input, args->file_name_output, args->stream, args->alpha,
+                                          args->threads, args->format)) ? (0) : (1);
+    }
 
     init_pixmap(pix, args->file_name_input);
+    if (!pix->data) /* missing, truncated or not a .pgm file: already reported */
+    {
+        return 1;
+    }
 
-    level = determine_qtree_level(pix);
+    if (QTC_ALL_LEVELS == (level = determine_qtree_level(pix))) /* too large for a quadtree */
+    {
+        free_pixmap(pix);
+        return 1;
+    }
 
-    (void)make_qtree(tree, pix->grey_level, level);
+    /* the variance plane is only needed when filtering, the errors by the rate-distortion filtering:
+     * on a memory allocation error, already reported, the output file is not created */
+    if (!make_qtree(tree, pix->grey_level, level, args->alpha >= 0.1 || args->target_bytes || args->nb_alphas > 1U) ||
+        ((args->psnr > 0.0 || args->lambda >= 0.0) && !make_qtree_sse(tree)))
+    {
+        free_pixmap(pix);
+        free_qtree(tree);
+        return 1;
+    }
 
-    init_quadtree(tree, pix);
+    init_quadtree_parallel(tree, pix, args->threads);
+
+    if (args->nb_alphas > 1U) /* a sweep: the tree is left unfiltered, each file filters its own copy */
+    {
+        err = sweep_pgm_to_qtc(args, tree);
+        free_pixmap(pix);
+        free_qtree(tree);
+        return err;
+    }
+
+    if (args->psnr > 0.0 || args->lambda >= 0.0) /* rate-distortion filtering */
+    {
+        psnr = (args->psnr > 0.0) ? (rd_filter_quadtree_psnr(tree, args->psnr)) : (rd_filter_quadtree(tree, args->lambda));
+        if (args->verbose)
+        {
+            fprintf(stdout, "PSNR %.2f dB\n", psnr);
+        }
+    }
+
+    if (args->target_bytes) /* a size budget: the alpha is searched on the tree built once */
+    {
+        if ((args->alpha = search_alpha_for_size(tree, args->target_bytes, args->format)) < 0.0)
+        {
+            free_pixmap(pix);
+            free_qtree(tree);
+            return 1;
+        }
+        if (args->verbose)
+        {
+            fprintf(stdout, "alpha %.2f for a target of %lu bytes\n", args->alpha, (unsigned long)args->target_bytes);
+        }
+    }
 
     if (args->alpha >= 0.1) /* filtering */
     {
@@ -42,20 +162,74 @@ int from_pgm_to_qtc(Args *args, Pixmap *pix, QTree *tree)
         free_pixmap(&grid);
     }
 
-    create_qtc_file(tree, pix->width, args->file_name_output);
+    if (args->format > 1U)
+    {
+        err = (create_qtc_file_chunked(tree, args->file_name_output, args->threads, args->format)) ? (0) : (1);
+    }
+    else
+    {
+        err = (create_qtc_file(tree, args->file_name_output)) ? (0) : (1);
+    }
 
     free_pixmap(pix);
     free_qtree(tree);
-    return 0;
+    return err;
 }
 
 int from_qtc_to_pgm(Args *args, Pixmap *pix, QTree *tree)
 {
     Pixmap grid = {0};
+    QtcRoi roi = {0U, 0U, 0U, 0U};
     char *seg_grid_file = NULL;
-    init_quadtree_from_file(tree, args->file_name_input);
+    PgmStream out = {0};
+    unsigned int width = 0U, height = 0U;
+    bool done = false;
+
+    /* by bands: each band of lines is written as soon as it is decoded */
+    if (args->stream)
+    {
+        if (!(out.file = fopen(args->file_name_output, "wb")))
+        {
+            fprintf(stderr, "Error: cannot open %s in from_qtc_to_pgm()!\n", args->file_name_output);
+            return 1;
+        }
+        out.ascii = args->ascii;
+        done = decode_qtc_file_streaming(args->file_name_input, args->stream, args->threads, write_pgm_band, &out);
+        done = (0 == fclose(out.file)) && done;
+        free(out.text);
+        return (done) ? (0) : (1);
+    }
 
-    pixmap_from_quadtree(tree, pix);
+    if (args->roi[2]) /* a region only */
+    {
+        roi.x = args->roi[0];
+        roi.y = args->roi[1];
+        roi.w = args->roi[2];
+        roi.h = args->roi[3];
+        /* checked against the header first: a region outside of the image writes nothing */
+        if (!qtc_file_image_size(args->file_name_input, &width, &height))
+        {
+            return 1;
+        }
+        if (roi.x >= width || roi.y >= height)
+        {
+            fprintf(stderr, "Error: the region at %u,%u is outside of the image of %ux%u pixels\n", roi.x, roi.y,
+                    width, height);
+            return 1;
+        }
+        init_quadtree_from_file_roi(tree, args->file_name_input, args->threads, &roi);
+        pixmap_from_quadtree_roi(tree, pix, &roi);
+    }
+    else if (QTC_ALL_LEVELS == args->max_level && !args->seg_grid) /* the leaves straight into the pixels */
+    {
+        init_pixmap_from_file(pix, args->file_name_input, args->threads);
+    }
+    else
+    {
+        /* all the levels, or the first ones for a thumbnail */
+        init_quadtree_from_file_max_level(tree, args->file_name_input, args->threads, args->max_level);
+        pixmap_from_quadtree(tree, pix);
+    }
 
     if (args->seg_grid)
     {
@@ -69,6 +243,15 @@ int from_qtc_to_pgm(Args *args, Pixmap *pix, QTree *tree)
 
         free_pixmap(&grid);
     }
+    if (!pix->data) /* the errors are already reported */
+    {
+        free_qtree(tree);
+        return 1;
+    }
+    if (args->ascii)
+    {
+        (void)strcpy(pix->magic_number, "P2");
+    }
     from_pixmap_to_pgm(pix, args->file_name_output);
 
     free_pixmap(pix);
@@ -98,6 +281,10 @@ int main(int argc, char *argv[])
     {
         return 1;
     }
+    if (args.batch) /* many files, on a pool of workers */
+    {
+        return batch_run(&args);
+    }
     if (!args.mode) /* PGM to QTC: encode */
     {
         return from_pgm_to_qtc(&args, &pix, &tree);
@@ -33,6 +33,16 @@ static void handle_u_option(Args *__restrict__ args, char *__restrict__ optarg);
 static void handle_i_option(Args *__restrict__ args, char *__restrict__ optarg);
 static void handle_o_option(Args *__restrict__ args, char *__restrict__ optarg);
 static void handle_a_option(Args *__restrict__ args, char *__restrict__ optarg);
+static void handle_j_option(Args *__restrict__ args, char *__restrict__ optarg);
+static void handle_f_option(Args *__restrict__ args, char *__restrict__ optarg);
+static void handle_r_option(Args *__restrict__ args, char *__restrict__ optarg);
+static void handle_l_option(Args *__restrict__ args, char *__restrict__ optarg);
+static void handle_t_option(Args *__restrict__ args, char *__restrict__ optarg);
+static void handle_p_option(Args *__restrict__ args, char *__restrict__ optarg);
+static void handle_L_option(Args *__restrict__ args, char *__restrict__ optarg);
+static void handle_s_option(Args *__restrict__ args, char *__restrict__ optarg);
+static void handle_A_option(Args *__restrict__ args, char *__restrict__ optarg);
+static void handle_b_option(Args *__restrict__ args, char *__restrict__ optarg);
 static void handle_unknown_option(Args *__restrict__ args, char *__restrict__ optarg);
 
 OptionHandler option_handlers[] = {
@@ -44,14 +54,29 @@ OptionHandler option_handlers[] = {
     {'i', handle_i_option},
     {'o', handle_o_option},
     {'a', handle_a_option},
+    {'j', handle_j_option},
+    {'f', handle_f_option},
+    {'r', handle_r_option},
+    {'l', handle_l_option},
+    {'t', handle_t_option},
+    {'p', handle_p_option},
+    {'L', handle_L_option},
+    {'s', handle_s_option},
+    {'A', handle_A_option},
+    {'b', handle_b_option},
     {'?', handle_unknown_option},
     {0, NULL}};
 
-static bool defined_mode = false;      /* `true` - if `encodeur` or `decodeur` is defined, false by default */
-static bool defined_extension = false; /* `true` - if input file is defined, false by default */
-static bool defined_output = false;    /* `true` - if output file is defined, false by default */
-static bool is_valid_input = true;
-static bool is_valid_output = true;
+/* long options, handled as their short version */
+static const struct option long_options[] = {
+    {"max-level", required_argument, NULL, 'l'},
+    {"target-bytes", required_argument, NULL, 't'},
+    {"psnr", required_argument, NULL, 'p'},
+    {"lambda", required_argument, NULL, 'L'},
+    {"stream", required_argument, NULL, 's'},
+    {"ascii", no_argument, NULL, 'A'},
+    {"batch", required_argument, NULL, 'b'},
+    {NULL, 0, NULL, 0}};
 
 static __inline__ bool is_double(char *__restrict__ str)
 {
@@ -65,11 +90,27 @@ static __inline__ void init_args(Args *__restrict__ args)
     args->file_name_input = NULL;
     args->file_name_output = NULL;
     args->alpha = 0.0;
+    args->nb_alphas = 0U;
+    args->threads = 1U;
+    args->format = 1U;
+    args->roi[0] = args->roi[1] = args->roi[2] = args->roi[3] = 0U;
+    args->max_level = 0xFFU;
+    args->target_bytes = 0UL;
+    args->psnr = 0.0;
+    args->lambda = -1.0;
+    args->stream = 0U;
+    args->batch = NULL;
+    args->inputs = NULL;
+    args->nb_inputs = 0;
     args->mode = false;
     args->seg_grid = false;
+    args->ascii = false;
     args->verbose = false;
     args->help = false;
     args->err = false;
+    args->defined_mode = false;
+    args->defined_extension = false;
+    args->defined_output = false;
 }
 
 extern void option_print_help(void)
@@ -90,8 +131,27 @@ extern void option_print_help_verbose(void)
             "\t-u,\tchosen mode is `decodeur` expects `.qtc` file\n"
             "\t-g,\tsegmentation grid\n"
             "\t-i,\tinput.{pgm | qtc}, input file depending from chosed mode\n"
-            "\t-o,\toutput.{pgm | qtc}, output file depending from chosed mode\n"
-            "\t-a,\t`double` in [0.0, 2.0], filtering rate for `encodeur`\n");
+            "\t-o,\toutput.{pgm | qtc}, output file depending from chosed mode\n");
+    fprintf(stdout,
+            "\t-a,\t`double` in [0.0, 2.0], filtering rate for `encodeur`, or `a1,a2,...` for one file per alpha\n"
+            "\t-j,\t`int` in [1, 1024], number of threads building the quadtree, and coding the chunks of Q2 files\n"
+            "\t-f,\t`1`, `2` or `3`, `.qtc` format for `encodeur`: 2 is chunked, 3 is chunked and range coded\n");
+    fprintf(stdout,
+            "\t-r,\t`x,y,w,h`, region of `w` x `h` pixels at (`x`, `y`) decoded by `decodeur`\n"
+            "\t-l,\t--max-level `k` in [0, 16], `decodeur` reads down to depth `k`, for a 2^k x 2^k thumbnail\n"
+            "\t-t,\t--target-bytes `N`, `encodeur` searches the alpha whose file fits in `N` bytes, not with `-a`\n");
+    fprintf(stdout,
+            "\t-p,\t--psnr `double` > 0, `encodeur` collapses the nodes by rate-distortion, down to this PSNR in dB\n"
+            "\t-L,\t--lambda `double` >= 0, `encodeur` collapses the nodes minimizing error + `lambda` x bits\n"
+            "\t-A,\t--ascii, `decodeur` writes a P2 (ASCII) `.pgm`, P5 by default; P2 inputs are read as well\n");
+    fprintf(stdout,
+            "\t-s,\t--stream `k` in [1, 16], `encodeur` reads a P5 `.pgm` by bands of 2^k lines, with `-f 2` or `-f 3`,\n"
+            "\t\t`decodeur` writes a Q2 or Q3 `.qtc` by bands of 2^k lines, at least a line of chunks,\n"
+            "\t\tthe memory used grows with the width of the image, not with its size\n");
+    fprintf(stdout,
+            "\t-b,\t--batch `dir`, encodes or decodes many files into `dir`: the inputs are files, directories,\n"
+            "\t\tand `-` or none for a list of files on stdin, one per line; `-j` workers, an image each at a time,\n"
+            "\t\tbetween a reader and a writer: the next images are read and the previous ones written meanwhile\n");
 }
 
 static __inline__ bool is_valid_extension(
@@ -138,14 +198,14 @@ static void handle_c_option(Args *__restrict__ args, char *__restrict__ optarg)
         (void)optarg;
         return;
     }
-    if (defined_mode)
+    if (args->defined_mode)
     {
         fprintf(stderr, "Double mode error: `encodeur` is already defined\n");
         args->err = true;
         return;
     }
     args->mode = false;
-    defined_mode = true;
+    args->defined_mode = true;
 }
 
 static void handle_u_option(Args *__restrict__ args, char *__restrict__ optarg)
@@ -155,14 +215,14 @@ static void handle_u_option(Args *__restrict__ args, char *__restrict__ optarg)
         (void)optarg;
         return;
     }
-    if (defined_mode)
+    if (args->defined_mode)
     {
         fprintf(stderr, "Double mode error: `decodeur` is already defined\n");
         args->err = true;
         return;
     }
     args->mode = true;
-    defined_mode = true;
+    args->defined_mode = true;
 }
 
 static __inline__ void handle_h_option(Args *__restrict__ args, char *__restrict__ optarg)
@@ -202,6 +262,18 @@ static __inline__ void check_error(Args *__restrict__ args)
     {
         return;
     }
+    if (args->batch)
+    {
+        if (!args->defined_mode || args->file_name_input || args->defined_output || args->seg_grid || args->roi[2] ||
+            0xFFU != args->max_level || args->target_bytes || args->psnr > 0.0 || args->lambda >= 0.0 ||
+            args->stream || args->nb_alphas > 1U)
+        {
+            fprintf(stderr, "Error: `--batch` needs `-c` or `-u`, its inputs without `-i`, and is only with "
+                            "`-a`, `-f`, `-j`, `--ascii` and `-v`\n");
+            args->err = true;
+        }
+        return;
+    }
     if (!args->file_name_input)
     {
         fprintf(stderr, "Error: no input.{pgm | qtc} file\n");
@@ -209,20 +281,18 @@ static __inline__ void check_error(Args *__restrict__ args)
         return;
     }
 
-    if (defined_mode && defined_extension)
+    if (args->defined_mode && args->defined_extension)
     {
         if (!args->mode && !is_valid_extension(args->file_name_input, ".pgm"))
         {
             fprintf(stderr, "Error: mode `encodeur` is only for `*.pgm` files\n");
             args->err = true;
-            is_valid_input = false;
             return;
         }
         else if (args->mode && !is_valid_extension(args->file_name_input, ".qtc"))
         {
             fprintf(stderr, "Error: mode `decodeur` is only for `*.qtc` files\n");
             args->err = true;
-            is_valid_input = false;
             return;
         }
     }
@@ -232,15 +302,66 @@ static __inline__ void check_error(Args *__restrict__ args)
     {
         fprintf(stderr, "Error: input and output files extension must have different extension\n");
         args->err = true;
-        is_valid_output = false;
         return;
     }
-    if (!defined_mode)
+    if (!args->defined_mode)
     {
         fprintf(stderr, "Error: mode `encodeur` or `decodeur` is not defined\n");
         args->err = true;
         return;
     }
+    if (args->roi[2] && (!args->mode || args->seg_grid))
+    {
+        fprintf(stderr, "Error: `-r` is only for `decodeur`, without `-g`\n");
+        args->err = true;
+        return;
+    }
+    if (0xFFU != args->max_level && (!args->mode || args->roi[2]))
+    {
+        fprintf(stderr, "Error: `--max-level` is only for `decodeur`, without `-r`\n");
+        args->err = true;
+        return;
+    }
+    if (args->target_bytes && (args->mode || 3U == args->format || args->nb_alphas))
+    {
+        fprintf(stderr, "Error: `--target-bytes` is only for `encodeur`, with `-f 1` or `-f 2`, without `-a`\n");
+        args->err = true;
+        return;
+    }
+    if ((args->psnr > 0.0 || args->lambda >= 0.0) &&
+        (args->mode || args->alpha >= 0.1 || args->target_bytes || (args->psnr > 0.0 && args->lambda >= 0.0)))
+    {
+        fprintf(stderr, "Error: `--psnr` or `--lambda`, not both, only for `encodeur`, without `-a` and `--target-bytes`\n");
+        args->err = true;
+        return;
+    }
+    if (args->ascii && !args->mode)
+    {
+        fprintf(stderr, "Error: `--ascii` is only for `decodeur`\n");
+        args->err = true;
+        return;
+    }
+    if (args->nb_alphas > 1U &&
+        (args->mode || args->seg_grid || args->target_bytes || args->psnr > 0.0 || args->lambda >= 0.0))
+    {
+        fprintf(stderr, "Error: several alphas are only for `encodeur`, without `-g`, `--target-bytes`, `--psnr` and `--lambda`\n");
+        args->err = true;
+        return;
+    }
+    if (args->stream && !args->mode && (args->format < 2U || args->seg_grid || args->nb_alphas > 1U ||
+                                        args->target_bytes || args->psnr > 0.0 || args->lambda >= 0.0))
+    {
+        fprintf(stderr, "Error: `--stream` in `encodeur` is only with `-f 2` or `-f 3`, without `-g`, several alphas, "
+                        "`--target-bytes`, `--psnr` and `--lambda`\n");
+        args->err = true;
+        return;
+    }
+    if (args->stream && args->mode && (args->seg_grid || args->roi[2] || 0xFFU != args->max_level))
+    {
+        fprintf(stderr, "Error: `--stream` in `decodeur` is only without `-g`, `-r` and `--max-level`\n");
+        args->err = true;
+        return;
+    }
 }
 
 static bool validate_extension(Args *__restrict__ args, const char *__restrict__ optarg, bool is_input)
@@ -256,22 +377,20 @@ static bool validate_extension(Args *__restrict__ args, const char *__restrict__
 
     if (is_input)
     {
-        if (defined_mode && !is_valid_extension(optarg, expected_input_extension))
+        if (args->defined_mode && !is_valid_extension(optarg, expected_input_extension))
         {
             fprintf(stderr, "Error: Input file for `%s` is only allowed with `%s` extension\n",
                     (args->mode ? "decodeur" : "encodeur"), expected_input_extension);
             args->err = true;
-            is_valid_input = false;
             return false;
         }
     }
     else
     {
-        if (defined_mode && !is_valid_extension(optarg, expected_output_extension))
+        if (args->defined_mode && !is_valid_extension(optarg, expected_output_extension))
         {
             fprintf(stderr, "Error: Output file is only allowed with `%s` extension\n", expected_output_extension);
             args->err = true;
-            is_valid_output = false;
             return false;
         }
     }
@@ -281,18 +400,10 @@ static bool validate_extension(Args *__restrict__ args, const char *__restrict__
     {
         fprintf(stderr, "Error: %s file extension - `%s` is not correct\n", file_type, optarg);
         args->err = true;
-        if (is_input)
-        {
-            is_valid_input = false;
-        }
-        else
-        {
-            is_valid_output = false;
-        }
         return false;
     }
 
-    defined_extension = true;
+    args->defined_extension = true;
     return true;
 }
 
@@ -316,29 +427,222 @@ static void handle_o_option(Args *__restrict__ args, char *__restrict__ optarg)
     }
     if (validate_extension(args, optarg, false))
     {
-        defined_output = true;
+        args->defined_output = true;
         args->file_name_output = optarg;
     }
 }
 
 static void handle_a_option(Args *__restrict__ args, char *__restrict__ optarg)
+{
+    char *endptr = NULL;
+    char name[16], other[16];
+    double alpha = 0.0;
+    unsigned int k = 0U;
+    if (!args || !optarg)
+    {
+        return;
+    }
+    /* one alpha, or a comma separated list of them for a sweep */
+    args->nb_alphas = 0U;
+    do
+    {
+        alpha = strtod(optarg, &endptr);
+        if (endptr == optarg || (*endptr != '\0' && *endptr != ','))
+        {
+            fprintf(stderr, "Error: alpha value must be a double\n");
+            args->err = true;
+            return;
+        }
+        if (alpha < 0.0 || alpha > 2.0)
+        {
+            fprintf(stderr, "Error: alpha value must be between 0.0 and 2.0\n");
+            args->err = true;
+            return;
+        }
+        if (args->nb_alphas == QTC_MAX_ALPHAS)
+        {
+            fprintf(stderr, "Error: at most %u alpha values\n", QTC_MAX_ALPHAS);
+            args->err = true;
+            return;
+        }
+        /* the files of a sweep are named from 2 decimals: `_a1.40` for 1.4 and 1.4049 alike */
+        (void)sprintf(name, "%.2f", alpha);
+        for (k = 0U; k < args->nb_alphas; ++k)
+        {
+            (void)sprintf(other, "%.2f", args->alphas[k]);
+            if (!strcmp(name, other))
+            {
+                fprintf(stderr, "Error: alphas %g and %g would write the same file `_a%s`\n", args->alphas[k], alpha,
+                        name);
+                args->err = true;
+                return;
+            }
+        }
+        args->alphas[args->nb_alphas++] = alpha;
+        optarg = endptr + 1;
+    } while (*endptr == ',');
+    args->alpha = args->alphas[0];
+}
+
+static void handle_j_option(Args *__restrict__ args, char *__restrict__ optarg)
+{
+    char *endptr = NULL;
+    long threads = 0L;
+    if (!args || !optarg)
+    {
+        return;
+    }
+    threads = strtol(optarg, &endptr, 10);
+    if (*endptr != '\0' || threads < 1L || threads > 1024L)
+    {
+        fprintf(stderr, "Error: number of threads must be an integer between 1 and 1024\n");
+        args->err = true;
+        return;
+    }
+    args->threads = (unsigned int)threads;
+}
+
+static void handle_f_option(Args *__restrict__ args, char *__restrict__ optarg)
 {
     if (!args || !optarg)
     {
         return;
     }
-    if (!is_double(optarg))
+    if (strcmp(optarg, "1") && strcmp(optarg, "2") && strcmp(optarg, "3"))
     {
-        fprintf(stderr, "Error: alpha value must be a double\n");
+        fprintf(stderr, "Error: format must be 1, 2 or 3\n");
         args->err = true;
         return;
     }
-    args->alpha = atof(optarg);
-    if (args->alpha < 0.0 || args->alpha > 2.0)
+    args->format = (unsigned char)(optarg[0] - '0');
+}
+
+static void handle_r_option(Args *__restrict__ args, char *__restrict__ optarg)
+{
+    char *endptr = optarg;
+    long value = 0L;
+    unsigned int k = 0U;
+    if (!args || !optarg)
+    {
+        return;
+    }
+    /* x, y, width, height separated by commas, the width and the height not 0 */
+    for (k = 0U; k < 4U; ++k)
+    {
+        value = strtol(endptr, &endptr, 10);
+        if (value < ((k < 2U) ? (0L) : (1L)) || value > 65535L || *endptr != ((k < 3U) ? (',') : ('\0')))
+        {
+            fprintf(stderr, "Error: region must be `x,y,w,h`, integers in [0, 65535], `w` and `h` not 0\n");
+            args->err = true;
+            args->roi[2] = 0U;
+            return;
+        }
+        args->roi[k] = (unsigned short)value;
+        ++endptr;
+    }
+}
+
+static void handle_l_option(Args *__restrict__ args, char *__restrict__ optarg)
+{
+    char *endptr = NULL;
+    long level = 0L;
+    if (!args || !optarg)
+    {
+        return;
+    }
+    level = strtol(optarg, &endptr, 10);
+    if (*endptr != '\0' || level < 0L || level > 16L)
+    {
+        fprintf(stderr, "Error: max level must be an integer between 0 and 16\n");
+        args->err = true;
+        return;
+    }
+    args->max_level = (unsigned char)level;
+}
+
+static void handle_t_option(Args *__restrict__ args, char *__restrict__ optarg)
+{
+    char *endptr = NULL;
+    unsigned long bytes = 0UL;
+    if (!args || !optarg)
+    {
+        return;
+    }
+    bytes = strtoul(optarg, &endptr, 10);
+    if (*endptr != '\0' || '-' == optarg[0] || !bytes)
+    {
+        fprintf(stderr, "Error: target size must be a positive number of bytes\n");
+        args->err = true;
+        return;
+    }
+    args->target_bytes = bytes;
+}
+
+static void handle_p_option(Args *__restrict__ args, char *__restrict__ optarg)
+{
+    if (!args || !optarg)
+    {
+        return;
+    }
+    if (!is_double(optarg) || atof(optarg) <= 0.0)
     {
-        fprintf(stderr, "Error: alpha value must be between 0.0 and 2.0\n");
+        fprintf(stderr, "Error: PSNR must be a positive double, in dB\n");
         args->err = true;
+        return;
     }
+    args->psnr = atof(optarg);
+}
+
+static void handle_L_option(Args *__restrict__ args, char *__restrict__ optarg)
+{
+    if (!args || !optarg)
+    {
+        return;
+    }
+    if (!is_double(optarg) || atof(optarg) < 0.0)
+    {
+        fprintf(stderr, "Error: lambda must be a double, 0 or more\n");
+        args->err = true;
+        return;
+    }
+    args->lambda = atof(optarg);
+}
+
+static void handle_s_option(Args *__restrict__ args, char *__restrict__ optarg)
+{
+    char *endptr = NULL;
+    long level = 0L;
+    if (!args || !optarg)
+    {
+        return;
+    }
+    level = strtol(optarg, &endptr, 10);
+    if (*endptr != '\0' || level < 1L || level > 16L)
+    {
+        fprintf(stderr, "Error: the bands of `--stream` must be 2^k lines, `k` an integer between 1 and 16\n");
+        args->err = true;
+        return;
+    }
+    args->stream = (unsigned char)level;
+}
+
+static void handle_A_option(Args *__restrict__ args, char *__restrict__ optarg)
+{
+    if (!args)
+    {
+        (void)optarg;
+        return;
+    }
+    args->ascii = true;
+}
+
+static void handle_b_option(Args *__restrict__ args, char *__restrict__ optarg)
+{
+    if (!args || !optarg)
+    {
+        return;
+    }
+    args->batch = optarg;
 }
 
 static void handle_unknown_option(Args *__restrict__ args, char *__restrict__ optarg)
@@ -357,7 +661,7 @@ extern int option_handle_args(int argc, char *argv[], Args *__restrict__ args)
     OptionHandler *handler = NULL;
     init_args(args);
 
-    while ((opt = getopt(argc, argv, "cuhvgi:o:a:")) != -1)
+    while ((opt = getopt_long(argc, argv, "cuhvgAi:o:a:j:f:r:l:t:p:L:s:b:", long_options, NULL)) != -1)
     {
         for (handler = option_handlers; handler->opt != 0; ++handler)
         {
@@ -369,20 +673,24 @@ extern int option_handle_args(int argc, char *argv[], Args *__restrict__ args)
         }
     }
 
-    if (optind < argc && !args->file_name_input)
+    if (args->batch) /* every other argument is an input */
+    {
+        args->inputs = argv + optind;
+        args->nb_inputs = argc - optind;
+    }
+    else if (optind < argc && !args->file_name_input)
     {
         if (!is_valid_extension(argv[optind], ".pgm") &&
             !is_valid_extension(argv[optind], ".qtc"))
         {
-            is_valid_input = false;
             fprintf(stderr, "Error: input file - `%s` is not correct\n", argv[optind]);
             args->err = true;
             return args->err;
         }
         args->file_name_input = argv[optind];
-        defined_extension = true;
+        args->defined_extension = true;
     }
-    if (!defined_output && defined_mode && defined_extension)
+    if (!args->defined_output && args->defined_mode && args->defined_extension && !args->batch)
     {
         args->file_name_output = args->mode ? "PGM/out.pgm" : "QTC/out.qtc";
     }
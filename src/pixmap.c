@@ -8,8 +8,19 @@
  * @copyright licence MIT Copyright (c) 2025
  */
 
+#define _DEFAULT_SOURCE /* mmap() and madvise() with `-ansi` */
+
 #include "qtree.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PGM_ASCII_PER_LINE 17UL /* values of a P2 line, 4 characters each at most */
+#define PGM_STREAM_CHUNK (1UL << 20) /* bytes read at once from a P2 stream */
+#define PGM_HEADER_SIZE 128UL /* the header written, 73 characters at most */
+
 FILE *read_pgm_file(Pixmap *pix, const char *filename)
 {
     FILE *fptr = NULL;
@@ -29,17 +40,21 @@ FILE *read_pgm_file(Pixmap *pix, const char *filename)
         return NULL;
     }
 
-    if (sscanf(buffer, "%s\n", pix->magic_number) != 1 || strcmp(buffer, "P5\n"))
+    if (strcmp(buffer, "P5\n") && strcmp(buffer, "P2\n"))
     {
-        fprintf(stderr, "Magic number: %s\n", buffer);
+        fprintf(stderr, "Error: magic number %.2s is neither P5 nor P2\n", buffer);
+        fclose(fptr);
+        return NULL;
     }
+    (void)strncpy(pix->magic_number, buffer, 2UL);
+    pix->magic_number[2] = '\0';
 
     while (fgets(buffer, BUFFER_SIZE, fptr) && *buffer == '#')
     {
         fprintf(stdout, "Comment: %s", buffer); /* comments */
     }
 
-    number_of_items = sscanf(buffer, "%hu %hu %u", &pix->width, &pix->height, &temp_grey_level);
+    number_of_items = sscanf(buffer, "%u %u %u", &pix->width, &pix->height, &temp_grey_level);
     if (number_of_items != 3)
     {
         /* third parameters on the next line */
@@ -52,7 +67,7 @@ FILE *read_pgm_file(Pixmap *pix, const char *filename)
 
     if (number_of_items != 3)
     {
-        fprintf(stderr, "width: %hu\nheight: %hu\ngrey_level: %hu\n", pix->width, pix->height, pix->grey_level);
+        fprintf(stderr, "width: %u\nheight: %u\ngrey_level: %hu\n", pix->width, pix->height, pix->grey_level);
         fprintf(stderr, "Error: incorect format when reading .pgm file\n");
         return NULL;
     }
@@ -60,9 +75,265 @@ FILE *read_pgm_file(Pixmap *pix, const char *filename)
     return fptr;
 }
 
+/**
+ * @brief Parse the raster of a P2 (ASCII) file: `n` decimal numbers separated by anything else
+ *
+ * @param buf the text of the raster
+ * @param len the size of `buf`
+ * @param data the `n` values parsed
+ * @param n the number of pixels
+ * @return size_t the number of values parsed, `n` if OK
+ */
+static size_t parse_pgm_ascii(const unsigned char *__restrict__ buf, size_t len,
+                              unsigned char *__restrict__ data, size_t n)
+{
+    const unsigned char *end = buf + len;
+    unsigned int value = 0U, digit = 0U;
+    size_t count = 0UL;
+
+    while (count < n)
+    {
+        /* separators, then a number: one comparison per byte, no locale */
+        while (buf < end && (unsigned int)(*buf - '0') > 9U)
+        {
+            ++buf;
+        }
+        if (buf == end)
+        {
+            break;
+        }
+        for (value = 0U; buf < end && (digit = (unsigned int)(*buf - '0')) <= 9U; ++buf)
+        {
+            value = value * 10U + digit;
+        }
+        data[count++] = (unsigned char)((value > 0xFFU) ? (0xFFU) : (value));
+    }
+    return count;
+}
+
+/**
+ * @brief Format `n` values as the raster of a P2 (ASCII) file, a line per row,
+ * cut every `PGM_ASCII_PER_LINE` values to stay below 70 characters
+ *
+ * @param data the values
+ * @param n the number of pixels
+ * @param width the number of values of a row
+ * @param out the text, 4 x `n` characters at most
+ * @return size_t the number of characters written
+ */
+static size_t format_pgm_ascii(const unsigned char *__restrict__ data, size_t n,
+                               unsigned int width, char *__restrict__ out)
+{
+    char *start = out;
+    size_t i = 0UL, col = 0UL;
+    unsigned int value = 0U;
+
+    for (i = 0UL; i < n; ++i)
+    {
+        value = data[i];
+        if (value >= 100U)
+        {
+            *out++ = (char)('0' + value / 100U);
+            value %= 100U;
+            *out++ = (char)('0' + value / 10U);
+        }
+        else if (value >= 10U)
+        {
+            *out++ = (char)('0' + value / 10U);
+        }
+        *out++ = (char)('0' + value % 10U);
+        ++col;
+        *out++ = (col == width || !(col % PGM_ASCII_PER_LINE)) ? ('\n') : (' ');
+        col = (col == width) ? (0UL) : (col);
+    }
+    return (size_t)(out - start);
+}
+
+/**
+ * @brief Read an unsigned number of a PGM header, after the blanks and comments
+ *
+ * @param buf the header
+ * @param len the size of `buf`
+ * @param pos the position in `buf`, moved after the number
+ * @param value the number read
+ * @return bool true if OK, false if there is no number
+ */
+static bool parse_pgm_number(const unsigned char *buf, size_t len, size_t *pos, unsigned long *value)
+{
+    size_t start = 0UL;
+    while (*pos < len && (isspace(buf[*pos]) || '#' == buf[*pos]))
+    {
+        if ('#' == buf[*pos]) /* comments */
+        {
+            start = *pos;
+            while (*pos < len && '\n' != buf[*pos])
+            {
+                ++*pos;
+            }
+            fprintf(stdout, "Comment: %.*s\n", (int)(*pos - start), (const char *)buf + start);
+        }
+        else
+        {
+            ++*pos;
+        }
+    }
+    for (*value = 0UL, start = *pos; *pos < len && isdigit(buf[*pos]) && *value <= 0x19999999UL; ++*pos)
+    {
+        *value = *value * 10UL + (unsigned long)(buf[*pos] - '0');
+    }
+    return *pos != start;
+}
+
+/**
+ * @brief Parse the header of a PGM file held in memory, after its magic number
+ *
+ * @param pix Pixmap whose magic number, size and grey level are set, `data` is not touched
+ * @param buf the file, its magic number checked
+ * @param len the size of `buf`
+ * @return size_t the position of the raster in `buf`, 0 on error
+ */
+static size_t parse_pgm_header(Pixmap *pix, const unsigned char *buf, size_t len)
+{
+    unsigned long width = 0UL, height = 0UL, grey_level = 0UL;
+    size_t pos = 2UL;
+
+    if (!parse_pgm_number(buf, len, &pos, &width) || !parse_pgm_number(buf, len, &pos, &height) ||
+        !parse_pgm_number(buf, len, &pos, &grey_level) || pos == len || !isspace(buf[pos]) ||
+        width > 0xFFFFFFFFUL || height > 0xFFFFFFFFUL || grey_level > 0xFFUL)
+    {
+        fprintf(stderr, "Error: incorect format when reading .pgm file\n");
+        return 0UL;
+    }
+    pix->width = (unsigned int)width;
+    pix->height = (unsigned int)height;
+    pix->grey_level = (unsigned char)grey_level;
+    pix->magic_number[0] = 'P';
+    pix->magic_number[1] = (char)buf[1];
+    pix->magic_number[2] = '\0';
+    return pos + 1UL; /* a single blank before the raster */
+}
+
+/**
+ * @brief Map a PGM file in memory and parse its header in place.
+ * The raster of a P5 file is used in place by `data`, a P2 one is parsed from the mapping.
+ *
+ * @param pix Pixmap to initialize
+ * @param filename Filename of the image
+ * @return int 1 if read, 0 if the file can not be mapped (a pipe, or not P5 nor P2), -1 on error
+ */
+static int map_pgm_file(Pixmap *pix, const char *filename)
+{
+    struct stat st;
+    unsigned char *map = NULL;
+    size_t len = 0UL, pos = 0UL;
+    int fd = -1;
+
+    /* stat() first: opening a FIFO here would consume it before the fallback */
+    if (stat(filename, &st) || !S_ISREG(st.st_mode) || st.st_size < 3 || (fd = open(filename, O_RDONLY)) < 0)
+    {
+        return 0;
+    }
+    len = (size_t)st.st_size;
+    /* private and writable: the pages are shared with the page cache until written */
+    map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (MAP_FAILED == map)
+    {
+        return 0;
+    }
+    if ('P' != map[0] || ('5' != map[1] && '2' != map[1]) || !isspace(map[2]))
+    {
+        munmap(map, len);
+        return 0;
+    }
+
+    if (!(pos = parse_pgm_header(pix, map, len)))
+    {
+        munmap(map, len);
+        return -1;
+    }
+
+    if ('2' == map[1]) /* ASCII: parsed in a buffer, the mapping is dropped */
+    {
+        (void)madvise(map, len, MADV_SEQUENTIAL);
+        if (!(pix->data = malloc((size_t)pix->width * pix->height * sizeof(*pix->data))))
+        {
+            fprintf(stderr, "Erreur d'allocation de mémoire pour les données de l'image !\n");
+            munmap(map, len);
+            return -1;
+        }
+        pos = parse_pgm_ascii(map + pos, len - pos, pix->data, (size_t)pix->width * pix->height);
+        munmap(map, len);
+        if (pos != (size_t)pix->width * pix->height)
+        {
+            fprintf(stderr, "Fichier PGM tronqué!\n");
+            free_pixmap(pix);
+            return -1;
+        }
+        return 1;
+    }
+    if (len - pos < (size_t)pix->width * pix->height)
+    {
+        fprintf(stderr, "Fichier PGM tronqué!\n");
+        munmap(map, len);
+        return -1;
+    }
+
+    (void)madvise(map, len, MADV_SEQUENTIAL);
+    pix->map = map;
+    pix->map_size = len;
+    pix->data = map + pos;
+    return 1;
+}
+
+/**
+ * @brief Parse the raster of a P2 stream, read by chunks, a number may span two chunks
+ *
+ * @param file the stream, after the header
+ * @param data the `n` values parsed
+ * @param n the number of pixels
+ * @return size_t the number of values parsed, `n` if OK
+ */
+static size_t read_pgm_ascii_stream(FILE *file, unsigned char *data, size_t n)
+{
+    unsigned char *buf = NULL;
+    size_t len = 0UL, keep = 0UL, count = 0UL, got = 0UL;
+
+    if (!(buf = malloc(PGM_STREAM_CHUNK)))
+    {
+        return 0UL;
+    }
+    while (count < n && (got = fread(buf + keep, 1UL, PGM_STREAM_CHUNK - keep, file)))
+    {
+        len = keep + got;
+        /* the trailing digits wait for the next chunk, unless it is the end of the stream */
+        keep = 0UL;
+        while (keep < len && (unsigned int)(buf[len - keep - 1UL] - '0') <= 9U)
+        {
+            ++keep;
+        }
+        keep = (keep == len || feof(file)) ? (0UL) : (keep);
+        count += parse_pgm_ascii(buf, len - keep, data + count, n - count);
+        (void)memmove(buf, buf + len - keep, keep);
+    }
+    if (count < n && keep)
+    {
+        count += parse_pgm_ascii(buf, keep, data + count, n - count);
+    }
+    free(buf);
+    return count;
+}
+
 /* Read PGM file with the name of the file, put value on pixmap */
 void free_pixmap(Pixmap *pix)
 {
+    if (pix && pix->map)
+    {
+        munmap(pix->map, pix->map_size);
+        pix->map = NULL;
+        pix->map_size = 0UL;
+        pix->data = NULL;
+    }
     if (pix && pix->data)
     {
         free(pix->data);
@@ -75,26 +346,44 @@ void init_pixmap(Pixmap *pix, const char *filename)
 {
     size_t check = 0UL;
     FILE *file = NULL;
+    int mapped = 0;
     if (!pix)
     {
         fprintf(stderr, "Erreur: pixmap est NULL dans init_pixmap()!\n");
         return;
     }
+    pix->map = NULL;
+    pix->map_size = 0UL;
+    if ((mapped = map_pgm_file(pix, filename)))
+    {
+        if (mapped < 0)
+        {
+            fprintf(stderr, "Erreur de lecture du fichier PGM !\n");
+        }
+        return;
+    }
     if (!(file = read_pgm_file(pix, filename)))
     {
         fprintf(stderr, "Erreur de lecture du fichier PGM !\n");
         return;
     }
     pix->data = NULL;
-    if (!(pix->data = malloc(pix->height * pix->width * sizeof(*pix->data))))
+    if (!(pix->data = malloc((size_t)pix->height * pix->width * sizeof(*pix->data))))
     {
         fprintf(stderr, "Erreur d'allocation de mémoire pour les données de l'image !\n");
         free(pix);
         return;
     }
-    check = fread(pix->data, sizeof(*pix->data), (pix->height * pix->width), file);
+    if ('2' == pix->magic_number[1])
+    {
+        check = read_pgm_ascii_stream(file, pix->data, (size_t)pix->height * pix->width);
+    }
+    else
+    {
+        check = fread(pix->data, sizeof(*pix->data), (size_t)pix->height * pix->width, file);
+    }
 
-    if (check != (size_t)(pix->height * pix->width))
+    if (check != (size_t)pix->height * pix->width)
     {
         fprintf(stderr, "Fichier PGM tronqué!\n");
         free_pixmap(pix);
@@ -108,23 +397,147 @@ void init_pixmap(Pixmap *pix, const char *filename)
 void from_pixmap_to_pgm(Pixmap *pix, const char *filename)
 {
     FILE *fptr = NULL;
-    size_t i = 0UL;
+    char *text = NULL;
+    size_t n = 0UL;
     if (!pix)
     {
         fprintf(stderr, "Erreur: pixmap est NULL dans from_pixmap_to_pgm()!\n");
         return;
     }
-    if (!(fptr = fopen(filename, "w")))
+    n = (size_t)pix->width * pix->height;
+    if ('2' == pix->magic_number[1] && !(text = malloc(4UL * n + 1UL)))
+    {
+        fprintf(stderr, "Erreur d'allocation de mémoire dans from_pixmap_to_pgm()!\n");
+        return;
+    }
+    if (!(fptr = fopen(filename, "wb")))
     {
         fprintf(stderr, "Erreur: %s fichier non trouvé dans from_pixmap_to_pgm()!\n", filename);
+        free(text);
         return;
     }
     fprintf(fptr, "%s\n", pix->magic_number); /* magic number */
     fprintf(fptr, "%s%s\n", "# Created by ", AUTHORS);
-    fprintf(fptr, "%hu %hu\n%u\n", pix->width, pix->height, (unsigned int)pix->grey_level);
-    for (i = 0UL; i < pix->width * pix->height; ++i)
+    fprintf(fptr, "%u %u\n%u\n", pix->width, pix->height, (unsigned int)pix->grey_level);
+    /* the raster in a single write, formatted first if ASCII */
+    if (text)
+    {
+        (void)fwrite(text, sizeof(*text), format_pgm_ascii(pix->data, n, pix->width, text), fptr);
+        free(text);
+    }
+    else
     {
-        fputc(pix->data[i], fptr);
+        (void)fwrite(pix->data, sizeof(*pix->data), n, fptr);
     }
     fclose(fptr);
 }
+
+bool write_pgm_band(void *stream, const unsigned char *lines, unsigned int width, unsigned int height,
+                    unsigned int first_line, unsigned int nb_lines)
+{
+    PgmStream *pgm = stream;
+    size_t n = (size_t)width * nb_lines;
+    char *text = NULL;
+
+    if (!pgm || !pgm->file || !lines)
+    {
+        fprintf(stderr, "Erreur: flux PGM est NULL dans write_pgm_band()!\n");
+        return false;
+    }
+    if (!first_line) /* the same header as `from_pixmap_to_pgm` */
+    {
+        fprintf(pgm->file, "%s\n", (pgm->ascii) ? ("P2") : ("P5"));
+        fprintf(pgm->file, "%s%s\n", "# Created by ", AUTHORS);
+        fprintf(pgm->file, "%u %u\n%u\n", width, height, (unsigned int)QTC_GREY_LEVEL);
+    }
+    if (!pgm->ascii)
+    {
+        return fwrite(lines, sizeof(*lines), n, pgm->file) == n;
+    }
+    /* a band is whole lines: its text follows the text of the band above */
+    if (pgm->text_size < 4UL * n + 1UL)
+    {
+        if (!(text = realloc(pgm->text, 4UL * n + 1UL)))
+        {
+            fprintf(stderr, "Erreur d'allocation de mémoire dans write_pgm_band()!\n");
+            return false;
+        }
+        pgm->text = text;
+        pgm->text_size = 4UL * n + 1UL;
+    }
+    n = format_pgm_ascii(lines, n, width, pgm->text);
+    return fwrite(pgm->text, sizeof(*pgm->text), n, pgm->file) == n;
+}
+
+bool read_pgm_buffer(Pixmap *pix, unsigned char *buf, size_t len, unsigned char **raster, size_t *raster_size)
+{
+    unsigned char *grown = NULL;
+    size_t pos = 0UL, n = 0UL;
+
+    if (!pix || !buf || !raster || !raster_size)
+    {
+        fprintf(stderr, "Erreur: pixmap est NULL dans read_pgm_buffer()!\n");
+        return false;
+    }
+    pix->data = pix->map = NULL;
+    pix->map_size = 0UL;
+    if (len < 3UL || 'P' != buf[0] || ('5' != buf[1] && '2' != buf[1]) || !isspace(buf[2]))
+    {
+        fprintf(stderr, "Error: magic number %.*s is neither P5 nor P2\n", (len < 2UL) ? ((int)len) : (2),
+                (const char *)buf);
+        return false;
+    }
+    if (!(pos = parse_pgm_header(pix, buf, len)))
+    {
+        return false;
+    }
+    n = (size_t)pix->width * pix->height;
+    if ('5' == buf[1]) /* the raster is used in place */
+    {
+        if (len - pos < n)
+        {
+            fprintf(stderr, "Fichier PGM tronqué!\n");
+            return false;
+        }
+        pix->data = buf + pos;
+        return true;
+    }
+    if (*raster_size < n)
+    {
+        if (!(grown = realloc(*raster, n)))
+        {
+            fprintf(stderr, "Erreur d'allocation de mémoire pour les données de l'image !\n");
+            return false;
+        }
+        *raster = grown;
+        *raster_size = n;
+    }
+    if (parse_pgm_ascii(buf + pos, len - pos, *raster, n) != n)
+    {
+        fprintf(stderr, "Fichier PGM tronqué!\n");
+        return false;
+    }
+    pix->data = *raster;
+    return true;
+}
+
+size_t pgm_buffer_size(unsigned int width, unsigned int height, bool ascii)
+{
+    return PGM_HEADER_SIZE + ((ascii) ? (4UL) : (1UL)) * width * height;
+}
+
+size_t write_pgm_buffer(unsigned char *out, const unsigned char *lines, unsigned int width, unsigned int height,
+                        bool ascii)
+{
+    size_t n = (size_t)width * height, len = 0UL;
+
+    /* the same header as `from_pixmap_to_pgm` and `write_pgm_band` */
+    len = (size_t)sprintf((char *)out, "%s\n%s%s\n%u %u\n%u\n", (ascii) ? ("P2") : ("P5"), "# Created by ", AUTHORS,
+                          width, height, (unsigned int)QTC_GREY_LEVEL);
+    if (!ascii)
+    {
+        (void)memcpy(out + len, lines, n);
+        return len + n;
+    }
+    return len + format_pgm_ascii(lines, n, width, (char *)out + len);
+}
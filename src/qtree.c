@@ -8,20 +8,232 @@
  * @copyright licence MIT Copyright (c) 2025
  */
 
+#define _DEFAULT_SOURCE /* ctime_r() and mmap() with `-ansi` */
+
 #include "qtree.h"
+#include "codec.h"
 #include <math.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+/* side, in pixels, of the square blocks walked by the bottom-up build */
+#define QTREE_BUILD_TILE 64UL
+
+/* bytes before a plane of nodes, holding the length of its mapping */
+#define QTREE_PLANE_HEADER 16UL
+
+/* width, in pixels, from which a row of a uniform block is filled by `memset` */
+#define QTREE_FILL_MEMSET 64UL
+
+/* per-worker buffers: variance, color, e, u of a line of parents, two normalized lines of pixels */
+#define QTREE_BUILD_SCRATCH ((QTREE_BUILD_TILE >> 1UL) * (sizeof(float) + 3UL) + 2UL * QTREE_BUILD_TILE)
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/**
+ * Range of subtrees built by one worker
+ */
+typedef struct build_task
+{
+    const BuildJob *job; /* shared state */
+    size_t first;        /* first subtree, index among the nodes at `job->depth` */
+    size_t last;         /* one past the last subtree */
+    VarianceStats stats; /* of the nodes of the subtrees */
+    bool done;           /* false if the worker could not allocate its buffers */
+} BuildTask;
+
+/**
+ * The planes of the edges of a tree, in its block `edges`
+ */
+typedef struct edge_planes
+{
+    double *sum;          /* sum of the variances of the internal nodes of the subtree of each node */
+    float *variance;      /* variance of each node */
+    float *max;           /* maximum variance of the subtree of each node */
+    unsigned char *color; /* color of each node */
+    unsigned char *eu;    /* `e` and `u` of each node */
+    unsigned char niveau; /* depth of the leaves */
+} EdgePlanes;
+
+static void fill_quadtree_from_pixmap(const BuildJob *job, unsigned char *scratch, VarianceStats *stats,
+                                      size_t line0, size_t col0, size_t side);
+
+static void fill_node_from_edges(const BuildJob *job, const EdgePlanes *edges, VarianceStats *stats, size_t i,
+                                 unsigned char depth);
+
+static void build_edges(const BuildJob *job);
+
+static void *build_subtrees(void *arg);
+
+static bool build_quadtree(QTree *tree, const unsigned char *pixels, size_t stride, unsigned int width,
+                           unsigned int height, unsigned char grey_level, unsigned int nb_threads);
+
+static bool is_uniform(QTree *tree, size_t child);
+
+/* alphas tried by `search_alpha_for_size`: 0 (no filtering), then 0.10, 0.11, ..., 2.00 */
+#define QTC_ALPHA_GRID 191U
+#define QTC_ALPHA_OF(p) ((double)((p) + 9U) / 100.0)
+
+/* grid position of a node never uniformized */
+#define QTC_ALPHA_NEVER (QTC_ALPHA_GRID + 1U)
+
+/**
+ * Reads or writes node `i`, at `depth`, from a `FileBit` or a `QtcEntropy` stream
+ */
+typedef void (*NodeCodec)(QTree *qtree, void *stream, size_t i, unsigned char depth);
+
+/**
+ * Range of chunks of a Q2 file, encoded or decoded by one worker
+ */
+typedef struct chunk_task
+{
+    QTree *qtree;                 /* tree to write, or to fill */
+    const unsigned char *payload; /* decoding: the streams, back to back */
+    const size_t *offsets;        /* decoding: start of each chunk in `payload`, and the end of the last one */
+    const QtcRoi *roi;            /* decoding: the chunks outside are not read, NULL to read them all */
+    size_t *sizes;                /* encoding: size of each chunk, in bytes */
+    size_t first;                 /* first chunk, index among the nodes at `depth` */
+    size_t last;                  /* one past the last chunk */
+    unsigned char depth;          /* depth of the roots of the chunks */
+    unsigned char last_level;     /* decoding: the depth of the last level read */
+    bool entropy;                 /* Q3: the streams are range coded */
+    bool done;                    /* false if the worker ran out of memory */
+    QtcEntropy *models;           /* Q3: the models of the worker, reset at each chunk */
+    FileBit bits;                 /* encoding: the chunks written, decoding: the chunk read */
+} ChunkTask;
+
+/**
+ * Range of the files of an alpha sweep written by one worker
+ */
+typedef struct sweep_task
+{
+    QTree *qtree;                  /* tree, left unfiltered */
+    const unsigned char *grid;     /* position of the first alpha at which each node is uniform */
+    const unsigned int *positions; /* position of the alpha of each file, 0 if unfiltered */
+    char *const *file_names;       /* name of each file */
+    unsigned char format;          /* version of the files */
+    unsigned int nb_threads;       /* threads of each chunked file */
+    size_t first;                  /* first file */
+    size_t last;                   /* one past the last file */
+    bool done;                     /* every file of the task is written */
+} SweepTask;
+
+/**
+ * Squared error and bits of the best pruning of a subtree, for the rate-distortion filtering
+ */
+typedef struct rd_cost
+{
+    double d; /* squared error of its pixels */
+    double r; /* bits of its nodes, in a Q1 file */
+} RdCost;
+
+/**
+ * A subtree to collapse on top of a pruning, with the error it adds and the bits it saves
+ */
+typedef struct rd_collapse
+{
+    size_t index; /* its root */
+    double error; /* error added */
+    double bits;  /* bits saved */
+} RdCollapse;
+
+/**
+ * A node waiting to be filled, on the stack of `fill_pixmap_tree`
+ */
+typedef struct fill_node
+{
+    size_t index;         /* index of the node */
+    unsigned int line;    /* first line of the node, in the image */
+    unsigned int col;     /* first column of the node, in the image */
+    unsigned char niveau; /* level of the node, its side is 2^niveau pixels */
+} FillNode;
+
+/* a node collapsed costs 3 bits, a node kept at least 2 + 3 x 8 */
+#define RD_COLLAPSED(cost) ((cost).r < 4.0)
+
+/* steps of the search of lambda for a PSNR, each one halves the logarithm of its range */
+#define QTC_RD_STEPS 20U
+
+static void qtc_write_node(QTree *qtree, void *stream, size_t i, unsigned char depth);
+
+static void qtc_write_node_rc(QTree *qtree, void *stream, size_t i, unsigned char depth);
+
+static void qtc_read_node_rc(QTree *tree, void *stream, size_t i, unsigned char depth);
+
+static void qtc_from_quadtree(QTree *qtree, FileBit *filebit);
+
+static void qtc_walk_top(QTree *qtree, void *stream, NodeCodec codec, unsigned char depth);
+
+static void qtc_walk_chunk(QTree *qtree, void *stream, NodeCodec codec, unsigned char depth, size_t chunk,
+                           unsigned char last);
+
+static void qtc_entropy_init(QtcEntropy *ent, unsigned char first, unsigned char last);
+
+static void *encode_chunks(void *arg);
+
+static void *decode_chunks(void *arg);
+
+static void *write_sweep_files(void *arg);
+
+static bool qtc_chunk_in_roi(QTree *tree, const QtcRoi *roi, unsigned char depth, size_t chunk);
+
+static size_t inside_nodes(const QTree *qtree, size_t i, unsigned char depth, unsigned char last);
+
+static size_t chunk_nodes_inside(const QTree *qtree, unsigned char depth, size_t chunk);
+
+static bool qtc_read_chunked(QTree *tree, FileBit *in, unsigned int nb_threads, bool entropy, const QtcRoi *roi,
+                             unsigned char last, QtcContext *ctx);
+
+static size_t qtc_stream_bound(size_t nb_nodes, bool entropy);
+
+static void read_qtc_file(QTree *tree, const char *file_name, unsigned int nb_threads, const QtcRoi *roi,
+                          unsigned char max_level, Pixmap *pix);
+
+static bool read_qtc(QTree *tree, FileBit *in, const char *file_name, unsigned int nb_threads, const QtcRoi *roi,
+                     unsigned char max_level, Pixmap *pix, QtcContext *ctx);
 
-static void fill_quadtree_recursive(QTree *qtree, Pixmap *pix, unsigned int child, unsigned char niveau, unsigned int line, unsigned int col);
+static unsigned long read_qtc_dimension(FileBit *in, unsigned char *character);
 
-static bool is_uniform(QTree *tree, unsigned int child);
+static bool clip_roi(const QtcRoi *roi, const QTree *qtree, QtcRoi *clipped);
 
-static void qtc_from_quadtree(QTree *qtree, FileBit *filebit, unsigned int *encoded_size, bool need_to_write);
+static double mean_variance(QTree *qtree);
 
-static unsigned int filtrage(QTree *qtree, unsigned int index, int niveau, double sigma, double alpha);
+static unsigned int filter_edge(const EdgePlanes *edges, size_t e, unsigned char depth, double sigma, double alpha);
 
-static unsigned short calculate_child_sum(QTree *tree, unsigned int child);
+static unsigned int first_uniform_alpha(float variance, unsigned char depth, unsigned int first,
+                                        const double *thresholds, unsigned int never);
 
-static float calculate_variance(QTree *qtree, unsigned int index, unsigned int child_index);
+static unsigned int edge_grid(const EdgePlanes *edges, size_t e, unsigned char depth, const double *thresholds,
+                              unsigned int never);
+
+static bool filter_grid(QTree *qtree, const double *alphas, unsigned int nb_alphas, unsigned char *grid);
+
+static void count_node_bits(QTree *qtree, size_t *diff, size_t i, unsigned char depth, unsigned char chunk_depth,
+                            unsigned int node_grid, unsigned int parent_grid);
+
+static double rd_prune(QTree *qtree, double lambda, RdCost *cost, bool apply);
+
+static double rd_psnr(QTree *qtree, double error);
+
+static void rd_spread_uniform(QTree *qtree);
+
+static int rd_compare_collapses(const void *a, const void *b);
+
+static double rd_fill_slack(QTree *qtree, const RdCost *cost, RdCost *cost_hi, double slack);
+
+static unsigned short calculate_child_sum(QTree *tree, size_t child);
+
+static float calculate_variance(QTree *qtree, size_t index, size_t child_index);
+
+static float children_variance(float m, const unsigned char *colors, const float *variances);
+
+static void *make_plane(size_t size);
+
+static void free_plane(void *plane);
 
 /**
  * @brief Normalize the value of the pixel
@@ -35,6 +247,21 @@ static __inline__ unsigned char normalize_value(unsigned char value, unsigned ch
     return (unsigned char)(value * QTC_GREY_LEVEL / depth);
 }
 
+/**
+ * @brief Squared error of a node collapsed to `color`: sum of (p - color)^2 over its pixels `p`.
+ * Every term is an integer below 2^53, so the double is exact.
+ *
+ * @param squares the sum of the squares of the pixels
+ * @param sum the sum of the pixels
+ * @param color the color of the node
+ * @param pixels the number of pixels
+ * @return double the squared error
+ */
+static __inline__ double collapse_error(double squares, double sum, unsigned char color, double pixels)
+{
+    return squares - 2.0 * color * sum + pixels * color * color;
+}
+
 /**
  * @brief Determine the size of the quadtree
  *
@@ -50,11 +277,17 @@ extern unsigned char determine_qtree_level(Pixmap *pix)
         fprintf(stderr, "Error: pixmap is NULL!\n");
         return 0UL;
     }
-    while (power < pix->width) /* width == height, so we can use only one */
+    while (power < pix->width || power < pix->height) /* the square holding the longest side */
     {
         power <<= 1UL;
         ++n;
     }
+    if (n >= QTC_LEVELS)
+    {
+        fprintf(stderr, "Error: %ux%u pixels, the longest side of an image is at most %lu pixels!\n",
+                pix->width, pix->height, 1UL << (QTC_LEVELS - 1U));
+        return QTC_ALL_LEVELS;
+    }
     return n;
 }
 
@@ -66,9 +299,8 @@ extern unsigned char determine_qtree_level(Pixmap *pix)
  * @param niveau
  * @return size_t the size of the quadtree
  */
-extern size_t make_qtree(QTree *tree, unsigned char grey_level, unsigned char niveau)
+extern size_t make_qtree(QTree *tree, unsigned char grey_level, unsigned char niveau, bool with_variance)
 {
-    size_t i = 0UL;
     size_t size = 0UL;
     if (!tree)
     {
@@ -77,38 +309,262 @@ extern size_t make_qtree(QTree *tree, unsigned char grey_level, unsigned char ni
     }
     tree->niveau = niveau;
     size = DETERMINE_QTREE_SIZE(tree->niveau);
+    tree->width = tree->height = 1U << niveau;
     tree->grey_level = grey_level;
-    if (!(tree->nodes = malloc(size * sizeof(*tree->nodes))))
+    tree->variance_sum = 0.0;
+    tree->variance_max = 0.0F;
+    tree->color = make_plane(size * sizeof(*tree->color));
+    tree->eu = make_plane(size * sizeof(*tree->eu));
+    /* the variance is only read by the filtering */
+    tree->variance = (with_variance) ? (make_plane(size * sizeof(*tree->variance))) : (NULL);
+    tree->sse = NULL;
+    tree->raster = NULL;
+    tree->edges = NULL; /* allocated by the build of an image which is not square */
+    if (!tree->color || !tree->eu || (with_variance && !tree->variance))
     {
         fprintf(stderr, "Memory allocation error for the quad tree !\n");
+        free_qtree(tree);
+        return 0;
+    }
+    return size;
+}
+
+extern void free_qtree(QTree *tree)
+{
+    if (!tree)
+    {
+        return;
+    }
+    free_plane(tree->color);
+    free_plane(tree->eu);
+    free_plane(tree->variance);
+    free_plane(tree->sse);
+    free(tree->edges);
+    tree->color = NULL;
+    tree->eu = NULL;
+    tree->variance = NULL;
+    tree->sse = NULL;
+    tree->edges = NULL;
+}
+
+extern size_t make_qtree_sse(QTree *tree)
+{
+    size_t size = 0UL;
+    if (!tree || !tree->color)
+    {
+        fprintf(stderr, "Error: tree is NULL in make_qtree_sse()!\n");
         return 0;
     }
-    for (i = 0UL; i < size; ++i)
+    /* the leaves are exact, only the internal nodes have an error */
+    size = DETERMINE_LEVEL_OFFSET((size_t)tree->niveau);
+    free_plane(tree->sse);
+    if (!(tree->sse = make_plane(((size) ? (size) : (1UL)) * sizeof(*tree->sse))))
     {
-        tree->nodes[i].color = 0x0U;
-        tree->nodes[i].e = 0x0U;
-        tree->nodes[i].u = 0x0U;
+        fprintf(stderr, "Memory allocation error for the quad tree !\n");
+        return 0;
     }
     return size;
 }
 
-extern void free_qtree(QTree *tree)
+/**
+ * @brief Allocate a plane of nodes, zeroed. The address space of the whole 4^n tree is reserved, but a page
+ * is only committed once one of its nodes is written: the nodes outside of an image which is not square
+ * never are, so the memory of a tree follows the pixels of its image rather than its square.
+ *
+ * @param size the bytes of the plane
+ * @return void* the plane, NULL on failure, freed by `free_plane`
+ */
+static void *make_plane(size_t size)
+{
+    void *block = mmap(NULL, size + QTREE_PLANE_HEADER, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (MAP_FAILED == block)
+    {
+        return NULL;
+    }
+    *(size_t *)block = size + QTREE_PLANE_HEADER;
+    return (unsigned char *)block + QTREE_PLANE_HEADER;
+}
+
+/**
+ * @brief Free a plane allocated by `make_plane`
+ *
+ * @param plane the plane, NULL is ignored
+ */
+static void free_plane(void *plane)
+{
+    unsigned char *block = NULL;
+    if (plane)
+    {
+        block = (unsigned char *)plane - QTREE_PLANE_HEADER;
+        (void)munmap(block, *(size_t *)(void *)block);
+    }
+}
+
+extern bool make_qtree_from(QTree *tree, QtcContext *ctx, unsigned char grey_level, unsigned char niveau,
+                             bool with_variance)
 {
-    if (tree && tree->nodes)
+    if (!ctx)
+    {
+        return 0UL != make_qtree(tree, grey_level, niveau, with_variance);
+    }
+    if (niveau > ctx->max_level)
+    {
+        return false;
+    }
+    /* the variance is only allocated by the first filtered encode */
+    if (with_variance && !ctx->variance &&
+        !(ctx->variance = ctx->allocator.alloc(ctx->allocator.user,
+                                               DETERMINE_QTREE_SIZE((size_t)ctx->max_level) * sizeof(*ctx->variance))))
     {
-        free(tree->nodes);
-        tree->nodes = NULL;
+        return false;
     }
+    tree->niveau = niveau;
+    tree->width = tree->height = 1U << niveau;
+    tree->grey_level = grey_level;
+    tree->variance_sum = 0.0;
+    tree->variance_max = 0.0F;
+    tree->color = ctx->color;
+    tree->eu = ctx->eu;
+    tree->variance = (with_variance) ? (ctx->variance) : (NULL);
+    tree->sse = NULL;
+    tree->raster = NULL;
+    tree->edges = ctx->edges;
+    return true;
 }
 
 extern void init_quadtree(QTree *tree, Pixmap *pix)
 {
-    if (!tree || !pix || !tree->nodes || !pix->data)
+    init_quadtree_parallel(tree, pix, 1U);
+}
+
+extern void init_quadtree_parallel(QTree *tree, Pixmap *pix, unsigned int nb_threads)
+{
+    if (!tree || !pix || !tree->color || !pix->data)
     {
         fprintf(stderr, "Error: tree / pixmap is NULL in init_quadtree()!\n");
+        return;
+    }
+    (void)build_quadtree(tree, pix->data, pix->width, pix->width, pix->height, pix->grey_level, nb_threads);
+}
+
+/**
+ * @brief Build a quadtree made by `make_qtree` from the lines of an image, on several threads
+ *
+ * @param tree the quadtree, of a level holding the image
+ * @param pixels the first pixel of the image
+ * @param stride the bytes from a line of pixels to the next one, the width at least
+ * @param width the width of the image
+ * @param height the height of the image
+ * @param grey_level the grey level of the pixels
+ * @param nb_threads the number of threads, 1 builds on the calling thread only
+ * @return true on success
+ * @return false if the image does not fit in the tree, or on a memory allocation error
+ */
+static bool build_quadtree(QTree *tree, const unsigned char *pixels, size_t stride, unsigned int width,
+                           unsigned int height, unsigned char grey_level, unsigned int nb_threads)
+{
+    BuildJob job;
+    BuildTask *tasks = NULL;
+    VarianceStats stats = {0.0, 0.0F};
+    size_t nb_subtrees = 1UL, i = 0UL;
+    unsigned int t = 0U;
+    bool done = true;
+
+    if (!width || !height || width > (1UL << tree->niveau) || height > (1UL << tree->niveau) || stride < width)
+    {
+        fprintf(stderr, "Error: the pixmap does not fit in the quadtree in init_quadtree()!\n");
+        return false;
+    }
+    tree->width = width;
+    tree->height = height;
+    tree->variance_sum = 0.0;
+    tree->variance_max = 0.0F;
+    if (!tree->niveau) /* a single pixel is a single leaf */
+    {
+        tree->eu[0] = QTREE_EU(0x0U, 0x1U);
+        tree->color[0] = normalize_value(pixels[0], grey_level);
+        if (tree->variance)
+        {
+            tree->variance[0] = 0.0F;
+        }
+        return true;
+    }
+
+    job.qtree = tree;
+    job.pixels = pixels;
+    job.stride = stride;
+    job.width = width;
+    job.height = height;
+    job.sums = NULL;
+    if (tree->sse && !(job.sums = make_plane(DETERMINE_LEVEL_OFFSET((size_t)tree->niveau) * sizeof(*job.sums))))
+    {
+        fprintf(stderr, "Error: memory allocation error in init_quadtree()!\n");
+        return false;
+    }
+    job.normalize = (grey_level != QTC_GREY_LEVEL);
+    for (i = 0UL; job.normalize && i <= QTC_GREY_LEVEL; ++i)
+    {
+        job.lut[i] = normalize_value((unsigned char)i, grey_level);
+    }
+
+    /* the nodes outside of the image are not built: their parents read them from the edges */
+    if (!QTREE_IS_SQUARE(tree))
+    {
+        if (!tree->edges && !(tree->edges = malloc(QTREE_EDGE_SIZE((size_t)tree->niveau))))
+        {
+            fprintf(stderr, "Error: memory allocation error in init_quadtree()!\n");
+            free_plane(job.sums);
+            return false;
+        }
+        build_edges(&job);
+    }
+
+    /* subtrees are independent: cut the tree at the first depth with enough of them,
+     * a subtree must still hold the parents of its leaves */
+    nb_threads = (nb_threads < 1U) ? (1U) : (nb_threads);
+    job.depth = 0U;
+    while (job.depth + 1U < tree->niveau && nb_subtrees < nb_threads)
+    {
+        ++job.depth;
+        nb_subtrees <<= 2UL;
+    }
+    nb_threads = (nb_subtrees < nb_threads) ? ((unsigned int)nb_subtrees) : (nb_threads);
+
+    if (!(tasks = malloc(nb_threads * sizeof(*tasks))))
+    {
+        fprintf(stderr, "Error: memory allocation error in init_quadtree()!\n");
+        free_plane(job.sums);
+        return false;
+    }
+
+    /* bottom-up: each worker builds a contiguous range of subtrees from the pixmap */
+    for (t = 0U; t < nb_threads; ++t)
+    {
+        tasks[t].job = &job;
+        tasks[t].first = nb_subtrees * t / nb_threads;
+        tasks[t].last = nb_subtrees * (t + 1U) / nb_threads;
+        tasks[t].stats = stats;
+        tasks[t].done = false;
     }
-    /* fprintf(stderr, "sizeof Node: %lu\n", sizeof(Node)); */
-    fill_quadtree_recursive(tree, pix, 0U, tree->niveau, 0U, 0U);
+    run_workers(build_subtrees, tasks, sizeof(*tasks), nb_threads);
+    for (t = 0U; t < nb_threads; ++t)
+    {
+        done = done && tasks[t].done;
+        stats.sum += tasks[t].stats.sum;
+        stats.max = (tasks[t].stats.max > stats.max) ? (tasks[t].stats.max) : (stats.max);
+    }
+
+    /* then the levels above the subtrees, serially */
+    if (done)
+    {
+        fill_quadtree_levels(&job, &stats, 0UL, 0, (int)job.depth - 1);
+    }
+    tree->variance_sum = stats.sum;
+    tree->variance_max = stats.max;
+    free_plane(job.sums);
+    free(tasks);
+    return done;
 }
 
 /**
@@ -119,17 +575,17 @@ extern void init_quadtree(QTree *tree, Pixmap *pix)
  * @return true if the children are uniform
  * @return false otherwise
  */
-static bool is_uniform(QTree *tree, unsigned int child)
+static bool is_uniform(QTree *tree, size_t child)
 {
     /* even the fact that the children satisfy (m1 = m2 = m3 = m4) is not enough */
-    return (tree->nodes[child].color == tree->nodes[child + 0x1U].color) &&
-           (tree->nodes[child].color == tree->nodes[child + 0x2U].color) &&
-           (tree->nodes[child].color == tree->nodes[child + 0x3U].color) &&
+    return (tree->color[child] == tree->color[child + 0x1U]) &&
+           (tree->color[child] == tree->color[child + 0x2U]) &&
+           (tree->color[child] == tree->color[child + 0x3U]) &&
            /* it's also necessary that (u1 = u2 = u3 = u4 = 1) */
-           (tree->nodes[child].u == 0x1U) &&
-           (tree->nodes[child].u == tree->nodes[child + 0x1U].u) &&
-           (tree->nodes[child].u == tree->nodes[child + 0x2U].u) &&
-           (tree->nodes[child].u == tree->nodes[child + 0x3U].u);
+           (QTREE_U(tree, child) == 0x1U) &&
+           (QTREE_U(tree, child) == QTREE_U(tree, child + 0x1U)) &&
+           (QTREE_U(tree, child) == QTREE_U(tree, child + 0x2U)) &&
+           (QTREE_U(tree, child) == QTREE_U(tree, child + 0x3U));
 }
 
 /**
@@ -139,506 +595,3092 @@ static bool is_uniform(QTree *tree, unsigned int child)
  * @param child the index of the first child
  * @return unsigned short the sum of the children
  */
-static unsigned short calculate_child_sum(QTree *tree, unsigned int child)
+static unsigned short calculate_child_sum(QTree *tree, size_t child)
 {
-    return (unsigned short)(tree->nodes[child].color +
-                            tree->nodes[child + 0x1U].color +
-                            tree->nodes[child + 0x2U].color +
-                            tree->nodes[child + 0x3U].color);
+    return (unsigned short)(tree->color[child] +
+                            tree->color[child + 0x1U] +
+                            tree->color[child + 0x2U] +
+                            tree->color[child + 0x3U]);
 }
 
 /**
- * @brief helper function to fill the output array recursively
+ * @brief Reduce two rows of leaves into one row of parents (2x2 blocks).
+ * For each parent `x`, children are `row0[2x]`, `row0[2x + 1]`, `row1[2x + 1]`, `row1[2x]`.
+ * Results are bit-identical to `calculate_child_sum`, `is_uniform` and `calculate_variance`:
+ * at this level every intermediate value of the variance is an exact integer.
  *
- * @param qtree the quadtree
- * @param pix the pixmap
- * @param index the index of the node
- * @param niveau the level of the quadtree
- * @param line the line of the pixmap
- * @param col the column of the pixmap
- * @param child the index of the first child
+ * @param row0 the upper row of leaves
+ * @param row1 the lower row of leaves
+ * @param count the number of parents
+ * @param color the average color of each parent
+ * @param e the error of each parent
+ * @param u the uniformity of each parent
+ * @param variance the variance of each parent
  * @return void
  */
-static void fill_quadtree_recursive(
-    QTree *qtree, Pixmap *pix,
-    unsigned int index, unsigned char niveau,
-    unsigned int line, unsigned int col)
+static void reduce_rows_2x2(const unsigned char *__restrict__ row0, const unsigned char *__restrict__ row1,
+                            size_t count, unsigned char *__restrict__ color, unsigned char *__restrict__ e,
+                            unsigned char *__restrict__ u, float *__restrict__ variance)
 {
-    unsigned int child_index = 0x0U;
-    unsigned short child_sum = 0x0U;
+    size_t x = 0UL;
+    unsigned short child_sum = 0U;
+    unsigned char m1 = 0U, m2 = 0U, m3 = 0U, m4 = 0U;
+    float m = 0.0F, mu = 0.0F;
 
-    if (!niveau)
+#if defined(__AVX2__)
+    for (; x + 16UL <= count; x += 16UL)
     {
-        qtree->nodes[index].u = 0x1U;
-        qtree->nodes[index].e = 0x0U;
-        qtree->nodes[index].variance = 0.0F; /* we need to calculate the variance for `filtrage` if it's present */
-        qtree->nodes[index].color = normalize_value(pix->data[line * pix->width + col], pix->grey_level);
-        return;
+        const __m256i low = _mm256_set1_epi16(0x00FF);
+        __m256i r0 = _mm256_loadu_si256((const __m256i *)(row0 + 2UL * x));
+        __m256i r1 = _mm256_loadu_si256((const __m256i *)(row1 + 2UL * x));
+        __m256i a = _mm256_and_si256(r0, low);  /* top-left     */
+        __m256i b = _mm256_srli_epi16(r0, 8);   /* top-right    */
+        __m256i c = _mm256_srli_epi16(r1, 8);   /* bottom-right */
+        __m256i d = _mm256_and_si256(r1, low);  /* bottom-left  */
+        __m256i s = _mm256_add_epi16(_mm256_add_epi16(a, b), _mm256_add_epi16(c, d));
+        __m256i m16 = _mm256_srli_epi16(s, 2);
+        __m256i u16 = _mm256_and_si256(_mm256_and_si256(_mm256_cmpeq_epi16(a, b), _mm256_cmpeq_epi16(a, c)),
+                                       _mm256_cmpeq_epi16(a, d));
+        __m256i sq = _mm256_setzero_si256(), sq_lo = _mm256_setzero_si256(), sq_hi = _mm256_setzero_si256();
+        __m256i packed = _mm256_setzero_si256();
+
+        /* packus works on 128-bit lanes: restore the order with a 64-bit permutation */
+        packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(m16, _mm256_and_si256(s, _mm256_set1_epi16(3))), 0xD8);
+        _mm_storeu_si128((__m128i *)(color + x), _mm256_castsi256_si128(packed));
+        _mm_storeu_si128((__m128i *)(e + x), _mm256_extracti128_si256(packed, 1));
+        packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(_mm256_srli_epi16(u16, 15), _mm256_setzero_si256()), 0xD8);
+        _mm_storeu_si128((__m128i *)(u + x), _mm256_castsi256_si128(packed));
+
+        /* (m - m_k)^2 < 2^16, their sum fits on 32 bits */
+        a = _mm256_sub_epi16(m16, a);
+        b = _mm256_sub_epi16(m16, b);
+        c = _mm256_sub_epi16(m16, c);
+        d = _mm256_sub_epi16(m16, d);
+        sq = _mm256_mullo_epi16(a, a);
+        sq_lo = _mm256_cvtepu16_epi32(_mm256_castsi256_si128(sq));
+        sq_hi = _mm256_cvtepu16_epi32(_mm256_extracti128_si256(sq, 1));
+        sq = _mm256_mullo_epi16(b, b);
+        sq_lo = _mm256_add_epi32(sq_lo, _mm256_cvtepu16_epi32(_mm256_castsi256_si128(sq)));
+        sq_hi = _mm256_add_epi32(sq_hi, _mm256_cvtepu16_epi32(_mm256_extracti128_si256(sq, 1)));
+        sq = _mm256_mullo_epi16(c, c);
+        sq_lo = _mm256_add_epi32(sq_lo, _mm256_cvtepu16_epi32(_mm256_castsi256_si128(sq)));
+        sq_hi = _mm256_add_epi32(sq_hi, _mm256_cvtepu16_epi32(_mm256_extracti128_si256(sq, 1)));
+        sq = _mm256_mullo_epi16(d, d);
+        sq_lo = _mm256_add_epi32(sq_lo, _mm256_cvtepu16_epi32(_mm256_castsi256_si128(sq)));
+        sq_hi = _mm256_add_epi32(sq_hi, _mm256_cvtepu16_epi32(_mm256_extracti128_si256(sq, 1)));
+        _mm256_storeu_ps(variance + x, _mm256_div_ps(_mm256_sqrt_ps(_mm256_cvtepi32_ps(sq_lo)), _mm256_set1_ps(4.0F)));
+        _mm256_storeu_ps(variance + x + 8UL, _mm256_div_ps(_mm256_sqrt_ps(_mm256_cvtepi32_ps(sq_hi)), _mm256_set1_ps(4.0F)));
+    }
+#endif
+#if defined(__SSE2__)
+    for (; x + 8UL <= count; x += 8UL)
+    {
+        const __m128i low = _mm_set1_epi16(0x00FF);
+        const __m128i zero = _mm_setzero_si128();
+        __m128i r0 = _mm_loadu_si128((const __m128i *)(row0 + 2UL * x));
+        __m128i r1 = _mm_loadu_si128((const __m128i *)(row1 + 2UL * x));
+        __m128i a = _mm_and_si128(r0, low); /* top-left     */
+        __m128i b = _mm_srli_epi16(r0, 8);  /* top-right    */
+        __m128i c = _mm_srli_epi16(r1, 8);  /* bottom-right */
+        __m128i d = _mm_and_si128(r1, low); /* bottom-left  */
+        __m128i s = _mm_add_epi16(_mm_add_epi16(a, b), _mm_add_epi16(c, d));
+        __m128i m16 = _mm_srli_epi16(s, 2);
+        __m128i u16 = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi16(a, b), _mm_cmpeq_epi16(a, c)),
+                                    _mm_cmpeq_epi16(a, d));
+        __m128i packed = _mm_packus_epi16(m16, _mm_and_si128(s, _mm_set1_epi16(3)));
+        __m128i sq = zero, sq_lo = zero, sq_hi = zero;
+
+        _mm_storel_epi64((__m128i *)(color + x), packed);
+        _mm_storel_epi64((__m128i *)(e + x), _mm_srli_si128(packed, 8));
+        _mm_storel_epi64((__m128i *)(u + x), _mm_packus_epi16(_mm_srli_epi16(u16, 15), zero));
+
+        /* (m - m_k)^2 < 2^16, their sum fits on 32 bits */
+        a = _mm_sub_epi16(m16, a);
+        b = _mm_sub_epi16(m16, b);
+        c = _mm_sub_epi16(m16, c);
+        d = _mm_sub_epi16(m16, d);
+        sq = _mm_mullo_epi16(a, a);
+        sq_lo = _mm_unpacklo_epi16(sq, zero);
+        sq_hi = _mm_unpackhi_epi16(sq, zero);
+        sq = _mm_mullo_epi16(b, b);
+        sq_lo = _mm_add_epi32(sq_lo, _mm_unpacklo_epi16(sq, zero));
+        sq_hi = _mm_add_epi32(sq_hi, _mm_unpackhi_epi16(sq, zero));
+        sq = _mm_mullo_epi16(c, c);
+        sq_lo = _mm_add_epi32(sq_lo, _mm_unpacklo_epi16(sq, zero));
+        sq_hi = _mm_add_epi32(sq_hi, _mm_unpackhi_epi16(sq, zero));
+        sq = _mm_mullo_epi16(d, d);
+        sq_lo = _mm_add_epi32(sq_lo, _mm_unpacklo_epi16(sq, zero));
+        sq_hi = _mm_add_epi32(sq_hi, _mm_unpackhi_epi16(sq, zero));
+        _mm_storeu_ps(variance + x, _mm_div_ps(_mm_sqrt_ps(_mm_cvtepi32_ps(sq_lo)), _mm_set1_ps(4.0F)));
+        _mm_storeu_ps(variance + x + 4UL, _mm_div_ps(_mm_sqrt_ps(_mm_cvtepi32_ps(sq_hi)), _mm_set1_ps(4.0F)));
+    }
+#endif
+    for (; x < count; ++x)
+    {
+        m1 = row0[2UL * x];
+        m2 = row0[2UL * x + 1UL];
+        m3 = row1[2UL * x + 1UL];
+        m4 = row1[2UL * x];
+        child_sum = (unsigned short)(m1 + m2 + m3 + m4);
+        color[x] = (unsigned char)(child_sum >> 0x2U);
+        e[x] = (unsigned char)(child_sum & 0x3U);
+        u[x] = (unsigned char)((m1 == m2) && (m1 == m3) && (m1 == m4));
+
+        m = color[x];
+        mu = 0.0F;
+        mu += (m - m1) * (m - m1);
+        mu += (m - m2) * (m - m2);
+        mu += (m - m3) * (m - m3);
+        mu += (m - m4) * (m - m4);
+        variance[x] = (float)sqrt(mu) / 4.0F;
     }
-
-    /* going down to leaf node first */
-    --niveau;
-
-    /* divide into quadrants and recurse */
-    child_index = index * MAX_CHILD + 0x1U;
-    fill_quadtree_recursive(qtree, pix, child_index, niveau, line, col);
-    fill_quadtree_recursive(qtree, pix, child_index + 1, niveau, line, col + (0x1U << niveau));
-    fill_quadtree_recursive(qtree, pix, child_index + 2, niveau, line + (0x1U << niveau), col + (0x1U << niveau));
-    fill_quadtree_recursive(qtree, pix, child_index + 3, niveau, line + (0x1U << niveau), col);
-
-    /* for internal nodes, we calculate the color as the average of the children */
-    child_sum = calculate_child_sum(qtree, child_index);
-    qtree->nodes[index].e = child_sum & 0x3U;                      /* we check if there any error on first two bits */
-    qtree->nodes[index].u = is_uniform(qtree, child_index);        /* not a leaf node, so we need to determine `u` from childs */
-    qtree->nodes[index].color = (unsigned char)(child_sum / 4.0F); /* average of the children */
-
-    /* we need to calculate the variance for `filtrage` if it's present */
-    qtree->nodes[index].variance = calculate_variance(qtree, index, child_index);
 }
 
-extern void create_qtc_file(QTree *qtree, unsigned short width, const char *file_name)
+/**
+ * @brief Number of nodes outside of the image from node `i` in its level: in z-order, the nodes
+ * of the largest subtree outside of the image whose first node of this level is `i`
+ *
+ * @param qtree the quadtree
+ * @param i the index of the node
+ * @param depth the depth of the node
+ * @return size_t the number of nodes to skip, 0 if `i` is in the image
+ */
+static __inline__ size_t outside_run(const QTree *qtree, size_t i, unsigned char depth)
 {
-    FileBit out = {0};
-    FILE *fptr = NULL;
-    time_t current_time = 0L;
-    char *c_time_string = NULL;
-    unsigned int encoded_size = 0U;
-    if (!qtree || !file_name)
+    size_t offset = i - DETERMINE_LEVEL_OFFSET((size_t)depth), run = 1UL;
+
+    if (!is_outside(qtree, i, depth))
     {
-        fprintf(stderr, "Error: qtree / file_name is NULL in create_qtc_file()!\n");
-        return;
+        return 0UL;
     }
-    if (!(fptr = fopen(file_name, "w")))
+    while (depth && !(offset & 0x3UL) &&
+           is_outside(qtree, DETERMINE_LEVEL_OFFSET((size_t)depth - 1UL) + (offset >> 2UL), (unsigned char)(depth - 1U)))
     {
-        fprintf(stderr, "Error: %s file not found in create_qtc_file()!\n", file_name);
-        return;
+        offset >>= 2UL;
+        run <<= 2UL;
+        --depth;
     }
-    fBitinit(&out, fptr);
-
-    current_time = time(NULL);
-    c_time_string = ctime(&current_time);
+    return run;
+}
 
-    fprintf(fptr, "Q1\n# %s", c_time_string);
-    fprintf(fptr, "# compression rate ");
+/**
+ * @brief Number of pixels of the image covered by a node
+ *
+ * @param qtree the quadtree
+ * @param i the index of the node
+ * @param depth the depth of the node
+ * @return double the number of pixels, 0 outside of the image
+ */
+static __inline__ double node_pixels(const QTree *qtree, size_t i, unsigned char depth)
+{
+    size_t offset = 0UL, line = 0UL, col = 0UL, side = 1UL << (qtree->niveau - depth), w = side, h = side;
 
-    qtc_from_quadtree(qtree, &out, &encoded_size, false);
+    if (!QTREE_IS_SQUARE(qtree))
+    {
+        offset = i - DETERMINE_LEVEL_OFFSET((size_t)depth);
+        line = compact_bits(offset >> 1UL);
+        col = (line ^ compact_bits(offset)) * side;
+        line *= side;
+        w = (col >= qtree->width) ? (0UL) : ((qtree->width - col < side) ? (qtree->width - col) : (side));
+        h = (line >= qtree->height) ? (0UL) : ((qtree->height - line < side) ? (qtree->height - line) : (side));
+    }
+    return (double)w * (double)h;
+}
 
-    /* writing the compression rate */
-    fprintf(fptr, "%.2f%%\n", ((float)encoded_size * 100.0F) / (width * width * 8.0F));
+/**
+ * @brief Number of nodes of the subtree of node `i` in the image, from its depth down to `last`:
+ * the nodes of the 4^n square of the tree for a square image, far fewer for a narrow one
+ *
+ * @param qtree the quadtree
+ * @param i the index of the root of the subtree
+ * @param depth the depth of the root
+ * @param last the depth of the last level counted
+ * @return size_t the number of nodes, 0 if the root is outside of the image
+ */
+static size_t inside_nodes(const QTree *qtree, size_t i, unsigned char depth, unsigned char last)
+{
+    size_t offset = i - DETERMINE_LEVEL_OFFSET((size_t)depth), line = compact_bits(offset >> 1UL);
+    size_t col = line ^ compact_bits(offset), side = 1UL << (qtree->niveau - depth), w = 0UL, h = 0UL, nodes = 0UL;
+    unsigned char level = 0U, shift = 0U;
+
+    col *= side;
+    line *= side;
+    w = (col >= qtree->width) ? (0UL) : ((qtree->width - col < side) ? (qtree->width - col) : (side));
+    h = (line >= qtree->height) ? (0UL) : ((qtree->height - line < side) ? (qtree->height - line) : (side));
+    for (level = depth; level <= last; ++level)
+    {
+        shift = (unsigned char)(qtree->niveau - level);
+        nodes += ((w + (1UL << shift) - 1UL) >> shift) * ((h + (1UL << shift) - 1UL) >> shift);
+    }
+    return nodes;
+}
 
-    fEcritCharbin(&out, qtree->niveau);
-    qtc_from_quadtree(qtree, &out, &encoded_size, true);
+/**
+ * @brief Number of nodes of a chunk in the image: its subtree without its root, which is in the top stream
+ *
+ * @param qtree the quadtree
+ * @param depth the depth of the roots of the chunks
+ * @param chunk the index of the chunk among the nodes of `depth`
+ * @return size_t the number of nodes
+ */
+static size_t chunk_nodes_inside(const QTree *qtree, unsigned char depth, size_t chunk)
+{
+    size_t nodes = inside_nodes(qtree, DETERMINE_LEVEL_OFFSET((size_t)depth) + chunk, depth, qtree->niveau);
+    return (nodes) ? (nodes - 1UL) : (0UL);
+}
 
-    fBitclose(&out);
+/**
+ * @brief The planes of the edges of a tree, in its block `edges`
+ *
+ * @param qtree the quadtree, its edges allocated
+ * @param planes the planes, filled
+ */
+static void edge_planes(const QTree *qtree, EdgePlanes *planes)
+{
+    size_t count = QTREE_EDGE_NODES((size_t)qtree->niveau);
+
+    /* the widest values first, to keep them aligned */
+    planes->sum = (double *)(void *)qtree->edges;
+    planes->variance = (float *)(void *)(planes->sum + count);
+    planes->max = planes->variance + count;
+    planes->color = (unsigned char *)(void *)(planes->max + count);
+    planes->eu = planes->color + count;
+    planes->niveau = qtree->niveau;
 }
 
 /**
- * @brief Create a .qtc file from the quadtree
+ * @brief Index, in the edges, of a node outside of the image. On the right of the image, its pixels repeat
+ * the last column, so it only depends on its lines: it is the node of the column of the same lines.
+ * Below the image, it is the node of the line of the same columns.
  *
  * @param qtree the quadtree
- * @param filebit the filebit structure
- * @param encoded_size the size of the encoded data
- * @param need_to_write true if we need to write the data
- * @return void
+ * @param i the index of the node, outside of the image
+ * @param depth the depth of the node
+ * @return size_t the index of its node of the edges
  */
-static void qtc_from_quadtree(
-    QTree *qtree, FileBit *filebit,
-    unsigned int *encoded_size, bool need_to_write)
+static __inline__ size_t edge_index(const QTree *qtree, size_t i, unsigned char depth)
 {
-    unsigned int error = 0U;
-    size_t i = 0UL;
-    size_t child_index = 0x0UL;
-    size_t parent_index = 0x0UL;
-    size_t qtree_size = 0UL;
-
-    if (!qtree || !filebit)
-    {
-        fprintf(stderr, "Error: qtree / filebit is NULL in qtc_from_quadtree()!\n");
-        return;
-    }
-    qtree_size = DETERMINE_QTREE_SIZE(qtree->niveau);
+    size_t offset = i - DETERMINE_LEVEL_OFFSET((size_t)depth), line = compact_bits(offset >> 1UL);
+    size_t col = line ^ compact_bits(offset), first = 2UL * ((1UL << depth) - 1UL);
 
-    for (i = 0; i < qtree_size; ++i)
-    {
-        error = qtree->nodes[i].e;
-        child_index = i * MAX_CHILD + 0x1U;
-        parent_index = (i) ? ((i - 1) / MAX_CHILD) : (0x0UL); /* parent index */
+    return ((col << (qtree->niveau - depth)) >= qtree->width) ? (first + line) : (first + (1UL << depth) + col);
+}
 
-        /* parent is uniform */
-        if (qtree->nodes[parent_index].u)
-        {
-            continue;
-        }
+/**
+ * @brief Index of the first child of a node of the edges, the second one follows it. A node of the column
+ * has 4 children, the first one twice then the second one twice; a node of the line the first one,
+ * the second one twice then the first one.
+ *
+ * @param e the index of the node
+ * @param depth the depth of the node
+ * @return size_t the index of its first child
+ */
+static __inline__ size_t edge_child(size_t e, unsigned char depth)
+{
+    return 2UL * ((2UL << depth) - 1UL) + 2UL * (e - 2UL * ((1UL << depth) - 1UL));
+}
 
-        /* that's a leaf */
-        if (child_index >= qtree_size)
+/**
+ * @brief Fill the leaves and their parents of a square block of the pixmap,
+ * two lines of pixels at a time. The block is walked by tiles of
+ * `QTREE_BUILD_TILE` pixels: a tile is a subtree, so its nodes are
+ * contiguous in each level and the writes stay local. The parents
+ * outside of the image are not built, their parents read them from the
+ * edges; the leaves outside of a parent in the image repeat its last
+ * line or column, and have no error.
+ *
+ * @param job the build shared by every worker
+ * @param scratch `QTREE_BUILD_SCRATCH` bytes owned by the caller
+ * @param stats the variances of the parents of the leaves are added to it
+ * @param line0 the first line of the block, in pixels
+ * @param col0 the first column of the block, in pixels
+ * @param side the side of the block, in pixels
+ * @return void
+ */
+static void fill_quadtree_from_pixmap(const BuildJob *job, unsigned char *scratch, VarianceStats *stats,
+                                      size_t line0, size_t col0, size_t side)
+{
+    QTree *qtree = job->qtree;
+    const unsigned char *row0 = NULL, *row1 = NULL;
+    unsigned char *color = NULL, *e = NULL, *u = NULL, *rows = NULL, *leaf = NULL;
+    float *variance = NULL;
+    unsigned int sum = 0U, squares = 0U, in[MAX_CHILD] = {0U};
+    size_t tile = (side < QTREE_BUILD_TILE) ? side : QTREE_BUILD_TILE, half = tile >> 1UL;
+    size_t first_parent = DETERMINE_LEVEL_OFFSET(qtree->niveau - 1UL);
+    size_t first_leaf = DETERMINE_LEVEL_OFFSET(qtree->niveau);
+    size_t tile_line = 0UL, tile_col = 0UL, line = 0UL, col = 0UL, z_line = 0UL, parent = 0UL, i = 0UL;
+    size_t y0 = 0UL, y1 = 0UL, x = 0UL, last_line = 0UL, parents = 0UL;
+    bool clamp = false;
+
+    /* variance first, to keep it aligned */
+    variance = (float *)(void *)scratch;
+    color = scratch + half * sizeof(*variance);
+    e = color + half;
+    u = e + half;
+    rows = u + half; /* two normalized lines of pixels, if needed */
+
+    for (tile_line = line0; tile_line < line0 + side && tile_line < job->height; tile_line += tile)
+    {
+        /* the parents in the image: lines and columns of pixels by pairs, the last one may be single */
+        last_line = (tile_line + tile > job->height) ? ((job->height + 1UL) >> 1UL) : ((tile_line + tile) >> 1UL);
+        for (tile_col = col0; tile_col < col0 + side && tile_col < job->width; tile_col += tile)
         {
-            /* not 4-th child */
-            if (i % MAX_CHILD > 0UL)
+            clamp = (tile_line + tile > job->height || tile_col + tile > job->width);
+            parents = (tile_col + tile > job->width) ? ((job->width - tile_col + 1UL) >> 1UL) : (half);
+            for (line = tile_line >> 1UL; line < last_line; ++line)
             {
-                if (need_to_write)
+                row0 = job->pixels + (2UL * line) * job->stride + tile_col;
+                row1 = row0 + job->stride;
+                if (clamp) /* the tile crosses the edges of the image */
                 {
-                    fEcritCharbin(filebit, qtree->nodes[i].color);
+                    y0 = (2UL * line < job->height) ? (2UL * line) : (job->height - 1UL);
+                    y1 = (2UL * line + 1UL < job->height) ? (2UL * line + 1UL) : (job->height - 1UL);
+                    for (col = 0UL; col < tile; ++col)
+                    {
+                        x = (tile_col + col < job->width) ? (tile_col + col) : (job->width - 1UL);
+                        rows[col] = job->pixels[y0 * job->stride + x];
+                        rows[tile + col] = job->pixels[y1 * job->stride + x];
+                        if (job->normalize)
+                        {
+                            rows[col] = job->lut[rows[col]];
+                            rows[tile + col] = job->lut[rows[tile + col]];
+                        }
+                    }
+                    row0 = rows;
+                    row1 = rows + tile;
                 }
-                else
+                else if (job->normalize)
                 {
-                    *encoded_size += 0x8U;
+                    for (col = 0UL; col < tile; ++col)
+                    {
+                        rows[col] = job->lut[row0[col]];
+                        rows[tile + col] = job->lut[row1[col]];
+                    }
+                    row0 = rows;
+                    row1 = rows + tile;
                 }
-            }
-            continue;
-        }
-        /* internal nodes and root */
-        if (!i || (i % MAX_CHILD))
-        {
 
-            if (need_to_write)
-            {
-                fEcritCharbin(filebit, qtree->nodes[i].color);
-            }
-            else
-            {
-                (*encoded_size) += 0x8U;
+                reduce_rows_2x2(row0, row1, half, color, e, u, variance);
+
+                z_line = spread_bits(line) << 1UL;
+                for (col = 0UL; col < parents; ++col)
+                {
+                    parent = z_line | spread_bits(line ^ ((tile_col >> 1UL) + col));
+
+                    qtree->color[first_parent + parent] = color[col];
+                    qtree->eu[first_parent + parent] = QTREE_EU(e[col], u[col]);
+
+                    leaf = qtree->color + first_leaf + (parent << 2UL);
+                    leaf[0] = row0[2UL * col];
+                    leaf[1] = row0[2UL * col + 1UL];
+                    leaf[2] = row1[2UL * col + 1UL];
+                    leaf[3] = row1[2UL * col];
+
+                    if (job->sums)
+                    {
+                        /* the pixels of the image only: top-left, top-right, bottom-right, bottom-left */
+                        x = tile_col + 2UL * col;
+                        in[0] = (2UL * line < job->height && x < job->width);
+                        in[1] = (2UL * line < job->height && x + 1UL < job->width);
+                        in[2] = (2UL * line + 1UL < job->height && x + 1UL < job->width);
+                        in[3] = (2UL * line + 1UL < job->height && x < job->width);
+                        sum = in[0] * leaf[0] + in[1] * leaf[1] + in[2] * leaf[2] + in[3] * leaf[3];
+                        squares = in[0] * leaf[0] * leaf[0] + in[1] * leaf[1] * leaf[1] +
+                                  in[2] * leaf[2] * leaf[2] + in[3] * leaf[3] * leaf[3];
+                        job->sums[first_parent + parent] = sum;
+                        qtree->sse[first_parent + parent] = collapse_error(squares, sum, color[col],
+                                                                           in[0] + in[1] + in[2] + in[3]);
+                    }
+
+                    leaf = qtree->eu + first_leaf + (parent << 2UL);
+                    leaf[0] = leaf[1] = leaf[2] = leaf[3] = QTREE_EU(0x0U, 0x1U);
+
+                    if (qtree->variance)
+                    {
+                        qtree->variance[first_parent + parent] = variance[col];
+                        stats->sum += variance[col];
+                        stats->max = (variance[col] > stats->max) ? (variance[col]) : (stats->max);
+                        for (i = 0UL; i < MAX_CHILD; ++i)
+                        {
+                            qtree->variance[first_leaf + (parent << 2UL) + i] = 0.0F;
+                        }
+                    }
+                }
             }
         }
+    }
+}
 
-        /* writing error everytime */
-        if (need_to_write)
-        {
-            fEcrireBit(filebit, (int)(error >> 0x1U));
-            fEcrireBit(filebit, (int)(error & 0x1U));
-        }
-        else
-        {
-            (*encoded_size) += 0x2U;
-        }
+extern void fill_quadtree_levels(const BuildJob *job, VarianceStats *stats, size_t subtree, int sub_depth, int bottom)
+{
+    QTree *qtree = job->qtree;
+    EdgePlanes edges;
+    size_t index = 0UL, first = 0UL, count = 0UL, child_index = 0UL, k = 0UL, skip = 0UL;
+    double sum = 0.0, squares = 0.0;
+    unsigned short child_sum = 0x0U;
+    int depth = 0;
+    bool outside = QTREE_HAS_EDGES(qtree);
 
-        /* error is 0, so we write uniform */
-        if (!error)
+    if (outside)
+    {
+        edge_planes(qtree, &edges);
+    }
+    for (depth = bottom; depth >= sub_depth; --depth)
+    {
+        count = 1UL << (2UL * (size_t)(depth - sub_depth));
+        first = DETERMINE_LEVEL_OFFSET((size_t)depth) + subtree * count;
+        for (index = first; index < first + count; ++index)
         {
-            if (need_to_write)
+            if (outside && (skip = outside_run(qtree, index, (unsigned char)depth))) /* read from the edges by its parent */
             {
-                fEcrireBit(filebit, qtree->nodes[i].u);
+                index += skip - 1UL;
+                continue;
             }
-            else
+            child_index = index * MAX_CHILD + 0x1U;
+            for (k = child_index; outside && k < child_index + MAX_CHILD; ++k)
+            {
+                if (is_outside(qtree, k, (unsigned char)(depth + 1)))
+                {
+                    fill_node_from_edges(job, &edges, stats, k, (unsigned char)(depth + 1));
+                }
+            }
+            child_sum = calculate_child_sum(qtree, child_index);
+            qtree->eu[index] = QTREE_EU(child_sum & 0x3U,                              /* we check if there any error on first two bits */
+                                        is_uniform(qtree, child_index));               /* not a leaf node, so we need to determine `u` from childs */
+            qtree->color[index] = (unsigned char)(child_sum / 4.0F);                  /* average of the children */
+            if (qtree->variance)
+            {
+                qtree->variance[index] = calculate_variance(qtree, index, child_index);
+                stats->sum += qtree->variance[index];
+                stats->max = (qtree->variance[index] > stats->max) ? (qtree->variance[index]) : (stats->max);
+            }
+            if (job->sums)
             {
-                ++(*encoded_size);
+                /* the squares of the pixels of each child, back from its error, inside the image only */
+                for (sum = squares = 0.0, k = child_index; k < child_index + MAX_CHILD; ++k)
+                {
+                    sum += job->sums[k];
+                    squares += qtree->sse[k] + 2.0 * qtree->color[k] * job->sums[k] -
+                               node_pixels(qtree, k, (unsigned char)(depth + 1)) * qtree->color[k] * qtree->color[k];
+                }
+                job->sums[index] = sum;
+                qtree->sse[index] = collapse_error(squares, sum, qtree->color[index],
+                                                   node_pixels(qtree, index, (unsigned char)depth));
             }
         }
     }
+}
+
+/**
+ * @brief Fill a node outside of the image from its node of the edges: its subtree is not built,
+ * its variances are added to the statistics all the same
+ *
+ * @param job the build
+ * @param edges the planes of the edges
+ * @param stats the variances of the subtree of the node are added to it
+ * @param i the index of the node, an internal one outside of the image
+ * @param depth the depth of the node
+ * @return void
+ */
+static void fill_node_from_edges(const BuildJob *job, const EdgePlanes *edges, VarianceStats *stats, size_t i,
+                                 unsigned char depth)
+{
+    QTree *qtree = job->qtree;
+    size_t e = edge_index(qtree, i, depth);
 
-    if (!need_to_write)
+    qtree->color[i] = edges->color[e];
+    qtree->eu[i] = edges->eu[e];
+    if (qtree->variance)
     {
-        /* padding at the end */
-        *encoded_size += (0x8U - *encoded_size % 0x8U) % 0x8U;
+        qtree->variance[i] = edges->variance[e];
+        stats->sum += edges->sum[e];
+        stats->max = (edges->max[e] > stats->max) ? (edges->max[e]) : (stats->max);
+    }
+    if (job->sums) /* no pixel of the image, no error */
+    {
+        job->sums[i] = 0.0;
+        qtree->sse[i] = 0.0;
     }
 }
 
-extern void init_quadtree_from_file(QTree *tree, const char *file_name)
+/**
+ * @brief Build the edges of the image, the nodes of the tree outside of it, bottom-up as `fill_quadtree_levels`
+ * does: the 1-D tree of its last column, its last pixel repeated below it, and of its last line,
+ * its last pixel repeated on its right
+ *
+ * @param job the build, of a tree which is not square, its edges allocated
+ * @return void
+ */
+static void build_edges(const BuildJob *job)
 {
-    FileBit in = {0};
-    size_t i = 0UL, qtree_size = 0UL, child_index = 0x0UL, parent_index = 0x0UL;
-    unsigned char character = 0U, niveau = 0U, color_fourth_child = 0U;
+    QTree *qtree = job->qtree;
+    EdgePlanes edges;
+    unsigned char colors[MAX_CHILD] = {0U};
+    float variances[MAX_CHILD] = {0.0F};
+    size_t count = 1UL << qtree->niveau, first = 2UL * (count - 1UL), p = 0UL, e = 0UL, child = 0UL, y = 0UL, x = 0UL;
+    unsigned short child_sum = 0x0U;
+    unsigned char depth = qtree->niveau, pixel = 0U;
+    bool line = false, uniform = false;
 
-    if (!tree || !file_name)
+    edge_planes(qtree, &edges);
+    for (p = 0UL; p < count; ++p)
     {
-        fprintf(stderr, "Error: tree / file_name is NULL in init_quadtree_from_file()!\n");
-        return;
+        y = (p < job->height) ? (p) : (job->height - 1UL);
+        x = (p < job->width) ? (p) : (job->width - 1UL);
+        pixel = job->pixels[y * job->stride + job->width - 1UL];
+        edges.color[first + p] = (job->normalize) ? (job->lut[pixel]) : (pixel);
+        pixel = job->pixels[(job->height - 1UL) * job->stride + x];
+        edges.color[first + count + p] = (job->normalize) ? (job->lut[pixel]) : (pixel);
     }
-    if (!(fBitopen(&in, file_name, "r")))
+    for (e = first; e < first + 2UL * count; ++e)
     {
-        fprintf(stderr, "Error: %s file not found in init_quadtree_from_file()!\n", file_name);
-        return;
+        edges.eu[e] = QTREE_EU(0x0U, 0x1U);
+        edges.variance[e] = edges.max[e] = 0.0F;
+        edges.sum[e] = 0.0;
     }
 
-    if ('Q' != fLireCharbin(&in) || '1' != fLireCharbin(&in))
+    /* the subtree of a node holds 2 copies of the subtree of each of its 2 children */
+    while (depth--)
     {
-        fprintf(stderr, "Error: %s is not a QTC file!\n", file_name);
-        return;
+        count >>= 1UL;
+        first = 2UL * (count - 1UL);
+        for (e = first; e < first + 2UL * count; ++e)
+        {
+            child = edge_child(e, depth);
+            line = (e >= first + count);
+            colors[0] = edges.color[child];
+            colors[1] = (line) ? (edges.color[child + 1UL]) : (edges.color[child]);
+            colors[2] = edges.color[child + 1UL];
+            colors[3] = (line) ? (edges.color[child]) : (edges.color[child + 1UL]);
+            variances[0] = edges.variance[child];
+            variances[1] = (line) ? (edges.variance[child + 1UL]) : (edges.variance[child]);
+            variances[2] = edges.variance[child + 1UL];
+            variances[3] = (line) ? (edges.variance[child]) : (edges.variance[child + 1UL]);
+            child_sum = (unsigned short)(colors[0] + colors[1] + colors[2] + colors[3]);
+            uniform = (colors[0] == colors[2]) && QTREE_U(&edges, child) && QTREE_U(&edges, child + 1UL);
+            edges.eu[e] = QTREE_EU(child_sum & 0x3U, uniform);
+            edges.color[e] = (unsigned char)(child_sum / 4.0F);
+            edges.variance[e] = children_variance(edges.color[e], colors, variances);
+            edges.sum[e] = edges.variance[e] + 2.0 * (edges.sum[child] + edges.sum[child + 1UL]);
+            edges.max[e] = (edges.max[child] > edges.max[child + 1UL]) ? (edges.max[child]) : (edges.max[child + 1UL]);
+            edges.max[e] = (edges.variance[e] > edges.max[e]) ? (edges.variance[e]) : (edges.max[e]);
+        }
     }
-    (void)fLireCharbin(&in); /* read '\n' */
+}
 
-    /* read all comments */
-    do
+/**
+ * @brief Worker: build every subtree of `[first, last)` at `job->depth`, from the pixels up to its root
+ *
+ * @param arg the `BuildTask`
+ * @return void* NULL
+ */
+static void *build_subtrees(void *arg)
+{
+    BuildTask *task = arg;
+    const BuildJob *job = task->job;
+    unsigned char *scratch = NULL;
+    size_t subtree = 0UL, line = 0UL, col = 0UL;
+    size_t side = 1UL << (job->qtree->niveau - job->depth); /* side of a subtree, in pixels */
+
+    if (!(scratch = malloc(QTREE_BUILD_SCRATCH)))
     {
-        character = fLireCharbin(&in);
-        if ('#' == character)
-        {
-            fprintf(stderr, "comment: ");
-            while ('\n' != character)
-            {
-                fprintf(stderr, "%c", character);
-                character = fLireCharbin(&in);
-            }
-            fprintf(stderr, "\n");
-        }
-        else
+        fprintf(stderr, "Error: memory allocation error in build_subtrees()!\n");
+        task->done = false;
+        return NULL;
+    }
+    for (subtree = task->first; subtree < task->last; ++subtree)
+    {
+        line = compact_bits(subtree >> 1UL);
+        col = (line ^ compact_bits(subtree)) * side;
+        if (line * side >= job->height || col >= job->width) /* outside of the image, read from the edges */
         {
-            niveau = character;
-            break;
+            continue;
         }
-    } while ('\n' == character);
+        fill_quadtree_from_pixmap(job, scratch, &task->stats, line * side, col, side);
+        fill_quadtree_levels(job, &task->stats, subtree, job->depth, (int)job->qtree->niveau - 2);
+    }
+    free(scratch);
+    task->done = true;
+    return NULL;
+}
 
-    qtree_size = make_qtree(tree, QTC_GREY_LEVEL, niveau);
+extern void run_workers(void *(*worker)(void *), void *tasks, size_t task_size, unsigned int nb_tasks)
+{
+    unsigned char *task = tasks;
+    pthread_t *threads = NULL;
+    unsigned int t = 0U, started = 1U;
 
-    for (i = 0UL; i < qtree_size; ++i)
+    if (nb_tasks > 1U && (threads = malloc(nb_tasks * sizeof(*threads))))
     {
-        parent_index = (i) ? (i - 1) / MAX_CHILD : (0UL);
-        child_index = i * MAX_CHILD + 0x1U;
-
-        /* that's a leaf */
-        if (child_index >= qtree_size)
+        for (started = 1U; started < nb_tasks; ++started)
         {
-            if (tree->nodes[parent_index].u)
-            {
-                tree->nodes[i].color = tree->nodes[parent_index].color;
-            }
-            else if (!(i % MAX_CHILD))
+            if (pthread_create(&threads[started], NULL, worker, task + started * task_size))
             {
-                /* m_4 = (4m + e) - (m_1 + m_2 + m_3) */
-                color_fourth_child = (unsigned char)((tree->nodes[parent_index].color * MAX_CHILD + /* 4m */
-                                                      tree->nodes[parent_index].e) -                /* + e */
-                                                     (tree->nodes[i - 3].color +                    /* - m_1 */
-                                                      tree->nodes[i - 2].color +                    /* - m_2 */
-                                                      tree->nodes[i - 1].color));                   /* - m_3 */
-                tree->nodes[i].color = color_fourth_child;
+                break;
             }
-            else
-            {
-                tree->nodes[i].color = fLireCharbin(&in);
-            }
-            tree->nodes[i].e = 0x0U;
-            tree->nodes[i].u = 0x1U;
-            continue;
         }
+    }
+    (void)worker(task);
+    for (t = started; t < nb_tasks; ++t) /* threads we could not start */
+    {
+        (void)worker(task + t * task_size);
+    }
+    for (t = 1U; t < started; ++t)
+    {
+        (void)pthread_join(threads[t], NULL);
+    }
+    free(threads);
+}
 
-        /* internal every 4th nodes, without root */
-        if (i && !(i % MAX_CHILD))
-        {
-            /* m_4 = (4m + e) - (m_1 + m_2 + m_3) */
-            color_fourth_child = (unsigned char)((tree->nodes[parent_index].color * MAX_CHILD + /* 4m */
-                                                  tree->nodes[parent_index].e) -                /* + e */
-                                                 (tree->nodes[i - 3].color +                    /* - m_1 */
-                                                  tree->nodes[i - 2].color +                    /* - m_2 */
-                                                  tree->nodes[i - 1].color));                   /* - m_3 */
-            tree->nodes[i].color = color_fourth_child;
+/**
+ * @brief Format the header of a .qtc file: magic number, date and compression rate,
+ * then the width and the height of the image when it is not the 2^n square of the tree
+ *
+ * @param buf the buffer, `QTC_HEADER_MAX` bytes at least
+ * @param version '1', '2' or '3'
+ * @param encoded_size the size of the encoded tree, in bits
+ * @param qtree the quadtree
+ * @return size_t the length of the header, in bytes
+ */
+static size_t format_qtc_header(char *buf, char version, size_t encoded_size, const QTree *qtree)
+{
+    time_t current_time = time(NULL);
+    char date[32] = "\n"; /* `ctime_r` writes 26 bytes, and the caller keeps its buffer: no shared state */
+    int len = 0;
 
-            tree->nodes[i].e = (unsigned char)(fLireBit(&in) << 0x1U);
-            tree->nodes[i].e |= (unsigned char)(fLireBit(&in));
-            tree->nodes[i].u = (!tree->nodes[i].e) ? (unsigned char)(fLireBit(&in)) : (0x0U);
-            continue;
-        }
+    (void)ctime_r(&current_time, date);
+    len = sprintf(buf, "Q%c\n# %s", version, date);
+    len += sprintf(buf + len, "# compression rate ");
+
+    /* writing the compression rate */
+    len += sprintf(buf + len, "%.2f%%\n",
+                   ((float)encoded_size * 100.0F) / ((float)qtree->width * (float)qtree->height * 8.0F));
 
-        tree->nodes[i].color = fLireCharbin(&in);                                         /* m */
-        tree->nodes[i].e = (unsigned char)(fLireBit(&in) << 0x1U);                        /* e */
-        tree->nodes[i].e |= (unsigned char)(fLireBit(&in));                               /* e */
-        tree->nodes[i].u = (!tree->nodes[i].e) ? (unsigned char)(fLireBit(&in)) : (0x0U); /* u */
+    /* the nodes outside of a rectangular image are not in the file */
+    if (!QTREE_IS_SQUARE(qtree))
+    {
+        len += sprintf(buf + len, "%u %u\n", qtree->width, qtree->height);
     }
+    return (size_t)len;
+}
+
+extern void write_qtc_header(FILE *fptr, char version, size_t encoded_size, const QTree *qtree)
+{
+    char header[QTC_HEADER_MAX];
+    size_t len = format_qtc_header(header, version, encoded_size, qtree);
+    (void)fwrite(header, sizeof(*header), len, fptr);
+}
+
+/**
+ * @brief Encode a quadtree as a Q1 file: a single pass over the tree, into memory,
+ * so that the size is known before the header
+ *
+ * @param qtree the quadtree
+ * @param dest the file, or a buffer of `fBitinit(dest, NULL)`
+ * @param ctx the context whose arenas receive the stream and the file in `dest`, NULL to write in `dest` as it is
+ * @return true on success
+ * @return false on a memory allocation or write error
+ */
+static bool qtc_encode_plain(QTree *qtree, FileBit *dest, QtcContext *ctx)
+{
+    FileBit out = {0};
+    char header[QTC_HEADER_MAX];
+    size_t len = 0UL, bound = 0x1UL + qtc_stream_bound(inside_nodes(qtree, 0UL, 0U, qtree->niveau), false);
+    unsigned char *stream = NULL;
+    bool done = false;
 
-    fBitclose(&in);
+    /* the level and the nodes, in a scratch they never grow out of */
+    if (!(stream = qtc_scratch(ctx, bound)))
+    {
+        return false;
+    }
+    fBitinit(&out, NULL);
+    out.mem = stream;
+    out.memcap = bound;
+    fEcritCharbin(&out, qtree->niveau);
+    qtc_from_quadtree(qtree, &out);
+    if (EOF != fBitflush(&out))
+    {
+        /* without the level, padding included */
+        len = format_qtc_header(header, '1', (out.memlen - 1UL) * 0x8UL, qtree);
+        done = (!ctx || qtc_context_file(ctx, dest, len + out.memlen)) &&
+               (EOF != fEcrireOctets(dest, (const unsigned char *)header, len)) &&
+               (EOF != fEcrireOctets(dest, out.mem, out.memlen)) && (EOF != fBitflush(dest));
+    }
+    qtc_scratch_release(ctx, stream);
+    return done;
 }
 
-static void fill_pixmap_recursive(QTree *qtree, Pixmap *pix,
-                                  unsigned int index, unsigned char niveau,
-                                  unsigned int line, unsigned int col)
+/**
+ * @brief Encode a quadtree as a chunked file, Q2 or Q3, on several threads
+ *
+ * @param qtree the quadtree
+ * @param dest the file, or a buffer of `fBitinit(dest, NULL)`
+ * @param nb_threads the number of threads, 1 encodes on the calling thread only
+ * @param format 2 for raw streams, 3 for range coded streams
+ * @param ctx the context whose arenas receive the streams and the file in `dest`, NULL to write in `dest` as it is
+ * @return true on success
+ * @return false on a memory allocation or write error
+ */
+static bool qtc_encode_chunked(QTree *qtree, FileBit *dest, unsigned int nb_threads, unsigned char format,
+                               QtcContext *ctx)
 {
-    unsigned int i = 0U, j = 0U, child_index = 0x0U, size = 1U << niveau;
+    FileBit top = {0};
+    ChunkTask *tasks = NULL;
+    QtcEntropy *models = NULL;
+    uint32_t *queues = NULL;
+    unsigned char *streams = NULL;
+    void *scratch = NULL;
+    size_t *sizes = NULL;
+    char header[QTC_HEADER_MAX];
+    size_t nb_chunks = 0UL, chunk = 0UL, encoded_size = 0UL, len = 0UL;
+    size_t chunk_nodes = 0UL, top_nodes = 0UL, streams_size = 0UL, nodes = 0UL, queue_cap = 0UL, offset = 0UL;
+    unsigned int t = 0U;
+    unsigned char depth = QTC_CHUNK_DEPTH(qtree->niveau);
+    bool done = true, entropy = (3U == format);
+
+    nb_chunks = 1UL << (2UL * depth);
+    nb_threads = (nb_threads < 1U) ? (1U) : (nb_threads);
+    nb_threads = (nb_chunks < nb_threads) ? ((unsigned int)nb_chunks) : (nb_threads);
+
+    /* each stream has its room in the scratch, which it never grows out of, for the nodes it has in the image,
+     * and each worker its models and queue: 2 symbols per internal node and 1 per leaf, the leaves of a chunk are
+     * 3/4 of its nodes */
+    top_nodes = inside_nodes(qtree, 0UL, 0U, depth);
+    streams_size = qtc_stream_bound(top_nodes, entropy);
+    for (chunk = 0UL; chunk < nb_chunks; ++chunk)
+    {
+        nodes = chunk_nodes_inside(qtree, depth, chunk);
+        chunk_nodes = (nodes > chunk_nodes) ? (nodes) : (chunk_nodes);
+        streams_size += qtc_stream_bound(nodes, entropy);
+    }
+    queue_cap = (chunk_nodes + (chunk_nodes >> 2UL) > 2UL * top_nodes) ? (chunk_nodes + (chunk_nodes >> 2UL))
+                                                                        : (2UL * top_nodes);
+    queue_cap = (entropy) ? (queue_cap + 1UL) : (0UL);
 
-    if (niveau > 0 && qtree->nodes[index].u)
+    if (!(scratch = qtc_scratch(ctx, nb_threads * sizeof(*tasks) + ((entropy) ? (nb_threads * sizeof(*models)) : (0UL)) +
+                                         nb_chunks * sizeof(*sizes) + nb_threads * queue_cap * sizeof(*queues) +
+                                         streams_size)))
+    {
+        return false;
+    }
+    tasks = scratch;
+    models = (void *)(tasks + nb_threads);
+    sizes = (void *)(models + ((entropy) ? (nb_threads) : (0U)));
+    queues = (void *)(sizes + nb_chunks);
+    streams = (void *)(queues + nb_threads * queue_cap);
+    (void)memset(tasks, 0, nb_threads * sizeof(*tasks));
+
+    /* the subtrees below `depth` are written by the workers, each one into its own buffer */
+    for (t = 0U; t < nb_threads; ++t)
     {
-        for (i = 0; i < size; ++i)
+        tasks[t].qtree = qtree;
+        tasks[t].sizes = sizes;
+        tasks[t].first = nb_chunks * t / nb_threads;
+        tasks[t].last = nb_chunks * (t + 1U) / nb_threads;
+        tasks[t].depth = depth;
+        tasks[t].entropy = entropy;
+        tasks[t].models = (entropy) ? (models + t) : (NULL);
+        if (entropy)
         {
-            for (j = 0; j < size; ++j)
-            {
-                pix->data[(line + i) * pix->width + (col + j)] = qtree->nodes[index].color;
-            }
+            models[t].queue = queues + t * queue_cap;
+            models[t].queue_cap = queue_cap;
         }
-        return;
+        fBitinit(&tasks[t].bits, NULL);
+        tasks[t].bits.mem = streams + offset;
+        for (chunk = tasks[t].first; chunk < tasks[t].last; ++chunk)
+        {
+            tasks[t].bits.memcap += qtc_stream_bound(chunk_nodes_inside(qtree, depth, chunk), entropy);
+        }
+        offset += tasks[t].bits.memcap;
     }
-
-    if (!niveau)
+    run_workers(encode_chunks, tasks, sizeof(*tasks), nb_threads);
+
+    /* the levels above them, on the calling thread, with the models of the first worker */
+    fBitinit(&top, NULL);
+    top.mem = streams + offset;
+    top.memcap = qtc_stream_bound(top_nodes, entropy);
+    done = (EOF != qtc_write_stream(qtree, &top, entropy, tasks[0].models, depth, QTC_TOP_STREAM));
+    encoded_size = 0x2UL + 0x4UL * (nb_chunks + 1UL) + top.memlen;
+    for (t = 0U; t < nb_threads; ++t)
     {
-        pix->data[line * pix->width + col] = qtree->nodes[index].color;
-        return;
+        done = done && tasks[t].done;
+        encoded_size += tasks[t].bits.memlen;
     }
 
-    /* going down to leaf node first */
-    --niveau;
-
-    /* divide into quadrants and recurse */
-    child_index = index * MAX_CHILD + 0x1U;
+    if (done)
+    {
+        len = format_qtc_header(header, (entropy) ? ('3') : ('2'), (encoded_size - 1UL) * 0x8UL, qtree);
+        done = (!ctx || qtc_context_file(ctx, dest, len + encoded_size)) &&
+               (EOF != fEcrireOctets(dest, (const unsigned char *)header, len));
+    }
+    if (done)
+    {
+        /* level, depth of the chunks, then the index: size of the top stream and of each chunk */
+        fEcritCharbin(dest, qtree->niveau);
+        fEcritCharbin(dest, depth);
+        (void)fEcrireBits(dest, (unsigned int)(top.memlen >> 16UL), 16U);
+        (void)fEcrireBits(dest, (unsigned int)(top.memlen & 0xFFFFUL), 16U);
+        for (chunk = 0UL; chunk < nb_chunks; ++chunk)
+        {
+            (void)fEcrireBits(dest, (unsigned int)(sizes[chunk] >> 16UL), 16U);
+            (void)fEcrireBits(dest, (unsigned int)(sizes[chunk] & 0xFFFFUL), 16U);
+        }
+        done = (EOF != fEcrireOctets(dest, top.mem, top.memlen)) && done;
+        for (t = 0U; t < nb_threads; ++t)
+        {
+            done = (EOF != fEcrireOctets(dest, tasks[t].bits.mem, tasks[t].bits.memlen)) && done;
+        }
+        done = (EOF != fBitflush(dest)) && done;
+    }
 
-    fill_pixmap_recursive(qtree, pix, child_index, niveau, line, col);
-    fill_pixmap_recursive(qtree, pix, child_index + 1, niveau, line, col + (0x1U << niveau));
-    fill_pixmap_recursive(qtree, pix, child_index + 2, niveau, line + (0x1U << niveau), col + (0x1U << niveau));
-    fill_pixmap_recursive(qtree, pix, child_index + 3, niveau, line + (0x1U << niveau), col);
+    qtc_scratch_release(ctx, scratch);
+    return done;
 }
 
-extern void pixmap_from_quadtree(QTree *qtree, Pixmap *pix)
+extern bool create_qtc_file(QTree *qtree, const char *file_name)
 {
-    (void)strncpy(pix->magic_number, "P5", 2UL);
-    pix->magic_number[2] = '\0';
-
-    pix->height = pix->width = (unsigned short)(1UL << (qtree->niveau));
-    pix->data = malloc(pix->width * pix->height * sizeof(*pix->data));
-    if (!pix->data)
+    FileBit out = {0};
+    bool done = false;
+    if (!qtree || !file_name)
     {
-        fprintf(stderr, "Error: memory allocation error in pixmap_from_quadtree()!\n");
-        return;
+        fprintf(stderr, "Error: qtree / file_name is NULL in create_qtc_file()!\n");
+        return false;
     }
-    pix->grey_level = QTC_GREY_LEVEL;
-    if (!pix->data)
+    if (!fBitopen(&out, file_name, "w"))
     {
-        fprintf(stderr, "Error: memory allocation error in pixmap_from_quadtree()!\n");
-        return;
+        fprintf(stderr, "Error: %s file not found in create_qtc_file()!\n", file_name);
+        return false;
     }
-    memset(pix->data, 0, pix->width * pix->height * sizeof(*pix->data));
-
-    fill_pixmap_recursive(qtree, pix, 0U, qtree->niveau, 0U, 0U);
+    done = qtc_encode_plain(qtree, &out, NULL);
+    done = (0 == fBitclose(&out)) && done;
+    if (!done)
+    {
+        fprintf(stderr, "Error: can't write %s in create_qtc_file()!\n", file_name);
+    }
+    return done;
 }
 
-/*******************************************************************************/
-/*******************************************************************************/
-/********************************   FILTERING   ********************************/
-/*******************************************************************************/
-/*******************************************************************************/
+extern bool create_qtc_file_chunked(QTree *qtree, const char *file_name,
+                                    unsigned int nb_threads, unsigned char format)
+{
+    FileBit out = {0};
+    bool done = false;
+    if (!qtree || !file_name)
+    {
+        fprintf(stderr, "Error: qtree / file_name is NULL in create_qtc_file_chunked()!\n");
+        return false;
+    }
+    if (!fBitopen(&out, file_name, "w"))
+    {
+        fprintf(stderr, "Error: %s file not found in create_qtc_file_chunked()!\n", file_name);
+        return false;
+    }
+    done = qtc_encode_chunked(qtree, &out, nb_threads, format, NULL);
+    done = (0 == fBitclose(&out)) && done;
+    if (!done)
+    {
+        fprintf(stderr, "Error: can't write %s in create_qtc_file_chunked()!\n", file_name);
+    }
+    return done;
+}
 
 /**
- * @brief Compute the average (medium) variance among all nodes in the quadtree.
+ * @brief Encode an image in memory: build its tree, filter it, and write the file in `dest`
  *
- * @param qtree The quadtree to inspect.
- * @return double The average variance.
+ * @param tree the quadtree, of a level holding the image, with the variance when filtered
+ * @param raster the first pixel of the image, its lines `stride` bytes apart
+ * @param width the width of the image
+ * @param height the height of the image
+ * @param stride the bytes from a line to the next one
+ * @param maxval the grey level of the pixels
+ * @param alpha the filtering rate, below 0.1 the tree is written unfiltered
+ * @param format 1, 2 or 3, the version of the file
+ * @param nb_threads the number of threads building and encoding the tree
+ * @param dest the buffer of the file
+ * @param ctx the context whose arena receives the file, NULL to write in `dest` as it is
+ * @return true on success
+ * @return false on a memory allocation error
  */
-static double compute_average_variance(QTree *qtree)
+static bool encode_raster(QTree *tree, const unsigned char *raster, unsigned int width, unsigned int height,
+                          size_t stride, unsigned char maxval, double alpha, unsigned char format,
+                          unsigned int nb_threads, FileBit *dest, QtcContext *ctx)
 {
-    size_t qtree_size = 0UL, number_of_nodes = 0UL, i = 0UL;
-    double sum = 0.0;
-    if (!qtree || !qtree->nodes)
+    if (!build_quadtree(tree, raster, stride, width, height, maxval, nb_threads))
     {
-        return 0.0;
+        return false;
+    }
+    if (alpha >= 0.1)
+    {
+        must_filter_qtree(tree, alpha, true);
+    }
+    return (format > 1U) ? (qtc_encode_chunked(tree, dest, nb_threads, format, ctx)) : (qtc_encode_plain(tree, dest, ctx));
+}
+
+extern bool qtc_encode_buffer(const unsigned char *raster, unsigned int width, unsigned int height, size_t stride,
+                              unsigned char maxval, double alpha, unsigned char format, unsigned int nb_threads,
+                              QtcBuffer *out)
+{
+    QTree tree = {0};
+    FileBit dest = {0};
+    Pixmap size = {0};
+    unsigned char niveau = 0U;
+    bool done = false;
+
+    if (!raster || !out || !maxval || stride < width || format < 1U || format > 3U)
+    {
+        return false;
     }
-    qtree_size = DETERMINE_QTREE_SIZE(qtree->niveau);
-    number_of_nodes = qtree_size - (1UL << (2UL * qtree->niveau));
-    for (i = 0; i < qtree_size; ++i)
+    size.width = width;
+    size.height = height;
+    if (QTC_ALL_LEVELS == (niveau = determine_qtree_level(&size)) || !make_qtree(&tree, maxval, niveau, alpha >= 0.1))
     {
-        sum += qtree->nodes[i].variance;
+        return false;
     }
+    /* the bytes of the previous call are written over, the buffer grows if needed */
+    fBitinit(&dest, NULL);
+    dest.mem = out->data;
+    dest.memcap = out->capacity;
+    done = encode_raster(&tree, raster, width, height, stride, maxval, alpha, format, nb_threads, &dest, NULL);
+    out->data = dest.mem;
+    out->capacity = dest.memcap;
+    out->size = (done) ? (dest.memlen) : (0UL);
+    free_qtree(&tree);
+    return done;
+}
+
+extern bool qtc_context_encode(QtcContext *ctx, const unsigned char *raster, unsigned int width, unsigned int height,
+                               size_t stride, unsigned char maxval, double alpha, unsigned char format,
+                               unsigned int nb_threads)
+{
+    QTree tree = {0};
+    FileBit dest = {0};
+    Pixmap size = {0};
+    unsigned char niveau = 0U;
+    bool done = false;
+
+    if (!ctx || !ctx->color || !raster || !maxval || stride < width || format < 1U || format > 3U)
+    {
+        return false;
+    }
+    ctx->file_size = 0UL;
+    size.width = width;
+    size.height = height;
+    if (QTC_ALL_LEVELS == (niveau = determine_qtree_level(&size)) ||
+        !make_qtree_from(&tree, ctx, maxval, niveau, alpha >= 0.1))
+    {
+        return false;
+    }
+    done = encode_raster(&tree, raster, width, height, stride, maxval, alpha, format, nb_threads, &dest, ctx);
+    ctx->file_size = (done) ? (dest.memlen) : (0UL);
+    return done;
+}
 
-    return (qtree_size > 0) ? ((sum / (double)number_of_nodes)) : (0.0);
+extern void qtc_free_buffer(QtcBuffer *buffer)
+{
+    if (!buffer)
+    {
+        return;
+    }
+    free(buffer->data);
+    buffer->data = NULL;
+    buffer->size = buffer->capacity = 0UL;
 }
 
 /**
- * @brief Compute the maximum variance among all nodes in the quadtree.
+ * @brief Worker: write the files of `[first, last)`, each one from a copy of `eu` filtered at its alpha
  *
- * @param qtree The quadtree to inspect.
- * @return double The maximum variance.
+ * @param arg the `SweepTask`
+ * @return void* NULL
  */
-static double compute_max_variance(QTree *qtree)
+static void *write_sweep_files(void *arg)
 {
-    size_t qtree_size = 0UL, i = 0UL;
-    double max_var = 0.0;
-    if (!qtree || !qtree->nodes)
+    SweepTask *task = arg;
+    QTree view = *task->qtree;
+    unsigned char *eu = NULL;
+    size_t file = 0UL, i = 0UL, last = 0UL, skip = 0UL, size = DETERMINE_QTREE_SIZE(view.niveau);
+    unsigned int position = 0U;
+    unsigned char depth = 0U;
+    bool outside = !QTREE_IS_SQUARE(&view);
+
+    task->done = false;
+    if (!(eu = make_plane(size * sizeof(*eu))))
     {
-        return 0.0;
+        fprintf(stderr, "Error: memory allocation error in write_sweep_files()!\n");
+        return NULL;
     }
-    qtree_size = DETERMINE_QTREE_SIZE(qtree->niveau);
-    for (i = 0; i < qtree_size; ++i)
+    task->done = true;
+    view.eu = eu;
+    for (file = task->first; file < task->last; ++file)
     {
-        if (qtree->nodes[i].variance > max_var)
+        /* the nodes uniformized at this alpha, the others as built, none outside of the image */
+        position = task->positions[file];
+        for (depth = 0U; depth <= view.niveau; ++depth)
+        {
+            last = DETERMINE_LEVEL_OFFSET((size_t)depth + 1UL);
+            for (i = DETERMINE_LEVEL_OFFSET((size_t)depth); i < last; ++i)
+            {
+                if (outside && (skip = outside_run(&view, i, depth)))
+                {
+                    i += skip - 1UL;
+                    continue;
+                }
+                eu[i] = (task->grid[i] && task->grid[i] <= position) ? (QTREE_EU(0U, 1U)) : (task->qtree->eu[i]);
+            }
+        }
+        if (task->format > 1U)
         {
-            max_var = qtree->nodes[i].variance;
+            task->done = create_qtc_file_chunked(&view, task->file_names[file], task->nb_threads, task->format) &&
+                         task->done;
+        }
+        else
+        {
+            task->done = create_qtc_file(&view, task->file_names[file]) && task->done;
         }
     }
-    return max_var;
+    free_plane(eu);
+    return NULL;
 }
 
-extern void must_filter_qtree(QTree *qtree, double alpha, bool flag)
+extern bool create_qtc_files_sweep(QTree *qtree, const double *alphas,
+                                   char *const *file_names, unsigned int nb_files,
+                                   unsigned int nb_threads, unsigned char format)
 {
-    double medvar = 0.0, maxvar = 0.0;
-    if (!qtree || !qtree->nodes)
+    SweepTask *tasks = NULL;
+    unsigned int *order = NULL, *positions = NULL;
+    double *sorted = NULL;
+    unsigned char *grid = NULL;
+    unsigned int f = 0U, k = 0U, nb_sorted = 0U, t = 0U;
+    bool done = false;
+
+    if (!qtree || !qtree->variance || !alphas || !file_names || !nb_files || nb_files >= 0xFFU)
     {
-        fprintf(stderr, "Error: empty quadtree!\n");
-        return;
+        fprintf(stderr, "Error: quadtree built without variance, or bad alphas in create_qtc_files_sweep()!\n");
+        return false;
     }
-    if (!flag)
+    order = malloc(nb_files * sizeof(*order));
+    positions = malloc(nb_files * sizeof(*positions));
+    sorted = malloc(nb_files * sizeof(*sorted));
+    grid = make_plane(DETERMINE_QTREE_SIZE(qtree->niveau) * sizeof(*grid));
+    nb_threads = (nb_threads < 1U) ? (1U) : (nb_threads);
+    t = (nb_files < nb_threads) ? (nb_files) : (nb_threads);
+    tasks = malloc(t * sizeof(*tasks));
+    if (!order || !positions || !sorted || !grid || !tasks)
     {
-        fprintf(stderr, "Filtering is disabled. Skipping.\n");
-        return;
+        fprintf(stderr, "Error: memory allocation error in create_qtc_files_sweep()!\n");
+        free(order);
+        free(positions);
+        free(sorted);
+        free_plane(grid);
+        free(tasks);
+        return false;
     }
 
-    medvar = compute_average_variance(qtree);
-    maxvar = compute_max_variance(qtree);
-    filter_quadtree(qtree, medvar, maxvar, alpha);
+    /* the alphas in increasing order, those below 0.1 unfiltered as with `-a` */
+    for (f = 0U; f < nb_files; ++f)
+    {
+        for (k = f; k && alphas[order[k - 1U]] > alphas[f]; --k)
+        {
+            order[k] = order[k - 1U];
+        }
+        order[k] = f;
+    }
+    for (k = 0U; k < nb_files; ++k)
+    {
+        if (alphas[order[k]] >= 0.1)
+        {
+            sorted[nb_sorted++] = alphas[order[k]];
+        }
+        positions[order[k]] = (alphas[order[k]] >= 0.1) ? (nb_sorted) : (0U);
+    }
+
+    /* one pass filters the tree at every alpha, then the files are written in parallel */
+    if (!filter_grid(qtree, sorted, nb_sorted, grid))
+    {
+        fprintf(stderr, "Error: memory allocation error in create_qtc_files_sweep()!\n");
+    }
+    else
+    {
+        for (k = 0U; k < t; ++k)
+        {
+            tasks[k].qtree = qtree;
+            tasks[k].grid = grid;
+            tasks[k].positions = positions;
+            tasks[k].file_names = file_names;
+            tasks[k].format = format;
+            tasks[k].nb_threads = nb_threads / t;
+            tasks[k].first = (size_t)nb_files * k / t;
+            tasks[k].last = (size_t)nb_files * (k + 1U) / t;
+        }
+        run_workers(write_sweep_files, tasks, sizeof(*tasks), t);
+        for (done = true, k = 0U; k < t; ++k)
+        {
+            done = tasks[k].done && done;
+        }
+    }
+    free(order);
+    free(positions);
+    free(sorted);
+    free_plane(grid);
+    free(tasks);
+    return done;
 }
 
 /**
- * @brief Calculate the variance of the node
+ * @brief Write node `i` in the bitstream, nothing if its parent is uniform or if it is outside of the image.
+ * The color of a 4th child is not written: m_4 = (4m + e) - (m_1 + m_2 + m_3).
+ * An internal node is followed by `e`, and `u` when `e` is 0.
  *
  * @param qtree the quadtree
- * @param index the index of the node
- * @param child_index the index of the first child
- * @return float the variance of the node
+ * @param stream the `FileBit`
+ * @param i the index of the node
+ * @param depth the depth of the node
  */
-static float calculate_variance(QTree *qtree, unsigned int index, unsigned int child_index)
+static void qtc_write_node(QTree *qtree, void *stream, size_t i, unsigned char depth)
 {
-    unsigned int k = 0U;
-    float mu = 0.0F, mk = 0.0F, vk = 0.0F, m = qtree->nodes[index].color;
-    for (k = 0; k < MAX_CHILD; ++k)
+    FileBit *out = stream;
+    unsigned char error = QTREE_E(qtree, i);
+
+    /* parent is uniform, or outside of the image */
+    if (i && (QTREE_U(qtree, (i - 1UL) / MAX_CHILD) || is_outside(qtree, i, depth)))
+    {
+        return;
+    }
+    /* not 4-th child, or root */
+    if (color_written(qtree, i, depth))
+    {
+        fEcritCharbin(out, qtree->color[i]);
+    }
+    /* that's a leaf */
+    if (depth == qtree->niveau)
     {
-        mk = qtree->nodes[child_index + k].color;    /* color of child */
-        vk = qtree->nodes[child_index + k].variance; /* variance of child */
-        mu += (vk * vk) + ((m - mk) * (m - mk));     /* given formula */
+        return;
     }
 
-    return (float)sqrt(mu) / 4.0F;
+    /* writing error everytime, followed by uniform when error is 0: one field of 2 or 3 bits */
+    if (error)
+    {
+        (void)fEcrireBits(out, error, 0x2U);
+    }
+    else
+    {
+        (void)fEcrireBits(out, QTREE_U(qtree, i), 0x3U);
+    }
 }
 
 /**
- * @brief Filtering the quadtree recursively on the root
- * \mu = \sum from 0 to k < 4, (v_k^2) + (m - m_k)^2 => v = \sqrt{\mu / 4}
+ * @brief Color of the 4th child: m_4 = (4m + e) - (m_1 + m_2 + m_3)
  *
- * @param qtree the quadtree
- * @param index the index of the node
- * @param niveau the level of the quadtree
- * @param sigma the threshold
- * @param alpha the alpha value
- * @return unsigned int 1 if the node is uniform, 0 otherwise
+ * @param tree the quadtree
+ * @param i the index of the 4th child
+ * @param parent_index the index of its parent
+ * @return unsigned char the color
  */
-static unsigned int filtrage(QTree *qtree,
-                             unsigned int index, int niveau,
-                             double sigma, double alpha)
+static __inline__ unsigned char fourth_child_color(QTree *tree, size_t i, size_t parent_index)
 {
-    unsigned int s = 0U, child_index = 0U;
-
-    /* if the node is already uniform or if the node is a leaf, return 1 */
-    if (qtree->nodes[index].u || !niveau)
-    {
-        return 1U;
-    }
-
-    --niveau;
-    child_index = index * MAX_CHILD + 1U;
+    return (unsigned char)((tree->color[parent_index] * MAX_CHILD + /* 4m */
+                            QTREE_E(tree, parent_index)) -          /* + e */
+                           (tree->color[i - 3] +                    /* - m_1 */
+                            tree->color[i - 2] +                    /* - m_2 */
+                            tree->color[i - 1]));                   /* - m_3 */
+}
 
-    /* descend into the lower levels: all children must be processed */
+/**
+ * @brief The pixel of a leaf, when the leaves are read straight into `tree->raster`.
+ * Its line and its column are gathered from the bits of its offset in a single pass
+ *
+ * @param tree the quadtree, its last level not allocated
+ * @param i the index of the leaf, in the image
+ * @return unsigned char* the pixel
+ */
+static __inline__ unsigned char *leaf_pixel(const QTree *tree, size_t i)
+{
+    uint64_t v = i - DETERMINE_LEVEL_OFFSET((size_t)tree->niveau);
+
+    /* the line on bits 32-47, the line ^ the column on bits 0-15 */
+    v = ((v >> 1U) << 32U | (v & 0xFFFFFFFFU)) & 0x5555555555555555U;
+    v = (v | (v >> 1U)) & 0x3333333333333333U;
+    v = (v | (v >> 2U)) & 0x0F0F0F0F0F0F0F0FU;
+    v = (v | (v >> 4U)) & 0x00FF00FF00FF00FFU;
+    v = (v | (v >> 8U)) & 0x0000FFFF0000FFFFU;
+    return tree->raster + (size_t)(v >> 32U) * tree->width + (size_t)((v >> 32U) ^ (v & 0xFFFFU));
+}
+
+/**
+ * @brief Color of a 4th leaf read into the pixels, the bottom-left one: its siblings are above and on its right
+ *
+ * @param tree the quadtree
+ * @param pixel the pixel of the leaf
+ * @param parent_index the index of its parent
+ * @return unsigned char the color
+ */
+static __inline__ unsigned char fourth_leaf_color(const QTree *tree, const unsigned char *pixel, size_t parent_index)
+{
+    const unsigned char *above = pixel - tree->width;
+    return (unsigned char)((tree->color[parent_index] * MAX_CHILD + QTREE_E(tree, parent_index)) -
+                           (above[0] + above[1] + pixel[1]));
+}
+
+extern void qtc_read_node(QTree *tree, void *stream, size_t i, unsigned char depth)
+{
+    FileBit *in = stream;
+    size_t parent_index = (i) ? ((i - 1UL) / MAX_CHILD) : (0UL);
+    unsigned char error = 0U, *pixel = NULL;
+
+    /* parent is uniform: so is the whole subtree, the nodes outside of the image are left out */
+    if (i && (QTREE_U(tree, parent_index) || is_outside(tree, i, depth)))
+    {
+        /* the pixels of a uniform parent are filled from it */
+        if ((tree->raster && depth == tree->niveau) || (!QTREE_IS_SQUARE(tree) && is_outside(tree, i, depth)))
+        {
+            return;
+        }
+        tree->color[i] = tree->color[parent_index];
+        tree->eu[i] = QTREE_EU(0x0U, 0x1U);
+        return;
+    }
+
+    /* a leaf read straight into its pixel */
+    if (tree->raster && depth == tree->niveau)
+    {
+        pixel = leaf_pixel(tree, i);
+        *pixel = (!color_written(tree, i, depth)) ? (fourth_leaf_color(tree, pixel, parent_index))
+                                                  : (fLireCharbin(in));
+        return;
+    }
+
+    tree->color[i] = (!color_written(tree, i, depth)) ? (fourth_child_color(tree, i, parent_index))
+                                                      : (fLireCharbin(in)); /* m */
+
+    /* that's a leaf */
+    if (depth == tree->niveau)
+    {
+        tree->eu[i] = QTREE_EU(0x0U, 0x1U);
+        return;
+    }
+    error = (unsigned char)(fLireBits(in, 0x2U) & 0x3);                                      /* e */
+    tree->eu[i] = QTREE_EU(error, (!error) ? ((unsigned char)(fLireBit(in) & 0x1)) : (0x0U)); /* u */
+}
+
+/**
+ * @brief Map the difference of two colors, modulo 256, to small values for small differences:
+ * 0, -1, 1, -2, 2, ... become 0, 1, 2, 3, 4, ...
+ *
+ * @param color the color
+ * @param prediction the predicted color
+ * @return unsigned int the residual in [0, 255]
+ */
+static __inline__ unsigned int color_residual(unsigned char color, unsigned char prediction)
+{
+    unsigned int diff = (unsigned int)(color - prediction) & 0xFFU;
+    return (diff < 0x80U) ? (diff << 1U) : (((0x100U - diff) << 1U) - 1U);
+}
+
+/* the reverse of `color_residual`, once per color decoded: an odd residual `r` is the difference
+ * -(r + 1) / 2, that is ~(r >> 1) */
+#define COLOR_FROM_RESIDUAL(residual, prediction) \
+    ((unsigned char)(((prediction) + (((residual) >> 1U) ^ (0U - ((residual) & 0x1U)))) & 0xFFU))
+
+/**
+ * @brief Write node `i` in a range coded stream: same nodes and fields as `qtc_write_node`
+ *
+ * @param qtree the quadtree
+ * @param stream the `QtcEntropy`
+ * @param i the index of the node
+ * @param depth the depth of the node
+ */
+static void qtc_write_node_rc(QTree *qtree, void *stream, size_t i, unsigned char depth)
+{
+    QtcEntropy *ent = stream;
+    size_t parent_index = (i) ? ((i - 1UL) / MAX_CHILD) : (0UL);
+    unsigned char error = QTREE_E(qtree, i);
+
+    /* parent is uniform, or outside of the image */
+    if (i && (QTREE_U(qtree, parent_index) || is_outside(qtree, i, depth)))
+    {
+        return;
+    }
+    /* not 4-th child, or root, predicted by the mid grey */
+    if (color_written(qtree, i, depth))
+    {
+        rans_encode(&ent->enc, &ent->color[depth],
+                    color_residual(qtree->color[i], (i) ? (qtree->color[parent_index]) : (0x80U)));
+    }
+    /* that's a leaf */
+    if (depth == qtree->niveau)
+    {
+        return;
+    }
+    rans_encode(&ent->enc, &ent->eu[depth][QTREE_E(qtree, parent_index)],
+                (error) ? (error + 1U) : (QTREE_U(qtree, i)));
+}
+
+/**
+ * @brief Read node `i` from a range coded stream, the reverse of `qtc_write_node_rc`
+ *
+ * @param tree the quadtree, nodes above `i` already read
+ * @param stream the `QtcEntropy`
+ * @param i the index of the node
+ * @param depth the depth of the node
+ */
+static void qtc_read_node_rc(QTree *tree, void *stream, size_t i, unsigned char depth)
+{
+    QtcEntropy *ent = stream;
+    size_t parent_index = (i) ? ((i - 1UL) / MAX_CHILD) : (0UL);
+    unsigned int eu = 0U, residual = 0U;
+    unsigned char *pixel = NULL;
+
+    /* parent is uniform: so is the whole subtree, the nodes outside of the image are left out */
+    if (i && (QTREE_U(tree, parent_index) || is_outside(tree, i, depth)))
+    {
+        /* the pixels of a uniform parent are filled from it */
+        if ((tree->raster && depth == tree->niveau) || (!QTREE_IS_SQUARE(tree) && is_outside(tree, i, depth)))
+        {
+            return;
+        }
+        tree->color[i] = tree->color[parent_index];
+        tree->eu[i] = QTREE_EU(0x0U, 0x1U);
+        return;
+    }
+
+    /* a leaf read straight into its pixel, never the root */
+    if (tree->raster && depth == tree->niveau)
+    {
+        pixel = leaf_pixel(tree, i);
+        if (!color_written(tree, i, depth))
+        {
+            *pixel = fourth_leaf_color(tree, pixel, parent_index);
+        }
+        else
+        {
+            residual = rans_decode(&ent->dec, &ent->color[depth]);
+            *pixel = COLOR_FROM_RESIDUAL(residual, tree->color[parent_index]);
+        }
+        return;
+    }
+
+    if (!color_written(tree, i, depth))
+    {
+        tree->color[i] = fourth_child_color(tree, i, parent_index);
+    }
+    else
+    {
+        residual = rans_decode(&ent->dec, &ent->color[depth]);
+        tree->color[i] = COLOR_FROM_RESIDUAL(residual, (i) ? (tree->color[parent_index]) : (0x80U));
+    }
+
+    /* that's a leaf */
+    if (depth == tree->niveau)
+    {
+        tree->eu[i] = QTREE_EU(0x0U, 0x1U);
+        return;
+    }
+    eu = rans_decode(&ent->dec, &ent->eu[depth][QTREE_E(tree, parent_index)]);
+    tree->eu[i] = (eu > 1U) ? (QTREE_EU(eu - 1U, 0x0U)) : (QTREE_EU(0x0U, eu));
+}
+
+/**
+ * @brief Write the quadtree in the bitstream, in BFS order
+ *
+ * @param qtree the quadtree
+ * @param filebit the filebit structure
+ * @return void
+ */
+static void qtc_from_quadtree(QTree *qtree, FileBit *filebit)
+{
+    if (!qtree || !filebit)
+    {
+        fprintf(stderr, "Error: qtree / filebit is NULL in qtc_from_quadtree()!\n");
+        return;
+    }
+    qtc_walk_top(qtree, filebit, qtc_write_node, qtree->niveau);
+}
+
+/**
+ * @brief Apply `codec` on the nodes from the root down to `depth`, in BFS order
+ *
+ * @param qtree the quadtree
+ * @param stream the stream
+ * @param codec `qtc_write_node` or `qtc_read_node`, and their range coded versions
+ * @param depth the depth of the last level
+ */
+static void qtc_walk_top(QTree *qtree, void *stream, NodeCodec codec, unsigned char depth)
+{
+    size_t i = 0UL, last = 0UL, skip = 0UL;
+    unsigned char level = 0U;
+    bool outside = !QTREE_IS_SQUARE(qtree);
+
+    for (level = 0U; level <= depth; ++level)
+    {
+        last = DETERMINE_LEVEL_OFFSET((size_t)level + 1UL);
+        for (i = DETERMINE_LEVEL_OFFSET((size_t)level); i < last; ++i)
+        {
+            /* the nodes outside of the image are neither written nor read */
+            if (outside && i && (skip = outside_run(qtree, i, level)))
+            {
+                i += skip - 1UL;
+                continue;
+            }
+            codec(qtree, stream, i, level);
+        }
+    }
+}
+
+/**
+ * @brief Apply `codec` on the nodes of a chunk: the subtree below the node `chunk` of `depth`,
+ * level by level, each level in BFS order
+ *
+ * @param qtree the quadtree
+ * @param stream the stream
+ * @param codec `qtc_write_node` or `qtc_read_node`, and their range coded versions
+ * @param depth the depth of the roots of the chunks, themselves in the top stream
+ * @param chunk the index of the chunk among the nodes of `depth`
+ * @param last the depth of the last level, `qtree->niveau` for the whole chunk
+ */
+static void qtc_walk_chunk(QTree *qtree, void *stream, NodeCodec codec, unsigned char depth, size_t chunk,
+                           unsigned char last)
+{
+    size_t i = 0UL, first = 0UL, count = 1UL, skip = 0UL;
+    unsigned char level = 0U;
+    bool outside = !QTREE_IS_SQUARE(qtree);
+
+    for (level = (unsigned char)(depth + 1U); level <= last; ++level)
+    {
+        count <<= 2UL;
+        first = DETERMINE_LEVEL_OFFSET((size_t)level) + chunk * count;
+        for (i = first; i < first + count; ++i)
+        {
+            /* the nodes outside of the image are neither written nor read */
+            if (outside && (skip = outside_run(qtree, i, level)))
+            {
+                i += skip - 1UL;
+                continue;
+            }
+            codec(qtree, stream, i, level);
+        }
+    }
+}
+
+/**
+ * @brief Reset the models of a Q3 stream, all the symbols equally likely.
+ * Only the models of the levels of the stream are set up.
+ *
+ * @param ent the models
+ * @param first the depth of the first level of the stream
+ * @param last the depth of its last level
+ */
+static void qtc_entropy_init(QtcEntropy *ent, unsigned char first, unsigned char last)
+{
+    unsigned int level = 0U, e = 0U;
+
+    for (level = first; level <= last && level < QTC_LEVELS; ++level)
+    {
+        rans_model_init(&ent->color[level], RANS_MAX_SYMBOLS, ent->color_count[level],
+                        ent->color_freq[level], ent->color_cum[level], ent->color_lookup[level]);
+        for (e = 0U; e < MAX_CHILD; ++e)
+        {
+            rans_model_init(&ent->eu[level][e], QTC_EU_SYMBOLS, ent->eu_count[level][e],
+                            ent->eu_freq[level][e], ent->eu_cum[level][e], ent->eu_lookup[level][e]);
+        }
+    }
+}
+
+extern int qtc_write_stream(QTree *qtree, FileBit *bits, bool entropy, QtcEntropy *models, unsigned char depth,
+                             size_t chunk)
+{
+    QtcEntropy *ent = NULL, *owned = NULL;
+    void *stream = bits;
+    NodeCodec codec = qtc_write_node;
+    int coderetour = 1;
+
+    if (entropy)
+    {
+        if (!(ent = (models) ? (models) : (owned = malloc(sizeof(*owned)))))
+        {
+            return EOF;
+        }
+        if (owned)
+        {
+            owned->queue = NULL;
+            owned->queue_cap = 0UL;
+        }
+        qtc_entropy_init(ent, (QTC_TOP_STREAM == chunk) ? (0U) : ((unsigned char)(depth + 1U)),
+                         (QTC_TOP_STREAM == chunk) ? (depth) : (qtree->niveau));
+        rans_encoder_init(&ent->enc, bits, ent->queue, ent->queue_cap);
+        stream = ent;
+        codec = qtc_write_node_rc;
+    }
+    if (QTC_TOP_STREAM == chunk)
+    {
+        qtc_walk_top(qtree, stream, codec, depth);
+    }
+    else
+    {
+        qtc_walk_chunk(qtree, stream, codec, depth, chunk, qtree->niveau);
+    }
+    coderetour = (ent) ? (rans_encoder_flush(&ent->enc)) : (fBitflush(bits));
+    free(owned);
+    return coderetour;
+}
+
+extern bool qtc_read_stream(QTree *tree, FileBit *bits, bool entropy, QtcEntropy *models, unsigned char depth,
+                             size_t chunk, unsigned char last)
+{
+    QtcEntropy *ent = NULL, *owned = NULL;
+    void *stream = bits;
+    NodeCodec codec = qtc_read_node;
+
+    if (entropy)
+    {
+        if (!(ent = (models) ? (models) : (owned = malloc(sizeof(*owned)))))
+        {
+            return false;
+        }
+        qtc_entropy_init(ent, (QTC_TOP_STREAM == chunk) ? (0U) : ((unsigned char)(depth + 1U)),
+                         (QTC_TOP_STREAM == chunk) ? ((last < depth) ? (last) : (depth)) : (last));
+        rans_decoder_init(&ent->dec, bits);
+        stream = ent;
+        codec = qtc_read_node_rc;
+    }
+    if (QTC_TOP_STREAM == chunk)
+    {
+        qtc_walk_top(tree, stream, codec, (last < depth) ? (last) : (depth));
+    }
+    else
+    {
+        qtc_walk_chunk(tree, stream, codec, depth, chunk, last);
+    }
+    free(owned);
+    return true;
+}
+
+/**
+ * @brief Worker: write the chunks of `[first, last)` back to back into the buffer of the task, each one byte aligned
+ *
+ * @param arg the `ChunkTask`
+ * @return void* NULL
+ */
+static void *encode_chunks(void *arg)
+{
+    ChunkTask *task = arg;
+    size_t chunk = 0UL, before = 0UL;
+
+    task->done = true;
+    for (chunk = task->first; chunk < task->last; ++chunk)
+    {
+        before = task->bits.memlen;
+        task->done =
+            (EOF != qtc_write_stream(task->qtree, &task->bits, task->entropy, task->models, task->depth, chunk)) &&
+            task->done;
+        task->sizes[chunk] = task->bits.memlen - before;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Worker: read the chunks of `[first, last)` from the payload
+ *
+ * @param arg the `ChunkTask`
+ * @return void* NULL
+ */
+static void *decode_chunks(void *arg)
+{
+    ChunkTask *task = arg;
+    size_t chunk = 0UL;
+
+    task->done = true;
+    for (chunk = task->first; chunk < task->last; ++chunk)
+    {
+        if (!qtc_chunk_in_roi(task->qtree, task->roi, task->depth, chunk))
+        {
+            continue;
+        }
+        fBitinitMem(&task->bits, task->payload + task->offsets[chunk], task->offsets[chunk + 1UL] - task->offsets[chunk]);
+        task->done = qtc_read_stream(task->qtree, &task->bits, task->entropy, task->models, task->depth, chunk,
+                                     task->last_level) &&
+                     task->done;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Tell if a chunk crosses a region. Nodes of a level are in the order of their paths from the root,
+ * each step being the quadrant of the child: 0 top left, 1 top right, 2 bottom right, 3 bottom left.
+ *
+ * @param tree the quadtree
+ * @param roi the region, NULL for the whole image
+ * @param depth the depth of the roots of the chunks
+ * @param chunk the index of the chunk among the nodes of `depth`
+ * @return true if the chunk has pixels in the region
+ */
+static bool qtc_chunk_in_roi(QTree *tree, const QtcRoi *roi, unsigned char depth, size_t chunk)
+{
+    size_t line = 0UL, col = 0UL, quadrant = 0UL, side = 1UL << (tree->niveau - depth);
+    unsigned char level = 0U;
+
+    if (!roi)
+    {
+        return true;
+    }
+    for (level = depth; level--;)
+    {
+        quadrant = (chunk >> (2U * level)) & 0x3UL;
+        line = (line << 1UL) | (quadrant >> 1UL);
+        col = (col << 1UL) | ((quadrant ^ (quadrant >> 1UL)) & 0x1UL);
+    }
+    line *= side;
+    col *= side;
+    return line < (size_t)roi->y + roi->h && (size_t)roi->y < line + side &&
+           col < (size_t)roi->x + roi->w && (size_t)roi->x < col + side;
+}
+
+/**
+ * @brief Upper bound of the bytes read to decode the first nodes of a stream:
+ * 11 bits per node at most in a Q2 stream, and in a Q3 stream the state and 2 bytes per symbol
+ *
+ * @param nb_nodes the number of nodes decoded
+ * @param entropy true for a range coded stream (Q3)
+ * @return size_t the number of bytes
+ */
+static size_t qtc_stream_bound(size_t nb_nodes, bool entropy)
+{
+    return (entropy) ? (0x4UL + 0x4UL * nb_nodes) : ((0xBUL * nb_nodes + 0x7UL) / 0x8UL);
+}
+
+/**
+ * @brief Read the index and the streams of a Q2 or Q3 file, the chunks on several threads
+ *
+ * @param tree the quadtree, allocated down to `last`
+ * @param in the file, just after the level
+ * @param nb_threads the number of threads
+ * @param entropy true for range coded streams (Q3)
+ * @param roi the region, the chunks outside are skipped in the file, NULL to read them all
+ * @param last the depth of the last level read, only the start of the streams is read above `tree->niveau`
+ * @param ctx the context whose arena lends the models of the workers, NULL to allocate them
+ * @return true on success
+ * @return false if the file is truncated or corrupted
+ */
+static bool qtc_read_chunked(QTree *tree, FileBit *in, unsigned int nb_threads, bool entropy, const QtcRoi *roi,
+                             unsigned char last, QtcContext *ctx)
+{
+    FileBit top = {0};
+    ChunkTask *tasks = NULL;
+    QtcEntropy *models = NULL; /* Q3: the models of each worker, the first one reads the top stream */
+    size_t *sizes = NULL;   /* size of the top stream and of each chunk, in the file */
+    size_t *offsets = NULL; /* start of the top stream, of each chunk, and end of the payload */
+    unsigned char *payload = NULL;
+    const unsigned char *streams = NULL; /* the payload, or the streams in place in a buffer */
+    size_t nb_chunks = 0UL, i = 0UL, len = 0UL, end = 0UL;
+    size_t top_bound = (size_t)~0UL, chunk_bound = (size_t)~0UL;
+    int high = 0, low = 0;
+    unsigned int t = 0U;
+    unsigned char depth = fLireCharbin(in);
+    bool done = false, whole = true;
+
+    if (depth > tree->niveau || (entropy && tree->niveau >= QTC_LEVELS))
+    {
+        return false;
+    }
+    nb_chunks = 1UL << (2UL * depth);
+    nb_threads = (nb_threads < 1U) ? (1U) : (nb_threads);
+    nb_threads = (nb_chunks < nb_threads) ? ((unsigned int)nb_chunks) : (nb_threads);
+
+    /* above the last level of the tree, only the start of each stream is needed: its nodes down to `last` */
+    if (last < tree->niveau)
+    {
+        top_bound = qtc_stream_bound(DETERMINE_LEVEL_OFFSET((size_t)((last < depth) ? (last) : (depth)) + 1UL), entropy);
+        chunk_bound = (last > depth) ? (qtc_stream_bound(DETERMINE_LEVEL_OFFSET((size_t)(last - depth) + 1UL) - 1UL, entropy))
+                                     : (0UL);
+    }
+
+    sizes = malloc((nb_chunks + 1UL) * sizeof(*sizes));
+    offsets = malloc((nb_chunks + 2UL) * sizeof(*offsets));
+    if (!sizes || !offsets)
+    {
+        free(sizes);
+        free(offsets);
+        return false;
+    }
+    /* the chunks outside the region take no room in memory */
+    offsets[0] = 0UL;
+    for (i = 0UL; i <= nb_chunks; ++i)
+    {
+        high = fLireBits(in, 16U);
+        low = fLireBits(in, 16U);
+        if (EOF == high || EOF == low)
+        {
+            free(sizes);
+            free(offsets);
+            return false;
+        }
+        sizes[i] = ((size_t)high << 16UL) | (size_t)low;
+        if (!i)
+        {
+            len = (sizes[i] < top_bound) ? (sizes[i]) : (top_bound);
+        }
+        else
+        {
+            len = (qtc_chunk_in_roi(tree, roi, depth, i - 1UL)) ? ((sizes[i] < chunk_bound) ? (sizes[i]) : (chunk_bound))
+                                                                 : (0UL);
+        }
+        offsets[i + 1UL] = offsets[i] + len;
+        end = (len) ? (i + 1UL) : (end);
+        whole = whole && (len == sizes[i]);
+    }
+
+    /* the tasks, then the models of the workers */
+    tasks = qtc_scratch(ctx, nb_threads * (sizeof(*tasks) + ((entropy) ? (sizeof(*models)) : (0UL))));
+    done = (NULL != tasks);
+    if (done)
+    {
+        (void)memset(tasks, 0, nb_threads * sizeof(*tasks));
+        models = (entropy) ? ((void *)(tasks + nb_threads)) : (NULL);
+    }
+    if (whole && !in->fich && !(in->nbBit % 8U) && offsets[nb_chunks + 1UL] <= in->len - in->pos + in->nbBit / 8U)
+    {
+        /* a whole file in memory: the streams are read where they are, the accumulator holds their first bytes */
+        streams = in->src + in->pos - in->nbBit / 8U;
+    }
+    else
+    {
+        /* the bytes kept in memory, each stream from its own offset, the others skipped in the file,
+         * and the file is not read after the last bytes kept */
+        streams = payload = malloc(offsets[nb_chunks + 1UL] + 1UL);
+        done = done && payload;
+        for (i = 0UL; done && i < end; ++i)
+        {
+            len = offsets[i + 1UL] - offsets[i];
+            done = (fLireOctets(in, payload + offsets[i], len) == len) &&
+                   (i + 1UL == end || fSauterOctets(in, sizes[i] - len) == sizes[i] - len);
+        }
+    }
+    if (done)
+    {
+        fBitinitMem(&top, streams, offsets[1]);
+        done = qtc_read_stream(tree, &top, entropy, models, depth, QTC_TOP_STREAM, last);
+    }
+    if (done && last > depth) /* the chunks, unless the levels read are all in the top stream */
+    {
+        for (t = 0U; t < nb_threads; ++t)
+        {
+            tasks[t].qtree = tree;
+            tasks[t].payload = streams;
+            tasks[t].offsets = offsets + 1UL;
+            tasks[t].roi = roi;
+            tasks[t].first = nb_chunks * t / nb_threads;
+            tasks[t].last = nb_chunks * (t + 1U) / nb_threads;
+            tasks[t].depth = depth;
+            tasks[t].last_level = last;
+            tasks[t].entropy = entropy;
+            tasks[t].models = (entropy) ? (models + t) : (NULL);
+        }
+        run_workers(decode_chunks, tasks, sizeof(*tasks), nb_threads);
+        for (t = 0U; t < nb_threads; ++t)
+        {
+            done = done && tasks[t].done;
+        }
+    }
+    qtc_scratch_release(ctx, tasks);
+    free(payload);
+    free(sizes);
+    free(offsets);
+    return done;
+}
+
+extern void init_quadtree_from_file(QTree *tree, const char *file_name)
+{
+    init_quadtree_from_file_parallel(tree, file_name, 1U);
+}
+
+extern void init_quadtree_from_file_parallel(QTree *tree, const char *file_name, unsigned int nb_threads)
+{
+    read_qtc_file(tree, file_name, nb_threads, NULL, QTC_ALL_LEVELS, NULL);
+}
+
+extern void init_quadtree_from_file_roi(QTree *tree, const char *file_name, unsigned int nb_threads,
+                                        const QtcRoi *roi)
+{
+    read_qtc_file(tree, file_name, nb_threads, roi, QTC_ALL_LEVELS, NULL);
+}
+
+extern void init_quadtree_from_file_max_level(QTree *tree, const char *file_name, unsigned int nb_threads,
+                                              unsigned char max_level)
+{
+    read_qtc_file(tree, file_name, nb_threads, NULL, max_level, NULL);
+}
+
+extern void init_pixmap_from_file(Pixmap *pix, const char *file_name, unsigned int nb_threads)
+{
+    QTree tree = {0};
+    QtcRoi roi = {0U, 0U, 0U, 0U};
+
+    if (!pix)
+    {
+        fprintf(stderr, "Error: pix is NULL in init_pixmap_from_file()!\n");
+        return;
+    }
+    pix->data = NULL;
+    read_qtc_file(&tree, file_name, nb_threads, NULL, QTC_ALL_LEVELS, pix);
+    if (!tree.raster) /* a tree of a single pixel, or an error */
+    {
+        if (tree.color)
+        {
+            pixmap_from_quadtree(&tree, pix);
+        }
+        free_qtree(&tree);
+        return;
+    }
+
+    /* the leaves are in the pixels, the uniform nodes above them are filled */
+    (void)strncpy(pix->magic_number, "P5", 2UL);
+    pix->magic_number[2] = '\0';
+    pix->width = roi.w = tree.width;
+    pix->height = roi.h = tree.height;
+    pix->grey_level = QTC_GREY_LEVEL;
+    fill_pixmap_tree(&tree, pix, &roi, 0UL, tree.niveau, 0U, 0U);
+    tree.raster = NULL;
+    free_qtree(&tree);
+}
+
+extern bool qtc_image_size(const unsigned char *data, size_t size, unsigned int *width, unsigned int *height)
+{
+    FileBit in = {0};
+    unsigned long w = 0UL, h = 0UL;
+    unsigned char version = 0U;
+
+    if (!data || !width || !height)
+    {
+        return false;
+    }
+    fBitinitMem(&in, data, size);
+    if (QTC_ALL_LEVELS == read_qtc_header(&in, NULL, &version, &w, &h))
+    {
+        return false;
+    }
+    *width = (unsigned int)w;
+    *height = (unsigned int)h;
+    return true;
+}
+
+extern bool qtc_file_image_size(const char *file_name, unsigned int *width, unsigned int *height)
+{
+    FileBit in = {0};
+    unsigned long w = 0UL, h = 0UL;
+    unsigned char version = 0U, niveau = 0U;
+
+    if (!file_name || !width || !height)
+    {
+        return false;
+    }
+    if (!fBitopen(&in, file_name, "rb"))
+    {
+        fprintf(stderr, "Error: cannot open %s!\n", file_name);
+        return false;
+    }
+    niveau = read_qtc_header(&in, NULL, &version, &w, &h);
+    (void)fBitclose(&in);
+    if (QTC_ALL_LEVELS == niveau)
+    {
+        fprintf(stderr, "Error: %s is not a QTC file, or is corrupted!\n", file_name);
+        return false;
+    }
+    *width = (unsigned int)w;
+    *height = (unsigned int)h;
+    return true;
+}
+
+/**
+ * @brief Decode a .qtc file in memory into the pixels of the caller
+ *
+ * @param ctx the context lending its arenas, NULL to allocate the tree and the lines
+ * @param data the bytes of the file
+ * @param size the number of bytes
+ * @param raster the first pixel of the image, its lines `stride` bytes apart
+ * @param width the width of the image
+ * @param height the height of the image
+ * @param stride the bytes from a line to the next one
+ * @param nb_threads the number of threads decoding the chunks of a Q2 or Q3 file
+ * @return true on success
+ * @return false if the bytes are not a .qtc file of this size, are truncated or corrupted, or on an error
+ */
+static bool decode_raster(QtcContext *ctx, const unsigned char *data, size_t size, unsigned char *raster,
+                          unsigned int width, unsigned int height, size_t stride, unsigned int nb_threads)
+{
+    QTree tree = {0};
+    FileBit in = {0};
+    Pixmap pix = {0};
+    QtcRoi roi = {0U, 0U, 0U, 0U};
+    unsigned int w = 0U, h = 0U, line = 0U;
+    bool done = false;
+
+    if (!raster || stride < width || !qtc_image_size(data, size, &w, &h) || w != width || h != height)
+    {
+        return false;
+    }
+
+    /* the leaves are read straight into the lines when they are contiguous, else into lines of their own */
+    if (stride == width)
+    {
+        pix.data = raster;
+    }
+    else if (ctx && !(pix.data = ctx->pixels = qtc_context_reserve(ctx, ctx->pixels, &ctx->pixels_capacity,
+                                                                    (size_t)width * height)))
+    {
+        return false;
+    }
+    fBitinitMem(&in, data, size);
+    done = read_qtc(&tree, &in, NULL, nb_threads, NULL, QTC_ALL_LEVELS, &pix, ctx);
+    if (done && !tree.raster) /* a single pixel */
+    {
+        raster[0] = tree.color[0];
+    }
+    else if (done)
+    {
+        pix.width = roi.w = width;
+        pix.height = roi.h = height;
+        fill_pixmap_tree(&tree, &pix, &roi, 0UL, tree.niveau, 0U, 0U);
+        for (line = 0U; pix.data != raster && line < height; ++line)
+        {
+            (void)memcpy(raster + line * stride, pix.data + (size_t)line * width, width);
+        }
+    }
+    if (!ctx) /* the arenas of a context are kept */
+    {
+        if (pix.data != raster)
+        {
+            free(pix.data);
+        }
+        free_qtree(&tree);
+    }
+    return done;
+}
+
+extern bool qtc_decode_buffer(const unsigned char *data, size_t size, unsigned char *raster, unsigned int width,
+                              unsigned int height, size_t stride, unsigned int nb_threads)
+{
+    return decode_raster(NULL, data, size, raster, width, height, stride, nb_threads);
+}
+
+extern bool qtc_context_decode(QtcContext *ctx, const unsigned char *data, size_t size, unsigned char *raster,
+                               unsigned int width, unsigned int height, size_t stride, unsigned int nb_threads)
+{
+    return ctx && ctx->color && decode_raster(ctx, data, size, raster, width, height, stride, nb_threads);
+}
+
+/**
+ * @brief Read a .qtc file, Q1, Q2 or Q3, into a quadtree
+ *
+ * @param tree the quadtree
+ * @param file_name the name of the file
+ * @param nb_threads the number of threads decoding the chunks of a Q2 or Q3 file
+ * @param roi the region, the chunks outside are skipped, NULL for the whole image
+ * @param max_level the depth of the last level read, the file is not read further
+ * @param pix the pixmap the leaves are read into, NULL to read them into the tree
+ */
+static void read_qtc_file(QTree *tree, const char *file_name, unsigned int nb_threads, const QtcRoi *roi,
+                          unsigned char max_level, Pixmap *pix)
+{
+    FileBit in = {0};
+
+    if (!tree || !file_name)
+    {
+        fprintf(stderr, "Error: tree / file_name is NULL in init_quadtree_from_file()!\n");
+        return;
+    }
+    if (!(fBitopen(&in, file_name, "r")))
+    {
+        fprintf(stderr, "Error: %s file not found in init_quadtree_from_file()!\n", file_name);
+        return;
+    }
+    (void)read_qtc(tree, &in, file_name, nb_threads, roi, max_level, pix, NULL);
+    (void)fBitclose(&in);
+}
+
+/**
+ * @brief Read a .qtc file, Q1, Q2 or Q3, from a file or a buffer into a quadtree
+ *
+ * @param tree the quadtree
+ * @param in the file or the buffer, at its first byte
+ * @param file_name the name of the file, for the comments and the errors, NULL to read quietly
+ * @param nb_threads the number of threads decoding the chunks of a Q2 or Q3 file
+ * @param roi the region, the chunks outside are skipped, NULL for the whole image
+ * @param max_level the depth of the last level read, the file is not read further
+ * @param pix the pixmap the leaves are read into, NULL to read them into the tree;
+ * its pixels are allocated unless `pix->data` is given, of the size of the image
+ * @param ctx the context lending the planes of the tree, NULL to allocate them
+ * @return true on success
+ * @return false if the file is not a .qtc file, is truncated or corrupted, or on a memory allocation error
+ */
+static bool read_qtc(QTree *tree, FileBit *in, const char *file_name, unsigned int nb_threads, const QtcRoi *roi,
+                     unsigned char max_level, Pixmap *pix, QtcContext *ctx)
+{
+    unsigned long width = 0UL, height = 0UL;
+    unsigned char niveau = 0U, version = 0U, last = 0U;
+    bool done = true, owned = false;
+
+    if (QTC_ALL_LEVELS == (niveau = read_qtc_header(in, file_name, &version, &width, &height)))
+    {
+        return false;
+    }
+
+    /* the tree stops at the last level read: its nodes are the leaves of a thumbnail */
+    last = (max_level < niveau) ? (max_level) : (niveau);
+    if (pix && niveau && last == niveau) /* or above the leaves, read straight into the pixels */
+    {
+        owned = !pix->data;
+        if ((owned && !(pix->data = malloc((size_t)width * height * sizeof(*pix->data)))) ||
+            !make_qtree_from(tree, ctx, QTC_GREY_LEVEL, (unsigned char)(niveau - 1U), false))
+        {
+            if (file_name)
+            {
+                fprintf(stderr, "Error: memory allocation error in init_pixmap_from_file()!\n");
+            }
+            if (owned)
+            {
+                free(pix->data);
+                pix->data = NULL;
+            }
+            return false;
+        }
+        tree->raster = pix->data;
+    }
+    else if (!make_qtree_from(tree, ctx, QTC_GREY_LEVEL, last, false))
+    {
+        return false;
+    }
+
+    /* but the nodes are read as those of the file, where the nodes of `last` may not be leaves */
+    tree->niveau = niveau;
+    tree->width = (unsigned int)width;
+    tree->height = (unsigned int)height;
+    if ('1' == version) /* a single stream, in BFS order: truncated if a node is read past its end */
+    {
+        qtc_walk_top(tree, in, qtc_read_node, last);
+        done = !in->depasse;
+    }
+    else
+    {
+        done = qtc_read_chunked(tree, in, nb_threads, '3' == version, roi, last, ctx);
+    }
+    if (!done && file_name)
+    {
+        fprintf(stderr, "Error: %s is truncated or corrupted!\n", file_name);
+    }
+    tree->niveau = last;
+    tree->width = (unsigned int)((width + (1UL << (niveau - last)) - 1UL) >> (niveau - last));
+    tree->height = (unsigned int)((height + (1UL << (niveau - last)) - 1UL) >> (niveau - last));
+    return done;
+}
+
+extern unsigned char read_qtc_header(FileBit *in, const char *file_name, unsigned char *version,
+                                      unsigned long *width, unsigned long *height)
+{
+    unsigned char character = 0U, niveau = 0U;
+    int next = 0; /* EOF at the end of a truncated comment */
+
+    *version = (unsigned char)(('Q' == fLireCharbin(in)) ? (fLireCharbin(in)) : (0U));
+    if ('1' != *version && '2' != *version && '3' != *version)
+    {
+        if (file_name)
+        {
+            fprintf(stderr, "Error: %s is not a QTC file!\n", file_name);
+        }
+        return QTC_ALL_LEVELS;
+    }
+    (void)fLireCharbin(in); /* read '\n' */
+
+    /* read all comments */
+    do
+    {
+        character = fLireCharbin(in);
+        if ('#' == character)
+        {
+            if (file_name)
+            {
+                fprintf(stderr, "comment: ");
+            }
+            while ('\n' != character && EOF != next)
+            {
+                if (file_name)
+                {
+                    fprintf(stderr, "%c", character);
+                }
+                character = (unsigned char)(next = fLireBits(in, 8U));
+            }
+            if (file_name)
+            {
+                fprintf(stderr, "\n");
+            }
+        }
+        else
+        {
+            niveau = character;
+            break;
+        }
+    } while ('\n' == character);
+
+    /* a rectangular image: its width and its height, then the level */
+    if (character >= '0' && character <= '9')
+    {
+        *width = read_qtc_dimension(in, &character);
+        character = fLireCharbin(in); /* after the space */
+        *height = read_qtc_dimension(in, &character);
+        niveau = fLireCharbin(in); /* after the '\n' */
+    }
+    else if (niveau < QTC_LEVELS)
+    {
+        *width = *height = 1UL << niveau;
+    }
+    if (EOF == next || niveau >= QTC_LEVELS || !*width || !*height ||
+        *width > (1UL << niveau) || *height > (1UL << niveau))
+    {
+        if (file_name)
+        {
+            fprintf(stderr, "Error: %s is truncated or corrupted!\n", file_name);
+        }
+        return QTC_ALL_LEVELS;
+    }
+    return niveau;
+}
+
+/**
+ * @brief Read a dimension of the header of a .qtc file, in decimal
+ *
+ * @param in the file
+ * @param character its first digit, then the character after its last one
+ * @return unsigned long the dimension, kept above 2^20 when larger: no image is that large
+ */
+static unsigned long read_qtc_dimension(FileBit *in, unsigned char *character)
+{
+    unsigned long value = 0UL;
+
+    while (*character >= '0' && *character <= '9')
+    {
+        value = (value <= 0xFFFFFUL) ? (value * 10UL + (unsigned long)(*character - '0')) : (value);
+        *character = fLireCharbin(in);
+    }
+    return value;
+}
+
+/**
+ * @brief Clip a region to the image of a quadtree
+ *
+ * @param roi the region
+ * @param qtree the quadtree
+ * @param clipped the region inside the image
+ * @return true if the region has pixels in the image
+ */
+static bool clip_roi(const QtcRoi *roi, const QTree *qtree, QtcRoi *clipped)
+{
+    if (!roi || !roi->w || !roi->h || roi->x >= qtree->width || roi->y >= qtree->height)
+    {
+        return false;
+    }
+    clipped->x = roi->x;
+    clipped->y = roi->y;
+    clipped->w = (roi->w < qtree->width - roi->x) ? (roi->w) : (qtree->width - roi->x);
+    clipped->h = (roi->h < qtree->height - roi->y) ? (roi->h) : (qtree->height - roi->y);
+    return true;
+}
+
+/**
+ * @brief Fill a block of `w` x `h` pixels with the same color, a row at a time with broadcast stores
+ *
+ * @param dst the first pixel of the block
+ * @param stride the width of a line of the pixmap
+ * @param color the color of the block
+ * @param w the width of the block
+ * @param h the height of the block
+ */
+static __inline__ void fill_block(unsigned char *__restrict__ dst, size_t stride, unsigned char color, size_t w, size_t h)
+{
+    uint64_t pattern = ((uint64_t)~(uint64_t)0 / 0xFFU) * color;
+    size_t i = 0UL, x = 0UL;
+
+    if (w >= QTREE_FILL_MEMSET) /* long rows: the store loop of the libc is as fast, and wider */
+    {
+        for (i = 0UL; i < h; ++i, dst += stride)
+        {
+            (void)memset(dst, color, w);
+        }
+        return;
+    }
+#if defined(__AVX2__)
+    if (w >= 32UL)
+    {
+        const __m256i v = _mm256_set1_epi8((char)color);
+        for (i = 0UL; i < h; ++i, dst += stride)
+        {
+            for (x = 0UL; x + 32UL <= w; x += 32UL)
+            {
+                _mm256_storeu_si256((__m256i *)(dst + x), v);
+            }
+            if (x < w) /* the last store overlaps the previous one */
+            {
+                _mm256_storeu_si256((__m256i *)(dst + w - 32UL), v);
+            }
+        }
+        return;
+    }
+#endif
+#if defined(__SSE2__)
+    if (w >= 16UL)
+    {
+        const __m128i v = _mm_set1_epi8((char)color);
+        for (i = 0UL; i < h; ++i, dst += stride)
+        {
+            for (x = 0UL; x + 16UL <= w; x += 16UL)
+            {
+                _mm_storeu_si128((__m128i *)(dst + x), v);
+            }
+            if (x < w)
+            {
+                _mm_storeu_si128((__m128i *)(dst + w - 16UL), v);
+            }
+        }
+        return;
+    }
+#endif
+    /* the blocks of 8, 4 and 2 pixels: one store per row */
+    switch (w)
+    {
+    case 8UL:
+        for (i = 0UL; i < h; ++i, dst += stride)
+        {
+            (void)memcpy(dst, &pattern, 8UL);
+        }
+        break;
+    case 4UL:
+        for (i = 0UL; i < h; ++i, dst += stride)
+        {
+            (void)memcpy(dst, &pattern, 4UL);
+        }
+        break;
+    case 2UL:
+        for (i = 0UL; i < h; ++i, dst += stride)
+        {
+            (void)memcpy(dst, &pattern, 2UL);
+        }
+        break;
+    default:
+        for (i = 0UL; i < h; ++i, dst += stride)
+        {
+            (void)memset(dst, color, w);
+        }
+        break;
+    }
+}
+
+extern void fill_pixmap_tree(QTree *qtree, Pixmap *pix, const QtcRoi *roi,
+                              size_t index, unsigned char niveau,
+                              unsigned int line, unsigned int col)
+{
+    FillNode stack[3U * QTC_LEVELS + 1U]; /* 3 siblings waiting by level, and the node popped */
+    FillNode node;
+    unsigned char *row = NULL;
+    const unsigned char *quad = NULL;
+    unsigned int size = 0U, half = 0U, first_line = 0U, last_line = 0U, first_col = 0U, last_col = 0U;
+    size_t top = 0UL, child = 0UL;
+
+    stack[top].index = index;
+    stack[top].niveau = niveau;
+    stack[top].line = line;
+    stack[top].col = col;
+    ++top;
+    while (top)
+    {
+        node = stack[--top];
+        size = 1U << node.niveau;
+
+        /* outside of the region */
+        if (node.line >= roi->y + roi->h || roi->y >= node.line + size ||
+            node.col >= roi->x + roi->w || roi->x >= node.col + size)
+        {
+            continue;
+        }
+        row = pix->data + (size_t)(node.line - roi->y) * pix->width + (node.col - roi->x);
+
+        if (!node.niveau) /* a pixel of the region */
+        {
+            *row = qtree->color[node.index];
+            continue;
+        }
+
+        if (QTREE_U(qtree, node.index))
+        {
+            first_line = (node.line > roi->y) ? (node.line) : (roi->y);
+            last_line = (node.line + size < roi->y + roi->h) ? (node.line + size) : (roi->y + roi->h);
+            first_col = (node.col > roi->x) ? (node.col) : (roi->x);
+            last_col = (node.col + size < roi->x + roi->w) ? (node.col + size) : (roi->x + roi->w);
+            fill_block(pix->data + (size_t)(first_line - roi->y) * pix->width + (first_col - roi->x), pix->width,
+                       qtree->color[node.index], last_col - first_col, last_line - first_line);
+            continue;
+        }
+
+        if (1U == node.niveau && qtree->raster) /* its leaves were read straight into the pixels */
+        {
+            continue;
+        }
+        child = node.index * MAX_CHILD + 0x1UL;
+        if (1U == node.niveau && node.line >= roi->y && node.line + 2U <= roi->y + roi->h &&
+            node.col >= roi->x && node.col + 2U <= roi->x + roi->w)
+        {
+            /* a quad of leaves, in the region: top-left and top-right are contiguous in the tree */
+            quad = qtree->color + child;
+            (void)memcpy(row, quad, 2UL);
+            row += pix->width;
+            row[0] = quad[3];
+            row[1] = quad[2];
+            continue;
+        }
+
+        /* the children, the top-left one on top of the stack */
+        half = size >> 1U;
+        --node.niveau;
+        stack[top].index = child + 3UL;
+        stack[top].niveau = node.niveau;
+        stack[top].line = node.line + half;
+        stack[top].col = node.col;
+        ++top;
+        stack[top].index = child + 2UL;
+        stack[top].niveau = node.niveau;
+        stack[top].line = node.line + half;
+        stack[top].col = node.col + half;
+        ++top;
+        stack[top].index = child + 1UL;
+        stack[top].niveau = node.niveau;
+        stack[top].line = node.line;
+        stack[top].col = node.col + half;
+        ++top;
+        stack[top].index = child;
+        stack[top].niveau = node.niveau;
+        stack[top].line = node.line;
+        stack[top].col = node.col;
+        ++top;
+    }
+}
+
+extern void pixmap_from_quadtree(QTree *qtree, Pixmap *pix)
+{
+    QtcRoi roi = {0U, 0U, 0U, 0U};
+    roi.w = qtree->width;
+    roi.h = qtree->height;
+    pixmap_from_quadtree_roi(qtree, pix, &roi);
+}
+
+extern void pixmap_from_quadtree_roi(QTree *qtree, Pixmap *pix, const QtcRoi *roi)
+{
+    QtcRoi clipped = {0U, 0U, 0U, 0U};
+
+    if (!clip_roi(roi, qtree, &clipped))
+    {
+        fprintf(stderr, "Error: the region is outside of the image in pixmap_from_quadtree_roi()!\n");
+        return;
+    }
+    (void)strncpy(pix->magic_number, "P5", 2UL);
+    pix->magic_number[2] = '\0';
+
+    pix->width = clipped.w;
+    pix->height = clipped.h;
+    pix->data = malloc((size_t)pix->width * pix->height * sizeof(*pix->data));
+    if (!pix->data)
+    {
+        fprintf(stderr, "Error: memory allocation error in pixmap_from_quadtree()!\n");
+        return;
+    }
+    pix->grey_level = QTC_GREY_LEVEL;
+
+    fill_pixmap_tree(qtree, pix, &clipped, 0U, qtree->niveau, 0U, 0U);
+}
+
+/*******************************************************************************/
+/*******************************************************************************/
+/********************************   FILTERING   ********************************/
+/*******************************************************************************/
+/*******************************************************************************/
+
+extern void must_filter_qtree(QTree *qtree, double alpha, bool flag)
+{
+    double medvar = 0.0, maxvar = 0.0;
+    if (!qtree || !qtree->color)
+    {
+        fprintf(stderr, "Error: empty quadtree!\n");
+        return;
+    }
+    if (!qtree->variance)
+    {
+        fprintf(stderr, "Error: quadtree built without variance, can't filter!\n");
+        return;
+    }
+    if (!flag)
+    {
+        fprintf(stderr, "Filtering is disabled. Skipping.\n");
+        return;
+    }
+
+    /* the sum and the maximum of the variances come with the build: the filtering is a single pass */
+    medvar = mean_variance(qtree);
+    maxvar = qtree->variance_max;
+    filter_quadtree(qtree, medvar, maxvar, alpha);
+}
+
+/**
+ * @brief Average variance of the internal nodes, from the sum accumulated by the build
+ *
+ * @param qtree the quadtree
+ * @return double the average variance
+ */
+static double mean_variance(QTree *qtree)
+{
+    size_t number_of_nodes = DETERMINE_QTREE_SIZE(qtree->niveau) - (1UL << (2UL * qtree->niveau));
+    return (number_of_nodes) ? (qtree->variance_sum / (double)number_of_nodes) : (0.0);
+}
+
+/**
+ * @brief Calculate the variance of the node
+ *
+ * @param qtree the quadtree
+ * @param index the index of the node
+ * @param child_index the index of the first child
+ * @return float the variance of the node
+ */
+static float calculate_variance(QTree *qtree, size_t index, size_t child_index)
+{
+    return children_variance(qtree->color[index], qtree->color + child_index, qtree->variance + child_index);
+}
+
+/**
+ * @brief Variance of a node from its children
+ *
+ * @param m the color of the node
+ * @param colors the colors of its 4 children
+ * @param variances the variances of its 4 children
+ * @return float the variance of the node
+ */
+static float children_variance(float m, const unsigned char *colors, const float *variances)
+{
+    unsigned int k = 0U;
+    float mu = 0.0F, mk = 0.0F, vk = 0.0F;
+    for (k = 0; k < MAX_CHILD; ++k)
+    {
+        mk = colors[k];                          /* color of child */
+        vk = variances[k];                       /* variance of child */
+        mu += (vk * vk) + ((m - mk) * (m - mk)); /* given formula */
+    }
+
+    return (float)sqrt(mu) / 4.0F;
+}
+
+extern unsigned int filtrage(QTree *qtree,
+                              size_t index, int niveau,
+                              double sigma, double alpha)
+{
+    EdgePlanes edges;
+    size_t child_index = 0UL;
+    unsigned int s = 0U;
+    unsigned char depth = (unsigned char)(qtree->niveau - niveau);
+
+    /* if the node is already uniform or if the node is a leaf, return 1 */
+    if (QTREE_U(qtree, index) || !niveau)
+    {
+        return 1U;
+    }
+
+    /* outside of the image: its subtree is not built, but filtered as its node of the edges */
+    if (QTREE_HAS_EDGES(qtree) && is_outside(qtree, index, depth))
+    {
+        edge_planes(qtree, &edges);
+        if (!filter_edge(&edges, edge_index(qtree, index, depth), depth, sigma, alpha))
+        {
+            return 0U;
+        }
+        qtree->eu[index] = QTREE_EU(0U, 1U);
+        return 1U;
+    }
+
+    --niveau;
+    child_index = index * MAX_CHILD + 1UL;
+
+    /* descend into the lower levels: all children must be processed */
     s += filtrage(qtree, child_index, niveau, sigma * alpha, alpha);
-    s += filtrage(qtree, child_index + 1U, niveau, sigma * alpha, alpha);
-    s += filtrage(qtree, child_index + 2U, niveau, sigma * alpha, alpha);
-    s += filtrage(qtree, child_index + 3U, niveau, sigma * alpha, alpha);
+    s += filtrage(qtree, child_index + 1UL, niveau, sigma * alpha, alpha);
+    s += filtrage(qtree, child_index + 2UL, niveau, sigma * alpha, alpha);
+    s += filtrage(qtree, child_index + 3UL, niveau, sigma * alpha, alpha);
 
     /* the current node is 'uniformized' only if:       *
      * - all 4 children have already been 'uniformized' *
      * - it is variance meets the filter conditions     */
-    if (s < MAX_CHILD || qtree->nodes[index].variance > sigma)
+    if (s < MAX_CHILD || qtree->variance[index] > sigma)
     {
         return 0U;
     }
 
-    qtree->nodes[index].e = 0U;
-    qtree->nodes[index].u = 1U;
+    qtree->eu[index] = QTREE_EU(0U, 1U);
     return 1U;
 }
 
+/**
+ * @brief `filtrage` of a node of the edges: its 4 children are 2 copies of each of its 2 children
+ *
+ * @param edges the planes of the edges
+ * @param e the index of the node
+ * @param depth the depth of the node
+ * @param sigma the threshold
+ * @param alpha the alpha value
+ * @return unsigned int 1 if the node would be uniform, 0 otherwise
+ */
+static unsigned int filter_edge(const EdgePlanes *edges, size_t e, unsigned char depth, double sigma, double alpha)
+{
+    size_t child = 0UL;
+    unsigned int s = 0U;
+
+    if (QTREE_U(edges, e) || depth == edges->niveau)
+    {
+        return 1U;
+    }
+    child = edge_child(e, depth);
+    s += 2U * filter_edge(edges, child, (unsigned char)(depth + 1U), sigma * alpha, alpha);
+    s += 2U * filter_edge(edges, child + 1UL, (unsigned char)(depth + 1U), sigma * alpha, alpha);
+    return (s < MAX_CHILD || edges->variance[e] > sigma) ? (0U) : (1U);
+}
+
 extern void filter_quadtree(QTree *qtree, double medvar, double maxvar, double alpha)
 {
     double sigma = medvar / maxvar; /* initial threshold */
-    (void)filtrage(qtree, 0U, qtree->niveau, sigma, alpha);
+    (void)filtrage(qtree, 0UL, qtree->niveau, sigma, alpha);
+}
+
+/**
+ * @brief First position of the alpha grid at which `filtrage` uniformizes an internal node
+ *
+ * @param variance the variance of the node
+ * @param depth the depth of the node
+ * @param first the position from which all its children are uniform, `never` if never
+ * @param thresholds the thresholds of `filtrage`, `QTC_LEVELS` depths per position
+ * @param never the position past the last alpha
+ * @return unsigned int the position, `never` if the node is never uniformized
+ */
+static unsigned int first_uniform_alpha(float variance, unsigned char depth, unsigned int first,
+                                        const double *thresholds, unsigned int never)
+{
+    unsigned int lo = (first) ? (first) : (1U), hi = never, mid = 0U;
+
+    /* the thresholds grow with alpha: the first one the variance does not exceed, compared as `filtrage` does */
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2U;
+        if (variance > thresholds[mid * QTC_LEVELS + depth])
+        {
+            lo = mid + 1U;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+ * @brief `first_uniform_alpha` of a node of the edges, 0 if uniform at any alpha
+ *
+ * @param edges the planes of the edges
+ * @param e the index of the node
+ * @param depth the depth of the node
+ * @param thresholds the thresholds of `filtrage`, `QTC_LEVELS` depths per position
+ * @param never the position past the last alpha
+ * @return unsigned int the position, `never` if the node is never uniformized
+ */
+static unsigned int edge_grid(const EdgePlanes *edges, size_t e, unsigned char depth, const double *thresholds,
+                              unsigned int never)
+{
+    size_t child = 0UL;
+    unsigned int first = 0U, second = 0U;
+
+    if (QTREE_U(edges, e) || depth == edges->niveau)
+    {
+        return 0U;
+    }
+    child = edge_child(e, depth);
+    first = edge_grid(edges, child, (unsigned char)(depth + 1U), thresholds, never);
+    second = edge_grid(edges, child + 1UL, (unsigned char)(depth + 1U), thresholds, never);
+    return first_uniform_alpha(edges->variance[e], depth, (second > first) ? (second) : (first), thresholds, never);
+}
+
+/**
+ * @brief Add the bits of node `i` to the size of its stream, at every position of the alpha grid:
+ * written with its `e` and `u` before `node_grid`, written uniform up to `parent_grid`, skipped after
+ *
+ * @param qtree the quadtree
+ * @param diff the differences between consecutive positions, `QTC_ALPHA_NEVER + 1` per stream
+ * @param i the index of the node, in the image
+ * @param depth the depth of the node
+ * @param chunk_depth the depth of the roots of the chunks, `qtree->niveau` for a single stream
+ * @param node_grid the position from which the node is uniform
+ * @param parent_grid the position from which its parent is uniform
+ */
+static void count_node_bits(QTree *qtree, size_t *diff, size_t i, unsigned char depth, unsigned char chunk_depth,
+                            unsigned int node_grid, unsigned int parent_grid)
+{
+    size_t bits = 0UL, uniform = 0UL;
+
+    bits = uniform = (color_written(qtree, i, depth)) ? (8UL) : (0UL); /* no color for a 4th child */
+
+    /* the top stream, then one stream per chunk */
+    if (depth > chunk_depth)
+    {
+        diff += (1UL + ((i - DETERMINE_LEVEL_OFFSET((size_t)depth)) >> (2UL * (size_t)(depth - chunk_depth)))) *
+                (QTC_ALPHA_NEVER + 1UL);
+    }
+    if (depth < qtree->niveau)
+    {
+        bits += (QTREE_E(qtree, i)) ? (2UL) : (3UL);
+        uniform += 3UL;
+    }
+    diff[0] += bits;
+    diff[node_grid] += uniform - bits;
+    diff[parent_grid] -= uniform;
+}
+
+/**
+ * @brief Filter the tree at each alpha of `alphas` at once, without changing it: position, in `alphas`,
+ * of the first alpha at which `filtrage` uniformizes each node, 0 for the nodes already uniform
+ *
+ * @param qtree the quadtree, with its variance
+ * @param alphas the alphas, in increasing order, 0.1 at least
+ * @param nb_alphas the number of alphas, below 255
+ * @param grid the position of each node, from 1 for `alphas[0]`, `nb_alphas + 1` if never uniformized
+ * @return true if done, false on allocation error
+ */
+static bool filter_grid(QTree *qtree, const double *alphas, unsigned int nb_alphas, unsigned char *grid)
+{
+    EdgePlanes edges;
+    double *thresholds = NULL;
+    double sigma = 0.0;
+    size_t i = 0UL, last = 0UL, child = 0UL, skip = 0UL;
+    unsigned int p = 0U, first = 0U, k = 0U, position = 0U;
+    unsigned char depth = 0U;
+    bool outside = QTREE_HAS_EDGES(qtree);
+
+    if (!(thresholds = malloc((nb_alphas + 1UL) * QTC_LEVELS * sizeof(*thresholds))))
+    {
+        return false;
+    }
+
+    /* the thresholds of `filtrage`: sigma at the root, multiplied by alpha at each depth */
+    sigma = mean_variance(qtree) / (double)qtree->variance_max;
+    for (p = 1U; p <= nb_alphas; ++p)
+    {
+        thresholds[p * QTC_LEVELS] = sigma;
+        for (depth = 1U; depth <= qtree->niveau; ++depth)
+        {
+            thresholds[p * QTC_LEVELS + depth] = thresholds[p * QTC_LEVELS + depth - 1U] * alphas[p - 1U];
+        }
+    }
+
+    /* bottom-up, a node is uniformized once its 4 children are, those outside of the image from the edges */
+    if (outside)
+    {
+        edge_planes(qtree, &edges);
+    }
+    depth = qtree->niveau;
+    do
+    {
+        last = DETERMINE_LEVEL_OFFSET((size_t)depth + 1UL);
+        for (i = DETERMINE_LEVEL_OFFSET((size_t)depth); i < last; ++i)
+        {
+            if (outside && (skip = outside_run(qtree, i, depth))) /* never read */
+            {
+                i += skip - 1UL;
+                continue;
+            }
+            if (depth == qtree->niveau || QTREE_U(qtree, i))
+            {
+                grid[i] = 0U; /* leaf, or uniform at any alpha */
+                continue;
+            }
+            child = i * MAX_CHILD + 1UL;
+            for (first = 0U, k = 0U; k < MAX_CHILD; ++k)
+            {
+                position = (outside && is_outside(qtree, child + k, (unsigned char)(depth + 1U)))
+                               ? (edge_grid(&edges, edge_index(qtree, child + k, (unsigned char)(depth + 1U)),
+                                            (unsigned char)(depth + 1U), thresholds, nb_alphas + 1U))
+                               : (grid[child + k]);
+                first = (position > first) ? (position) : (first);
+            }
+            grid[i] = (unsigned char)first_uniform_alpha(qtree->variance[i], depth, first, thresholds, nb_alphas + 1U);
+        }
+    } while (depth--);
+
+    free(thresholds);
+    return true;
+}
+
+extern double search_alpha_for_size(QTree *qtree, size_t target_bytes, unsigned char format)
+{
+    char header[QTC_HEADER_MAX];
+    double alphas[QTC_ALPHA_GRID];
+    size_t *diff = NULL, *stream = NULL;
+    unsigned char *grid = NULL;
+    size_t nb_streams = 1UL, s = 0UL, i = 0UL, last = 0UL, skip = 0UL, encoded = 0UL, size = 0UL;
+    unsigned int p = 0U;
+    unsigned char depth = 0U, chunk_depth = 0U;
+
+    if (!qtree || !qtree->color || !qtree->variance)
+    {
+        fprintf(stderr, "Error: quadtree built without variance in search_alpha_for_size()!\n");
+        return -1.0;
+    }
+    if (format > 2U)
+    {
+        fprintf(stderr, "Error: the size of a range coded file can't be predicted!\n");
+        return -1.0;
+    }
+    chunk_depth = (format > 1U) ? (QTC_CHUNK_DEPTH(qtree->niveau)) : (qtree->niveau);
+    nb_streams = (format > 1U) ? (1UL + (1UL << (2UL * chunk_depth))) : (1UL);
+    for (p = 1U; p < QTC_ALPHA_NEVER; ++p)
+    {
+        alphas[p - 1U] = QTC_ALPHA_OF(p);
+    }
+
+    diff = calloc(nb_streams * (QTC_ALPHA_NEVER + 1UL), sizeof(*diff));
+    grid = make_plane(DETERMINE_QTREE_SIZE(qtree->niveau) * sizeof(*grid));
+    if (!diff || !grid || !filter_grid(qtree, alphas, QTC_ALPHA_GRID, grid))
+    {
+        fprintf(stderr, "Error: memory allocation error in search_alpha_for_size()!\n");
+        free(diff);
+        free_plane(grid);
+        return -1.0;
+    }
+
+    /* the bits of each node are known at every alpha, from its position and its parent's */
+    count_node_bits(qtree, diff, 0UL, 0U, chunk_depth, grid[0], QTC_ALPHA_NEVER);
+    for (depth = 1U; depth <= qtree->niveau; ++depth)
+    {
+        last = DETERMINE_LEVEL_OFFSET((size_t)depth + 1UL);
+        for (i = DETERMINE_LEVEL_OFFSET((size_t)depth); i < last; ++i)
+        {
+            if ((skip = outside_run(qtree, i, depth))) /* never written */
+            {
+                i += skip - 1UL;
+                continue;
+            }
+            count_node_bits(qtree, diff, i, depth, chunk_depth, grid[i], grid[(i - 1UL) / MAX_CHILD]);
+        }
+    }
+
+    /* the sizes of the streams at each alpha, then the first alpha whose file fits */
+    for (s = 0UL; s < nb_streams; ++s)
+    {
+        stream = diff + s * (QTC_ALPHA_NEVER + 1UL);
+        for (p = 1U; p < QTC_ALPHA_NEVER; ++p)
+        {
+            stream[p] += stream[p - 1U];
+        }
+    }
+    for (p = 0U; p < QTC_ALPHA_NEVER; ++p)
+    {
+        encoded = (format > 1U) ? (0x2UL + 0x4UL * nb_streams) : (0x1UL); /* level, depth and index */
+        for (s = 0UL; s < nb_streams; ++s)
+        {
+            encoded += (diff[s * (QTC_ALPHA_NEVER + 1UL) + p] + 7UL) / 8UL;
+        }
+        size = format_qtc_header(header, (char)('0' + format), (encoded - 1UL) * 0x8UL, qtree) + encoded;
+        if (size <= target_bytes)
+        {
+            break;
+        }
+    }
+    free(diff);
+    free_plane(grid);
+    if (QTC_ALPHA_NEVER == p)
+    {
+        fprintf(stderr, "Error: %lu bytes at alpha %.2f, above the target of %lu bytes\n",
+                (unsigned long)size, QTC_ALPHA_OF(QTC_ALPHA_GRID), (unsigned long)target_bytes);
+        return -1.0;
+    }
+    return (p) ? (QTC_ALPHA_OF(p)) : (0.0);
+}
+
+/**
+ * @brief Optimal pruning for `lambda`, bottom-up: a node is collapsed when its error, plus `lambda`
+ * times its 3 bits of `e` and `u`, costs no more than the best pruning of its children.
+ * The nodes outside of the image cost nothing, they are left out.
+ *
+ * @param qtree the quadtree, with its errors
+ * @param lambda the price of a bit
+ * @param cost the best pruning of each internal node in the image, filled
+ * @param apply true to collapse the nodes chosen, false to only measure
+ * @return double the squared error of the image
+ */
+static double rd_prune(QTree *qtree, double lambda, RdCost *cost, bool apply)
+{
+    size_t i = 0UL, k = 0UL, last = 0UL, skip = 0UL;
+    double d = 0.0, r = 0.0;
+    unsigned char depth = qtree->niveau;
+
+    while (depth--) /* children before their parent */
+    {
+        last = DETERMINE_LEVEL_OFFSET((size_t)depth + 1UL);
+        for (i = DETERMINE_LEVEL_OFFSET((size_t)depth); i < last; ++i)
+        {
+            if ((skip = outside_run(qtree, i, depth)))
+            {
+                i += skip - 1UL;
+                continue;
+            }
+
+            /* kept: its `e` (and `u`), the colors of its children written, and the best pruning of the internal ones */
+            d = 0.0;
+            r = (QTREE_E(qtree, i)) ? (2.0) : (3.0);
+            for (k = i * MAX_CHILD + 1UL; k < i * MAX_CHILD + 1UL + MAX_CHILD; ++k)
+            {
+                if (is_outside(qtree, k, (unsigned char)(depth + 1U)))
+                {
+                    continue;
+                }
+                if (color_written(qtree, k, (unsigned char)(depth + 1U)))
+                {
+                    r += 8.0;
+                }
+                if (depth + 1U < qtree->niveau)
+                {
+                    d += cost[k].d;
+                    r += cost[k].r;
+                }
+            }
+
+            /* collapsed: its error, `e` = 0 and `u` = 1 */
+            if (QTREE_U(qtree, i) || qtree->sse[i] + lambda * 3.0 <= d + lambda * r)
+            {
+                cost[i].d = qtree->sse[i];
+                cost[i].r = 3.0;
+                if (apply)
+                {
+                    qtree->eu[i] = QTREE_EU(0U, 1U);
+                }
+            }
+            else
+            {
+                cost[i].d = d;
+                cost[i].r = r;
+            }
+        }
+    }
+    return cost[0].d;
+}
+
+/**
+ * @brief PSNR of the image decoded from the tree
+ *
+ * @param qtree the quadtree
+ * @param error the squared error of the image
+ * @return double the PSNR, in dB, `HUGE_VAL` without error
+ */
+static double rd_psnr(QTree *qtree, double error)
+{
+    double pixels = (double)qtree->width * (double)qtree->height;
+    return (error > 0.0) ? (10.0 * log10((double)QTC_GREY_LEVEL * QTC_GREY_LEVEL * pixels / error)) : (HUGE_VAL);
+}
+
+/**
+ * @brief Make the subtrees of the nodes collapsed uniform too, as the decoder reads them
+ *
+ * @param qtree the quadtree
+ */
+static void rd_spread_uniform(QTree *qtree)
+{
+    size_t i = 0UL, last = 0UL, skip = 0UL;
+    unsigned char depth = 0U;
+    for (depth = 1U; depth < qtree->niveau; ++depth)
+    {
+        last = DETERMINE_LEVEL_OFFSET((size_t)depth + 1UL);
+        for (i = DETERMINE_LEVEL_OFFSET((size_t)depth); i < last; ++i)
+        {
+            if ((skip = outside_run(qtree, i, depth)))
+            {
+                i += skip - 1UL;
+                continue;
+            }
+            if (QTREE_U(qtree, (i - 1UL) / MAX_CHILD))
+            {
+                qtree->eu[i] = QTREE_EU(0U, 1U);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Order of the collapses left to the greedy pass: most bits saved per unit of error first
+ *
+ * @param a the first `RdCollapse`
+ * @param b the second `RdCollapse`
+ * @return int negative if `a` comes first
+ */
+static int rd_compare_collapses(const void *a, const void *b)
+{
+    const RdCollapse *x = a, *y = b;
+    double lhs = x->bits * y->error, rhs = y->bits * x->error; /* x->bits / x->error against y's */
+    return (lhs > rhs) ? (-1) : ((lhs < rhs) ? (1) : (0));
+}
+
+/**
+ * @brief Collapse, greedily, the subtrees pruned at `hi` but not at `lo` that fit in the error left:
+ * the top-most ones are disjoint, so their errors and bits add up independently
+ *
+ * @param qtree the quadtree, pruned at `lo`
+ * @param cost the best pruning at `lo`
+ * @param cost_hi the best pruning at `hi`, overwritten
+ * @param slack the error left under the budget
+ * @return double the error added
+ */
+static double rd_fill_slack(QTree *qtree, const RdCost *cost, RdCost *cost_hi, double slack)
+{
+    RdCollapse *collapses = NULL, *grown = NULL;
+    size_t i = 0UL, nb = 0UL, cap = 0UL, parent = 0UL, last = 0UL, skip = 0UL;
+    double added = 0.0;
+    unsigned char depth = 0U;
+
+    for (depth = 0U; depth < qtree->niveau; ++depth)
+    {
+        last = DETERMINE_LEVEL_OFFSET((size_t)depth + 1UL);
+        for (i = DETERMINE_LEVEL_OFFSET((size_t)depth); i < last; ++i)
+        {
+            if ((skip = outside_run(qtree, i, depth))) /* no cost */
+            {
+                i += skip - 1UL;
+                continue;
+            }
+            parent = (i - 1UL) / MAX_CHILD;
+            if (i && (cost_hi[parent].r < 0.0 || RD_COLLAPSED(cost_hi[parent])))
+            {
+                cost_hi[i].r = -1.0; /* below a node collapsed at `hi` */
+                continue;
+            }
+            if (!RD_COLLAPSED(cost_hi[i]) || RD_COLLAPSED(cost[i]))
+            {
+                continue;
+            }
+            if (nb == cap) /* out of memory, the collapses gathered so far are kept */
+            {
+                if (!(grown = realloc(collapses, ((cap) ? (cap << 1UL) : (64UL)) * sizeof(*collapses))))
+                {
+                    break;
+                }
+                collapses = grown;
+                cap = (cap) ? (cap << 1UL) : (64UL);
+            }
+            collapses[nb].index = i;
+            collapses[nb].error = qtree->sse[i] - cost[i].d;
+            collapses[nb].bits = cost[i].r - 3.0;
+            ++nb;
+        }
+    }
+
+    if (nb)
+    {
+        qsort(collapses, nb, sizeof(*collapses), rd_compare_collapses);
+    }
+    for (i = 0UL; i < nb; ++i)
+    {
+        if (collapses[i].error <= slack - added)
+        {
+            added += collapses[i].error;
+            qtree->eu[collapses[i].index] = QTREE_EU(0U, 1U);
+        }
+    }
+    free(collapses);
+    return added;
+}
+
+extern double rd_filter_quadtree(QTree *qtree, double lambda)
+{
+    RdCost *cost = NULL;
+    double error = 0.0;
+
+    if (!qtree || !qtree->color || !qtree->sse)
+    {
+        fprintf(stderr, "Error: quadtree built without errors, can't filter!\n");
+        return 0.0;
+    }
+    if (!qtree->niveau) /* a single leaf */
+    {
+        return HUGE_VAL;
+    }
+    if (!(cost = make_plane(DETERMINE_LEVEL_OFFSET((size_t)qtree->niveau) * sizeof(*cost))))
+    {
+        fprintf(stderr, "Error: memory allocation error in rd_filter_quadtree()!\n");
+        return 0.0;
+    }
+    error = rd_prune(qtree, lambda, cost, true);
+    rd_spread_uniform(qtree);
+    free_plane(cost);
+    return rd_psnr(qtree, error);
+}
+
+extern double rd_filter_quadtree_psnr(QTree *qtree, double psnr)
+{
+    RdCost *cost = NULL, *cost_hi = NULL;
+    size_t nb_internal = 0UL;
+    double max_error = 0.0, error = 0.0, lo = 0.0, hi = 0.0, mid = 0.0;
+    unsigned int step = 0U;
+
+    if (!qtree || !qtree->color || !qtree->sse)
+    {
+        fprintf(stderr, "Error: quadtree built without errors, can't filter!\n");
+        return 0.0;
+    }
+    if (!qtree->niveau) /* a single leaf */
+    {
+        return HUGE_VAL;
+    }
+    nb_internal = DETERMINE_LEVEL_OFFSET((size_t)qtree->niveau);
+    cost = make_plane(nb_internal * sizeof(*cost));
+    cost_hi = make_plane(nb_internal * sizeof(*cost_hi));
+    if (!cost || !cost_hi)
+    {
+        fprintf(stderr, "Error: memory allocation error in rd_filter_quadtree_psnr()!\n");
+        free_plane(cost);
+        free_plane(cost_hi);
+        return 0.0;
+    }
+
+    /* the error grows with lambda: none at 0, the error of the root once lambda reaches it */
+    max_error = (double)QTC_GREY_LEVEL * QTC_GREY_LEVEL * (double)qtree->width * (double)qtree->height /
+                pow(10.0, psnr / 10.0);
+    hi = qtree->sse[0] + 1.0;
+    if (rd_prune(qtree, hi, cost, false) <= max_error)
+    {
+        free_plane(cost);
+        free_plane(cost_hi);
+        return rd_filter_quadtree(qtree, hi);
+    }
+    lo = hi * 1e-12;
+    if (rd_prune(qtree, lo, cost, false) > max_error)
+    {
+        hi = lo;
+        lo = 0.0;
+    }
+    /* the largest lambda that keeps the error in the budget, on a logarithmic scale */
+    for (step = 0U; lo > 0.0 && step < QTC_RD_STEPS; ++step)
+    {
+        mid = sqrt(lo * hi);
+        if (rd_prune(qtree, mid, cost, false) <= max_error)
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    /* pruned at `lo`, then the error left is spent on the collapses between `lo` and `hi` */
+    (void)rd_prune(qtree, hi, cost_hi, false);
+    error = rd_prune(qtree, lo, cost, true);
+    error += rd_fill_slack(qtree, cost, cost_hi, max_error - error);
+    rd_spread_uniform(qtree);
+    free_plane(cost);
+    free_plane(cost_hi);
+    return rd_psnr(qtree, error);
 }
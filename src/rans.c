@@ -0,0 +1,257 @@
+/**
+ * @file src/rans.c
+ * @authors MUNAITPASOV M. & BENVENISTE A.
+ * @brief Range coding with adaptive models (rANS) implementation
+ * @version 0.1
+ * @date 2025-01-09
+ *
+ * @copyright licence MIT Copyright (c) 2025
+ *
+ */
+
+#include "rans.h"
+
+/* the encoder renormalizes when the state would not fit on 32 bits: x >= RANS_BOUND * freq */
+#define RANS_BOUND ((uint64_t)(RANS_LOW >> RANS_SCALE_BITS) << 16U)
+
+/**
+ * @brief Rebuild the frequencies from the counts: every symbol keeps a frequency of 1 at least,
+ * the rounding leftover goes to the most frequent one
+ *
+ * @param m the model
+ */
+static void rans_model_refresh(RansModel *m)
+{
+    uint32_t *count = m->count, *lookup = m->lookup;
+    uint16_t *freq = m->freq, *cum = m->cum;
+    unsigned int s = 0U, best = 0U, slot = 0U, sum = 0U, next = 0U, group = 1U << m->shift, nb_symbols = m->nb_symbols;
+    uint32_t scale = 0U, entry = 0U;
+
+    m->total += m->interval - m->left; /* the symbols counted since the last refresh */
+    if (m->total > RANS_MAX_COUNT)     /* forget the past, slowly */
+    {
+        m->total = 0U;
+        for (s = 0U; s < m->nb_symbols; ++s)
+        {
+            m->count[s] = (m->count[s] + 1U) >> 1U;
+            m->total += m->count[s];
+        }
+    }
+    /* freq = 1 + count * (RANS_SCALE - nb_symbols) / total, by a fixed point reciprocal */
+    scale = (uint32_t)(((uint64_t)(RANS_SCALE - nb_symbols) << 16U) / m->total);
+    for (s = 0U; s < nb_symbols; ++s)
+    {
+        freq[s] = (uint16_t)(1U + (uint32_t)(((uint64_t)count[s] * scale) >> 16U));
+        sum += freq[s];
+        best = (count[s] > count[best]) ? (s) : (best);
+    }
+    freq[best] = (uint16_t)(freq[best] + RANS_SCALE - sum);
+
+    /* a group of slots holds what the decoder needs of the symbol of its first slot, it steps to the next ones */
+    cum[0] = 0U;
+    for (s = 0U; s < nb_symbols; ++s)
+    {
+        next = cum[s] + freq[s];
+        cum[s + 1U] = (uint16_t)next;
+        if (lookup && slot < next) /* the same entry for all the groups starting in the symbol */
+        {
+            entry = s | ((uint32_t)(freq[s] - 1U) << 8U) | ((uint32_t)cum[s] << 20U);
+            do
+            {
+                lookup[slot >> m->shift] = entry;
+                slot += group;
+            } while (slot < next);
+        }
+    }
+
+    m->interval = (m->interval < RANS_REFRESH_LAST) ? (m->interval << 1U) : (RANS_REFRESH_LAST);
+    m->left = m->interval;
+}
+
+/* count symbol `s` of model `m`, and rebuild the frequencies when it is time to: a macro, once per symbol
+ * coded or decoded, so that it costs no call in a build without optimization */
+#define RANS_MODEL_UPDATE(m, s)        \
+    do                                 \
+    {                                  \
+        ++(m)->count[s];               \
+        if (!--(m)->left)              \
+        {                              \
+            rans_model_refresh(m);     \
+        }                              \
+    } while (0)
+
+extern void rans_model_init(RansModel *m, unsigned int nb_symbols,
+                            uint32_t *count, uint16_t *freq, uint16_t *cum, uint32_t *lookup)
+{
+    unsigned int s = 0U;
+    m->count = count;
+    m->freq = freq;
+    m->cum = cum;
+    m->lookup = lookup;
+    m->nb_symbols = nb_symbols;
+    /* a group per entry of `lookup`: the more symbols, the smaller the groups */
+    m->shift = RANS_SCALE_BITS;
+    while ((RANS_SCALE >> m->shift) < nb_symbols)
+    {
+        --m->shift;
+    }
+    for (s = 0U; s < nb_symbols; ++s)
+    {
+        m->count[s] = 1U;
+    }
+    m->total = nb_symbols;
+    m->interval = RANS_REFRESH_FIRST >> 1U;
+    m->left = m->interval;
+    rans_model_refresh(m);
+}
+
+/**
+ * @brief Make room for one more symbol in the queue, doubling it: a lent queue is copied into one of the encoder
+ *
+ * @param enc the encoder
+ */
+static void rans_queue_grow(RansEncoder *enc)
+{
+    uint32_t *queue = NULL;
+    size_t cap = (enc->cap) ? (enc->cap << 1UL) : (1UL << 12UL);
+    if ((queue = (enc->owned) ? (realloc(enc->queue, cap * sizeof(*queue))) : (malloc(cap * sizeof(*queue)))))
+    {
+        if (!enc->owned && enc->len)
+        {
+            (void)memcpy(queue, enc->queue, enc->len * sizeof(*queue));
+        }
+        enc->queue = queue;
+        enc->cap = cap;
+        enc->owned = true;
+    }
+    else
+    {
+        enc->error = true; /* the stream is lost, `rans_encoder_flush` fails */
+    }
+}
+
+extern void rans_encoder_init(RansEncoder *enc, FileBit *bits, uint32_t *queue, size_t cap)
+{
+    enc->bits = bits;
+    enc->queue = queue;
+    enc->len = 0UL;
+    enc->cap = (queue) ? (cap) : (0UL);
+    enc->owned = false;
+    enc->error = false;
+}
+
+extern void rans_encode(RansEncoder *enc, RansModel *m, unsigned int s)
+{
+    if (!enc->error && enc->len == enc->cap)
+    {
+        rans_queue_grow(enc);
+    }
+    if (!enc->error)
+    {
+        enc->queue[enc->len++] = ((uint32_t)m->cum[s] << 16U) | m->freq[s];
+    }
+    RANS_MODEL_UPDATE(m, s);
+}
+
+extern int rans_encoder_flush(RansEncoder *enc)
+{
+    unsigned char *end = NULL, *ptr = NULL;
+    uint32_t x = RANS_LOW, freq = 0U, cum = 0U;
+    size_t i = enc->len;
+    int coderetour = EOF;
+
+    /* the bytes are written from the end of the queue and one more entry, backwards: at most 2 bytes per symbol
+     * and the final state, so they never reach a symbol not coded yet */
+    if (!enc->error && enc->len == enc->cap)
+    {
+        rans_queue_grow(enc);
+    }
+    if (!enc->error)
+    {
+        /* rANS is last in, first out: the symbols are coded backwards, and so are the bytes */
+        end = (unsigned char *)(enc->queue + enc->len + 1UL);
+        ptr = end;
+        while (i--)
+        {
+            freq = enc->queue[i] & 0xFFFFU;
+            cum = enc->queue[i] >> 16U;
+            if (x >= RANS_BOUND * freq)
+            {
+                *--ptr = (unsigned char)(x & 0xFFU);
+                *--ptr = (unsigned char)((x >> 8U) & 0xFFU);
+                x >>= 16U;
+            }
+            x = ((x / freq) << RANS_SCALE_BITS) + (x % freq) + cum;
+        }
+        ptr -= 4;
+        ptr[0] = (unsigned char)(x >> 24U);
+        ptr[1] = (unsigned char)(x >> 16U);
+        ptr[2] = (unsigned char)(x >> 8U);
+        ptr[3] = (unsigned char)x;
+        coderetour = fEcrireOctets(enc->bits, ptr, (size_t)(end - ptr));
+        coderetour = (EOF == fBitflush(enc->bits)) ? (EOF) : (coderetour);
+    }
+    if (enc->owned)
+    {
+        free(enc->queue);
+    }
+    enc->queue = NULL;
+    enc->len = enc->cap = 0UL;
+    enc->owned = false;
+    return coderetour;
+}
+
+extern void rans_decoder_init(RansDecoder *dec, FileBit *bits)
+{
+    unsigned int i = 0U;
+    dec->ptr = bits->src + bits->pos;
+    dec->end = bits->src + bits->len;
+    dec->x = 0U;
+    for (i = 0U; i < 4U; ++i)
+    {
+        dec->x = (dec->x << 8U) | ((dec->ptr < dec->end) ? (*dec->ptr++) : (0U));
+    }
+}
+
+extern unsigned int rans_decode(RansDecoder *dec, RansModel *m)
+{
+    uint32_t x = dec->x, slot = x & (RANS_SCALE - 1U), entry = 0U, freq = 0U, cum = 0U;
+    unsigned int s = 0U;
+
+    if (m->lookup) /* most slots are in the symbol of the first slot of their group */
+    {
+        entry = m->lookup[slot >> m->shift];
+        s = entry & 0xFFU;
+        freq = ((entry >> 8U) & 0xFFFU) + 1U;
+        cum = entry >> 20U;
+    }
+    else
+    {
+        freq = m->freq[0];
+    }
+    if (slot - cum >= freq)
+    {
+        do
+        {
+            ++s;
+        } while (slot >= m->cum[s + 1U]);
+        freq = m->freq[s];
+        cum = m->cum[s];
+    }
+    x = freq * (x >> RANS_SCALE_BITS) + slot - cum;
+
+    /* at most one refill of 16 bits, once every few symbols: zeros are read past the end, where the pointer stays */
+    if (x < RANS_LOW)
+    {
+        x <<= 16U;
+        if (dec->ptr + 2 <= dec->end)
+        {
+            x |= ((uint32_t)dec->ptr[0] << 8U) | dec->ptr[1];
+            dec->ptr += 2;
+        }
+    }
+    dec->x = x;
+
+    RANS_MODEL_UPDATE(m, s);
+    return s;
+}